@@ -0,0 +1,94 @@
+/**
+    This file is part of NeoPS.
+
+    NeoPS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    NeoPS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+**/
+#ifndef BENCHMARK_HPP_INCLUDED
+#define BENCHMARK_HPP_INCLUDED
+
+#include <cstdint>
+
+namespace psx
+{
+    class system;
+}
+
+#define BENCHMARK_CYCLES        40000000    /**< CPU cycles we run per pass */
+#define BENCHMARK_PASSES        3           /**< We keep the fastest of this many passes */
+#define BENCHMARK_GTE_COMMANDS  2000000     /**< GTE commands we run per pass */
+#define BENCHMARK_PRIMITIVES    20000       /**< GPU primitives we draw per pass */
+#define BENCHMARK_SNAPSHOTS     200         /**< Save states we take (and load) per pass */
+#define BENCHMARK_REWIND_FRAMES 600         /**< Frames we record rewind history for */
+#define BENCHMARK_DMA_WORDS     1024        /**< Words the chopped DMA transfer moves */
+
+/**
+ *  Microbenchmarks, run with --benchmark. These don't need a BIOS, they poke their own code into RAM.
+ */
+namespace benchmark
+{
+    /**
+     *  Time the interpreter's dispatch: a tight loop of ALU, load/store and branch instructions run
+     *  one @ref cpu::r3000a::cycle at a time, against the same loop on the threaded interpreter.
+     *
+     *  @arg cycles - Number of (emulated) cycles to run per pass.
+     */
+    void interpreter(std::uint32_t cycles);
+
+    /**
+     *  Time the GTE on a mix of RTPT, MVMVA and lighting commands with random registers.
+     *
+     *  @arg commands - Number of commands to run per pass.
+     */
+    void gte(std::uint32_t commands);
+
+    /**
+     *  Time the rasterizer's span kernels on a mix of flat, gouraud and textured (4, 8 and 15-bit)
+     *  primitives, with dithering and semi-transparency, drawn on one thread so it's all fill rate.
+     *  We complain if any kernel leaves VRAM different from the scalar one.
+     *
+     *  @arg primitives - Number of primitives to draw per pass.
+     */
+    void rasterizer(std::uint32_t primitives);
+
+    /**
+     *  Time taking and loading save states of the whole machine, with the interpreter loop running in
+     *  between. We complain if running on from a loaded state doesn't end up where it did the first time.
+     *
+     *  @arg snapshots - Number of states to save and load per pass.
+     */
+    void savestate(std::uint32_t snapshots);
+
+    /**
+     *  Time recording rewind history for a "game" that runs the interpreter loop, scribbles over some RAM
+     *  and fills a rectangle of VRAM every frame, and see how much memory it takes. Then rewind through it
+     *  and complain if any frame doesn't come back the way it was.
+     *
+     *  @arg frames - Number of frames to record.
+     */
+    void rewind(std::uint32_t frames);
+
+    /**
+     *  Check that a chopped DMA transfer shares the bus with the CPU. A program starts one to the GPU and
+     *  counts how many times it polls the channel before it's done, timing it on root counter 2. We complain
+     *  if the CPU didn't get a look in between bursts, if the transfer finished a lot later than its bursts
+     *  and gaps add up to, or if the ways of executing we've got (each run through @ref psx::system::run)
+     *  don't all poll the same number of times, since timing mustn't depend on which one's running.
+     *
+     *  @arg machine - The system to run it on. Its CPU gets taken over.
+     *  @arg words - Number of words to move.
+     */
+    void dma(psx::system& machine, std::uint32_t words);
+}
+
+#endif // BENCHMARK_HPP_INCLUDED
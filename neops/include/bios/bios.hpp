@@ -17,6 +17,7 @@
 #ifndef BIOS_HPP_INCLUDED
 #define BIOS_HPP_INCLUDED
 
+#include <cstdint>
 #include <string>
 
 #define PSX_BIOS_SEGMENT_PHYS   0x1fc00000
@@ -26,7 +27,12 @@ namespace bios
 {
 
     /**
-     *  Load bios from disk.
+     *  Load bios from disk, and map it into the bus bound to this thread.
+     *
+     *  There's only ever one BIOS image, however many machines there are. The first load maps the file read-only
+     *  (so it comes straight out of the page cache, shared with every other process using it) and checks its CRC
+     *  against the dumps we know about. Every machine after that gets the same image, so they all have to ask
+     *  for the same file.
      *
      *  @param path - Path to the bios binary.
      *  @return true if loaded successfully, false otherwise
@@ -44,7 +50,7 @@ namespace bios
     /**
      *  Read a 16-bit value from bios.
      *
-     *  @param addr - Address we want to read from.
+     *  @param addr - Address we want to read from (offset into the BIOS). Rounded down to a halfword.
      *  @return Half-Word from memory.
      */
     std::uint16_t   read_hword(std::uint32_t addr);
@@ -52,7 +58,7 @@ namespace bios
     /**
      *  Read a 32-bit value from bios.
      *
-     *  @param addr - Address we want to read from.
+     *  @param addr - Address we want to read from (offset into the BIOS). Rounded down to a word.
      *  @return Word from memory.
      */
     std::uint32_t   read_word(std::uint32_t addr);
@@ -19,12 +19,39 @@
 
 #include <cstdint>
 
+#include "bus/device.hpp"
+
 #define PSX_KUSEG_SIZE          0x001fffff
 #define PSX_MEM_SIZE            0x200000
 
+#define PSX_PAGE_SHIFT          12
+#define PSX_PAGE_SIZE           (1 << PSX_PAGE_SHIFT)
+#define PSX_PAGE_MASK           (PSX_PAGE_SIZE - 1)
+#define PSX_PHYS_SIZE           0x20000000  /**< Size of the physical address space covered by the page tables (512MiB) */
+
+#define PSX_SCRATCHPAD_BASE     0x1f800000
+#define PSX_SCRATCHPAD_SIZE     0x400
+
+// Fastmem needs memfd_create() to map the same memory at more than one address, and 4GiB of address space to spare.
+#if defined(__linux__) && defined(__LP64__)
+#define NEOPS_HAS_FASTMEM
+#endif
+
+#define PSX_FASTMEM_SIZE        0x100000000ULL  /**< Fastmem covers the whole 32-bit virtual address space */
+
 #define PSX_MEM_CONTROL_BASE    0x1f801000
 #define PSX_MEM_CONTROL_END     0x1f801020
 
+#define PSX_MEM_EXP1_DELAY      0x1f801008  /**< First of the delay/size registers: EXP1, EXP3, BIOS, SPU, CDROM, then EXP2 */
+#define PSX_MEM_COM_DELAY       0x1f801020  /**< Common delays, which the delay/size registers can opt in to */
+
+#define PSX_RAM_READ_CYCLES     5           /**< Cycles a read from RAM holds up the CPU */
+#define PSX_IO_READ_CYCLES      2           /**< Cycles a read from any other hardware register holds up the CPU */
+
+#define PSX_IO_BASE             0x1f801000  /**< Start of the hardware register window */
+#define PSX_IO_SIZE             0x2000
+
+#define PSX_INTERRUPT_STAT_REG  0x1f801070
 #define PSX_INTERRUPT_MASK_REG  0x1f801074
 
 #define PSX_TIMER_COUNTER_0     0x1f801100
@@ -42,7 +69,6 @@
 #define PSX_MEM_RAM_SIZE_REG    0x1f801060
 #define PSX_CACHE_CTRL_REG      0xfffe0130
 
-
 /**
  *  Memory and hardware bus.
  *
@@ -67,19 +93,62 @@
  *
  *      BIOS (real mapped location on a PSX)
  *      0xbfc0_0000-0xbfc7_ffff BIOS (512K)
+ *
+ *  Accesses are dispatched through a pair of page tables (one for reads, one for writes) covering the
+ *  physical address space in @ref PSX_PAGE_SIZE pages. Pages backed by memory (RAM, BIOS, scratchpad) point
+ *  straight at the host buffer, so they cost a table load and a host access. Every other page is empty and
+ *  goes the slow way, through the hardware register handlers.
+ *
+ *  Where the host allows it (see @ref NEOPS_HAS_FASTMEM), RAM and the scratchpad are also mapped into a 4GiB "fastmem"
+ *  region laid out like the R3000A's VIRTUAL address space, at every address the CPU can see them (kuseg, kseg0 and kseg1).
+ *  Everything else in that region is inaccessible, so code that goes through it has to be able to handle the fault.
+ *
+ *  Every machine (see @ref psx::system) has a bus of its own, in a @ref context. Everything here works on the
+ *  context bound to the calling thread, so machines on different threads never see each other's memory.
  */
 namespace bus
 {
+    struct context;
+
+    /**
+     *  Initialise a new bus, with RAM, the scratchpad and the devices we only stub out, and bind it to this thread.
+     *
+     *  @return The new bus.
+     */
+    context* psmem_init();
+
+    /**
+     *  Free up any used memory and release it back to the system. Unbinds ctx if it's bound to this thread.
+     */
+    void psmem_destroy(context* ctx);
 
     /**
-     *  Initialise the memory subsystem.
+     *  Make ctx the bus everything on this thread works on (nullptr for none).
      */
-    void psmem_init();
+    void bind(context* ctx);
 
     /**
-     *  Free up any used memory and release it back to the system.
+     *  Get the bus bound to this thread.
      */
-    void psmem_destroy();
+    context* bound();
+
+    /**
+     *  Back a range of physical memory with a host buffer.
+     *
+     *  @arg addr - Physical address of the first page. Must be page aligned.
+     *  @arg size - Size of the range in bytes. Must be a multiple of @ref PSX_PAGE_SIZE.
+     *  @arg host - Host memory backing the range.
+     *  @arg writable - Whether writes go to host memory too. Writes to read-only pages go to the hardware handlers.
+     */
+    void map_pages(std::uint32_t addr, std::uint32_t size, std::uint8_t* host, bool writable);
+
+    /**
+     *  Remove a range of physical memory from the page tables. Accesses to it go to the hardware handlers again.
+     *
+     *  @arg addr - Physical address of the first page. Must be page aligned.
+     *  @arg size - Size of the range in bytes. Must be a multiple of @ref PSX_PAGE_SIZE.
+     */
+    void unmap_pages(std::uint32_t addr, std::uint32_t size);
 
     void write_byte(std::uint32_t addr, std::uint8_t val);
     void write_hword(std::uint32_t addr, std::uint16_t val);
@@ -109,6 +178,37 @@ namespace bus
      */
     std::uint32_t   read_word(std::uint32_t addr);
 
+    /**
+     *  Hand a range of the hardware register window (@ref PSX_IO_BASE) over to a device. Every access
+     *  to the range goes straight to the device through a table, however many devices there are.
+     *
+     *  @arg dev - The device. The bus doesn't take ownership of it.
+     *  @arg addr - Physical address of the first register. Must be word aligned.
+     *  @arg size - Size of the range in bytes. Must be a multiple of 4.
+     */
+    void register_device(device* dev, std::uint32_t addr, std::uint32_t size);
+
+    /**
+     *  Take a device (and every range it was registered at) off the bus.
+     */
+    void unregister_device(device* dev);
+
+    /**
+     *  Reset every device on the bus.
+     */
+    void reset_devices();
+
+    /**
+     *  Print how often each device, and each of the busiest registers, has been accessed.
+     */
+    void print_io_stats();
+
+    /**
+     *  Save or load RAM, the scratchpad and every device on the bus, in the order they were registered
+     *  (see @ref state::serializer).
+     */
+    void serialize(state::serializer& s);
+
     /**
      *  Write to a memory control register (which is technically memory mapped IO, but it's here for fun!)
      *
@@ -116,6 +216,60 @@ namespace bus
      *  @arg val - Value we want to write.
      */
     void write_creg(std::uint32_t reg, std::uint32_t value);
+
+    /**
+     *  How long a read holds up the CPU. RAM and the hardware registers take a fixed time, the scratchpad is on the
+     *  CPU so it's free, and everything behind a delay/size register (BIOS, SPU, CDROM and the expansion regions)
+     *  takes however long that register (and the common delays) say. Writes go through the CPU's write buffer, so
+     *  they don't hold anything up.
+     *
+     *  @param addr - Physical address.
+     *  @param size - Size of the read in bytes (1, 2 or 4).
+     *  @return Cycles the read takes.
+     */
+    std::uint32_t read_cycles(std::uint32_t addr, unsigned size);
+
+    /**
+     *  Get the write generation counter of the page containing addr. Every write to a RAM page bumps
+     *  its counter, which is how anything caching code (see @ref cpu::block_cache) finds out it has been overwritten.
+     *
+     *  @param addr - Physical address.
+     *  @return Pointer to the page's counter, or nullptr if code at this address can't be cached.
+     */
+    const std::uint32_t* page_generation(std::uint32_t addr);
+
+    /**
+     *  Get the CPU's cache control register (@ref PSX_CACHE_CTRL_REG). It's on the CPU's side of the bus really,
+     *  but this is where writes to it end up. Native code can check it through the pointer.
+     */
+    const std::uint32_t* cache_control();
+
+    /**
+     *  Get the write generation counters of every page in the physical address space, indexed by (addr >> PSX_PAGE_SHIFT).
+     *  Anything writing to memory without going through the bus (fastmem) has to bump these itself.
+     */
+    std::uint32_t* page_generation_table();
+
+    /**
+     *  Get the base of the fastmem region. Virtual address vaddr lives at fastmem_base() + vaddr.
+     *
+     *  @return Base of the region, or nullptr if we couldn't set one up.
+     */
+    std::uint8_t* fastmem_base();
+
+    /**
+     *  Get RAM (@ref PSX_MEM_SIZE bytes, little endian), for DMA to get at directly.
+     *  Anything written straight to it has to be reported with @ref ram_written.
+     */
+    std::uint8_t* ram();
+
+    /**
+     *  Tell the bus a range of RAM was written without going through it, so cached code from there is thrown away.
+     *
+     *  @arg addr - Physical address of the first byte.
+     *  @arg size - Size of the range in bytes.
+     */
+    void ram_written(std::uint32_t addr, std::uint32_t size);
 }
 
 #endif // PSMEM_HPP_INCLUDED
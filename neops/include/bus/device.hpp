@@ -0,0 +1,106 @@
+/**
+    This file is part of NeoPS.
+
+    NeoPS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    NeoPS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+**/
+#ifndef DEVICE_HPP_INCLUDED
+#define DEVICE_HPP_INCLUDED
+
+#include <cstdint>
+
+namespace state
+{
+    class serializer;
+}
+
+namespace bus
+{
+    /**
+     *  A memory mapped I/O device living in the hardware register window (see @ref bus::register_device).
+     *
+     *  Every address handed to a device is the full physical address. Anything a device doesn't override
+     *  gets logged and ignored, and reads of it return 0.
+     */
+    class device
+    {
+    public:
+        device(const char* name);
+        virtual ~device();
+
+        virtual std::uint8_t    read8(std::uint32_t addr);
+        virtual std::uint16_t   read16(std::uint32_t addr);
+        virtual std::uint32_t   read32(std::uint32_t addr);
+
+        virtual void write8(std::uint32_t addr, std::uint8_t val);
+        virtual void write16(std::uint32_t addr, std::uint16_t val);
+        virtual void write32(std::uint32_t addr, std::uint32_t val);
+
+        /**
+         *  Take a word from a DMA transfer out of RAM (see @ref dma_controller::connect).
+         */
+        virtual void dma_write(std::uint32_t val);
+
+        /**
+         *  Give a word to a DMA transfer into RAM.
+         */
+        virtual std::uint32_t dma_read();
+
+        /**
+         *  Take a run of words from a DMA transfer out of RAM in one go. By default it's @ref dma_write
+         *  for every word, devices that can do better override it.
+         *
+         *  @arg words - The words, straight out of RAM.
+         *  @arg count - Number of words.
+         */
+        virtual void dma_write_block(const std::uint32_t* words, std::uint32_t count);
+
+        /**
+         *  Fill a run of words for a DMA transfer into RAM in one go. By default it's @ref dma_read for every word.
+         *
+         *  @arg words - Where the words go, straight into RAM.
+         *  @arg count - Number of words.
+         */
+        virtual void dma_read_block(std::uint32_t* words, std::uint32_t count);
+
+        /**
+         *  Is the device asking for the next block of a request mode DMA transfer (its DRQ line)?
+         *  By default it always is.
+         */
+        virtual bool dma_ready();
+
+        /**
+         *  Put the device back in its power on state.
+         */
+        virtual void reset();
+
+        /**
+         *  Save or load the device's state (see @ref state::serializer). Devices with state to keep
+         *  start their own section for it. By default there isn't any.
+         */
+        virtual void serialize(state::serializer& s);
+
+        const char* get_name() const
+        {
+            return name;
+        }
+
+        std::uint64_t reads;    /**< Number of reads the bus has sent us. */
+        std::uint64_t writes;   /**< Number of writes the bus has sent us. */
+
+    private:
+        const char* name;       /**< Name of the device, for logging. */
+    };
+}
+
+#endif // DEVICE_HPP_INCLUDED
@@ -0,0 +1,106 @@
+/**
+    This file is part of NeoPS.
+
+    NeoPS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    NeoPS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with NeoPS.  If not, see <http://www.gnu.org/licenses/>.
+**/
+#ifndef BLOCK_CACHE_HPP_INCLUDED
+#define BLOCK_CACHE_HPP_INCLUDED
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#define BLOCK_MAX_INSTRUCTIONS  64 /**< Maximum number of instructions we decode into a single block */
+
+namespace cpu
+{
+    class r3000a;
+
+    typedef void (r3000a::*operation_t)();
+
+    /**
+     *  A single predecoded instruction. All of the operand fields are pulled out of the instruction
+     *  word once when the block is built, so the handlers never have to touch the bitfields.
+     */
+    struct decoded_instruction
+    {
+        operation_t     handler;    /**< Handler that executes this instruction. */
+        std::uint32_t   word;       /**< Raw instruction word. */
+        std::uint32_t   target;     /**< 26-bit jump target (J-Type). */
+        std::uint16_t   imm;        /**< 16-bit immediate (I-Type). NOT sign extended. */
+        std::uint8_t    rs;         /**< Source register. */
+        std::uint8_t    rt;         /**< Target register. */
+        std::uint8_t    rd;         /**< Destination register (R-Type). */
+        std::uint8_t    shamt;      /**< Shift amount (R-Type). */
+        std::uint8_t    label;      /**< Where the threaded interpreter jumps to for this instruction. */
+        std::uint8_t    cycles;     /**< Cycles it takes to issue, counting a read from RAM for loads, but no other stalls. */
+    };
+
+    /**
+     *  A straight-line run of predecoded code. A block starts at a physical address and
+     *  ends after the first branch and its delay slot, at the end of a memory page or after
+     *  @ref BLOCK_MAX_INSTRUCTIONS instructions, whichever comes first.
+     */
+    struct block
+    {
+        std::uint32_t                       phys_addr;  /**< Physical address of the first instruction. */
+        std::uint32_t                       generation; /**< Value of the page's write generation when we were decoded. */
+        const std::uint32_t*                page_gen;   /**< The page's write generation counter (see @ref bus::page_generation). */
+        std::vector<decoded_instruction>    ops;        /**< Decoded instructions. */
+
+        /**
+         *  A block is stale as soon as anything writes to the page it was decoded from.
+         */
+        bool valid() const
+        {
+            return *page_gen == generation;
+        }
+    };
+
+    /**
+     *  Cache of predecoded blocks, keyed by physical address (so kseg0 and kseg1 share code).
+     */
+    class block_cache
+    {
+    public:
+        block_cache();
+        ~block_cache();
+
+        /**
+         *  Find a valid block starting at a physical address.
+         *
+         *  @param phys_addr - Physical address of the first instruction.
+         *  @return The block, or nullptr if there isn't one (or it's gone stale).
+         */
+        block* lookup(std::uint32_t phys_addr);
+
+        /**
+         *  Create an empty block at a physical address, replacing any stale block already there.
+         *
+         *  @param phys_addr - Physical address of the first instruction.
+         *  @param page_gen - Write generation counter of the page containing phys_addr.
+         */
+        block* create(std::uint32_t phys_addr, const std::uint32_t* page_gen);
+
+        /**
+         *  Throw away every block in the cache.
+         */
+        void flush();
+
+    private:
+        std::unordered_map<std::uint32_t, block> blocks;
+    };
+}
+
+#endif // BLOCK_CACHE_HPP_INCLUDED
@@ -18,15 +18,51 @@
 #define COP0_HPP_INCLUDED
 
 #include <cstdint>
+#include <vector>
 #include "cpu/r3000a.hpp"
 
 #define COP0_MAX_REGS 16
 #define COP0_MAX_TLB_ENTRIES 64
 
+namespace state
+{
+    class serializer;
+}
+
 namespace cpu
 {
+    class icache;
     class r3000a;
 
+    /**
+     *  A log of every memory access made through the MMU. While recording, accesses go to the bus
+     *  as normal and are appended to the log. While replaying, reads are answered from the log and
+     *  writes are checked against it, so nothing reaches the bus at all.
+     *
+     *  The recompiler's differential mode uses this to run one block twice (interpreted then recompiled).
+     */
+    struct memory_trace
+    {
+        enum MODE
+        {
+            RECORD = 0,
+            REPLAY,
+        };
+
+        struct access
+        {
+            std::uint32_t   vaddr;  /**< Virtual address accessed. */
+            std::uint32_t   value;  /**< Value read or written. */
+            std::uint8_t    size;   /**< Access size in bytes. */
+            bool            write;  /**< Was this a write? */
+        };
+
+        MODE                mode;       /**< Are we recording or replaying? */
+        std::vector<access> log;        /**< Every access, in order. */
+        std::size_t         position;   /**< Next access to replay. */
+        bool                mismatch;   /**< Set if a replayed access didn't match the log. */
+    };
+
     /**
      *  Our R3000A's first co-processor. Performs various operations in relation to
      *  the system's memory management, system interrupt management (exceptions) and breakpoints.
@@ -34,7 +70,11 @@ namespace cpu
     class cop0
     {
     public:
-        cop0();
+        /**
+         *  @arg ic - The CPU's instruction cache, which loads and stores go to while it's isolated (SR bit 16).
+         *  @arg budget - The CPU's cycle budget, which loads from slow memory take their wait states off.
+         */
+        cop0(icache* ic, std::int32_t* budget);
         ~cop0();
 
         enum EXCEPTION_TYPE
@@ -94,6 +134,11 @@ namespace cpu
 
         void trigger_exception(EXCEPTION_TYPE ex, r3000a* cpu);
 
+        /**
+         *  Save or load the registers and TLB (see @ref state::serializer).
+         */
+        void serialize(state::serializer& s);
+
         /**
          *  Write a byte to memory given a virtual address.
          *
@@ -142,11 +187,64 @@ namespace cpu
          */
         std::uint32_t   virtual_read32(std::uint32_t vaddr);
 
+        /**
+         *  Read an instruction from memory given a 32-bit virtual address. Same as @ref virtual_read32, except
+         *  fetches don't care if the cache is isolated (that's only for loads and stores) and aren't traced.
+         *
+         *  @param vaddr - Virtual address.
+         *  @return Instruction word.
+         */
+        std::uint32_t   virtual_fetch32(std::uint32_t vaddr);
+
+        /**
+         *  Translate a virtual address into a physical address.
+         *
+         *  @param vaddr - Virtual address.
+         *  @return Physical address on the bus.
+         */
+        static std::uint32_t virtual_to_physical(std::uint32_t vaddr);
+
+        /**
+         *  Start tracing memory accesses (or stop, if trace is nullptr).
+         *
+         *  @param trace - Trace to record into or replay from.
+         */
+        void set_trace(memory_trace* trace)
+        {
+            this->trace = trace;
+        }
+
+        /**
+         *  Get a pointer to the status register, so native code can check it without calling us.
+         */
+        const std::uint32_t* status_register() const
+        {
+            return &gpr[12];
+        }
+
     private:
         std::uint32_t gpr[COP0_MAX_REGS]; /**< 16 32-bit control registers */
         std::uint64_t tlb[COP0_MAX_TLB_ENTRIES]; /**< Our TLB, which contains 64 4kb page entries, which is 256MiB of virtual memory */
 
         EXCEPTION_TYPE curr_exception;
+
+        memory_trace* trace; /**< Memory trace we're recording to/replaying from. Usually nullptr. */
+        icache* ic; /**< Where loads and stores go while the cache is isolated. */
+        std::int32_t* budget; /**< The CPU's cycle budget. */
+
+        /**
+         *  Is the cache isolated (SR bit 16)? Loads and stores go to it instead of the bus.
+         */
+        bool isolated() const
+        {
+            return (gpr[12] & 0x00010000) != 0;
+        }
+
+        std::uint32_t isolated_read(std::uint32_t phys_addr, std::uint8_t size) const;
+        void read_wait(std::uint32_t phys_addr, unsigned size);
+        void isolated_write(std::uint32_t phys_addr, std::uint32_t value) const;
+
+        std::uint32_t traced_access(std::uint32_t vaddr, std::uint8_t size, bool write, std::uint32_t value);
     };
 }
 
@@ -0,0 +1,166 @@
+/**
+    This file is part of NeoPS.
+
+    NeoPS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    NeoPS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+**/
+#ifndef GTE_HPP_INCLUDED
+#define GTE_HPP_INCLUDED
+
+#include <cstdint>
+
+#define GTE_NUM_REGS    32 /**< Number of data (and control) registers */
+
+#define GTE_FLAG_ERROR  0x7f87e000 /**< FLAG bits that also set the error bit (31) */
+
+namespace state
+{
+    class serializer;
+}
+
+namespace cpu
+{
+    /**
+     *  Geometry Transformation Engine, cop2. See documentation/hw/gte.txt.
+     *
+     *  Everything is bit exact with the real thing, including the saturation bits in FLAG, the
+     *  GTE's own (inexact) division for the perspective transform and the bugs in MVMVA.
+     */
+    class gte
+    {
+    public:
+        gte();
+        ~gte();
+
+        /**
+         *  Reset every register to 0.
+         */
+        void reset();
+
+        /**
+         *  Save or load every register (see @ref state::serializer).
+         */
+        void serialize(state::serializer& s);
+
+        /**
+         *  Execute a GTE command (COP2 imm25).
+         *
+         *  @arg command - The low 25 bits of the instruction.
+         */
+        void execute(std::uint32_t command);
+
+        /**
+         *  How long a GTE command takes (nocash's timings, and 1 for anything unknown).
+         *
+         *  @arg command - The low 25 bits of the instruction.
+         *  @return Cycles.
+         */
+        static unsigned command_cycles(std::uint32_t command);
+
+        /**
+         *  Read a data register (MFC2/SWC2).
+         */
+        std::uint32_t read_data(unsigned reg) const;
+
+        /**
+         *  Write a data register (MTC2/LWC2).
+         */
+        void write_data(unsigned reg, std::uint32_t value);
+
+        /**
+         *  Read a control register (CFC2).
+         */
+        std::uint32_t read_control(unsigned reg) const;
+
+        /**
+         *  Write a control register (CTC2).
+         */
+        void write_control(unsigned reg, std::uint32_t value);
+
+    private:
+        // Data registers
+        std::int16_t    v[3][3];        /**< Input vectors V0..V2 (x, y, z). */
+        std::uint8_t    rgbc[4];        /**< Color and code. */
+        std::uint16_t   otz;            /**< Average Z. */
+        std::int16_t    ir[4];          /**< Intermediate results IR0..IR3. */
+        std::int16_t    sxy[3][2];      /**< Screen XY FIFO. */
+        std::uint16_t   sz[4];          /**< Screen Z FIFO. */
+        std::uint8_t    rgb[3][4];      /**< Color FIFO. */
+        std::uint32_t   res1;           /**< Prohibited register 23, just holds whatever's written. */
+        std::int32_t    mac[4];         /**< Sums of products MAC0..MAC3. */
+        std::uint32_t   lzcs;           /**< Leading zero count source. */
+        std::uint32_t   lzcr;           /**< Leading zero count result. */
+
+        // Control registers
+        std::int16_t    rotation[3][3]; /**< Rotation matrix (RT). */
+        std::int32_t    translation[3]; /**< Translation vector (TR). */
+        std::int16_t    light[3][3];    /**< Light source matrix (LLM). */
+        std::int32_t    background[3];  /**< Background color (BK). */
+        std::int16_t    color[3][3];    /**< Light color matrix (LCM). */
+        std::int32_t    far_color[3];   /**< Far color (FC). */
+        std::int32_t    ofx;            /**< Screen offset X. */
+        std::int32_t    ofy;            /**< Screen offset Y. */
+        std::uint16_t   h;              /**< Projection plane distance. */
+        std::int16_t    dqa;            /**< Depth cueing coefficient. */
+        std::int32_t    dqb;            /**< Depth cueing offset. */
+        std::int16_t    zsf3;           /**< Z3 average scale factor. */
+        std::int16_t    zsf4;           /**< Z4 average scale factor. */
+        std::uint32_t   flag;           /**< Errors of the last command. */
+
+        // Saturation and overflow checks, all of them set their FLAG bits.
+        void check_mac(int i, std::int64_t value);
+        void check_mac0(std::int64_t value);
+        void set_mac(int i, std::int64_t value, int shift);
+        void set_ir(int i, std::int32_t value, bool lm);
+        void set_mac_ir(int i, std::int64_t value, int shift, bool lm);
+        void push_sz(std::int32_t value);
+        void push_sxy(std::int32_t x, std::int32_t y);
+        void push_color();
+
+        /**
+         *  [MAC1..3] = (T * 1000h + M * V) SAR shift, [IR1..3] = [MAC1..3].
+         */
+        void multiply_add(const std::int16_t m[3][3], const std::int32_t t[3], const std::int16_t vec[3], int shift, bool lm);
+
+        /**
+         *  Same as @ref multiply_add, with the hardware bug that hits MVMVA when the translation vector is FC.
+         */
+        void multiply_add_fc(const std::int16_t m[3][3], const std::int16_t vec[3], int shift, bool lm);
+
+        /**
+         *  [MAC1..3] = in + (FC * 1000h - in) * IR0, the depth cueing step of DPCS/NCDS and friends.
+         */
+        void interpolate(const std::int64_t in[3], int shift, bool lm);
+
+        // Commands
+        void rtps(const std::int16_t vec[3], int shift, bool lm, bool last);
+        void nclip();
+        void op(int shift, bool lm);
+        void dpcs(const std::uint8_t col[3], int shift, bool lm);
+        void intpl(int shift, bool lm);
+        void mvmva(std::uint32_t command, int shift, bool lm);
+        void ncds(const std::int16_t vec[3], int shift, bool lm);
+        void cdp(int shift, bool lm);
+        void nccs(const std::int16_t vec[3], int shift, bool lm);
+        void cc(int shift, bool lm);
+        void ncs(const std::int16_t vec[3], int shift, bool lm);
+        void sqr(int shift);
+        void dcpl(int shift, bool lm);
+        void avsz3();
+        void avsz4();
+        void gpf(int shift, bool lm);
+        void gpl(int shift, bool lm);
+    };
+}
+
+#endif // GTE_HPP_INCLUDED
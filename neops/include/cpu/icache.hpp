@@ -0,0 +1,117 @@
+/**
+    This file is part of NeoPS.
+
+    NeoPS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    NeoPS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+**/
+#ifndef ICACHE_HPP_INCLUDED
+#define ICACHE_HPP_INCLUDED
+
+#include <cstdint>
+
+#define ICACHE_SIZE             0x1000                          /**< 4KiB of instruction cache */
+#define ICACHE_LINE_SIZE        16                              /**< Bytes (4 words) a tag covers */
+#define ICACHE_LINES            (ICACHE_SIZE / ICACHE_LINE_SIZE)
+#define ICACHE_TAG_MASK         0xfffffff0                      /**< Address bits a line's tag holds, the rest are its valid bits */
+
+#define ICACHE_CTRL_TAG_TEST    0x00000004                      /**< Cache control: isolated stores write tags, not data */
+#define ICACHE_CTRL_ENABLE      0x00000800                      /**< Cache control: instruction cache on */
+
+#define ICACHE_REFILL_CYCLES    2                               /**< Cycles each word of a refill costs */
+
+namespace state
+{
+    class serializer;
+}
+
+namespace cpu
+{
+    /**
+     *  The R3000A's 4KiB direct mapped instruction cache: 256 lines of 4 words, each line with the address it
+     *  holds and a valid bit per word. A miss refills the line from the word that missed to its end, which is how
+     *  the hardware bursts it.
+     *
+     *  We only keep this for timing. Instructions still come from memory (through the @ref block_cache), so
+     *  the data here is only ever seen by loads with the cache isolated, which is how the BIOS flushes it.
+     *  Only kuseg and kseg0 fetches go through the cache, and only while it's enabled in cache control.
+     */
+    class icache
+    {
+    public:
+        icache();
+
+        /**
+         *  Throw away everything.
+         */
+        void reset();
+
+        /**
+         *  Fetch a straight run of instructions through the cache, refilling whatever misses.
+         *
+         *  @arg phys_addr - Physical address of the first instruction.
+         *  @arg count - Number of instructions.
+         *  @return Number of words we had to refill.
+         */
+        std::uint32_t fetch(std::uint32_t phys_addr, std::uint32_t count);
+
+        /**
+         *  Load from the cache while it's isolated. Everything reads the data array.
+         *
+         *  @arg addr - Address. Only the bits that pick the word matter.
+         */
+        std::uint32_t isolated_read(std::uint32_t addr) const
+        {
+            return data[(addr & (ICACHE_SIZE - 1)) >> 2];
+        }
+
+        /**
+         *  Store to the cache while it's isolated. In tag test mode the store writes the line's tag (and clears
+         *  its valid bits, the BIOS only ever writes zero), otherwise it writes the data word.
+         *
+         *  @arg addr - Address.
+         *  @arg value - Word being stored.
+         *  @arg tag_test - Is cache control in tag test mode?
+         */
+        void isolated_write(std::uint32_t addr, std::uint32_t value, bool tag_test);
+
+        /**
+         *  Get the tag (address and valid bits) of the line an address lands in, so native code can check it.
+         */
+        const std::uint32_t* tag(std::uint32_t addr) const
+        {
+            return &tags[(addr & (ICACHE_SIZE - 1)) / ICACHE_LINE_SIZE];
+        }
+
+        /**
+         *  Valid bits a run of instructions needs within its line.
+         *
+         *  @arg addr - Address of the first instruction.
+         *  @arg count - Number of instructions, none of them past the end of the line.
+         */
+        static std::uint32_t valid_bits(std::uint32_t addr, std::uint32_t count)
+        {
+            return ((1 << count) - 1) << ((addr >> 2) & 0x3);
+        }
+
+        /**
+         *  Save or load the cache (see @ref state::serializer).
+         */
+        void serialize(state::serializer& s);
+
+    private:
+        std::uint32_t   tags[ICACHE_LINES];     /**< Address of every line, with the valid bits of its words at the bottom. */
+        std::uint32_t   data[ICACHE_SIZE / 4];  /**< What isolated stores have written. */
+    };
+}
+
+#endif // ICACHE_HPP_INCLUDED
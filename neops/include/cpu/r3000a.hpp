@@ -18,14 +18,29 @@
 #define R3000_HPP_INCLUDED
 
 #include <cstdint>
+#include "cpu/block_cache.hpp"
 #include "cpu/cop0.hpp"
+#include "cpu/gte.hpp"
 #include "instruction.hpp"
 
 #define R3000_GPR_MAX 32 /**< Maximum number of General Purporse Registers (GPRs) contained in the MiPS R3000 */
+#define R3000_SPECIAL 64 /**< SPECIAL (opcode 0) instructions sit after the 64 primary opcodes in the op table, indexed by funct */
+#define R3000_OP_MAX  128 /**< Size of the (flattened) op table */
+
+#define R3000_CLOCK         33868800    /**< The CPU's clock, in Hz */
+#define R3000_DIV_CYCLES    36          /**< Cycles until a DIV/DIVU's result is in hi/lo */
+
+namespace hle
+{
+    class kernel;
+}
 
 namespace cpu
 {
     class cop0;
+    class gte;
+    class icache;
+    class recompiler;
 
     /**
      *  Our R3000A CPU. Some interesting quirks and facts:
@@ -37,26 +52,109 @@ namespace cpu
      */
     class r3000a
     {
-    typedef void (r3000a::*operation_t)();
+    friend class recompiler;
+    friend class hle::kernel;
 
     public:
         r3000a();
         ~r3000a();
 
+        /**
+         *  How instructions are executed.
+         */
+        enum EXEC_MODE
+        {
+            INTERPRETER = 0,    /**< Interpret every instruction (from the block cache). */
+            RECOMPILER,         /**< Recompile blocks to native code. */
+            DIFFERENTIAL,       /**< Run every block through both, and die if they ever disagree. */
+            THREADED,           /**< Interpret with threaded dispatch (see @ref run_threaded). */
+        };
+
         /**
          *  Perform one cycle (step) of the CPU.
          */
         void cycle();
 
+        /**
+         *  Run the CPU for (roughly) a number of cycles. Every instruction costs what the op table says (see
+         *  @ref decoded_instruction::cycles), plus however long the CPU stalls: fetching code (refilling the
+         *  instruction cache, or from uncached memory), waiting on slow memory and waiting on MULT/DIV. The
+         *  recompiler only stops between blocks, and fetches are charged a block at a time, so we may overshoot
+         *  by up to a block.
+         *
+         *  @arg cycles - Number of cycles to run.
+         *  @return Number of cycles we actually ran.
+         */
+        std::uint32_t run(std::uint32_t cycles);
+
+        /**
+         *  Interpret for a number of cycles with threaded dispatch. Same semantics as calling @ref cycle
+         *  in a loop, but every handler jumps straight to the next instruction's handler through one table,
+         *  instead of everything funneling through a single indirect call.
+         *
+         *  @arg cycles - Number of cycles to run.
+         *  @return Number of cycles we actually ran.
+         */
+        std::uint32_t run_threaded(std::uint32_t cycles);
+
+        /**
+         *  Select how we execute instructions.
+         *
+         *  @arg mode - Execution mode we want.
+         *  @return false if this mode isn't supported on this host (we stay on the interpreter).
+         */
+        bool set_exec_mode(EXEC_MODE mode);
+
+        EXEC_MODE get_exec_mode() const
+        {
+            return exec_mode;
+        }
+
+        /**
+         *  Turn high-level emulation of the BIOS kernel on or off (see @ref hle::kernel). While it's on, calls
+         *  to the kernel are handled natively instead of running the BIOS's code.
+         *
+         *  @arg enabled - Do we want it?
+         *  @return true if it's now on.
+         */
+        bool set_hle(bool enabled);
+
+        /**
+         *  Our HLE kernel, or nullptr if HLE is off.
+         */
+        hle::kernel* get_hle()
+        {
+            return hle_kernel;
+        }
+
+        typedef void (*hook_callback)(void* data);
+
+        /**
+         *  Get called back the first time the CPU's about to run the instruction at a physical address, before it
+         *  does. We only look where the CPU jumps to (the start of a block), so it's meant for entry points. There's
+         *  one hook at a time, and it's cleared before it's called. Hooks aren't part of save states.
+         *
+         *  @arg phys_addr - Physical address of the instruction.
+         *  @arg callback - Function to call, or nullptr to clear the hook.
+         *  @arg data - Passed along to callback.
+         */
+        void set_hook(std::uint32_t phys_addr, hook_callback callback, void* data);
+
         /**
          *  Reset the processor.
          */
         void reset();
 
+        /**
+         *  Save or load the processor's state, and its coprocessors' (see @ref state::serializer).
+         *  Loading throws away everything we've predecoded or compiled.
+         */
+        void serialize(state::serializer& s);
+
         /**
          *  Write a value to a general purpose register.
          *
-         *  Note: This writes into the delayed GPR, which are copied after the isntruction has executed.
+         *  Note: If a load is landing in the same register at the end of this instruction, we win and the load is dropped.
          *
          *  @arg reg - Register number we want to write to. Encoded in operation.
          *  @arg value - Value we want to write.
@@ -78,6 +176,34 @@ namespace cpu
             return pc;
         }
 
+        /**
+         *  Get the CPU's own clock.
+         *
+         *  @return Cycles we've run since reset.
+         */
+        std::uint64_t now() const
+        {
+            return run_end - budget - budget_ahead;
+        }
+
+        /**
+         *  How far we've got into the run we're in the middle of (see @ref scheduler::exact).
+         *
+         *  @return Cycles we've run since @ref run was called.
+         */
+        std::uint32_t ran() const
+        {
+            return (std::uint32_t)(now() - run_start);
+        }
+
+        /**
+         *  Cut the run we're in the middle of short (see @ref scheduler::set_clock). It only ever gets shorter,
+         *  and whatever instruction or block we're in finishes first.
+         *
+         *  @arg cycles - How far into the run we stop.
+         */
+        void preempt(std::uint32_t cycles);
+
         void set_pc(std::uint32_t addr)
         {
             pc = addr;
@@ -86,9 +212,9 @@ namespace cpu
 
     private:
         cop0*           cp0;                    /**< Our CPU's cp0. */
-        //cop2*           co2;                  /**< Our CPU's cop2. */
+        gte*            cp2;                    /**< Our CPU's cop2, the GTE. */
+        icache*         ic;                     /**< Our CPU's instruction cache. */
         std::uint32_t   gpr[R3000_GPR_MAX];     /**< Our General Purprose Registers. */
-        std::uint32_t   gpr_delay[R3000_GPR_MAX];
 
         std::uint64_t   hi;                     /**< Multiplication 64 bit high result or division  remainder. */
         std::uint64_t   lo;                     /**< Multiplication 64 bit low result or division quotient. */
@@ -97,13 +223,110 @@ namespace cpu
         std::uint32_t   next_pc;                /**< Instruction next PC (of next instruction)*/
         std::uint32_t   load_delay;             /**< Load delay value. */
         std::uint32_t   delay_reg;              /**< Our delay register we want to write to. */
+        std::uint32_t   retire_value;           /**< Value of the load landing at the end of the current instruction. */
+        std::uint32_t   retire_reg;             /**< Register it lands in (0 if none, or if the current instruction overwrote it). */
         bool            is_branch;              /**< Has a branch occurred? */
         bool            delay_slot;             /**< Are we in a branch delay?? */
-        instruction_t   instruction;            /**< Current instruction. */
         instruction_t   next_instruction;       /**< Next instruction to execute */
 
-        operation_t ops_normal[64];
-        operation_t ops_special[64];
+        const decoded_instruction*  current;        /**< Current (predecoded) instruction. */
+        decoded_instruction         uncached;       /**< Scratch space for instructions fetched from outside RAM/BIOS. */
+        block_cache                 cache;          /**< Predecoded blocks, keyed by physical address. */
+        block*                      current_block;  /**< Block we're currently executing from. */
+        std::uint32_t               block_pc;       /**< Virtual address of the next instruction in current_block. */
+        std::uint32_t               block_index;    /**< Index of the next instruction in current_block. */
+        std::uint32_t               fetch_cycles;   /**< Cycles each instruction in current_block takes to fetch, if it's uncached. */
+
+        operation_t     ops[R3000_OP_MAX];      /**< Handler of every opcode, with SPECIAL flattened in at @ref R3000_SPECIAL. */
+        std::uint8_t    labels[R3000_OP_MAX];   /**< Label of every opcode in the threaded interpreter. */
+        std::uint8_t    costs[R3000_OP_MAX];    /**< Cycles every opcode takes to issue (see @ref decoded_instruction::cycles). */
+
+        EXEC_MODE       exec_mode;              /**< How we're executing instructions. */
+        recompiler*     jit;                    /**< Our recompiler, if we've got one. */
+        std::int32_t    budget;                 /**< Cycles we may still run for before returning. Recompiled code counts it down too. */
+        std::int32_t    budget_ahead;           /**< Cycles recompiled code has taken off the budget for instructions it hasn't run yet. */
+        std::uint32_t   block_fetch;            /**< Cycles each instruction of the recompiled block we're in takes to fetch, if it's uncached. */
+        std::uint64_t   run_start;              /**< Cycle the current run started at. */
+        std::uint64_t   run_end;                /**< Cycle the current run ends at, when the budget reaches 0. */
+        std::uint64_t   hilo_ready;             /**< Cycle the last MULT/DIV's result lands in hi/lo. */
+        hle::kernel*    hle_kernel;             /**< High-level kernel, if HLE is on. */
+        std::uint32_t   hook_addr;              /**< Physical address of the hook. */
+        hook_callback   hook;                   /**< Hook to call there, if any. */
+        void*           hook_data;              /**< Passed along to hook. */
+
+        /**
+         *  Decode an instruction word into its handler and operand fields.
+         *
+         *  @arg word - Instruction word.
+         *  @arg op - Where to put the decoded instruction.
+         */
+        void decode(std::uint32_t word, decoded_instruction& op) const;
+
+        /**
+         *  Fetch the (predecoded) instruction at pc, continuing on through the current block
+         *  if we can, otherwise looking up (or building) the block that starts at pc.
+         */
+        const decoded_instruction* fetch();
+
+        /**
+         *  Does the CPU have to stop and look before running the instruction at a physical address (a kernel entry
+         *  point, with HLE on, or the hook)? Code there is never cached or compiled.
+         */
+        bool trapped(std::uint32_t phys_addr) const;
+
+        /**
+         *  Throw away everything we've predecoded or compiled.
+         */
+        void flush_code();
+
+        /**
+         *  Start a run of some number of cycles.
+         *
+         *  @arg cycles - Number of cycles to run.
+         */
+        void start_run(std::uint32_t cycles);
+
+        /**
+         *  Fetch a run of instructions, through the instruction cache if the address and cache control allow it.
+         *
+         *  @arg vaddr - Virtual address of the first instruction.
+         *  @arg phys_addr - Physical address of the first instruction.
+         *  @arg count - Number of instructions.
+         *  @return Cycles we stall for, refilling whatever missed or reading every word from the bus.
+         */
+        std::uint32_t fetch_stall(std::uint32_t vaddr, std::uint32_t phys_addr, std::uint32_t count);
+
+        /**
+         *  Wait for the last MULT/DIV to finish, before we touch hi/lo.
+         */
+        void wait_hilo();
+
+        /**
+         *  Decode a new block starting at a physical address.
+         *
+         *  @arg phys_addr - Physical address of the first instruction.
+         *  @return The new block, or nullptr if code at this address can't be cached.
+         */
+        block* build_block(std::uint32_t phys_addr);
+
+        /**
+         *  Execute a single (already fetched) instruction.
+         *
+         *  @arg op - The instruction at pc.
+         */
+        void execute(const decoded_instruction* op);
+
+        /**
+         *  Move the pipeline on to an instruction, before its handler runs.
+         *
+         *  @arg op - The instruction at pc.
+         */
+        void issue(const decoded_instruction* op);
+
+        /**
+         *  Land the pending load, after the handler's run.
+         */
+        void retire();
 
         // INSTRUCTIONS
         void op_addi();
@@ -181,6 +404,8 @@ namespace cpu
         void op_subu();
         void op_syscall();
         void op_xor();
+
+        void op_illegal();
     };
 }
 
@@ -0,0 +1,204 @@
+/**
+    This file is part of NeoPS.
+
+    NeoPS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    NeoPS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with NeoPS.  If not, see <http://www.gnu.org/licenses/>.
+**/
+#ifndef RECOMPILER_HPP_INCLUDED
+#define RECOMPILER_HPP_INCLUDED
+
+#include <cstdint>
+#include <deque>
+#include <unordered_map>
+
+#include "cpu/block_cache.hpp"
+#include "cpu/cop0.hpp"
+
+// The recompiler only knows how to emit x86-64. Everywhere else we stick to the interpreter.
+#if defined(__x86_64__) || defined(_M_X64)
+#define NEOPS_HAS_RECOMPILER
+#endif
+
+#define RECOMPILER_CODE_SIZE    0x01000000  /**< Size of our code buffer (16MiB). */
+#define RECOMPILER_BLOCK_MAX    0x00010000  /**< Most code a single block could ever need. */
+#define RECOMPILER_FASTMEM_SITE 5           /**< Bytes of every fastmem access, so there's always room to patch in a jmp. */
+
+namespace cpu
+{
+    class r3000a;
+    class x64_emitter;
+
+    /**
+     *  Dynamic recompiler. Translates the blocks built by the interpreter's @ref block_cache into x86-64.
+     *
+     *  ALU instructions, branches and the plain loads and stores are emitted natively. Anything else
+     *  (coprocessors, exceptions, mult/div, unaligned loads...) calls straight back into the interpreter's
+     *  handler for that instruction, so the two can never drift apart on the odd stuff.
+     *
+     *  Blocks that end in a known target are linked directly to the next block once it's been compiled.
+     *  Every block checks its page's write generation on entry, so self-modifying code sends us back
+     *  to the dispatcher to recompile, exactly like the block cache.
+     *
+     *  With fastmem (see @ref bus::fastmem_base), loads and stores are a single host access relative to r15.
+     *  An access that hits anything but RAM or the scratchpad faults. The fault handler rewrites the access
+     *  into a jump to an out-of-line call to the bus, so it only ever faults once.
+     */
+    class recompiler
+    {
+    public:
+        recompiler(r3000a* cpu);
+        ~recompiler();
+
+        /**
+         *  Run recompiled code for (roughly) a number of cycles (see @ref r3000a::run).
+         *
+         *  @arg cycles - Number of cycles to run.
+         *  @return Number of cycles we actually ran.
+         */
+        std::uint32_t run(std::uint32_t cycles);
+
+        /**
+         *  Throw away all of our compiled code.
+         */
+        void flush();
+
+        /**
+         *  In differential mode every block is run through the interpreter first, then rewound and run
+         *  again as native code, replaying the interpreter's memory accesses. If the two disagree, we die.
+         *
+         *  @arg enabled - Enable/disable differential mode.
+         */
+        void set_differential(bool enabled)
+        {
+            // Replaying has to see every access, so differential code is compiled without fastmem.
+            if(enabled != differential)
+                flush();
+
+            differential = enabled;
+        }
+
+        /**
+         *  Called by the SIGSEGV handler. If the fault came from one of our fastmem accesses, patch the
+         *  access so it goes through the bus from now on.
+         *
+         *  @arg rip - Address of the faulting instruction.
+         *  @return Where to carry on from, or nullptr if the fault isn't ours.
+         */
+        static std::uint8_t* fastmem_fault(std::uint8_t* rip);
+
+    private:
+        typedef std::uint8_t* (*enter_t)(r3000a* cpu, std::uint8_t* code);
+
+        /**
+         *  A block of native code.
+         */
+        struct native_block
+        {
+            std::uint8_t*           body;       /**< Start of the block's code. */
+            const std::uint32_t*    page_gen;   /**< Write generation counter of the page we were compiled from. */
+            std::uint32_t           generation; /**< Value of page_gen when we were compiled. */
+            std::uint32_t           length;     /**< Number of MIPS instructions in this block. */
+        };
+
+        /**
+         *  Register state we compare in differential mode.
+         */
+        struct cpu_state
+        {
+            std::uint32_t   gpr[32];
+            std::uint64_t   hi;
+            std::uint64_t   lo;
+            std::uint32_t   pc;
+            std::uint32_t   next_pc;
+            std::uint32_t   load_delay;
+            std::uint32_t   delay_reg;
+            bool            is_branch;
+            std::uint64_t   hilo_ready;
+        };
+
+        r3000a*         cpu;            /**< CPU we're recompiling for. */
+        std::uint8_t*   code;           /**< Executable code buffer. */
+        std::size_t     code_used;      /**< Bytes of the code buffer in use. */
+        std::size_t     code_base;      /**< Bytes used by the enter/leave trampolines. */
+        std::uint32_t   epoch;          /**< Bumped every time we flush, so stale link requests are ignored. */
+        enter_t         enter;          /**< Trampoline into native code. */
+        std::uint8_t*   leave;          /**< Trampoline back out of native code. */
+        bool            differential;   /**< Are we checking every block against the interpreter? */
+        std::uint8_t*   fastmem;        /**< Base of the fastmem region, or nullptr if we go through the bus. */
+
+        std::unordered_map<std::uint32_t, native_block> blocks;     /**< Native blocks, keyed by VIRTUAL address. */
+        std::deque<decoded_instruction>                 fallbacks;  /**< Instructions the native code hands back to the interpreter. */
+        std::unordered_map<const std::uint8_t*, std::uint8_t*> fastmem_sites; /**< Out-of-line slow path of each fastmem access. */
+
+        memory_trace    trace;          /**< Memory accesses of the interpreted run (differential mode). */
+        std::uint64_t   checked;        /**< Blocks checked in differential mode. */
+        std::uint64_t   skipped;        /**< Blocks that wrote to their own page, which we can't replay. */
+
+        // Offsets of the CPU state we touch, from the r3000a pointer (which lives in rbx).
+        std::int32_t    off_gpr;
+        std::int32_t    off_hi;
+        std::int32_t    off_lo;
+        std::int32_t    off_pc;
+        std::int32_t    off_next_pc;
+        std::int32_t    off_load_delay;
+        std::int32_t    off_delay_reg;
+        std::int32_t    off_is_branch;
+        std::int32_t    off_budget;
+        std::int32_t    off_ahead;
+        std::int32_t    off_block_fetch;
+
+        void emit_trampolines();
+
+        /**
+         *  Find the native block for a virtual address, compiling (or recompiling) it if need be.
+         *
+         *  @return The block, or nullptr if we can't compile code at this address.
+         */
+        native_block* lookup(std::uint32_t vaddr);
+        bool compile(std::uint32_t vaddr, native_block& nb);
+
+        void run_block_differential(native_block* nb);
+        void interpret_one();
+        void capture(cpu_state& state) const;
+        void restore(const cpu_state& state);
+
+        // Code generation
+        int  classify(const decoded_instruction& op) const;
+        void emit_load_gpr(x64_emitter& e, int reg, unsigned mips_reg);
+        void emit_store_gpr(x64_emitter& e, unsigned mips_reg, int reg);
+        void emit_apply_load_delay(x64_emitter& e);
+        void emit_call(x64_emitter& e, const void* function);
+        void emit_set_ahead(x64_emitter& e, std::uint32_t cycles, std::uint32_t ops);
+        void emit_exit_static(x64_emitter& e, std::uint32_t target);
+        void emit_exit_dynamic(x64_emitter& e);
+
+        // Called from native code
+        static std::uint32_t interpret(r3000a* cpu, const decoded_instruction* op);
+        static void fetch_block(r3000a* cpu, std::uint32_t vaddr, std::uint32_t count);
+        static void wait_hilo(r3000a* cpu);
+        static std::uint32_t read_byte(r3000a* cpu, std::uint32_t vaddr);
+        static std::uint32_t read_hword(r3000a* cpu, std::uint32_t vaddr);
+        static std::uint32_t read_hword_signed(r3000a* cpu, std::uint32_t vaddr);
+        static std::uint32_t read_word(r3000a* cpu, std::uint32_t vaddr);
+        static void load_byte(r3000a* cpu, std::uint32_t vaddr, std::uint32_t rt);
+        static void load_byte_unsigned(r3000a* cpu, std::uint32_t vaddr, std::uint32_t rt);
+        static void load_hword(r3000a* cpu, std::uint32_t vaddr, std::uint32_t rt);
+        static void load_hword_unsigned(r3000a* cpu, std::uint32_t vaddr, std::uint32_t rt);
+        static void load_word(r3000a* cpu, std::uint32_t vaddr, std::uint32_t rt);
+        static void store_byte(r3000a* cpu, std::uint32_t vaddr, std::uint32_t value);
+        static void store_hword(r3000a* cpu, std::uint32_t vaddr, std::uint32_t value);
+        static void store_word(r3000a* cpu, std::uint32_t vaddr, std::uint32_t value);
+    };
+}
+
+#endif // RECOMPILER_HPP_INCLUDED
@@ -19,6 +19,12 @@
 
 #include <cstdint>
 
+#include "bus/device.hpp"
+#include "scheduler/scheduler.hpp"
+
+#define DMA_REGISTER_BASE   0x1f801080
+#define DMA_REGISTER_SIZE   0x80
+
 #define DMA_CHANNEL0_BASE   0x1f801080 // MDECin
 #define DMA_CHANNEL1_BASE   0x1f801090 // MDECout
 #define DMA_CHANNEL2_BASE   0x1f8010a0 // GPU (lists + image data)
@@ -32,6 +38,11 @@
 #define DMA_1F8010F8H       0x7ffac68b
 #define DMA_1F8010FCh       0x00fffff7
 
+#define DMA_WORD_CYCLES         1                       /**< Bus cycles to move one word */
+#define DMA_LIST_NODE_CYCLES    10                      /**< Extra bus cycles per linked list node (fetching the header and following it) */
+#define DMA_LIST_MAX_NODES      (PSX_MEM_SIZE / 4)      /**< More nodes than this and a linked list has to be going round in circles */
+#define DMA_DRQ_POLL_CYCLES     64                      /**< How long we leave a device that isn't ready for the next block before asking again */
+
 namespace bus
 {
     enum DIRECTION
@@ -78,6 +89,10 @@ namespace bus
         ADDRESS_MODE    addr_mode;      /**< Channel address mode (increment [+4] or decrement (-4)) */
         std::uint8_t    dma_chop_size;  /**< DMA Chopping Window Size */
         std::uint8_t    cpu_chop_size;  /**< CPU Copping Window Size */
+        std::uint32_t   cycles;         /**< Bus cycles the last transfer on this channel took */
+        std::uint32_t   next_addr;      /**< Where the transfer carries on from */
+        std::uint32_t   words_left;     /**< Words the transfer has left to move */
+        bool            started;        /**< Has the transfer been set up (it may be waiting between bursts)? */
 
     };
 
@@ -85,13 +100,25 @@ namespace bus
      *  The PSXs DMA controller. Allows us to transfer blocks of memory to different
      *  devices and peripherals independent of the CPU. That is, we can copy the data
      *  from main memory to
+     *
+     *  Transfers happen in bursts. A burst moves its words straight away and holds the CPU off the bus
+     *  for as long as it would have taken (see @ref scheduler::stall). Between bursts (a chopping window,
+     *  or a device that isn't ready for the next block) the CPU gets to run, and a scheduler event brings
+     *  us back for the next one. Only one channel has the bus at a time, picked by its DPCR priority.
      */
-    class dma_controller
+    class dma_controller : public device
     {
     public:
         dma_controller();
         ~dma_controller();
 
+        std::uint32_t read32(std::uint32_t addr) override;
+        void write16(std::uint32_t addr, std::uint16_t val) override;
+        void write32(std::uint32_t addr, std::uint32_t val) override;
+
+        void reset() override;
+        void serialize(state::serializer& s) override;
+
         void write_dpcr(std::uint32_t val);
         std::uint32_t read_dpcr();
 
@@ -103,7 +130,17 @@ namespace bus
         void controller_write(std::uint32_t address, std::uint32_t val);
         std::uint32_t controller_read(std::uint32_t address);
 
-        void dma_run(int channel);
+        /**
+         *  Connect a device to a DMA port. Words going out of RAM on that port are handed to
+         *  @ref device::dma_write, and words coming in come from @ref device::dma_read.
+         *
+         *  @arg port - Port the device sits on.
+         *  @arg dev - The device.
+         */
+        void connect(PORT port, device* dev)
+        {
+            ports[port] = dev;
+        }
 
         bool channel_enabled(int channel) const
         {
@@ -118,21 +155,97 @@ namespace bus
                 return true;
         }
 
-        bool channel_active(int channel)
+        bool channel_active(int channel) const
         {
             return channel_trigger(channel) && channel_enabled(channel);
         }
 
+        /**
+         *  How long the last transfer on a channel held the bus.
+         */
+        std::uint32_t transfer_cycles(int channel) const
+        {
+            return channels[channel].cycles;
+        }
+
     private:
         std::uint32_t dpcr;
         std::uint32_t dicr;
 
         channel channels[7];    /**< Our DMA channels */
+        device* ports[7];       /**< Device on the other end of each channel (nullptr if nothing's there yet). */
+
+        int current;                    /**< Channel with the bus, or -1 if nobody has it. */
+        scheduler::event_id event;      /**< Brings us back between bursts. */
+        bool event_added;               /**< Has event been added yet? */
+
+        /**
+         *  Move words for a block transfer, carrying on from where the channel left off.
+         *
+         *  @arg channel - The channel.
+         *  @arg words - Number of words to move.
+         *  @return Bus cycles it took.
+         */
+        std::uint32_t dma_block_copy(int channel, std::uint32_t words);
+
+        /**
+         *  Build an empty ordering table (channel 6), straight into RAM.
+         *
+         *  @arg addr - Address of the last (highest) entry.
+         *  @arg words - Number of entries.
+         */
+        void clear_ordering_table(std::uint32_t addr, std::uint32_t words);
+
+        /**
+         *  Walk a linked list (channel 2) and hand each node's packet to the GPU as one block.
+         *
+         *  @return Bus cycles it took.
+         */
+        std::uint32_t dma_list_copy(int channel);
+
+        /**
+         *  Send a run of RAM out to a device, straight from RAM where we can.
+         *
+         *  @arg dev - The device.
+         *  @arg addr - Address of the first word.
+         *  @arg words - Number of words.
+         */
+        void write_device(device* dev, std::uint32_t addr, std::uint32_t words);
+
+        /**
+         *  Get the channel that should have the bus next.
+         *
+         *  @return The channel, or -1 if none of them want it.
+         */
+        int next_channel() const;
+
+        /**
+         *  If nobody has the bus, give it to whoever should have it and run bursts until we're
+         *  out of channels or one has to wait.
+         */
+        void arbitrate();
+
+        /**
+         *  Set up a transfer on a channel from its registers.
+         */
+        void start(int channel);
+
+        /**
+         *  Run one burst of a channel's transfer.
+         *
+         *  @return true if the transfer's done, false if it has to wait for @ref event.
+         */
+        bool burst(int channel);
 
-        void dma_block_copy(int channel);
-        void dma_list_copy(int channel);
+        /**
+         *  Add @ref event, if it hasn't been already.
+         */
+        void add_event();
 
-        void do_dma(int channel);
+        /**
+         *  Fired between bursts. Lets go of the bus so whoever should have it next gets it.
+         */
+        static void resume(void* data);
 
         void transfer_done(int channel)
         {
@@ -143,6 +256,7 @@ namespace bus
                 dicr |= flag;
 
             channels[channel].channel_control &= ~0x01000000;
+            channels[channel].started = false;
 
             update_irq_active();
         }
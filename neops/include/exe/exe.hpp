@@ -0,0 +1,93 @@
+/**
+    This file is part of NeoPS.
+
+    NeoPS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    NeoPS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+**/
+#ifndef EXE_HPP_INCLUDED
+#define EXE_HPP_INCLUDED
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#define EXE_HEADER_SIZE     0x800       /**< The header takes up the first 2KiB of the file, the text starts after it */
+#define EXE_SHELL_ENTRY     0x80030000  /**< Where the BIOS jumps to start the shell, once the kernel's all set up */
+
+namespace cpu
+{
+    class r3000a;
+}
+
+/**
+ *  PS-X EXE executables, the format everything on the PlayStation ships its code in (and what homebrew and test
+ *  suites get built to). Instead of going through a CD, we copy one straight into RAM and jump to it.
+ */
+namespace exe
+{
+    /**
+     *  The parts of a PS-X EXE header we care about.
+     */
+    struct header
+    {
+        std::uint32_t   pc;         /**< Entry point */
+        std::uint32_t   gp;         /**< Initial gp */
+        std::uint32_t   text_addr;  /**< Where the text (code and data, it's all one segment) goes */
+        std::uint32_t   text_size;
+        std::uint32_t   bss_addr;   /**< Memory to zero before we start */
+        std::uint32_t   bss_size;
+        std::uint32_t   stack_addr; /**< Base of the stack, or 0 to keep whatever sp we've got */
+        std::uint32_t   stack_size; /**< Offset from stack_addr the stack starts at */
+    };
+
+    class executable
+    {
+    public:
+        executable();
+
+        /**
+         *  Read an executable from disk and check it's one we can run.
+         *
+         *  @param path - Path to the executable.
+         *  @return true if it's loaded, false otherwise (and we stay empty).
+         */
+        bool load(const std::string& path);
+
+        /**
+         *  Have we got an executable?
+         */
+        bool loaded() const
+        {
+            return !text.empty();
+        }
+
+        const header& get_header() const
+        {
+            return hdr;
+        }
+
+        /**
+         *  Copy the text into the RAM of the bus bound to this thread, zero its BSS, and point the CPU at the
+         *  entry point with the registers the header asks for, the way the BIOS's Exec would.
+         *
+         *  @param cpu - CPU to start.
+         */
+        void start(cpu::r3000a& cpu) const;
+
+    private:
+        header                      hdr;
+        std::vector<std::uint8_t>   text;   /**< The text, straight out of the file */
+    };
+}
+
+#endif // EXE_HPP_INCLUDED
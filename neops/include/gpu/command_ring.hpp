@@ -0,0 +1,95 @@
+/**
+    This file is part of NeoPS.
+
+    NeoPS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    NeoPS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+**/
+#ifndef COMMAND_RING_HPP_INCLUDED
+#define COMMAND_RING_HPP_INCLUDED
+
+#include <atomic>
+#include <cstdint>
+
+#include "gpu/rasterizer.hpp"
+
+#define GPU_RING_SIZE   4096    /**< Primitives in flight between the emulation thread and the GPU thread (a power of 2) */
+
+namespace gpu
+{
+    /**
+     *  Lock free ring of recorded primitives, with exactly one producer (the emulation thread)
+     *  and one consumer (the GPU thread). Neither side ever blocks in here; the GPU
+     *  works out how each side sleeps when there's nothing to do (see @ref gpu::sync).
+     */
+    class command_ring
+    {
+    public:
+        command_ring() : head(0), tail(0)
+        {
+
+        }
+
+        /**
+         *  Producer: append a primitive.
+         *
+         *  @return false if the ring's full.
+         */
+        bool push(const primitive& p)
+        {
+            std::uint32_t t = tail.load(std::memory_order_relaxed);
+
+            if(t - head.load(std::memory_order_acquire) == GPU_RING_SIZE)
+                return false;
+
+            slots[t & (GPU_RING_SIZE - 1)] = p;
+
+            // Sequentially consistent, so a consumer going to sleep either sees this or is seen sleeping.
+            tail.store(t + 1, std::memory_order_seq_cst);
+            return true;
+        }
+
+        /**
+         *  Consumer: oldest primitive in the ring, or nullptr if it's empty. It stays put until @ref pop.
+         */
+        const primitive* front() const
+        {
+            std::uint32_t h = head.load(std::memory_order_relaxed);
+
+            if(h == tail.load(std::memory_order_acquire))
+                return nullptr;
+
+            return &slots[h & (GPU_RING_SIZE - 1)];
+        }
+
+        /**
+         *  Consumer: let go of the primitive @ref front returned.
+         */
+        void pop()
+        {
+            head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+        bool empty() const
+        {
+            return head.load(std::memory_order_acquire) == tail.load(std::memory_order_seq_cst);
+        }
+
+    private:
+        // The slots sit between the two counters, so the threads don't fight over one cache line.
+        std::atomic<std::uint32_t>  head;   /**< Next slot to pop, only written by the consumer. */
+        primitive                   slots[GPU_RING_SIZE];
+        std::atomic<std::uint32_t>  tail;   /**< Next slot to push, only written by the producer. */
+    };
+}
+
+#endif // COMMAND_RING_HPP_INCLUDED
@@ -17,19 +17,242 @@
 #ifndef GPU_HPP_INCLUDED
 #define GPU_HPP_INCLUDED
 
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "bus/device.hpp"
+#include "gpu/command_ring.hpp"
+#include "gpu/rasterizer.hpp"
+
 #define GPU_GP0_SEND            0x1f801810
 #define GPU_GP1_SEND            0x1f801814
 #define GPU_GPUREAD_RESPONSE    0x1f801810
 #define GPU_GPUREAD_STAT        0x1f801814
 
+#define GPU_REGISTER_BASE       0x1f801810
+#define GPU_REGISTER_SIZE       0x08
+
+#define GPU_FIFO_SIZE           16      /**< Longest GP0 command, in words (a shaded, textured quad is 12) */
+#define GPU_VERSION             2       /**< What GP1(10h) index 7 reports */
+
+#define GPU_VIDEO_CLOCK_MUL     11      /**< The video clock is the CPU's times 11/7 (53.2MHz NTSC, 53.7MHz PAL, near enough) */
+#define GPU_VIDEO_CLOCK_DIV     7
+#define GPU_NTSC_LINE_CYCLES    3413    /**< Video cycles an NTSC scanline takes */
+#define GPU_NTSC_LINES          263     /**< Scanlines an NTSC field takes */
+#define GPU_NTSC_VBLANK_START   240     /**< Scanline vertical blanking starts at in an NTSC field */
+#define GPU_PAL_LINE_CYCLES     3406
+#define GPU_PAL_LINES           314
+#define GPU_PAL_VBLANK_START    288
+#define GPU_HBLANK_START        2560    /**< Video cycle horizontal blanking starts at in a scanline (the rest is picture) */
+
 namespace gpu
 {
-    class gpu
+    /**
+     *  The GPU. GP0 commands are decoded here, on the emulation thread, and turned into @ref primitive "primitives".
+     *  They go through a @ref command_ring to the GPU thread, which hands them to the @ref rasterizer, so drawing
+     *  overlaps with the CPU. Decoding stays on this side, so GPUSTAT and GP1(10h) never have to wait for the GPU thread.
+     *
+     *  Only reading VRAM back (VRAM to CPU transfers, @ref get_vram, save states) has to wait for the GPU
+     *  thread to catch up (@ref sync). Uploads and VRAM copies are primitives too, so they stay in order with the drawing.
+     */
+    class gpu : public bus::device
     {
     public:
+        gpu();
+        ~gpu();
+
+        std::uint32_t read32(std::uint32_t addr) override;
+        void write32(std::uint32_t addr, std::uint32_t val) override;
+
+        void dma_write(std::uint32_t val) override;
+        std::uint32_t dma_read() override;
+        void dma_write_block(const std::uint32_t* words, std::uint32_t count) override;
+        void dma_read_block(std::uint32_t* words, std::uint32_t count) override;
+        bool dma_ready() override;
+
+        void reset() override;
+        void serialize(state::serializer& s) override;
+
+        /**
+         *  Send a word to GP0 (drawing commands and VRAM transfers).
+         */
+        void gp0(std::uint32_t val);
+
+        /**
+         *  Send a word to GP1 (display control).
+         */
+        void gp1(std::uint32_t val);
+
+        /**
+         *  Read a word back from GPUREAD (VRAM to CPU transfers, or the answer to GP1(10h)).
+         */
+        std::uint32_t gpuread();
+
+        std::uint32_t read_gpustat() const;
+
+        /**
+         *  Is the display set up for PAL (GP1(08h))?
+         */
+        bool pal() const
+        {
+            return (gpustat >> 20) & 1;
+        }
+
+        /**
+         *  Get the video cycles a dot takes in the current horizontal resolution (the dotclock divider).
+         */
+        unsigned dot_cycles() const;
+
+        /**
+         *  Get VRAM, with everything we've been asked to draw so far in it.
+         */
+        const std::uint16_t* get_vram()
+        {
+            sync();
+            return vram.data();
+        }
+
+        /**
+         *  Set how many threads the rasterizer uses (0 for one per core).
+         */
+        void set_threads(unsigned threads)
+        {
+            sync();
+            raster.set_threads(threads);
+        }
+
+        /**
+         *  Select the rasterizer's span kernel (see @ref rasterizer::set_kernel).
+         */
+        bool set_kernel(rasterizer::KERNEL kernel)
+        {
+            sync();
+            return raster.set_kernel(kernel);
+        }
+
+        /**
+         *  Draw on the GPU thread, or right here on the emulation thread as primitives are recorded.
+         */
+        void set_async(bool enabled);
+
+        /**
+         *  Wait until everything we've recorded is in VRAM.
+         */
+        void sync();
 
     private:
-        std::uint32_t gpustat;
+        /**
+         *  What GP0 does with the next word we get.
+         */
+        enum MODE
+        {
+            COMMAND = 0,    /**< Collecting the words of a command. */
+            CPU_TO_VRAM,    /**< Pixels going to VRAM. */
+            POLYLINE,       /**< More vertices of a polyline, until the terminator. */
+        };
+
+        /**
+         *  A rectangle of VRAM being copied to or from the CPU.
+         */
+        struct transfer
+        {
+            std::uint32_t x;
+            std::uint32_t y;
+            std::uint32_t width;
+            std::uint32_t height;
+            std::uint32_t words;    /**< Words left to go. */
+        };
+
+        std::vector<std::uint16_t>  vram;           /**< 1024x512 16-bit pixels (plus the rasterizer's slack). Only the GPU thread touches it, unless we've synced. */
+        rasterizer                  raster;         /**< Only used by the GPU thread, unless we've synced. */
+
+        command_ring                ring;           /**< Primitives on their way to the GPU thread. */
+        std::thread                 render_thread;  /**< The GPU thread. */
+        std::mutex                  lock;           /**< Only taken to sleep and wake up. */
+        std::condition_variable     wake;           /**< Signalled when the ring stops being empty. */
+        std::condition_variable     idle;           /**< Signalled when the GPU thread has drawn everything. */
+        std::atomic<bool>           sleeping;       /**< Is the GPU thread waiting for work? */
+        std::atomic<std::uint64_t>  completed;      /**< Primitives the GPU thread has drawn into VRAM. */
+        std::uint64_t               pushed;         /**< Primitives we've pushed. */
+        bool                        quit;           /**< Tells the GPU thread to stop. */
+        bool                        async;          /**< Are we drawing on the GPU thread? */
+
+        std::uint32_t   gpustat;
+        MODE            mode;
+        std::uint32_t   fifo[GPU_FIFO_SIZE];        /**< Words of the command we're collecting. */
+        unsigned        fifo_length;                /**< Words we've got. */
+        unsigned        fifo_needed;                /**< Words the command needs. */
+
+        transfer        write_transfer;             /**< CPU to VRAM transfer in progress. */
+        transfer        read_transfer;              /**< VRAM to CPU transfer in progress. */
+        std::uint16_t*  upload;                     /**< Pixels of the CPU to VRAM transfer, sent as one primitive once they're all here. */
+        std::vector<std::uint16_t> readback;        /**< Copy of the rectangle being read by the VRAM to CPU transfer. */
+        std::uint32_t   gpuread_latch;              /**< Last value put on GPUREAD. */
+
+        vertex          polyline_last;              /**< Last vertex of the polyline we're drawing. */
+        std::uint32_t   polyline_command;           /**< Command that started it. */
+
+        std::uint32_t   texture_window;             /**< Raw GP0(E2h..E5h), for GP1(10h). */
+        std::uint32_t   area_top_left;
+        std::uint32_t   area_bottom_right;
+        std::uint32_t   draw_offset;
+        std::int32_t    offset_x;                   /**< Drawing offset, added to every vertex. */
+        std::int32_t    offset_y;
+        bool            allow_texture_disable;      /**< GP1(09h). */
+
+        std::uint32_t   display_start;              /**< GP1(05h..07h), we don't display anything yet. */
+        std::uint32_t   display_range_x;
+        std::uint32_t   display_range_y;
+
+        /**
+         *  Number of words in a GP0 command, from its first word.
+         */
+        static unsigned command_length(std::uint32_t command);
+
+        /**
+         *  Run the GP0 command in the fifo.
+         */
+        void execute();
+
+        void draw_polygon();
+        void draw_line();
+        void draw_polyline(std::uint32_t val);
+        void draw_rectangle();
+        void fill_rectangle();
+        void copy_rectangle();
+        void start_transfer(transfer& t);
+        void start_upload();
+        void start_readback();
+
+        /**
+         *  Send a primitive to the GPU thread (or draw it, if we're not async).
+         */
+        void push(const primitive& p);
+
+        void start_thread();
+        void stop_thread();
+        void render_loop();
+
+        /**
+         *  Drawing state as it stands, for a primitive using a CLUT.
+         */
+        draw_state current_state(std::uint16_t clut) const;
+
+        /**
+         *  Apply a texpage attribute (from GP0(E1h) or a textured polygon) to GPUSTAT.
+         */
+        void set_texpage(std::uint16_t texpage);
+
+        vertex decode_vertex(std::uint32_t position, std::uint32_t color) const;
+
+        /**
+         *  Clip a primitive's bounding box to the drawing area and send it off to be drawn.
+         */
+        void submit(primitive& p, std::int32_t x1, std::int32_t y1, std::int32_t x2, std::int32_t y2);
     };
 
 }
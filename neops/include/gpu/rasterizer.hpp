@@ -0,0 +1,269 @@
+/**
+    This file is part of NeoPS.
+
+    NeoPS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    NeoPS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+**/
+#ifndef RASTERIZER_HPP_INCLUDED
+#define RASTERIZER_HPP_INCLUDED
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define GPU_VRAM_WIDTH          1024    /**< VRAM width in (16-bit) pixels */
+#define GPU_VRAM_HEIGHT         512     /**< VRAM height in lines */
+#define GPU_VRAM_SLACK          1       /**< Spare pixels the rasterizer needs after VRAM (texture gathers read 32 bits at a time) */
+
+#define RASTERIZER_TILE_SIZE    64      /**< Width and height of the tiles the workers split VRAM into */
+#define RASTERIZER_TILES_X      (GPU_VRAM_WIDTH / RASTERIZER_TILE_SIZE)
+#define RASTERIZER_TILES_Y      (GPU_VRAM_HEIGHT / RASTERIZER_TILE_SIZE)
+#define RASTERIZER_MAX_THREADS  8       /**< Most threads we'll render with, however many cores there are */
+#define RASTERIZER_MAX_QUEUE    4096    /**< Primitives we queue up before rendering them anyway */
+
+// The span kernel has an AVX2 version, picked at runtime. Everywhere else we only have the scalar one.
+#if defined(__x86_64__) && defined(__GNUC__)
+#define NEOPS_HAS_RASTERIZER_SIMD
+#endif
+
+namespace gpu
+{
+    /**
+     *  A vertex, already moved by the drawing offset (so in VRAM coordinates).
+     */
+    struct vertex
+    {
+        std::int32_t    x;
+        std::int32_t    y;
+        std::uint8_t    r;
+        std::uint8_t    g;
+        std::uint8_t    b;
+        std::uint8_t    u;
+        std::uint8_t    v;
+    };
+
+    /**
+     *  The bits of the GPU's drawing state a primitive needs. They're copied into every primitive
+     *  when it's recorded, so the GPU is free to change them while the primitive's waiting to be drawn.
+     */
+    struct draw_state
+    {
+        std::int32_t    area_x1;            /**< Drawing area, inclusive. */
+        std::int32_t    area_y1;
+        std::int32_t    area_x2;
+        std::int32_t    area_y2;
+        std::uint16_t   texpage_x;          /**< Texture page base, in pixels. */
+        std::uint16_t   texpage_y;
+        std::uint16_t   clut_x;             /**< CLUT position, in pixels. */
+        std::uint16_t   clut_y;
+        std::uint8_t    depth;              /**< Texture depth (0 = 4-bit, 1 = 8-bit, 2 = 15-bit). */
+        std::uint8_t    semi_mode;          /**< Semi-transparency mode (0 = B/2+F/2, 1 = B+F, 2 = B-F, 3 = B+F/4). */
+        std::uint8_t    window_mask_x;      /**< Texture window, in units of 8 pixels. */
+        std::uint8_t    window_mask_y;
+        std::uint8_t    window_offset_x;
+        std::uint8_t    window_offset_y;
+        bool            dither;             /**< Dither 24-bit color down to 15-bit? */
+        bool            set_mask;           /**< Set bit 15 of everything we draw? */
+        bool            check_mask;         /**< Leave pixels with bit 15 set alone? */
+    };
+
+    /**
+     *  A recorded drawing command. Quads are split into two triangles when they're recorded.
+     */
+    struct primitive
+    {
+        enum TYPE
+        {
+            TRIANGLE = 0,
+            LINE,
+            RECTANGLE,
+            FILL,
+            COPY,       /**< VRAM to VRAM copy, from v[1] to v[0]. */
+            UPLOAD,     /**< CPU to VRAM transfer of pixels to v[0]. */
+        };
+
+        TYPE            type;
+        vertex          v[3];           /**< Vertices (lines use 2, rectangles, fills and uploads just the first). */
+        std::int32_t    width;          /**< Size of a rectangle, fill, copy or upload. */
+        std::int32_t    height;
+        bool            shaded;         /**< Gouraud shaded? */
+        bool            textured;       /**< Textured? */
+        bool            raw;            /**< Textured without blending in the vertex color? */
+        bool            semi;           /**< Semi-transparent? */
+        std::uint16_t*  pixels;         /**< Pixels of an upload, allocated with new[]. The rasterizer frees them once they're in VRAM. */
+        draw_state      state;
+
+        std::int32_t    x1;             /**< Bounding box in VRAM, inclusive. */
+        std::int32_t    y1;
+        std::int32_t    x2;
+        std::int32_t    y2;
+    };
+
+    /**
+     *  Software rasterizer.
+     *
+     *  Primitives are queued (@ref submit) and drawn in batches by a pool of workers. VRAM is split into tiles. Each worker takes one tile at a time and draws every queued
+     *  primitive that touches it, in order, clipped to that tile. Tiles never share a pixel, so the result
+     *  is exactly what drawing the primitives one after the other would give.
+     *
+     *  The one thing tiles can't do alone is read pixels another tile is drawing, which is what a primitive
+     *  does when it's textured from somewhere the batch draws to. We render the batch before queueing
+     *  anything like that.
+     *
+     *  Spans go through the pixel pipeline 8 at a time with AVX2 when we've got it, and the scalar
+     *  kernel does the rest. The scalar kernel is the reference, AVX2 has to match it bit for bit.
+     */
+    class rasterizer
+    {
+    public:
+        /**
+         *  @arg vram - VRAM we draw into, with @ref GPU_VRAM_SLACK spare pixels after it.
+         */
+        rasterizer(std::uint16_t* vram);
+        ~rasterizer();
+
+        /**
+         *  Which span kernel we're using.
+         */
+        enum KERNEL
+        {
+            SCALAR = 0,
+            AVX2,
+        };
+
+        /**
+         *  Select the span kernel. Don't call this while a batch is being drawn.
+         *
+         *  @arg kernel - Kernel we want.
+         *  @return false if this host can't run it (we keep the one we had).
+         */
+        bool set_kernel(KERNEL kernel);
+
+        KERNEL get_kernel() const
+        {
+            return kernel;
+        }
+
+        /**
+         *  Set how many threads we render with (including the emulation thread, which helps out while it waits).
+         *
+         *  @arg threads - Number of threads, 0 for one per core.
+         */
+        void set_threads(unsigned threads);
+
+        /**
+         *  Queue a primitive. Copies and uploads don't split into tiles; they wait for the queue to be drawn and happen right away.
+         */
+        void submit(const primitive& p);
+
+        /**
+         *  Draw everything queued and wait until it's in VRAM. Anything touching VRAM other than
+         *  through us has to call this first.
+         */
+        void flush();
+
+    private:
+        /**
+         *  A rectangle of VRAM, inclusive.
+         */
+        struct rect
+        {
+            std::int32_t x1;
+            std::int32_t y1;
+            std::int32_t x2;
+            std::int32_t y2;
+
+            bool empty() const
+            {
+                return x1 > x2 || y1 > y2;
+            }
+
+            bool intersects(const rect& r) const
+            {
+                return !empty() && !r.empty() && x1 <= r.x2 && r.x1 <= x2 && y1 <= r.y2 && r.y1 <= y2;
+            }
+
+            void merge(const rect& r);
+        };
+
+        /**
+         *  A horizontal run of pixels and the attributes at its first pixel, in 16.16 fixed point.
+         */
+        struct span
+        {
+            std::int32_t    y;
+            std::int32_t    x1;     /**< First pixel. */
+            std::int32_t    x2;     /**< One past the last pixel. */
+            std::int32_t    r, g, b, u, v;
+            std::int32_t    dr, dg, db, du, dv;
+        };
+
+        std::uint16_t*              vram;
+        KERNEL                      kernel;         /**< Span kernel we're using. */
+        std::vector<primitive>      queue;          /**< Primitives waiting to be drawn. */
+        rect                        drawn;          /**< Everything the queue draws to. */
+        rect                        sampled;        /**< Everything the queue reads textures from. */
+
+        unsigned                    threads;        /**< Threads we render with. */
+        std::vector<std::thread>    workers;        /**< Worker threads (threads - 1 of them, we're the last one). */
+        std::mutex                  lock;
+        std::condition_variable     wake;           /**< Signalled when there's a new batch. */
+        std::condition_variable     done;           /**< Signalled when the last worker finishes a batch. */
+        std::uint32_t               batch;          /**< Bumped for every batch. */
+        unsigned                    busy;           /**< Workers still drawing the current batch. */
+        bool                        quit;           /**< Tells the workers to go home. */
+        std::atomic<unsigned>       next_tile;      /**< Next tile nobody's taken yet. */
+
+        void start_workers();
+        void stop_workers();
+        void worker(std::uint32_t seen);
+
+        /**
+         *  Take tiles until there are none left, and draw the queue into each.
+         */
+        void render_tiles();
+
+        void render(const primitive& p, const rect& clip);
+        void triangle(const primitive& p, const rect& clip);
+        void line(const primitive& p, const rect& clip);
+        void rectangle(const primitive& p, const rect& clip);
+        void fill(const primitive& p, const rect& clip);
+        void copy(const primitive& p);
+        void upload(const primitive& p);
+        void write_pixel(const draw_state& st, std::uint32_t x, std::uint32_t y, std::uint16_t pixel);
+
+        /**
+         *  Run a span through the whole pixel pipeline (texture, blending, dithering, mask).
+         */
+        void draw_span(const primitive& p, const span& s);
+
+#ifdef NEOPS_HAS_RASTERIZER_SIMD
+        /**
+         *  AVX2 span kernel. Draws as many whole groups of 8 pixels as the span has, and leaves the rest.
+         *
+         *  @return Number of pixels drawn.
+         */
+        std::int32_t draw_span_avx2(const primitive& p, const span& s);
+#endif
+
+        /**
+         *  Area of VRAM a primitive could read its texture (and CLUT) from.
+         */
+        static rect texture_footprint(const primitive& p);
+    };
+}
+
+#endif // RASTERIZER_HPP_INCLUDED
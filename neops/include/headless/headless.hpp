@@ -0,0 +1,59 @@
+/**
+    This file is part of NeoPS.
+
+    NeoPS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    NeoPS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+**/
+#ifndef HEADLESS_HPP_INCLUDED
+#define HEADLESS_HPP_INCLUDED
+
+#include <cstdint>
+
+#include "cpu/r3000a.hpp"
+
+#define HEADLESS_CYCLES_PER_FRAME   (R3000_CLOCK / 60)  /**< Cycles we count as a frame (NTSC) */
+
+/**
+ *  Headless runs (--headless): boot, run for a fixed number of cycles with nothing on screen, then print hashes
+ *  of RAM, VRAM and the CPU so runs can be compared bit for bit. Nothing depends on the host (timing, thread
+ *  count), so the same inputs and execution mode always give the same hashes. We don't stop exactly on the
+ *  budget (see @ref psx::system::run): the "cycles" line says how far we really got, and the recompiler, which
+ *  only stops between blocks, can stop somewhere else than the interpreter does.
+ *
+ *  Hashes go to stdout, one "name value" pair a line. Timing goes to stderr, since it's different every time.
+ */
+namespace headless
+{
+    struct options
+    {
+        const char*             bios;           /**< BIOS image */
+        const char*             exe;            /**< PS-X EXE to sideload, or nullptr */
+        const char*             load_state;     /**< Save state to start from, or nullptr to boot */
+        const char*             save_state;     /**< Where to write a save state at the end, or nullptr */
+        std::uint64_t           cycles;         /**< How long to run for (we can go a little over) */
+        cpu::r3000a::EXEC_MODE  exec_mode;      /**< How the CPU runs */
+        unsigned                gpu_threads;    /**< Rasterizer threads (0 for one per core) */
+        bool                    stats;          /**< Print I/O statistics at the end */
+        bool                    hle;            /**< Handle kernel calls natively (see @ref hle::kernel) */
+        bool                    fast_boot;      /**< Skip the BIOS, HLE's the whole kernel (implies hle) */
+    };
+
+    /**
+     *  Do a headless run.
+     *
+     *  @return Exit code for main().
+     */
+    int run(const options& opts);
+}
+
+#endif // HEADLESS_HPP_INCLUDED
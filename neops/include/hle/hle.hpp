@@ -0,0 +1,238 @@
+/**
+    This file is part of NeoPS.
+
+    NeoPS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    NeoPS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+**/
+#ifndef HLE_HPP_INCLUDED
+#define HLE_HPP_INCLUDED
+
+#include <bitset>
+#include <cstdint>
+#include <cstdio>
+
+#define HLE_A0_VECTOR       0x000000a0  /**< Physical address of the A0 function table's entry point */
+#define HLE_B0_VECTOR       0x000000b0
+#define HLE_C0_VECTOR       0x000000c0
+#define HLE_EXCEPTION       0x00000080  /**< Physical address of the general exception vector */
+
+#define HLE_IDLE_ADDR       0x80001000  /**< Where a fast booted CPU spins until it's given something to run */
+#define HLE_STACK_TOP       0x801fff00  /**< Stack pointer a fast booted program starts with */
+#define HLE_RAM_SIZE_ADDR   0x00000060  /**< Where the kernel keeps the RAM size (in MiB), see SetMem */
+
+#define HLE_MAX_EVENTS      16          /**< Event control blocks (the BIOS's default) */
+#define HLE_MAX_THREADS     4           /**< Thread control blocks (the BIOS's default), including the main thread */
+
+namespace state
+{
+    class serializer;
+}
+
+namespace cpu
+{
+    class r3000a;
+}
+
+/**
+ *  High-level emulation of the BIOS kernel.
+ *
+ *  Programs call the kernel by jumping to 0xa0, 0xb0 or 0xc0 with the function number in t1. With HLE on,
+ *  the CPU hands those jumps to us instead of running the kernel's code, and we do the work natively and
+ *  return straight to ra.
+ *
+ *  There are two ways of running:
+ *      - With the real BIOS booted, we only take over functions that don't depend on anything the kernel
+ *        keeps in RAM (string and memory functions, printf and friends). Everything else goes to the BIOS.
+ *      - Fast booted (see @ref kernel::fast_boot), none of the BIOS runs at all. We're the whole kernel, so we
+ *        also do the heap, events, threads, file I/O (stubbed out, there's nothing to open) and critical
+ *        sections. Anything we don't know is reported and returns 0.
+ */
+namespace hle
+{
+    /**
+     *  A kernel event (OpenEvent and friends).
+     */
+    struct event
+    {
+        std::uint32_t   ev_class;   /**< What it's waiting for (0xf0000000 and up are software events) */
+        std::uint32_t   spec;       /**< Which of the class's events */
+        std::uint32_t   mode;       /**< 0x1000 calls func when delivered, 0x2000 just marks it ready */
+        std::uint32_t   func;       /**< Callback, for mode 0x1000 */
+        std::uint32_t   status;     /**< 0 free, 0x1000 disabled, 0x2000 enabled, 0x4000 delivered */
+    };
+
+    /**
+     *  A thread's saved registers.
+     */
+    struct thread
+    {
+        std::uint32_t   used;       /**< Is this slot taken? */
+        std::uint32_t   gpr[32];
+        std::uint32_t   hi;
+        std::uint32_t   lo;
+        std::uint32_t   pc;
+    };
+
+    class kernel
+    {
+    public:
+        kernel(cpu::r3000a* cpu);
+
+        /**
+         *  Is this physical address one we might take over? Code there can't be cached or compiled, so every
+         *  jump to it comes through @ref intercept.
+         */
+        static bool traps(std::uint32_t phys_addr)
+        {
+            return phys_addr == HLE_A0_VECTOR || phys_addr == HLE_B0_VECTOR || phys_addr == HLE_C0_VECTOR || phys_addr == HLE_EXCEPTION;
+        }
+
+        /**
+         *  The CPU's about to run the instruction at phys_addr. If it's a kernel call we handle, do it and
+         *  move the CPU on to wherever the call returns to.
+         *
+         *  @return true if we did, false if the CPU should run the code that's there.
+         */
+        bool intercept(std::uint32_t phys_addr);
+
+        /**
+         *  Set the machine up as if the BIOS had booted it, without running any of it: memory control
+         *  registers, kernel variables, the stack and one (main) thread. The CPU ends up idling at
+         *  @ref HLE_IDLE_ADDR until something points it somewhere else.
+         */
+        void fast_boot();
+
+        /**
+         *  Were we fast booted (so we're the whole kernel)?
+         */
+        bool booted() const
+        {
+            return native;
+        }
+
+        /**
+         *  Where anything the program prints (printf, puts, writes to the TTY) goes. stdout by default.
+         */
+        void set_tty(std::FILE* tty)
+        {
+            this->tty = tty;
+        }
+
+        /**
+         *  Save or load our state (see @ref state::serializer). The heap lives in RAM, like the BIOS's.
+         */
+        void serialize(state::serializer& s);
+
+    private:
+        typedef std::uint32_t (kernel::*function_t)();
+
+        /**
+         *  A kernel function we know.
+         */
+        struct function
+        {
+            std::uint32_t   vector;     /**< HLE_A0_VECTOR, HLE_B0_VECTOR or HLE_C0_VECTOR */
+            std::uint32_t   number;     /**< Function number (t1) */
+            const char*     name;
+            function_t      handler;    /**< Does the work, returning v0 */
+            bool            standalone; /**< Safe to run alongside the real BIOS (doesn't touch its state) */
+        };
+
+        static const function functions[];
+
+        cpu::r3000a*    cpu;
+        std::FILE*      tty;
+
+        bool            native;                     /**< Fast booted, so everything's up to us */
+        std::uint32_t   heap_start;                 /**< InitHeap's block */
+        std::uint32_t   heap_end;
+        std::uint32_t   rand_seed;
+        std::uint32_t   current_thread;             /**< Index of the running thread */
+        event           events[HLE_MAX_EVENTS];
+        thread          threads[HLE_MAX_THREADS];
+        std::bitset<768> reported;                  /**< Unknown calls we've already complained about (256 per table) */
+        bool            switched;                   /**< The function moved the CPU on itself (ChangeThread) */
+
+        const function* find(std::uint32_t vector, std::uint32_t number) const;
+        void exception();
+
+        std::uint32_t arg(unsigned n) const;
+        std::uint8_t read8(std::uint32_t vaddr) const;
+        std::uint32_t read32(std::uint32_t vaddr) const;
+        void write8(std::uint32_t vaddr, std::uint8_t value);
+        void write32(std::uint32_t vaddr, std::uint32_t value);
+        std::uint32_t string_length(std::uint32_t vaddr) const;
+        void print(const char* text, std::size_t length);
+
+        // A0 (and the B0 duplicates)
+        std::uint32_t fn_open();
+        std::uint32_t fn_lseek();
+        std::uint32_t fn_read();
+        std::uint32_t fn_write();
+        std::uint32_t fn_close();
+        std::uint32_t fn_abs();
+        std::uint32_t fn_atoi();
+        std::uint32_t fn_strcat();
+        std::uint32_t fn_strncat();
+        std::uint32_t fn_strcmp();
+        std::uint32_t fn_strncmp();
+        std::uint32_t fn_strcpy();
+        std::uint32_t fn_strncpy();
+        std::uint32_t fn_strlen();
+        std::uint32_t fn_strchr();
+        std::uint32_t fn_strrchr();
+        std::uint32_t fn_toupper();
+        std::uint32_t fn_tolower();
+        std::uint32_t fn_bcopy();
+        std::uint32_t fn_bzero();
+        std::uint32_t fn_memcpy();
+        std::uint32_t fn_memset();
+        std::uint32_t fn_memmove();
+        std::uint32_t fn_memcmp();
+        std::uint32_t fn_memchr();
+        std::uint32_t fn_rand();
+        std::uint32_t fn_srand();
+        std::uint32_t fn_malloc();
+        std::uint32_t fn_free();
+        std::uint32_t fn_calloc();
+        std::uint32_t fn_realloc();
+        std::uint32_t fn_init_heap();
+        std::uint32_t fn_putchar();
+        std::uint32_t fn_puts();
+        std::uint32_t fn_printf();
+        std::uint32_t fn_flush_cache();
+        std::uint32_t fn_set_mem();
+
+        // B0
+        std::uint32_t fn_deliver_event();
+        std::uint32_t fn_open_event();
+        std::uint32_t fn_close_event();
+        std::uint32_t fn_wait_event();
+        std::uint32_t fn_test_event();
+        std::uint32_t fn_enable_event();
+        std::uint32_t fn_disable_event();
+        std::uint32_t fn_undeliver_event();
+        std::uint32_t fn_open_thread();
+        std::uint32_t fn_close_thread();
+        std::uint32_t fn_change_thread();
+        std::uint32_t fn_first_file();
+
+        // C0
+        std::uint32_t fn_change_clear_rcnt();
+
+        std::uint32_t heap_alloc(std::uint32_t size);
+        event* find_event(std::uint32_t handle);
+    };
+}
+
+#endif // HLE_HPP_INCLUDED
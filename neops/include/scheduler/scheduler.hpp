@@ -0,0 +1,196 @@
+/**
+    This file is part of NeoPS.
+
+    NeoPS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    NeoPS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+**/
+#ifndef SCHEDULER_HPP_INCLUDED
+#define SCHEDULER_HPP_INCLUDED
+
+#include <cstdint>
+
+#define SCHEDULER_MAX_SLICE     100000  /**< Most cycles we'll let the CPU run without checking back, even with nothing scheduled */
+#define SCHEDULER_NEVER         0xffffffffffffffffULL
+
+namespace state
+{
+    class serializer;
+}
+
+/**
+ *  Event scheduler. Time is counted in CPU cycles since power on.
+ *
+ *  Devices add an event once, then schedule it however many cycles ahead they need to hear back.
+ *  The main loop asks us how long the CPU can run before the next event is due (@ref slice), runs it
+ *  for that long and hands us the cycles it actually ran (@ref advance), which fires everything due.
+ *  Nothing has to be polled per instruction. Something the CPU does in the middle of a slice (a register
+ *  write, say) can schedule an event sooner than the slice was meant to end, so we cut the slice short
+ *  (see @ref set_clock) and the event fires on its cycle.
+ *
+ *  An event is either pending or not. Scheduling a pending event moves it, it doesn't queue it twice.
+ *
+ *  Every machine (see @ref psx::system) has its own events and time in a @ref context. Everything here works on
+ *  the context bound to the calling thread, so machines on different threads never see each other's.
+ */
+namespace scheduler
+{
+    typedef std::uint32_t event_id;
+
+    struct context;
+
+    /**
+     *  Make a new context, with no events and time at 0.
+     */
+    context* create();
+
+    /**
+     *  Free a context, unbinding it if it's bound to this thread.
+     */
+    void destroy(context* ctx);
+
+    /**
+     *  Make ctx the context everything on this thread works on (nullptr for none).
+     */
+    void bind(context* ctx);
+
+    /**
+     *  Get the context bound to this thread.
+     */
+    context* bound();
+
+    /**
+     *  Called when an event fires. While it runs, @ref now is the exact cycle the event was due.
+     *
+     *  @arg data - Whatever was handed to @ref add_event.
+     */
+    typedef void (*event_callback)(void* data);
+
+    /**
+     *  Create a new (not yet pending) event.
+     *
+     *  @arg name - Name of the event, for debugging.
+     *  @arg callback - Function to call when the event fires.
+     *  @arg data - Passed along to callback.
+     *  @return Handle of the new event.
+     */
+    event_id add_event(const char* name, event_callback callback, void* data);
+
+    /**
+     *  Schedule an event to fire some number of cycles from now (see @ref exact). If the CPU's slice would
+     *  run past it, the slice is cut short.
+     *
+     *  @arg id - The event.
+     *  @arg cycles - How far in the future it fires. 0 fires it as soon as we get back to the main loop.
+     */
+    void schedule(event_id id, std::uint64_t cycles);
+
+    /**
+     *  Stop an event from firing.
+     */
+    void cancel(event_id id);
+
+    /**
+     *  Is this event waiting to fire?
+     */
+    bool pending(event_id id);
+
+    /**
+     *  Get the cycle a pending event is due.
+     */
+    std::uint64_t due(event_id id);
+
+    /**
+     *  Get the current time.
+     *
+     *  @return Cycles since power on.
+     */
+    std::uint64_t now();
+
+    /**
+     *  Called to find out how many cycles the CPU has run so far in the slice it's running (see @ref exact),
+     *  which is 0 if it isn't running one.
+     *
+     *  @arg data - Whatever was handed to @ref set_clock.
+     */
+    typedef std::uint32_t (*clock_callback)(void* data);
+
+    /**
+     *  Called to cut the CPU's slice short, when an event comes due before it would end. The CPU has to stop
+     *  as soon as it can once it's run that far (it can't stop in the middle of an instruction or a block,
+     *  so it may go a little past). It's a no-op if it isn't running a slice.
+     *
+     *  @arg data - Whatever was handed to @ref set_clock.
+     *  @arg cycles - How far into the slice it stops.
+     */
+    typedef void (*preempt_callback)(void* data, std::uint32_t cycles);
+
+    /**
+     *  Tell us how to find out how far into its slice the CPU has got, and how to cut it short.
+     *
+     *  @arg clock - Function to ask, or nullptr if nobody can tell us.
+     *  @arg preempt - Function to cut the slice short, or nullptr if nobody can.
+     *  @arg data - Passed along to both.
+     */
+    void set_clock(clock_callback clock, preempt_callback preempt, void* data);
+
+    /**
+     *  Get the current time down to the cycle. @ref now only moves between slices, so a device working out
+     *  what it's been up to since (a counter being read, say) wants this instead.
+     *
+     *  @return Cycles since power on, including however far the CPU has got into its slice.
+     */
+    std::uint64_t exact();
+
+    /**
+     *  Get the cycle the next event is due.
+     *
+     *  @return Cycle of the next event, or @ref SCHEDULER_NEVER if there isn't one.
+     */
+    std::uint64_t next_event();
+
+    /**
+     *  How many cycles the CPU can run before the next event is due.
+     *
+     *  @return Cycles until the next event, capped at @ref SCHEDULER_MAX_SLICE.
+     */
+    std::uint32_t slice();
+
+    /**
+     *  Move time forward, firing every event that's come due along the way in order.
+     *
+     *  @arg cycles - Cycles that have passed.
+     */
+    void advance(std::uint32_t cycles);
+
+    /**
+     *  Take cycles away from the CPU (DMA holding the bus, say). They pass on the next @ref advance
+     *  on top of whatever the CPU ran, or on this one if we're called from an event. Whatever's scheduled
+     *  comes that much sooner for the CPU, so its slice is cut short to match.
+     *
+     *  @arg cycles - Cycles the CPU sat out.
+     */
+    void stall(std::uint32_t cycles);
+
+    /**
+     *  Cancel every event and start time over from 0. Events stay added.
+     */
+    void reset();
+
+    /**
+     *  Save or load the time (see @ref state::serializer). Events belong to whoever added them, so
+     *  they save their own (see @ref due). Loading cancels every event, and they schedule theirs again.
+     */
+    void serialize(state::serializer& s);
+}
+
+#endif // SCHEDULER_HPP_INCLUDED
@@ -19,13 +19,34 @@
 
 #include <cstdint>
 
-#define PSX_SPU_NUM_CREG    20
+#include "bus/device.hpp"
+
+#define PSX_SPU_BASE        0x1f801c00
+#define PSX_SPU_SIZE        0x400
+
+#define PSX_SPU_NUM_CREG    32
 #define PSX_SPU_CREG_START  0x1f801d80
 #define PSX_SPU_CREG_END    0x1f801dbc
 
 namespace spu
 {
-    void write_creg(std::uint32_t reg, std::uint32_t val);
+    class spu : public bus::device
+    {
+    public:
+        spu();
+        ~spu();
+
+        std::uint16_t read16(std::uint32_t addr) override;
+        void write16(std::uint32_t addr, std::uint16_t val) override;
+
+        void reset() override;
+        void serialize(state::serializer& s) override;
+
+    private:
+        std::uint16_t creg[PSX_SPU_NUM_CREG]; /**< Our SPU control registers */
+
+        void write_creg(std::uint32_t reg, std::uint16_t val);
+    };
 }
 
 #endif // SPU_HPP_INCLUDED
@@ -0,0 +1,106 @@
+/**
+    This file is part of NeoPS.
+
+    NeoPS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    NeoPS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+**/
+#ifndef REWIND_HPP_INCLUDED
+#define REWIND_HPP_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "state/state.hpp"
+
+#define REWIND_BUDGET               (32 << 20)  /**< Bytes of history we keep by default */
+#define REWIND_KEYFRAME_INTERVAL    600         /**< Frames between keyframes by default (10 seconds at 60Hz) */
+#define REWIND_BLOCK_SIZE           4096        /**< Snapshots are compared this many bytes at a time */
+
+namespace state
+{
+    /**
+     *  Rewind history: the last however many frames of the machine, squeezed into a fixed budget.
+     *
+     *  We keep the newest snapshot as it is. Every older frame is the XOR of its snapshot with the frame after it,
+     *  run length encoded. Not much changes in a frame, so that's almost all zeroes and RLE makes short work of it.
+     *  Snapshots are compared a block at a time first, so blocks that haven't changed (most of RAM and VRAM) cost
+     *  a memcmp() and nothing else. XOR works both ways, so going back a frame is just decoding its delta over the
+     *  frame after it.
+     *
+     *  Every so often a frame is kept whole (still RLE'd) instead, as a keyframe, so a long jump back starts from
+     *  the nearest keyframe rather than walking every delta from the newest frame.
+     */
+    class rewind
+    {
+    public:
+        /**
+         *  @arg cpu - The machine's CPU.
+         *  @arg budget - Most bytes of history to keep. The oldest frames go first.
+         *  @arg keyframe_interval - Frames between keyframes.
+         */
+        rewind(cpu::r3000a& cpu, std::size_t budget = REWIND_BUDGET, std::uint32_t keyframe_interval = REWIND_KEYFRAME_INTERVAL);
+
+        /**
+         *  Record the machine as it is now. Call it once a frame.
+         */
+        void push();
+
+        /**
+         *  Put the machine back the way it was some frames ago. Anything newer is forgotten.
+         *
+         *  @arg count - How many frames back to go (the newest frame is 0, which just loads it again).
+         *  @return false if we don't have that many frames.
+         */
+        bool step_back(std::uint32_t count);
+
+        /**
+         *  Get how many frames we can go back.
+         */
+        std::uint32_t frames() const
+        {
+            return history.size();
+        }
+
+        /**
+         *  Get how many bytes of history we're keeping (not counting the newest frame).
+         */
+        std::size_t memory() const
+        {
+            return used;
+        }
+
+    private:
+        /**
+         *  An old frame.
+         */
+        struct frame
+        {
+            std::vector<std::uint8_t>   data;       /**< The encoded frame */
+            std::size_t                 size;       /**< Size of its snapshot */
+            bool                        keyframe;   /**< Is it the whole snapshot, or the XOR with the frame after it? */
+        };
+
+        snapshot                    snap;               /**< Where we take snapshots, and load them from */
+        std::vector<std::uint8_t>   latest;             /**< The newest frame, as it is */
+        bool                        have_latest;        /**< Have we taken a snapshot yet? */
+        std::deque<frame>           history;            /**< Older frames, oldest first */
+        std::size_t                 budget;             /**< Most bytes history can take up */
+        std::size_t                 used;               /**< Bytes history takes up */
+        std::uint32_t               keyframe_interval;  /**< Frames between keyframes */
+        std::uint32_t               since_keyframe;     /**< Frames since the last keyframe */
+    };
+}
+
+#endif // REWIND_HPP_INCLUDED
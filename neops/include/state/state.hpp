@@ -0,0 +1,188 @@
+/**
+    This file is part of NeoPS.
+
+    NeoPS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    NeoPS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+**/
+#ifndef STATE_HPP_INCLUDED
+#define STATE_HPP_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#define STATE_MAGIC         0x5353504e  /**< "NPSS" */
+#define STATE_VERSION       2           /**< Version of the save state format (the section layout, not what's in them) */
+#define STATE_NAME_SIZE     16          /**< Bytes a section's name gets, including the terminator */
+
+namespace cpu
+{
+    class r3000a;
+}
+
+/**
+ *  Save states.
+ *
+ *  A save state is a small header followed by one section per component, in a fixed order. Every section starts
+ *  with the component's name, the version of its layout and its size, so a component can still read sections
+ *  written by older versions of itself, and anything it doesn't read gets skipped. Everything's in host byte order.
+ *
+ *  Components don't write or read state themselves, they describe it to a @ref serializer, which either copies it
+ *  out, copies it back in or just adds up how big it is. The same function does all three, so they can't drift apart.
+ */
+namespace state
+{
+    /**
+     *  Walks a component's state, one field at a time, in whichever direction it's going.
+     */
+    class serializer
+    {
+    public:
+        enum MODE
+        {
+            MEASURE = 0,    /**< Just count bytes */
+            SAVE,           /**< Copy state into the buffer */
+            LOAD,           /**< Copy state out of the buffer */
+        };
+
+        /**
+         *  @arg mode - Which way we're going.
+         *  @arg buffer - The state (nullptr when measuring). We never allocate or resize it.
+         *  @arg size - Size of buffer.
+         */
+        serializer(MODE mode, std::uint8_t* buffer, std::size_t size);
+
+        /**
+         *  Are we putting state back? Components use this to rebuild anything that isn't saved.
+         */
+        bool loading() const
+        {
+            return mode == LOAD;
+        }
+
+        /**
+         *  Start a component's section (and end the last one).
+         *
+         *  @arg name - Name of the component. Sections have to be read back in the order they were written.
+         *  @arg version - Version of the component's layout.
+         *  @return The version the section was written with. When saving, that's just version.
+         */
+        std::uint32_t section(const char* name, std::uint32_t version);
+
+        /**
+         *  Save or load a run of bytes.
+         */
+        void bytes(void* data, std::size_t size);
+
+        /**
+         *  Save or load a value (or an array of them). It has to be plain data.
+         */
+        template<typename T>
+        void value(T& val)
+        {
+            bytes(&val, sizeof(val));
+        }
+
+        /**
+         *  End the last section.
+         *
+         *  @return true if everything fit and matched.
+         */
+        bool finish();
+
+        /**
+         *  Get how many bytes we've gone through so far.
+         */
+        std::size_t size() const
+        {
+            return position;
+        }
+
+        bool ok() const
+        {
+            return !failed;
+        }
+
+    private:
+        MODE            mode;
+        std::uint8_t*   buffer;
+        std::size_t     capacity;       /**< Size of buffer */
+        std::size_t     position;       /**< Where the next byte goes (or comes from) */
+        std::size_t     section_start;  /**< Where the current section's payload starts, or 0 if we're not in one */
+        std::size_t     section_end;    /**< Where the current section ends (loading only) */
+        bool            failed;         /**< Did we run off the end, or find something we didn't expect? */
+
+        void end_section();
+    };
+
+    /**
+     *  A snapshot of the whole machine, kept in a buffer allocated up front, so taking one is a few
+     *  memcpy()s with no allocation (unless the machine's state grows, a VRAM transfer in progress say).
+     */
+    class snapshot
+    {
+    public:
+        snapshot(cpu::r3000a& cpu);
+
+        /**
+         *  Take a snapshot of the machine.
+         *
+         *  @return false if something went wrong (which shouldn't happen).
+         */
+        bool save();
+
+        /**
+         *  Put the machine back the way it was when the snapshot was taken (or written).
+         *
+         *  @return false if the snapshot's broken or from a version we can't read. The machine may be half loaded.
+         */
+        bool load();
+
+        /**
+         *  Write the snapshot to a file.
+         */
+        bool write(const char* path) const;
+
+        /**
+         *  Read a snapshot written by @ref write. It isn't loaded into the machine until @ref load.
+         */
+        bool read(const char* path);
+
+        /**
+         *  Replace the snapshot with a copy of one we've been handed. It isn't loaded into the machine until @ref load.
+         */
+        void assign(const std::uint8_t* data, std::size_t size);
+
+        const std::uint8_t* data() const
+        {
+            return buffer.data();
+        }
+
+        std::size_t size() const
+        {
+            return used;
+        }
+
+    private:
+        cpu::r3000a&                cpu;
+        std::vector<std::uint8_t>   buffer;     /**< The snapshot, plus room to grow */
+        std::size_t                 used;       /**< Bytes of buffer the snapshot takes up */
+
+        /**
+         *  Walk the whole machine's state.
+         */
+        void visit(serializer& s);
+    };
+}
+
+#endif // STATE_HPP_INCLUDED
@@ -0,0 +1,141 @@
+/**
+    This file is part of NeoPS.
+
+    NeoPS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    NeoPS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+**/
+#ifndef SYSTEM_HPP_INCLUDED
+#define SYSTEM_HPP_INCLUDED
+
+#include <cstdint>
+#include <string>
+
+#include "bus/bus.hpp"
+#include "cpu/r3000a.hpp"
+#include "dma/dma.hpp"
+#include "exe/exe.hpp"
+#include "gpu/gpu.hpp"
+#include "scheduler/scheduler.hpp"
+#include "spu/spu.hpp"
+#include "timers/timers.hpp"
+
+namespace psx
+{
+    /**
+     *  A whole PlayStation: its bus (RAM, scratchpad and page tables), scheduler, DMA, GPU, SPU, root counters and CPU.
+     *  Nothing is shared between systems except the BIOS image (see @ref bios::load_bios), which is read-only,
+     *  so as many as you like can run at once, each on its own thread.
+     *
+     *  The bus and scheduler are still used through their free functions, which work on whichever system is
+     *  bound to the calling thread. A new system binds itself to the thread that made it, and @ref run binds
+     *  it to the thread that runs it. Anything else that talks to the bus (a save state, say) has to happen
+     *  on a thread the system is bound to.
+     */
+    class system
+    {
+    public:
+        system();
+        ~system();
+
+        system(const system&) = delete;
+        system& operator=(const system&) = delete;
+
+        /**
+         *  Make this the system the bus and scheduler work on, for the calling thread.
+         */
+        void bind();
+
+        /**
+         *  Map the BIOS in.
+         *
+         *  @param path - Path to the bios binary.
+         *  @return true if loaded successfully, false otherwise
+         */
+        bool load_bios(const std::string& path);
+
+        /**
+         *  Run a PS-X EXE instead of booting whatever's in the drive. If the HLE kernel fast booted us (see
+         *  @ref hle::kernel::fast_boot) there's no shell to wait for, so it starts right away. Otherwise the BIOS
+         *  boots like it always does, and the executable starts in place of the shell, once the kernel's set up.
+         *
+         *  @param path - Path to the executable.
+         *  @return true if it's loaded (and started, or waiting to), false otherwise.
+         */
+        bool sideload(const std::string& path);
+
+        /**
+         *  Run the CPU for a number of cycles, firing events as they come due. Binds us to the calling thread.
+         *  We stop after the first instruction that takes us up to or past the end (or the first block, on the
+         *  recompiler), so we can run over by up to an instruction or a block, or by however long a DMA burst
+         *  holds the CPU off the bus. Later runs don't make up for it.
+         *
+         *  @arg cycles - How long to run for.
+         *  @return Cycles we actually ran, overshoot and all.
+         */
+        std::uint64_t run(std::uint64_t cycles);
+
+        cpu::r3000a& get_cpu()
+        {
+            return *cpu;
+        }
+
+        gpu::gpu& get_gpu()
+        {
+            return gpu_device;
+        }
+
+        spu::spu& get_spu()
+        {
+            return spu_device;
+        }
+
+        bus::dma_controller& get_dma()
+        {
+            return dma;
+        }
+
+        timers::root_counters& get_timers()
+        {
+            return counters;
+        }
+
+    private:
+        bus::context*           bus_context;    /**< RAM, page tables and everything else behind the bus. */
+        scheduler::context*     events;         /**< Our events and time. */
+
+        bus::dma_controller     dma;
+        gpu::gpu                gpu_device;
+        spu::spu                spu_device;
+        timers::root_counters   counters;       /**< Made after the GPU, which it gets blanking and the dotclock from. */
+        cpu::r3000a*            cpu;            /**< Made once the bus is up, since the recompiler needs fastmem. */
+        exe::executable         program;        /**< What we're sideloading, if anything. */
+        bool                    running;        /**< Is the CPU in the middle of a slice? */
+
+        /**
+         *  Start the sideloaded program (a CPU hook, at the shell's entry point).
+         */
+        static void start_program(void* data);
+
+        /**
+         *  Tell the scheduler how far into its slice the CPU has got (see @ref scheduler::set_clock).
+         */
+        static std::uint32_t cpu_clock(void* data);
+
+        /**
+         *  Cut the CPU's slice short, for an event that's come due sooner (see @ref scheduler::set_clock).
+         */
+        static void cpu_preempt(void* data, std::uint32_t cycles);
+    };
+}
+
+#endif // SYSTEM_HPP_INCLUDED
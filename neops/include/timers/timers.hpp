@@ -0,0 +1,210 @@
+/**
+    This file is part of NeoPS.
+
+    NeoPS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    NeoPS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with NeoPS.  If not, see <http://www.gnu.org/licenses/>.
+**/
+#ifndef TIMERS_HPP_INCLUDED
+#define TIMERS_HPP_INCLUDED
+
+#include <cstdint>
+
+#include "bus/device.hpp"
+#include "scheduler/scheduler.hpp"
+
+#define TIMER_REGISTER_BASE     0x1f801100
+#define TIMER_REGISTER_SIZE     0x30
+#define TIMER_COUNT             3
+
+#define TIMER_COUNTER           0x0     /**< Offset of the current value in a counter's registers */
+#define TIMER_MODE              0x4     /**< Offset of the counter mode */
+#define TIMER_TARGET            0x8     /**< Offset of the target value */
+
+#define TIMER_MODE_SYNC_ENABLE  0x0001  /**< Gate the counter with its sync mode (bits 1-2) */
+#define TIMER_MODE_RESET_TARGET 0x0008  /**< Go back to 0 on reaching the target, instead of 0xffff */
+#define TIMER_MODE_IRQ_TARGET   0x0010  /**< IRQ on reaching the target */
+#define TIMER_MODE_IRQ_OVERFLOW 0x0020  /**< IRQ on reaching 0xffff */
+#define TIMER_MODE_IRQ_REPEAT   0x0040  /**< IRQ every time, not just the first time after the mode's written */
+#define TIMER_MODE_IRQ_TOGGLE   0x0080  /**< Toggle the IRQ line on every IRQ, instead of pulsing it */
+#define TIMER_MODE_IRQ_LINE     0x0400  /**< The IRQ line, which is active low */
+#define TIMER_MODE_HIT_TARGET   0x0800  /**< Reached the target since the mode was last read */
+#define TIMER_MODE_HIT_OVERFLOW 0x1000  /**< Reached 0xffff since the mode was last read */
+
+namespace gpu
+{
+    class gpu;
+}
+
+namespace timers
+{
+    /**
+     *  What a counter counts (mode bits 8-9 pick one, what they mean depends on the counter).
+     */
+    enum CLOCK
+    {
+        SYSTEM = 0,     /**< The CPU's clock */
+        SYSTEM_8,       /**< The CPU's clock, over 8 (counter 2) */
+        DOT,            /**< The GPU's dotclock (counter 0) */
+        HBLANK,         /**< Horizontal blanks (counter 1) */
+    };
+
+    class root_counters;
+
+    /**
+     *  One of the root counters.
+     */
+    struct counter
+    {
+        std::uint32_t   value;      /**< Count, as of @ref last. */
+        std::uint32_t   mode;       /**< Counter mode. */
+        std::uint32_t   target;     /**< Target value. */
+        std::uint64_t   last;       /**< Cycle value was brought up to date at. */
+        bool            irq_done;   /**< Has a one-shot IRQ gone off since the mode was written? */
+        bool            released;   /**< Has sync mode 3 seen its blank yet (so it runs free)? */
+
+        root_counters*          owner;  /**< Who we belong to, for our event. */
+        int                     index;  /**< Which counter we are. */
+        scheduler::event_id     event;  /**< Fires when we're next due to IRQ. */
+    };
+
+    /**
+     *  The three root counters (timers). Counter 0 counts the CPU clock or the dotclock and can sync to horizontal
+     *  blanking, counter 1 counts the CPU clock or horizontal blanks and can sync to vertical blanking, and counter 2
+     *  counts the CPU clock or an eighth of it and can be stopped.
+     *
+     *  Nothing ticks. A counter works out what it's been up to from the cycle it was last brought up to date when one
+     *  of its registers is touched (see @ref scheduler::exact), and keeps a single event, for its next IRQ. Blanking
+     *  and the dotclock come from the GPU's display mode, on the video clock (see @ref GPU_VIDEO_CLOCK_MUL).
+     */
+    class root_counters : public bus::device
+    {
+    public:
+        root_counters(gpu::gpu& video);
+        ~root_counters();
+
+        std::uint16_t read16(std::uint32_t addr) override;
+        std::uint32_t read32(std::uint32_t addr) override;
+        void write16(std::uint32_t addr, std::uint16_t val) override;
+        void write32(std::uint32_t addr, std::uint32_t val) override;
+
+        void reset() override;
+        void serialize(state::serializer& s) override;
+
+        /**
+         *  Get the counters that have raised an IRQ since we were last asked, and forget them. This is what
+         *  the interrupt controller would see (I_STAT bits 4-6), and there isn't one yet, so nothing asks.
+         *
+         *  @return Bit n set if counter n raised one.
+         */
+        std::uint32_t take_irqs()
+        {
+            std::uint32_t raised = irqs;
+
+            irqs = 0;
+            return raised;
+        }
+
+    private:
+        gpu::gpu&       video;                  /**< Where blanking and the dotclock come from. */
+        counter         counters[TIMER_COUNT];  /**< Our counters. */
+        std::uint32_t   irqs;                   /**< Counters that have raised an IRQ nobody's taken yet. */
+        bool            events_added;           /**< Have our events been added yet? */
+
+        /**
+         *  Get what a counter is counting, from its mode.
+         */
+        CLOCK source(int index) const;
+
+        /**
+         *  Count a clock from power on.
+         *
+         *  @arg clock - The clock.
+         *  @arg time - The cycle to count up to.
+         *  @return Ticks of clock by time.
+         */
+        std::uint64_t ticks_at(CLOCK clock, std::uint64_t time) const;
+
+        /**
+         *  The other way round from @ref ticks_at.
+         *
+         *  @return The first cycle clock has ticked ticks times by.
+         */
+        std::uint64_t time_of(CLOCK clock, std::uint64_t ticks) const;
+
+        /**
+         *  Is a counter's blank (horizontal for counter 0, vertical for counter 1) happening?
+         *
+         *  @arg index - The counter.
+         *  @arg video - Video cycles since power on.
+         *  @arg change - Set to the video cycle that changes.
+         *  @return true if we're in the blank.
+         */
+        bool blanking(int index, std::uint64_t video, std::uint64_t& change) const;
+
+        /**
+         *  Is the counter stopped for good (counter 2's sync modes 0 and 3)?
+         */
+        bool stopped(int index) const;
+
+        /**
+         *  Bring a counter up to date, as of right now.
+         */
+        void catch_up(int index);
+
+        /**
+         *  Bring a counter up to date, as of a cycle, following its sync mode along the way.
+         *
+         *  @arg index - The counter.
+         *  @arg until - The cycle. Nothing happens if the counter's already past it.
+         */
+        void run(int index, std::uint64_t until);
+
+        /**
+         *  Count a number of ticks, wrapping at the target or 0xffff and raising whatever IRQs it hits on the way.
+         */
+        void count(int index, std::uint64_t ticks);
+
+        /**
+         *  Work out how many ticks it'll be before a value is next reached, counting from where the counter is.
+         *
+         *  @return Ticks, or 0 if it never will be.
+         */
+        std::uint64_t ticks_until(int index, std::uint32_t value) const;
+
+        /**
+         *  Deliver IRQs a counter has raised, as the mode says.
+         *
+         *  @arg index - The counter.
+         *  @arg raised - How many it's raised.
+         */
+        void interrupt(int index, std::uint64_t raised);
+
+        /**
+         *  Schedule a counter's event for its next IRQ, or cancel it if there won't be one. Pausing and
+         *  resetting only ever hold a counter back, so when they're on it can go off early, and just schedules again.
+         */
+        void schedule_irq(int index);
+
+        /**
+         *  Add our events, if they haven't been already.
+         */
+        void add_events();
+
+        /**
+         *  Fired when a counter's due to IRQ.
+         */
+        static void fire(void* data);
+    };
+}
+
+#endif // TIMERS_HPP_INCLUDED
@@ -0,0 +1,590 @@
+/**
+    This file is part of NeoPS.
+
+    NeoPS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    NeoPS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+**/
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+#include "benchmark/benchmark.hpp"
+#include "bus/bus.hpp"
+#include "cpu/gte.hpp"
+#include "cpu/r3000a.hpp"
+#include "cpu/recompiler.hpp"
+#include "gpu/gpu.hpp"
+#include "state/rewind.hpp"
+#include "state/state.hpp"
+#include "system/system.hpp"
+
+#define BENCHMARK_CODE  0x80010000  /**< Where our loop lives (kseg0) */
+#define BENCHMARK_DATA  0x80020000  /**< Scratch data the loop reads and writes */
+
+static std::uint32_t i_type(std::uint32_t op, std::uint32_t rs, std::uint32_t rt, std::uint32_t imm)
+{
+    return (op << 26) | (rs << 21) | (rt << 16) | (imm & 0xffff);
+}
+
+static std::uint32_t r_type(std::uint32_t rs, std::uint32_t rt, std::uint32_t rd, std::uint32_t shamt, std::uint32_t funct)
+{
+    return (rs << 21) | (rt << 16) | (rd << 11) | (shamt << 6) | funct;
+}
+
+/**
+ *  Write the benchmark loop into RAM. It's roughly what a game's inner loop looks like: some loads and
+ *  stores, a pile of ALU ops and a branch back every 12 instructions. It never ends, we just stop running it.
+ */
+static void load_program()
+{
+    std::vector<std::uint32_t> code;
+
+    code.push_back(i_type(0x0f, 0, 10, BENCHMARK_DATA >> 16));  // lui    t2, hi(BENCHMARK_DATA)
+    code.push_back(i_type(0x09, 0, 8, 100));                    // addiu  t0, zero, 100
+    // loop:
+    code.push_back(i_type(0x23, 10, 9, 0));                     // lw     t1, 0(t2)
+    code.push_back(i_type(0x09, 8, 8, 0xffff));                 // addiu  t0, t0, -1
+    code.push_back(r_type(11, 9, 11, 0, 0x21));                 // addu   t3, t3, t1
+    code.push_back(r_type(0, 11, 12, 2, 0x00));                 // sll    t4, t3, 2
+    code.push_back(r_type(12, 8, 13, 0, 0x26));                 // xor    t5, t4, t0
+    code.push_back(i_type(0x2b, 10, 13, 4));                    // sw     t5, 4(t2)
+    code.push_back(i_type(0x0c, 13, 14, 0xff));                 // andi   t6, t5, 0xff
+    code.push_back(r_type(14, 8, 15, 0, 0x2b));                 // sltu   t7, t6, t0
+    code.push_back(r_type(15, 11, 24, 0, 0x25));                // or     t8, t7, t3
+    code.push_back(i_type(0x24, 10, 25, 4));                    // lbu    t9, 4(t2)
+    code.push_back(i_type(0x05, 8, 0, 0xfff5));                 // bne    t0, zero, loop
+    code.push_back(r_type(25, 24, 1, 0, 0x21));                 // addu   at, t9, t8
+    code.push_back((0x02 << 26) | ((BENCHMARK_CODE >> 2) & 0x3ffffff)); // j BENCHMARK_CODE
+    code.push_back(0);                                          // nop
+
+    for(std::size_t i = 0; i < code.size(); i++)
+        bus::write_word((BENCHMARK_CODE & 0x1fffffff) + i * 4, code[i]);
+
+    bus::write_word((BENCHMARK_DATA & 0x1fffffff), 0x12345678);
+}
+
+/**
+ *  Run the loop on a fresh CPU and time it.
+ *
+ *  @arg threaded - Use the threaded interpreter instead of cycle().
+ *  @arg cycles - How long to run for.
+ *  @arg checksum - Gets a checksum of the registers once we're done, so we can tell both ran the same thing.
+ *  @return Seconds we took.
+ */
+static double time_run(bool threaded, std::uint32_t cycles, std::uint32_t& checksum)
+{
+    load_program();
+
+    cpu::r3000a cpu;
+    cpu.set_pc(BENCHMARK_CODE);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    if(threaded)
+    {
+        cpu.run_threaded(cycles);
+    }
+    else
+    {
+        // Same place run_threaded() stops: the first instruction that takes us up to (or past) the end.
+        std::uint64_t end = cpu.now() + cycles;
+
+        while(cpu.now() < end)
+            cpu.cycle();
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    checksum = cpu.get_pc();
+    for(unsigned reg = 1; reg < R3000_GPR_MAX; reg++)
+        checksum = checksum * 31 + cpu.read_gpr(reg);
+
+    return elapsed.count();
+}
+
+void benchmark::interpreter(std::uint32_t cycles)
+{
+    double best[2] = {0.0, 0.0};
+    std::uint32_t checksum[2] = {0, 0};
+
+    for(int pass = 0; pass < BENCHMARK_PASSES; pass++)
+    {
+        for(int threaded = 0; threaded < 2; threaded++)
+        {
+            double seconds = time_run(threaded != 0, cycles, checksum[threaded]);
+
+            if(pass == 0 || seconds < best[threaded])
+                best[threaded] = seconds;
+        }
+    }
+
+    std::printf("interpreter: %u cycles, best of %d passes\n", cycles, BENCHMARK_PASSES);
+    std::printf("    cycle():        %8.3fms %8.2fx realtime\n", best[0] * 1000.0, cycles / best[0] / R3000_CLOCK);
+    std::printf("    run_threaded(): %8.3fms %8.2fx realtime (%.2fx)\n", best[1] * 1000.0, cycles / best[1] / R3000_CLOCK, best[0] / best[1]);
+
+    if(checksum[0] != checksum[1])
+        std::printf("warning: cycle() and run_threaded() finished in different states (0x%08x vs 0x%08x)!\n", checksum[0], checksum[1]);
+}
+
+// RTPT, NCDT, NCCT (lm=1), MVMVA (RT * V0 + TR), MVMVA (LLM * IR + BK, sf=0), DPCT, AVSZ3, RTPS (lm=1)
+static const std::uint32_t gte_commands[] = {0x0280030, 0x0f80016, 0x108043f, 0x0480012, 0x043a012, 0x0f8002a, 0x158002d, 0x0180401};
+
+/**
+ *  Run a mix of GTE commands, with registers reloaded from a (fixed seed) random stream every so often
+ *  so we hit the saturation and overflow paths as well as the common case.
+ *
+ *  @return Seconds we took.
+ */
+static double time_gte(cpu::gte& g, std::uint32_t commands)
+{
+    std::uint32_t seed = 0x12345678;
+    const std::size_t count = sizeof(gte_commands) / sizeof(gte_commands[0]);
+
+    g.reset();
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    for(std::uint32_t i = 0; i < commands; i++)
+    {
+        if((i & 0xff) == 0)
+        {
+            for(unsigned reg = 0; reg < GTE_NUM_REGS; reg++)
+            {
+                seed = seed * 1103515245 + 12345;
+                g.write_control(reg, (reg == 31) ? 0 : seed >> (reg & 7));
+                seed = seed * 1103515245 + 12345;
+                g.write_data(reg, seed >> (reg & 7));
+            }
+        }
+
+        g.execute(gte_commands[i % count]);
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+void benchmark::gte(std::uint32_t commands)
+{
+    cpu::gte g;
+    double best = 0.0;
+
+    for(int pass = 0; pass < BENCHMARK_PASSES; pass++)
+    {
+        double seconds = time_gte(g, commands);
+
+        if(pass == 0 || seconds < best)
+            best = seconds;
+    }
+
+    std::printf("gte: %u commands, best of %d passes\n", commands, BENCHMARK_PASSES);
+    std::printf("    execute():      %8.3fms %8.2f Mcmd/s\n", best * 1000.0, commands / best / 1000000.0);
+}
+
+static std::uint32_t position(std::int32_t x, std::int32_t y)
+{
+    return (x & 0xffff) | ((y & 0xffff) << 16);
+}
+
+/**
+ *  Draw a mix of primitives through GP0, positions and colors from a (fixed seed) random stream.
+ *  Everything's drawn into the top half of VRAM, and textured from whatever's in the bottom half.
+ *  (A primitive textured from pixels it's drawing itself depends on the order pixels are written in,
+ *  which the kernels are allowed to disagree on.)
+ *
+ *  @return Seconds we took.
+ */
+static double time_rasterizer(gpu::gpu& g, std::uint32_t primitives, std::uint32_t& checksum)
+{
+    std::uint32_t seed = 0x12345678;
+
+    g.reset();
+    g.gp0(0xe3000000);
+    g.gp0(0xe4000000 | (GPU_VRAM_WIDTH - 1) | ((GPU_VRAM_HEIGHT / 2 - 1) << 10));
+
+    // Random textures (and CLUTs) in the bottom half, with a few transparent texels.
+    g.gp0(0xa0000000);
+    g.gp0(position(0, GPU_VRAM_HEIGHT / 2));
+    g.gp0(position(GPU_VRAM_WIDTH, GPU_VRAM_HEIGHT / 2));
+
+    for(std::uint32_t i = 0; i < GPU_VRAM_WIDTH * GPU_VRAM_HEIGHT / 4; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        g.gp0((seed & 0x0f000f00) ? seed : 0);
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    for(std::uint32_t i = 0; i < primitives; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        std::int32_t x = (seed >> 8) % 800;
+        seed = seed * 1103515245 + 12345;
+        std::int32_t y = (seed >> 8) % 200;
+        std::uint32_t color = seed & 0xffffff;
+        std::uint32_t depth = i % 3;
+
+        // Draw mode: a texture page in the bottom half, the current depth, dithering and a blend mode.
+        g.gp0(0xe1000000 | (8 + (i & 7)) | 0x10 | ((i & 3) << 5) | (depth << 7) | 0x200);
+
+        switch(i & 3)
+        {
+        case 0: // Gouraud quad
+            g.gp0(0x38000000 | color);
+            g.gp0(position(x, y));
+            g.gp0(color ^ 0xffffff);
+            g.gp0(position(x + 120, y + 10));
+            g.gp0(color >> 4);
+            g.gp0(position(x + 5, y + 120));
+            g.gp0(color << 2);
+            g.gp0(position(x + 130, y + 140));
+            break;
+        case 1: // Textured, blended, semi-transparent quad
+            g.gp0(0x2e000000 | color);
+            g.gp0(position(x, y));
+            g.gp0(((480 << 6) << 16) | 0x0000);
+            g.gp0(position(x + 128, y));
+            g.gp0(((0x10 | (8 + (i & 7)) | (depth << 7)) << 16) | 0x00ff);
+            g.gp0(position(x, y + 128));
+            g.gp0(0xff00);
+            g.gp0(position(x + 128, y + 128));
+            g.gp0(0xffff);
+            break;
+        case 2: // Shaded, textured triangle
+            g.gp0(0x34000000 | color);
+            g.gp0(position(x, y));
+            g.gp0(((490 << 6) << 16) | 0x1020);
+            g.gp0(color ^ 0x808080);
+            g.gp0(position(x + 150, y + 20));
+            g.gp0(((0x10 | (8 + (i & 7)) | (depth << 7)) << 16) | 0x10f0);
+            g.gp0(color >> 1);
+            g.gp0(position(x + 40, y + 130));
+            g.gp0(0xf040);
+            break;
+        case 3: // Textured rectangle
+            g.gp0(0x64000000 | color);
+            g.gp0(position(x, y));
+            g.gp0(((500 << 6) << 16) | 0x0810);
+            g.gp0(position(100, 100));
+            break;
+        }
+    }
+
+    const std::uint16_t* vram = g.get_vram();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    checksum = 0;
+
+    for(std::uint32_t i = 0; i < GPU_VRAM_WIDTH * GPU_VRAM_HEIGHT; i++)
+        checksum = checksum * 31 + vram[i];
+
+    return elapsed.count();
+}
+
+void benchmark::rasterizer(std::uint32_t primitives)
+{
+    const char* names[] = {"scalar", "avx2"};
+    gpu::gpu* g = new gpu::gpu();
+
+    g->set_async(false);
+    g->set_threads(1);
+
+    std::printf("rasterizer: %u primitives, best of %d passes\n", primitives, BENCHMARK_PASSES);
+
+    double scalar = 0.0;
+    std::uint32_t reference = 0;
+
+    for(int k = gpu::rasterizer::SCALAR; k <= gpu::rasterizer::AVX2; k++)
+    {
+        if(!g->set_kernel((gpu::rasterizer::KERNEL)k))
+        {
+            std::printf("    %-8s        (not supported on this host)\n", names[k]);
+            continue;
+        }
+
+        double best = 0.0;
+        std::uint32_t checksum = 0;
+
+        for(int pass = 0; pass < BENCHMARK_PASSES; pass++)
+        {
+            double seconds = time_rasterizer(*g, primitives, checksum);
+
+            if(pass == 0 || seconds < best)
+                best = seconds;
+        }
+
+        if(k == gpu::rasterizer::SCALAR)
+        {
+            scalar = best;
+            reference = checksum;
+        }
+
+        std::printf("    %-8s        %8.3fms %8.2f Kprim/s (%.2fx)\n", names[k], best * 1000.0, primitives / best / 1000.0, scalar / best);
+
+        if(checksum != reference)
+            std::printf("warning: the %s kernel doesn't match the scalar one (0x%08x vs 0x%08x)!\n", names[k], checksum, reference);
+    }
+
+    delete g;
+}
+
+/**
+ *  Get a checksum of the CPU's registers and RAM.
+ */
+static std::uint32_t machine_checksum(const cpu::r3000a& cpu)
+{
+    std::uint32_t checksum = cpu.get_pc();
+
+    for(unsigned reg = 1; reg < R3000_GPR_MAX; reg++)
+        checksum = checksum * 31 + cpu.read_gpr(reg);
+
+    const std::uint8_t* ram = bus::ram();
+
+    for(std::uint32_t i = 0; i < PSX_MEM_SIZE; i += 64)
+        checksum = checksum * 31 + ram[i];
+
+    return checksum;
+}
+
+void benchmark::savestate(std::uint32_t snapshots)
+{
+    load_program();
+
+    cpu::r3000a cpu;
+    cpu.set_pc(BENCHMARK_CODE);
+
+    state::snapshot snap(cpu);
+    double best_save = 0.0;
+    double best_load = 0.0;
+    bool mismatch = false;
+
+    for(int pass = 0; pass < BENCHMARK_PASSES; pass++)
+    {
+        double save_time = 0.0;
+        double load_time = 0.0;
+
+        for(std::uint32_t i = 0; i < snapshots; i++)
+        {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            snap.save();
+            std::chrono::steady_clock::time_point saved = std::chrono::steady_clock::now();
+
+            cpu.run_threaded(1000);
+            std::uint32_t expected = machine_checksum(cpu);
+
+            std::chrono::steady_clock::time_point loading = std::chrono::steady_clock::now();
+            snap.load();
+            std::chrono::steady_clock::time_point loaded = std::chrono::steady_clock::now();
+
+            cpu.run_threaded(1000);
+            mismatch |= machine_checksum(cpu) != expected;
+
+            save_time += std::chrono::duration<double>(saved - start).count();
+            load_time += std::chrono::duration<double>(loaded - loading).count();
+        }
+
+        if(pass == 0 || save_time < best_save)
+            best_save = save_time;
+
+        if(pass == 0 || load_time < best_load)
+            best_load = load_time;
+    }
+
+    std::printf("savestate: %u snapshots of %zu bytes, best of %d passes\n", snapshots, snap.size(), BENCHMARK_PASSES);
+    std::printf("    save:           %8.3fms per snapshot\n", best_save * 1000.0 / snapshots);
+    std::printf("    load:           %8.3fms per snapshot\n", best_load * 1000.0 / snapshots);
+
+    if(mismatch)
+        std::printf("warning: running on from a loaded state didn't end up where it did the first time!\n");
+}
+
+/**
+ *  Get a checksum of the corner of VRAM the rewind benchmark draws in, read back through GPUREAD.
+ */
+static std::uint32_t vram_checksum()
+{
+    std::uint32_t checksum = 0;
+
+    bus::write_word(GPU_GP0_SEND, 0xc0000000);
+    bus::write_word(GPU_GP0_SEND, 0);
+    bus::write_word(GPU_GP0_SEND, (192 << 16) | 320);
+
+    for(std::uint32_t i = 0; i < 192 * 320 / 2; i++)
+        checksum = checksum * 31 + bus::read_word(GPU_GP0_SEND);
+
+    return checksum;
+}
+
+void benchmark::rewind(std::uint32_t frames)
+{
+    load_program();
+
+    cpu::r3000a cpu;
+    cpu.set_pc(BENCHMARK_CODE);
+
+    state::rewind history(cpu, REWIND_BUDGET, REWIND_KEYFRAME_INTERVAL);
+    std::vector<std::uint32_t> checksums;
+    std::uint32_t seed = 0x12345678;
+    double push_time = 0.0;
+
+    for(std::uint32_t frame = 0; frame < frames; frame++)
+    {
+        cpu.run_threaded(10000);
+
+        // A few KiB of fresh data somewhere in RAM, and a rectangle of VRAM.
+        std::uint32_t base = 0x100000 + (frame % 64) * 0x1000;
+
+        for(std::uint32_t i = 0; i < 0x800; i += 4)
+        {
+            seed = seed * 1103515245 + 12345;
+            bus::write_word(base + i, seed);
+        }
+
+        bus::write_word(GPU_GP0_SEND, 0x02000000 | (seed & 0xffffff));
+        bus::write_word(GPU_GP0_SEND, ((frame % 32) * 4 << 16) | ((frame % 64) * 4));
+        bus::write_word(GPU_GP0_SEND, (32 << 16) | 64);
+
+        checksums.push_back(machine_checksum(cpu) ^ vram_checksum());
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        history.push();
+        push_time += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    std::size_t per_frame = history.memory() / (history.frames() ? history.frames() : 1);
+
+    std::printf("rewind: %u frames, %u kept\n", frames, history.frames());
+    std::printf("    push:           %8.3fms per frame\n", push_time * 1000.0 / frames);
+    std::printf("    memory:         %8.2fMiB, %zu bytes per frame (%.0f seconds at 60Hz in %dMiB)\n", history.memory() / 1048576.0,
+                per_frame, REWIND_BUDGET / (double)(per_frame ? per_frame : 1) / 60.0, REWIND_BUDGET >> 20);
+
+    // Back a frame at a time, then a long jump back over a keyframe.
+    bool mismatch = false;
+    std::uint32_t newest = frames - 1;
+
+    for(std::uint32_t back = 1; back <= 30 && back <= history.frames(); back++)
+    {
+        history.step_back(1);
+        mismatch |= (machine_checksum(cpu) ^ vram_checksum()) != checksums[newest - back];
+    }
+
+    std::uint32_t jump = history.frames() / 2;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    history.step_back(jump);
+    double jump_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    mismatch |= (machine_checksum(cpu) ^ vram_checksum()) != checksums[newest - 30 - jump];
+
+    std::printf("    jump back %u:   %8.3fms\n", jump, jump_time * 1000.0);
+
+    if(mismatch)
+        std::printf("warning: rewinding didn't bring the machine back the way it was!\n");
+}
+
+#define BENCHMARK_DMA_CHOP      4   /**< Words per burst, as a power of two */
+#define BENCHMARK_CPU_CHOP      6   /**< Cycles the CPU gets between bursts, as a power of two */
+
+/**
+ *  Write the DMA program into RAM. It starts a chopped transfer of words from BENCHMARK_DATA to the GPU, spins
+ *  on the channel's busy bit counting in t2, and leaves root counter 2 from before and after in s0 and s1.
+ */
+static void load_dma_program(std::uint32_t words)
+{
+    std::uint32_t chcr = 0x11000101 | (BENCHMARK_DMA_CHOP << 16) | (BENCHMARK_CPU_CHOP << 20);
+    std::vector<std::uint32_t> code;
+
+    code.push_back(i_type(0x0f, 0, 8, 0x1f80));                 // lui    t0, 0x1f80
+    code.push_back(i_type(0x0f, 0, 9, chcr >> 16));             // lui    t1, hi(chcr)
+    code.push_back(i_type(0x0d, 9, 9, chcr));                   // ori    t1, t1, lo(chcr)
+    code.push_back(i_type(0x23, 8, 16, 0x1120));                // lw     s0, TIMER2(t0)
+    code.push_back(0);                                          // nop
+    code.push_back(i_type(0x2b, 8, 9, 0x10a8));                 // sw     t1, CHCR2(t0)
+    code.push_back(i_type(0x09, 0, 10, 0));                     // addiu  t2, zero, 0
+    code.push_back(i_type(0x0f, 0, 12, 0x0100));                // lui    t4, 0x0100
+    // poll:
+    code.push_back(i_type(0x23, 8, 11, 0x10a8));                // lw     t3, CHCR2(t0)
+    code.push_back(0);                                          // nop
+    code.push_back(r_type(11, 12, 11, 0, 0x24));                // and    t3, t3, t4
+    code.push_back(i_type(0x05, 11, 0, 0xfffc));                // bne    t3, zero, poll
+    code.push_back(i_type(0x09, 10, 10, 1));                    // addiu  t2, t2, 1
+    code.push_back(i_type(0x23, 8, 17, 0x1120));                // lw     s1, TIMER2(t0)
+    code.push_back(0);                                          // nop
+    // done:
+    code.push_back((0x02 << 26) | (((BENCHMARK_CODE >> 2) + code.size()) & 0x3ffffff)); // j done
+    code.push_back(0);                                          // nop
+
+    for(std::size_t i = 0; i < code.size(); i++)
+        bus::write_word((BENCHMARK_CODE & 0x1fffffff) + i * 4, code[i]);
+
+    // GP0 NOPs, so the GPU doesn't mind what we send it.
+    for(std::uint32_t i = 0; i < words; i++)
+        bus::write_word((BENCHMARK_DATA & 0x1fffffff) + i * 4, 0);
+
+    // Counter 2 on the CPU's clock over 8, so it doesn't wrap even if the CPU hogs a couple of slices.
+    bus::write_word(TIMER_REGISTER_BASE + 0x20 + TIMER_MODE, 0x200);
+
+    bus::write_word(DMA_CTRL_REG, bus::read_word(DMA_CTRL_REG) | 0x800);
+    bus::write_word(DMA_CHANNEL2_BASE, BENCHMARK_DATA & 0x1fffffff);
+    bus::write_word(DMA_CHANNEL2_BASE + 4, words);
+}
+
+void benchmark::dma(psx::system& machine, std::uint32_t words)
+{
+    static const cpu::r3000a::EXEC_MODE modes[] = {cpu::r3000a::INTERPRETER, cpu::r3000a::THREADED,
+#ifdef NEOPS_HAS_RECOMPILER
+                                                   cpu::r3000a::RECOMPILER,
+#endif
+                                                  };
+    static const char* const names[] = {"interpreter:", "threaded:", "recompiler:"};
+
+    cpu::r3000a& cpu = machine.get_cpu();
+    std::uint32_t bursts = (words + (1u << BENCHMARK_DMA_CHOP) - 1) >> BENCHMARK_DMA_CHOP;
+    std::uint32_t first_polls = 0;
+    bool hogged = false;
+    bool late = false;
+    bool disagree = false;
+
+    std::printf("dma: %u words in %u-word bursts, %u cycles apart\n", words, 1u << BENCHMARK_DMA_CHOP, 1u << BENCHMARK_CPU_CHOP);
+
+    for(std::size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++)
+    {
+        machine.bind();
+        load_dma_program(words);
+        cpu.set_exec_mode(modes[i]);
+        cpu.set_pc(BENCHMARK_CODE);
+
+        // Long enough that the CPU would spin out a whole slice if the bursts didn't cut it short.
+        machine.run(2 * SCHEDULER_MAX_SLICE);
+
+        std::uint32_t polls = cpu.read_gpr(10);
+        std::uint32_t took = ((cpu.read_gpr(17) - cpu.read_gpr(16)) & 0xffff) * 8;
+        std::uint32_t expected = machine.get_dma().transfer_cycles(bus::PORT::GPU) + (bursts - 1) * (1u << BENCHMARK_CPU_CHOP);
+
+        std::printf("    %-15s done after %u cycles (%u expected), polled %u times\n", names[i], took, expected, polls);
+
+        if(i == 0)
+            first_polls = polls;
+
+        hogged |= polls < bursts;
+        late |= took > expected * 2;
+        disagree |= polls != first_polls;
+    }
+
+    if(hogged)
+        std::printf("warning: the CPU didn't get a look in between bursts!\n");
+
+    if(late)
+        std::printf("warning: the transfer took a lot longer than its bursts and gaps add up to!\n");
+
+    if(disagree)
+        std::printf("warning: the CPU polled a different number of times depending on how it was executing!\n");
+}
@@ -12,28 +12,96 @@
     GNU General Public License for more details.
 
     You should have received a copy of the GNU General Public License
-    along with NeoPS.  If not, see <http://www.gnu.org/licenses/>.
+    along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
 **/
 #include "bios/bios.hpp"
+#include "bus/bus.hpp"
 
-#include <fstream>
-#include <cassert>
 #include <cstdio>
+#include <cstring>
+#include <mutex>
 
-static std::uint8_t* bseg = nullptr;
+#if defined(_WIN32)
+#include <fstream>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
-bool bios::load_bios(const std::string& path)
+/**
+ *  A BIOS dump we know is good.
+ */
+struct known_bios
+{
+    std::uint32_t   crc;        /**< CRC-32 of the whole image */
+    const char*     model;      /**< Console it came out of */
+    const char*     version;    /**< Version and region */
+};
+
+static const known_bios known_images[] =
+{
+    {0x3b601fc8, "SCPH-1000", "1.0 NTSC-J"},
+    {0x37157331, "SCPH-1001", "2.2 NTSC-U"},
+    {0xff3eeb8c, "SCPH-5500", "3.0 NTSC-J"},
+    {0x8d8cb7e4, "SCPH-5501", "3.0 NTSC-U"},
+    {0xd786f0b9, "SCPH-5502", "3.0 PAL"},
+    {0x502224b6, "SCPH-7001", "4.1 NTSC-U"},
+    {0x171bdcec, "SCPH-101",  "4.5 NTSC-U"},
+};
+
+static const std::uint8_t* bseg = nullptr;  /**< The BIOS image every machine shares. Read-only, it's mapped straight from the file. */
+static std::string bseg_path;               /**< Where bseg came from */
+static std::mutex bseg_lock;                /**< Machines on different threads can all boot at once */
+
+/**
+ *  CRC-32 (the zlib one), which is what everybody lists BIOS dumps by.
+ */
+static std::uint32_t crc32(const std::uint8_t* data, std::size_t size)
+{
+    static std::uint32_t table[256];
+    static std::once_flag table_built;
+
+    std::call_once(table_built, []()
+    {
+        for(std::uint32_t i = 0; i < 256; i++)
+        {
+            std::uint32_t c = i;
+
+            for(int k = 0; k < 8; k++)
+                c = (c & 1) ? (0xedb88320 ^ (c >> 1)) : (c >> 1);
+
+            table[i] = c;
+        }
+    });
+
+    std::uint32_t crc = 0xffffffff;
+
+    for(std::size_t i = 0; i < size; i++)
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+
+    return crc ^ 0xffffffff;
+}
+
+/**
+ *  Get the BIOS file into memory, read-only. Where we can, it's mapped rather than read, so every machine (and
+ *  every other process using the same file) shares the page cache's copy and we never copy it ourselves.
+ *
+ *  @return The image, or nullptr if we couldn't get it.
+ */
+static const std::uint8_t* map_image(const std::string& path)
 {
+#if defined(_WIN32)
     std::ifstream bfile;
     int bsize;
 
-    assert(bseg == nullptr); // Make sure we don't have a realloc!
     bfile.open(path, std::ios::binary);
 
     if(bfile.is_open() == false)
     {
-        std::printf("bios::load_bios( ): Error opening bios file at %s! Perhaps the file doesn't exist!", path.c_str());
-        return false;
+        std::printf("warning: bios: couldn't open %s, perhaps the file doesn't exist!\n", path.c_str());
+        return nullptr;
     }
 
     bfile.seekg(0, bfile.end);
@@ -41,15 +109,95 @@ bool bios::load_bios(const std::string& path)
 
     if(bsize != PSX_BIOS_SIZE)
     {
-        std::printf("bios::load_bios( ): BIOS size is incorrect! Should be %d, read %d!", PSX_BIOS_SIZE, bsize);
-        return false;
+        std::printf("warning: bios: %s is the wrong size, should be %d bytes, read %d!\n", path.c_str(), PSX_BIOS_SIZE, bsize);
+        return nullptr;
     }
 
-    bseg = new std::uint8_t[PSX_BIOS_SIZE];
+    std::uint8_t* image = new std::uint8_t[PSX_BIOS_SIZE];
 
     // Finally, load the BIOS binary.
     bfile.seekg(0, bfile.beg);
-    bfile.read((char*)bseg, PSX_BIOS_SIZE);
+    bfile.read((char*)image, PSX_BIOS_SIZE);
+    return image;
+#else
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if(fd < 0)
+    {
+        std::printf("warning: bios: couldn't open %s, perhaps the file doesn't exist!\n", path.c_str());
+        return nullptr;
+    }
+
+    struct stat st;
+
+    if(fstat(fd, &st) != 0 || st.st_size != PSX_BIOS_SIZE)
+    {
+        std::printf("warning: bios: %s is the wrong size, should be %d bytes, read %lld!\n", path.c_str(), PSX_BIOS_SIZE, (long long)st.st_size);
+        close(fd);
+        return nullptr;
+    }
+
+    void* image = mmap(nullptr, PSX_BIOS_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); // The mapping keeps the file open for us.
+
+    if(image == MAP_FAILED)
+    {
+        std::printf("warning: bios: unable to map %s!\n", path.c_str());
+        return nullptr;
+    }
+
+    return (const std::uint8_t*)image;
+#endif
+}
+
+/**
+ *  Get the BIOS image into bseg, if nobody has yet.
+ */
+static bool load_image(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(bseg_lock);
+
+    if(bseg != nullptr)
+    {
+        if(path != bseg_path)
+        {
+            std::printf("warning: bios: %s is already loaded, can't share it with %s!\n", bseg_path.c_str(), path.c_str());
+            return false;
+        }
+
+        return true;
+    }
+
+    const std::uint8_t* image = map_image(path);
+
+    if(image == nullptr)
+        return false;
+
+    // Anything we don't recognise still gets to run (homebrew BIOSes, test ROMs), but it's worth knowing about.
+    std::uint32_t crc = crc32(image, PSX_BIOS_SIZE);
+    const known_bios* known = nullptr;
+
+    for(std::size_t i = 0; i < sizeof(known_images) / sizeof(known_images[0]); i++)
+    {
+        if(known_images[i].crc == crc)
+            known = &known_images[i];
+    }
+
+    if(known == nullptr)
+        std::printf("warning: bios: %s (crc 0x%08x) isn't a BIOS we know, it might not work!\n", path.c_str(), crc);
+
+    bseg = image;
+    bseg_path = path;
+    return true;
+}
+
+bool bios::load_bios(const std::string& path)
+{
+    if(!load_image(path))
+        return false;
+
+    // The BIOS is ROM, so writes to it still go to the I/O handlers (and never reach the image).
+    bus::map_pages(PSX_BIOS_SEGMENT_PHYS, PSX_BIOS_SIZE, (std::uint8_t*)bseg, false);
 
     return true;
 }
@@ -61,16 +209,22 @@ std::uint8_t bios::read_byte(std::uint32_t addr)
 
 std::uint16_t bios::read_hword(std::uint32_t addr)
 {
-    std::uint16_t ret = 0;
+    std::uint16_t ret;
 
-    ret = (bseg[addr + 1] << 8) | bseg[addr];
+    std::memcpy(&ret, bseg + (addr & ~1u), sizeof(ret));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    ret = __builtin_bswap16(ret);
+#endif
     return ret;
 }
 
 std::uint32_t bios::read_word(std::uint32_t addr)
 {
-    std::uint32_t ret = 0;
+    std::uint32_t ret;
 
-    ret = (bseg[addr + 3] << 24) | (bseg[addr + 2] << 16) | (bseg[addr + 1] << 8) | bseg[addr];
+    std::memcpy(&ret, bseg + (addr & ~3u), sizeof(ret));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    ret = __builtin_bswap32(ret);
+#endif
     return ret;
-}
\ No newline at end of file
+}
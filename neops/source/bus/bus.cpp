@@ -14,302 +14,814 @@
     You should have received a copy of the GNU General Public License
     along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
 **/
+#include <algorithm>
 #include <cassert>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <vector>
 
 #include "bus/bus.hpp"
 #include "bios/bios.hpp"
-#include "dma/dma.hpp"
-#include "gpu/gpu.hpp"
-#include "spu/spu.hpp"
+#include "state/state.hpp"
 
-static std::uint32_t mem_size;          /**< Memory size register. Usually 0x00000b88 */
-static std::uint32_t mem_creg[10];      /**< Our memory control registers **/
-static std::uint8_t* kuseg = nullptr;   /**< Our base RAM (which is called KUSEG)*/
+#ifdef NEOPS_HAS_FASTMEM
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
-using namespace bus;
+#ifdef NEOPS_HAS_FASTMEM
+#define FASTMEM_SHARED_SIZE (PSX_MEM_SIZE + PSX_PAGE_SIZE)
 
-dma_controller dma;
+static const std::uint32_t fastmem_segments[] = {0x00000000, 0x80000000, 0xa0000000}; /**< kuseg, kseg0 and kseg1 */
+#endif
 
-// IMPORTANT FUCKIN NOTE!!!!
-// ALL ADDRESSES ARE PHYSICAL!
-void bus::psmem_init()
-{
-    assert(kuseg == nullptr);
-    kuseg = new std::uint8_t[PSX_MEM_SIZE];
-    std::memset(kuseg, 0xba, PSX_MEM_SIZE);
-}
+using namespace bus;
 
-void bus::psmem_destroy()
+/**
+ *  The memory control registers, plus RAM_SIZE, which lives a little further up, and the CPU's cache control
+ *  register, which lives somewhere else entirely (see @ref bus::cache_control).
+ */
+class memory_control : public device
 {
-    assert(kuseg != nullptr);
+public:
+    memory_control() : device("memctrl")
+    {
+        reset();
+    }
 
-    delete kuseg;
-    kuseg = nullptr;
-}
+    /**
+     *  The regions with a delay/size register of their own, in register order.
+     */
+    enum REGION
+    {
+        EXP1 = 0,
+        EXP3,
+        BIOS,
+        SPU,
+        CDROM,
+        EXP2,
+        REGION_MAX,
+    };
 
-void bus::write_creg(std::uint32_t reg, std::uint32_t val)
-{
-    mem_creg[reg - 0x1f801000] = val;
-}
+    std::uint32_t mem_size;         /**< Memory size register. Usually 0x00000b88 */
+    std::uint32_t mem_creg[10];     /**< Our memory control registers **/
+    std::uint32_t cache_ctrl;       /**< Cache control (BIU/Cache Configuration) */
+    std::uint8_t  timings[REGION_MAX][3];   /**< Cycles a byte, half word and word read of each region takes */
 
-void bus::write_byte(std::uint32_t addr, std::uint8_t val)
-{
-    //std::printf("write_byte: attempt to write to physical address 0x%08x with val 0x%02x\n", addr, val);
+    std::uint32_t read32(std::uint32_t addr) override
+    {
+        if(addr == PSX_MEM_RAM_SIZE_REG)
+            return mem_size;
 
-    if(addr >= 0x1f802000 && addr <= 0x1f802042)
+        if(addr >= PSX_MEM_CONTROL_BASE && addr <= PSX_MEM_CONTROL_END)
+            return mem_creg[(addr - PSX_MEM_CONTROL_BASE) >> 2];
+
+        return device::read32(addr);
+    }
+
+    void write32(std::uint32_t addr, std::uint32_t val) override
     {
-        std::printf("Attempt to write to Expansion2! 0x%08x:0x%08x\n", addr, val);
-        return;
+        if(addr == PSX_MEM_RAM_SIZE_REG)
+        {
+            mem_size = val;
+            return;
+        }
+
+        if(addr >= PSX_MEM_CONTROL_BASE && addr <= PSX_MEM_CONTROL_END)
+        {
+            write_creg(addr, val);
+            return;
+        }
+
+        device::write32(addr, val);
     }
 
-    if(addr == 0x1f801800)
+    void reset() override
     {
-        std::printf("cdrom: attempt to write CDROM register!\n");
-        exit(-1);
+        mem_size = 0;
+        std::memset(mem_creg, 0x00, sizeof(mem_creg));
+        cache_ctrl = 0;
+        update_timings();
     }
 
-    kuseg[addr] = val;
-}
+    /**
+     *  Work out how long reads from every region take from its delay/size register and the common delays
+     *  (see the "Memory Control" section of nocash's psx-spx). The first access of a read costs more than
+     *  the ones that follow it, and an 8-bit region needs an access per byte.
+     */
+    void update_timings()
+    {
+        std::uint32_t com = mem_creg[(PSX_MEM_COM_DELAY - PSX_MEM_CONTROL_BASE) >> 2];
 
-void bus::write_hword(std::uint32_t addr, std::uint16_t val)
-{
-    //std::printf("write_hword: attempt to write to physical address 0x%08x with val 0x%04x\n", addr, val);
+        for(int i = 0; i < REGION_MAX; i++)
+        {
+            std::uint32_t delay = mem_creg[((PSX_MEM_EXP1_DELAY - PSX_MEM_CONTROL_BASE) >> 2) + i];
+            std::int32_t access = (delay >> 4) & 0xf;
+            std::int32_t first = 0;
+            std::int32_t seq = 0;
+            std::int32_t min = 0;
+
+            if(delay & (1 << 8))    // Recovery period (COM0)
+            {
+                first += (std::int32_t)(com & 0xf) - 1;
+                seq += (std::int32_t)(com & 0xf) - 1;
+            }
+
+            if(delay & (1 << 10))   // Floating release (COM2)
+            {
+                first += (com >> 8) & 0xf;
+                seq += (com >> 8) & 0xf;
+            }
+
+            if(delay & (1 << 11))   // Pre-strobe (COM3)
+                min = (com >> 12) & 0xf;
+
+            if(first < 6)
+                first++;
+
+            first = std::max(first + access + 2, min + 6);
+            seq = std::max(seq + access + 2, min + 2);
+
+            bool wide = (delay & (1 << 12)) != 0;   // 16-bit data bus
 
-    if(addr >= PSX_SPU_CREG_START && addr <= PSX_SPU_CREG_END)
+            timings[i][0] = first;
+            timings[i][1] = wide ? first : first + seq;
+            timings[i][2] = wide ? first + seq : first + seq * 3;
+        }
+    }
+
+    void serialize(state::serializer& s) override
     {
-        spu::write_creg(addr, val);
-        return;
+        std::uint32_t version = s.section(get_name(), 2);
+        s.value(mem_size);
+        s.value(mem_creg);
+
+        if(version >= 2)
+            s.value(cache_ctrl);
+        else if(s.loading())
+            cache_ctrl = 0;
+
+        if(s.loading())
+            update_timings();
     }
+};
 
-    if(addr == PSX_TIMER_MODE_0 || addr == PSX_TIMER_MODE_1 || addr == PSX_TIMER_MODE_2)
+/**
+ *  Stand-in for hardware we don't emulate yet. Reads give back a fixed value, writes get logged and ignored.
+ */
+class stub_device : public device
+{
+public:
+    stub_device(const char* name, std::uint32_t value, bool fatal_writes = false) : device(name)
     {
-        std::printf("warning: attempt to write 0x%04x to timer register 0x%08x!\n", val, addr);
-        return;
+        this->value = value;
+        this->fatal_writes = fatal_writes;
     }
 
-    if(addr == PSX_TIMER_TARGET_0 || addr == PSX_TIMER_TARGET_1 || addr == PSX_TIMER_TARGET_2)
+    std::uint8_t read8(std::uint32_t) override
     {
-        std::printf("warning: attempt to write 0x%04x to timer register 0x%08x!\n", val, addr);
-        return;
+        return value & 0xff;
     }
 
-    if(addr == PSX_TIMER_COUNTER_0 || addr == PSX_TIMER_COUNTER_1 || addr == PSX_TIMER_COUNTER_2)
+    std::uint16_t read16(std::uint32_t) override
     {
-        std::printf("warning: attempt to write 0x%04x to timer register 0x%08x!\n", val, addr);
-        return;
+        return value & 0xffff;
     }
 
-    if(addr >= 0x1f801c00 && addr <= 0x1f801e80)
+    std::uint32_t read32(std::uint32_t) override
     {
-        std::printf("attempt to write spu with value 0x%08x!\n", val);
-        return;
+        return value;
     }
 
-    if(addr == PSX_INTERRUPT_MASK_REG)
+    void write8(std::uint32_t addr, std::uint8_t val) override
     {
-        std::printf("warning: attempt 16-bit write of PSX_INTERRUPT_MASK_REG!\n");
-        return;
+        write32(addr, val);
     }
 
-    if(addr >= DMA_CHANNEL0_BASE && addr <= DMA_CHANNEL6_BASE + 8)
+    void write16(std::uint32_t addr, std::uint16_t val) override
     {
-        std::printf("dma: attempting to write 0x%08x to DMA register 0x%08x\n", val, addr);
-        dma.controller_write(addr, val);
-        return;
+        write32(addr, val);
+    }
+
+    void write32(std::uint32_t addr, std::uint32_t val) override
+    {
+        std::printf("warning: %s: attempt to write 0x%08x to 0x%08x!\n", get_name(), val, addr);
+
+        if(fatal_writes)
+            exit(-1);
     }
 
-    kuseg[addr + 0] = val & 0xff;
-    kuseg[addr + 1] = (val >> 8) & 0xff;
+private:
+    std::uint32_t   value;          /**< What every read returns. */
+    bool            fatal_writes;   /**< Die on writes, because carrying on would be pointless. */
+};
+
+/**
+ *  Everything behind one machine's bus. See @ref bus::bind.
+ */
+struct bus::context
+{
+    context() : irq_stub("irq", 0x00), cdrom_stub("cdrom", 0x00, true), expansion2_stub("expansion2", 0xffffffff) {}
+
+    std::uint8_t* kuseg = nullptr;  /**< Our base RAM (which is called KUSEG)*/
+
+    /**
+     *  The scratchpad is only 1KiB, but it gets a whole page to itself so it can go in the page tables.
+     *  Nothing else lives in that page, so the rest of it is just padding.
+     */
+    std::uint8_t* scratchpad = nullptr;
+
+    std::uint8_t* fastmem = nullptr;    /**< Fastmem region, if we've got one */
+    std::uint8_t* shared_mem = nullptr; /**< Our own view of the memory that backs fastmem (RAM, then scratchpad) */
+    int fastmem_fd = -1;                /**< The memfd behind shared_mem */
+
+    std::uint8_t* read_pages[PSX_PHYS_SIZE >> PSX_PAGE_SHIFT] = {};  /**< Host memory behind each page for reads, or nullptr for I/O */
+    std::uint8_t* write_pages[PSX_PHYS_SIZE >> PSX_PAGE_SHIFT] = {}; /**< Host memory behind each page for writes, or nullptr for I/O */
+    std::uint32_t page_gen[PSX_PHYS_SIZE >> PSX_PAGE_SHIFT] = {};    /**< Write generation of each page */
+
+    device* io_devices[PSX_IO_SIZE >> 2] = {};  /**< Device behind each word of the hardware register window */
+    std::uint64_t io_hits[PSX_IO_SIZE >> 2] = {};   /**< Accesses to each word of the hardware register window */
+    std::vector<device*> devices;               /**< Every registered device, in the order they were registered */
+
+    memory_control mem_control;
+    stub_device irq_stub;
+    stub_device cdrom_stub;
+    stub_device expansion2_stub;
+};
+
+static thread_local bus::context* current = nullptr; /**< The bus everything on this thread uses */
+
+/**
+ *  Find the device behind an address in the hardware register window.
+ *
+ *  @return The device, or nullptr if there isn't one (or addr isn't in the window at all).
+ */
+static inline device* io_device(std::uint32_t addr)
+{
+    std::uint32_t offset = addr - PSX_IO_BASE;
+
+    if(offset >= PSX_IO_SIZE)
+        return nullptr;
+
+    current->io_hits[offset >> 2]++;
+    return current->io_devices[offset >> 2];
 }
 
-void bus::write_word(std::uint32_t addr, std::uint32_t val)
+static void io_write_byte(std::uint32_t addr, std::uint8_t val);
+static void io_write_hword(std::uint32_t addr, std::uint16_t val);
+static void io_write_word(std::uint32_t addr, std::uint32_t val);
+static std::uint8_t io_read_byte(std::uint32_t addr);
+static std::uint16_t io_read_hword(std::uint32_t addr);
+static std::uint32_t io_read_word(std::uint32_t addr);
+
+/**
+ *  Find the host memory behind a physical address.
+ *
+ *  @return Pointer to the byte at addr, or nullptr if addr isn't backed by memory.
+ */
+static inline std::uint8_t* lookup(std::uint8_t* const* pages, std::uint32_t addr)
+{
+    if(addr >= PSX_PHYS_SIZE)
+        return nullptr;
+
+    std::uint8_t* page = pages[addr >> PSX_PAGE_SHIFT];
+
+    if(page == nullptr)
+        return nullptr;
+
+    return page + (addr & PSX_PAGE_MASK);
+}
+
+// The PSX is little endian, and so is everything we run on worth mentioning. memcpy keeps us
+// clear of alignment and aliasing trouble and compiles down to a single mov.
+static inline std::uint16_t load16(const std::uint8_t* p)
+{
+    std::uint16_t val;
+
+    std::memcpy(&val, p, sizeof(val));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    val = __builtin_bswap16(val);
+#endif
+    return val;
+}
+
+static inline std::uint32_t load32(const std::uint8_t* p)
+{
+    std::uint32_t val;
+
+    std::memcpy(&val, p, sizeof(val));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    val = __builtin_bswap32(val);
+#endif
+    return val;
+}
+
+static inline void store16(std::uint8_t* p, std::uint16_t val)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    val = __builtin_bswap16(val);
+#endif
+    std::memcpy(p, &val, sizeof(val));
+}
+
+static inline void store32(std::uint8_t* p, std::uint32_t val)
 {
-    //std::printf("write_word: attempt to write to physical address 0x%08x with val 0x%08x\n", addr, val);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    val = __builtin_bswap32(val);
+#endif
+    std::memcpy(p, &val, sizeof(val));
+}
+
+#ifdef NEOPS_HAS_FASTMEM
+static void fastmem_destroy()
+{
+    if(current->fastmem != nullptr)
+        munmap(current->fastmem, PSX_FASTMEM_SIZE);
+
+    if(current->shared_mem != nullptr)
+        munmap(current->shared_mem, FASTMEM_SHARED_SIZE);
 
-    if(addr == 0x1f801074 || addr == 0x1f801070)
+    if(current->fastmem_fd >= 0)
+        close(current->fastmem_fd);
+
+    current->fastmem = nullptr;
+    current->shared_mem = nullptr;
+    current->fastmem_fd = -1;
+}
+
+/**
+ *  Put RAM and the scratchpad in a memfd, so we can map them into the fastmem region as many times as we like.
+ *
+ *  @return true if we got fastmem, false if we have to make do without.
+ */
+static bool fastmem_init()
+{
+    current->fastmem_fd = memfd_create("neops-ram", MFD_CLOEXEC);
+    if(current->fastmem_fd < 0 || ftruncate(current->fastmem_fd, FASTMEM_SHARED_SIZE) != 0)
     {
-        std::printf("warning: attempt to write IRQ register!\n");
-        return;
+        std::printf("warning: fastmem: unable to create shared memory, falling back to the slow path!\n");
+        fastmem_destroy();
+        return false;
     }
 
-    if(addr >= PSX_MEM_CONTROL_BASE && addr <= PSX_MEM_CONTROL_END)
+    void* view = mmap(nullptr, FASTMEM_SHARED_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, current->fastmem_fd, 0);
+    void* region = mmap(nullptr, PSX_FASTMEM_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    current->shared_mem = (view != MAP_FAILED) ? (std::uint8_t*)view : nullptr;
+    current->fastmem = (region != MAP_FAILED) ? (std::uint8_t*)region : nullptr;
+
+    bool ok = (current->shared_mem != nullptr && current->fastmem != nullptr);
+
+    for(std::size_t i = 0; ok && i < sizeof(fastmem_segments) / sizeof(fastmem_segments[0]); i++)
     {
-        write_creg(addr, val);
-        return;
+        std::uint8_t* ram = current->fastmem + fastmem_segments[i];
+        std::uint8_t* scratch = current->fastmem + fastmem_segments[i] + PSX_SCRATCHPAD_BASE;
+
+        ok = ok && mmap(ram, PSX_MEM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, current->fastmem_fd, 0) != MAP_FAILED;
+        ok = ok && mmap(scratch, PSX_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, current->fastmem_fd, PSX_MEM_SIZE) != MAP_FAILED;
     }
 
-    if(addr == PSX_MEM_RAM_SIZE_REG)
+    if(!ok)
     {
-        mem_size = val;
-        return;
+        std::printf("warning: fastmem: unable to map the fastmem region, falling back to the slow path!\n");
+        fastmem_destroy();
+        return false;
     }
 
-    if(addr == PSX_CACHE_CTRL_REG)
+    current->kuseg = current->shared_mem;
+    current->scratchpad = current->shared_mem + PSX_MEM_SIZE;
+    return true;
+}
+#endif
+
+// IMPORTANT FUCKIN NOTE!!!!
+// ALL ADDRESSES ARE PHYSICAL!
+bus::context* bus::psmem_init()
+{
+    current = new context();
+
+#ifdef NEOPS_HAS_FASTMEM
+    if(!fastmem_init())
+#endif
     {
-        std::printf("warning: attempt to write cache control with value: 0x%08x!\n", val);
-        return;
+        current->kuseg = new std::uint8_t[PSX_MEM_SIZE];
+        current->scratchpad = new std::uint8_t[PSX_PAGE_SIZE];
     }
 
-    if(addr == GPU_GP0_SEND)
+    std::memset(current->kuseg, 0xba, PSX_MEM_SIZE);
+    std::memset(current->scratchpad, 0x00, PSX_PAGE_SIZE);
+
+    map_pages(0, PSX_MEM_SIZE, current->kuseg, true);
+    map_pages(PSX_SCRATCHPAD_BASE, PSX_PAGE_SIZE, current->scratchpad, true);
+
+    register_device(&current->mem_control, PSX_MEM_CONTROL_BASE, PSX_MEM_CONTROL_END + 4 - PSX_MEM_CONTROL_BASE);
+    register_device(&current->mem_control, PSX_MEM_RAM_SIZE_REG, 4);
+    register_device(&current->irq_stub, PSX_INTERRUPT_STAT_REG, 8);
+    register_device(&current->cdrom_stub, 0x1f801800, 4);
+    register_device(&current->expansion2_stub, 0x1f802000, 0x1000);
+    return current;
+}
+
+void bus::psmem_destroy(context* ctx)
+{
+    assert(ctx != nullptr);
+
+    context* previous = current;
+    current = ctx;
+
+    while(!current->devices.empty())
+        unregister_device(current->devices.back());
+
+    if(current->fastmem != nullptr)
     {
-        //std::printf("gp0: attempt to send command/packet to gp0! value: 0x%08x\n", val);
-        return;
+#ifdef NEOPS_HAS_FASTMEM
+        fastmem_destroy();
+#endif
     }
-
-    if(addr == GPU_GP1_SEND)
+    else
     {
-        //std::printf("gp1: attempt to send command/packet to gp0! value: 0x%08x\n", val);
-        return;
+        delete[] current->kuseg;
+        delete[] current->scratchpad;
     }
 
-    if(addr == PSX_TIMER_MODE_0 || addr == PSX_TIMER_MODE_1 || addr == PSX_TIMER_MODE_2)
+    delete ctx;
+    current = (previous == ctx) ? nullptr : previous;
+}
+
+void bus::bind(context* ctx)
+{
+    current = ctx;
+}
+
+bus::context* bus::bound()
+{
+    return current;
+}
+
+std::uint8_t* bus::fastmem_base()
+{
+    return current->fastmem;
+}
+
+void bus::map_pages(std::uint32_t addr, std::uint32_t size, std::uint8_t* host, bool writable)
+{
+    assert((addr & PSX_PAGE_MASK) == 0 && (size & PSX_PAGE_MASK) == 0);
+    assert(addr + size <= PSX_PHYS_SIZE);
+
+    for(std::uint32_t offset = 0; offset < size; offset += PSX_PAGE_SIZE)
     {
-        std::printf("warning: attempt to write 0x%08x to timer register 0x%08x!\n", val, addr);
-        return;
+        std::uint32_t page = (addr + offset) >> PSX_PAGE_SHIFT;
+
+        current->read_pages[page] = host + offset;
+        current->write_pages[page] = writable ? host + offset : nullptr;
+        current->page_gen[page]++; // Whatever was cached from here before is gone
     }
+}
 
-    if(addr == PSX_TIMER_TARGET_0 || addr == PSX_TIMER_TARGET_1 || addr == PSX_TIMER_TARGET_2)
+void bus::unmap_pages(std::uint32_t addr, std::uint32_t size)
+{
+    assert((addr & PSX_PAGE_MASK) == 0 && (size & PSX_PAGE_MASK) == 0);
+    assert(addr + size <= PSX_PHYS_SIZE);
+
+    for(std::uint32_t offset = 0; offset < size; offset += PSX_PAGE_SIZE)
     {
-        std::printf("warning: attempt to write 0x%08x to timer register 0x%08x!\n", val, addr);
-        return;
+        std::uint32_t page = (addr + offset) >> PSX_PAGE_SHIFT;
+
+        current->read_pages[page] = nullptr;
+        current->write_pages[page] = nullptr;
+        current->page_gen[page]++;
     }
+}
 
-    if(addr == PSX_TIMER_COUNTER_0 || addr == PSX_TIMER_COUNTER_1 || addr == PSX_TIMER_COUNTER_2)
+void bus::register_device(device* dev, std::uint32_t addr, std::uint32_t size)
+{
+    if(addr < PSX_IO_BASE || addr + size > PSX_IO_BASE + PSX_IO_SIZE || (addr & 3) || (size & 3))
     {
-        std::printf("warning: attempt to write 0x%08x to timer register 0x%08x!\n", val, addr);
-        return;
+        std::printf("fatal: bus: %s registered at a bad range (0x%08x, 0x%x bytes)!\n", dev->get_name(), addr, size);
+        exit(-1);
     }
 
-    if(addr == DMA_CTRL_REG)
+    for(std::uint32_t offset = addr - PSX_IO_BASE; offset < addr + size - PSX_IO_BASE; offset += 4)
     {
-        //std::printf("warning: attempt to write DMA control reg (0x%08x) with value: 0x%08x!\n", addr, val);
-        dma.write_dpcr(val);
-        return;
+        device* other = current->io_devices[offset >> 2];
+
+        if(other != nullptr && other != dev)
+        {
+            std::printf("fatal: bus: %s overlaps %s at 0x%08x!\n", dev->get_name(), other->get_name(), PSX_IO_BASE + offset);
+            exit(-1);
+        }
+
+        current->io_devices[offset >> 2] = dev;
     }
 
-    if(addr == DMA_INTERRUPT_REG)
+    if(std::find(current->devices.begin(), current->devices.end(), dev) == current->devices.end())
+        current->devices.push_back(dev);
+}
+
+void bus::unregister_device(device* dev)
+{
+    for(std::uint32_t i = 0; i < (PSX_IO_SIZE >> 2); i++)
     {
-        //std::printf("warning: attempt to write DMA interrupt reg (0x%08x) with value: 0x%08x!\n", addr, val);
-        dma.write_dicr(val);
-        return;
+        if(current->io_devices[i] == dev)
+            current->io_devices[i] = nullptr;
     }
 
-    if(addr >= DMA_CHANNEL0_BASE && addr <= DMA_CHANNEL6_BASE + 8)
+    current->devices.erase(std::remove(current->devices.begin(), current->devices.end(), dev), current->devices.end());
+}
+
+void bus::reset_devices()
+{
+    for(std::size_t i = 0; i < current->devices.size(); i++)
+        current->devices[i]->reset();
+}
+
+void bus::serialize(state::serializer& s)
+{
+    s.section("memory", 1);
+    s.bytes(current->kuseg, PSX_MEM_SIZE);
+    s.bytes(current->scratchpad, PSX_SCRATCHPAD_SIZE);
+
+    if(s.loading())
     {
-        std::printf("dma: attempting to write 0x%08x to DMA register 0x%08x\n", val, addr);
-        dma.controller_write(addr, val);
-        return;
+        ram_written(0, PSX_MEM_SIZE);
+        current->page_gen[PSX_SCRATCHPAD_BASE >> PSX_PAGE_SHIFT]++;
     }
 
-    kuseg[addr + 0] = val & 0xff;
-    kuseg[addr + 1] = (val >> 8) & 0xff;
-    kuseg[addr + 2] = (val >> 16) & 0xff;
-    kuseg[addr + 3] = (val >> 24) & 0xff;
+    for(std::size_t i = 0; i < current->devices.size(); i++)
+        current->devices[i]->serialize(s);
 }
 
-std::uint8_t bus::read_byte(std::uint32_t addr)
+void bus::print_io_stats()
 {
-    if(addr >= PSX_BIOS_SEGMENT_PHYS && addr <= PSX_BIOS_SEGMENT_PHYS + PSX_BIOS_SIZE)
-        return bios::read_byte(addr - PSX_BIOS_SEGMENT_PHYS);
+    std::printf("I/O accesses by device:\n");
 
-    if(addr >= 0x1f802000 && addr <= 0x1f802042)
+    for(std::size_t i = 0; i < current->devices.size(); i++)
+        std::printf("    %-12s %12llu reads %12llu writes\n", current->devices[i]->get_name(), (unsigned long long)current->devices[i]->reads, (unsigned long long)current->devices[i]->writes);
+
+    std::vector<std::uint32_t> busiest;
+
+    for(std::uint32_t i = 0; i < (PSX_IO_SIZE >> 2); i++)
     {
-        std::printf("Attempt to read Expansion2! 0x%08x\n", addr);
-        return 0xFF;
+        if(current->io_hits[i] != 0)
+            busiest.push_back(i);
     }
 
-    if(addr >= 0x1f000080 && addr <= 0x1f000084)
+    std::sort(busiest.begin(), busiest.end(), [](std::uint32_t a, std::uint32_t b) { return current->io_hits[a] > current->io_hits[b]; });
+
+    if(busiest.size() > 16)
+        busiest.resize(16);
+
+    std::printf("Busiest I/O registers:\n");
+
+    for(std::size_t i = 0; i < busiest.size(); i++)
     {
-        std::printf("Attempt to read Expansion1! 0x%08x\n", addr);
-        return 0xFF;
+        device* dev = current->io_devices[busiest[i]];
+        std::printf("    0x%08x %-12s %12llu\n", PSX_IO_BASE + (busiest[i] << 2), dev != nullptr ? dev->get_name() : "(unmapped)", (unsigned long long)current->io_hits[busiest[i]]);
     }
+}
 
-    return kuseg[addr];
+void bus::write_creg(std::uint32_t reg, std::uint32_t val)
+{
+    current->mem_control.mem_creg[(reg - PSX_MEM_CONTROL_BASE) >> 2] = val;
+    current->mem_control.update_timings();
 }
 
-std::uint16_t bus::read_hword(std::uint32_t addr)
+std::uint32_t bus::read_cycles(std::uint32_t addr, unsigned size)
+{
+    // RAM (and its mirrors) first, it's what nearly every read hits.
+    if(addr < 0x00800000)
+        return PSX_RAM_READ_CYCLES;
+
+    const std::uint8_t (*timings)[3] = current->mem_control.timings;
+    unsigned width = size >> 1;
+
+    if(addr >= 0x1f000000 && addr < PSX_SCRATCHPAD_BASE)
+        return timings[memory_control::EXP1][width];
+
+    if(addr >= PSX_SCRATCHPAD_BASE && addr < PSX_SCRATCHPAD_BASE + PSX_SCRATCHPAD_SIZE)
+        return 0;
+
+    if(addr >= 0x1f801800 && addr < 0x1f801810)
+        return timings[memory_control::CDROM][width];
+
+    if(addr >= 0x1f801c00 && addr < 0x1f802000)
+        return timings[memory_control::SPU][width];
+
+    if(addr >= 0x1f802000 && addr < 0x1f804000)
+        return timings[memory_control::EXP2][width];
+
+    if(addr >= 0x1fa00000 && addr < PSX_BIOS_SEGMENT_PHYS)
+        return timings[memory_control::EXP3][width];
+
+    if(addr >= PSX_BIOS_SEGMENT_PHYS && addr < PSX_BIOS_SEGMENT_PHYS + PSX_BIOS_SIZE)
+        return timings[memory_control::BIOS][width];
+
+    return PSX_IO_READ_CYCLES;
+}
+
+const std::uint32_t* bus::page_generation(std::uint32_t addr)
 {
+    if(addr < PSX_MEM_SIZE)
+        return &current->page_gen[addr >> PSX_PAGE_SHIFT];
+
     if(addr >= PSX_BIOS_SEGMENT_PHYS && addr < PSX_BIOS_SEGMENT_PHYS + PSX_BIOS_SIZE)
-        return bios::read_hword(addr - PSX_BIOS_SEGMENT_PHYS);
+        return &current->page_gen[addr >> PSX_PAGE_SHIFT];
+
+    return nullptr;
+}
+
+const std::uint32_t* bus::cache_control()
+{
+    return &current->mem_control.cache_ctrl;
+}
+
+std::uint32_t* bus::page_generation_table()
+{
+    return current->page_gen;
+}
+
+std::uint8_t* bus::ram()
+{
+    return current->kuseg;
+}
+
+void bus::ram_written(std::uint32_t addr, std::uint32_t size)
+{
+    if(size == 0)
+        return;
 
-    if(addr >= PSX_SPU_CREG_START && addr <= PSX_SPU_CREG_END)
+    for(std::uint32_t page = addr >> PSX_PAGE_SHIFT; page <= (addr + size - 1) >> PSX_PAGE_SHIFT; page++)
+        current->page_gen[page]++;
+}
+
+void bus::write_byte(std::uint32_t addr, std::uint8_t val)
+{
+    std::uint8_t* p = lookup(current->write_pages, addr);
+
+    if(p == nullptr)
     {
-        //std::printf("warning: attempt to read spu register! Ignoring...\n");
-        return 0x00;
+        io_write_byte(addr, val);
+        return;
     }
 
-    if(addr >= 0x1f801c00 && addr <= 0x1f801e80)
+    current->page_gen[addr >> PSX_PAGE_SHIFT]++;
+    *p = val;
+}
+
+void bus::write_hword(std::uint32_t addr, std::uint16_t val)
+{
+    std::uint8_t* p = lookup(current->write_pages, addr);
+
+    if(p == nullptr)
     {
-        std::printf("attempt to read spu 0x%08x\n", addr);
-        return 0x00;
+        io_write_hword(addr, val);
+        return;
     }
 
-    if(addr == PSX_INTERRUPT_MASK_REG)
+    current->page_gen[addr >> PSX_PAGE_SHIFT]++;
+    store16(p, val);
+}
+
+void bus::write_word(std::uint32_t addr, std::uint32_t val)
+{
+    std::uint8_t* p = lookup(current->write_pages, addr);
+
+    if(p == nullptr)
     {
-        std::printf("warning: attempt 16-bit read of PSX_INTERRUPT_MASK_REG!\n");
-        return 0x00;
+        io_write_word(addr, val);
+        return;
     }
 
-    return kuseg[addr] | (kuseg[addr + 1] << 8);
+    current->page_gen[addr >> PSX_PAGE_SHIFT]++;
+    store32(p, val);
+}
+
+std::uint8_t bus::read_byte(std::uint32_t addr)
+{
+    const std::uint8_t* p = lookup(current->read_pages, addr);
+
+    if(p == nullptr)
+        return io_read_byte(addr);
+
+    return *p;
+}
+
+std::uint16_t bus::read_hword(std::uint32_t addr)
+{
+    const std::uint8_t* p = lookup(current->read_pages, addr);
+
+    if(p == nullptr)
+        return io_read_hword(addr);
+
+    return load16(p);
 }
 
 std::uint32_t bus::read_word(std::uint32_t addr)
 {
-    if(addr >= PSX_BIOS_SEGMENT_PHYS && addr < PSX_BIOS_SEGMENT_PHYS + PSX_BIOS_SIZE)
-        return bios::read_word(addr - PSX_BIOS_SEGMENT_PHYS);
+    const std::uint8_t* p = lookup(current->read_pages, addr);
+
+    if(p == nullptr)
+        return io_read_word(addr);
 
-    if(addr >= PSX_MEM_CONTROL_BASE && addr <= PSX_MEM_CONTROL_END)
-        return mem_creg[addr];
+    return load32(p);
+}
 
-    if(addr == PSX_INTERRUPT_MASK_REG)
+static void io_write_byte(std::uint32_t addr, std::uint8_t val)
+{
+    device* dev = io_device(addr);
+
+    if(dev != nullptr)
     {
-        std::printf("warning: attempt to read from PSX_INTERRUPT_MASK_REG! Returning 0 for now!\n");
-        return 0;
+        dev->writes++;
+        dev->write8(addr, val);
+        return;
     }
 
+    std::printf("warning: attempt to write 0x%02x to unmapped address 0x%08x!\n", val, addr);
+}
 
-    if(addr == GPU_GPUREAD_RESPONSE)
+static void io_write_hword(std::uint32_t addr, std::uint16_t val)
+{
+    device* dev = io_device(addr);
+
+    if(dev != nullptr)
     {
-        return 0x00;
+        dev->writes++;
+        dev->write16(addr, val);
+        return;
     }
 
-    if(addr == GPU_GPUREAD_STAT)
+    std::printf("warning: attempt to write 0x%04x to unmapped address 0x%08x!\n", val, addr);
+}
+
+static void io_write_word(std::uint32_t addr, std::uint32_t val)
+{
+    device* dev = io_device(addr);
+
+    if(dev != nullptr)
     {
-        //std::printf("attempt to read GPUSTAT!\n");
-        return 0x1c000000;
+        dev->writes++;
+        dev->write32(addr, val);
+        return;
     }
 
-    if(addr == DMA_CTRL_REG)
+    if(addr == PSX_CACHE_CTRL_REG)
     {
-        //std::printf("warning: reading DMA control register\n");
-        return dma.read_dpcr();
+        current->mem_control.cache_ctrl = val;
+        return;
     }
 
-    if(addr == DMA_INTERRUPT_REG)
+    std::printf("warning: attempt to write 0x%08x to unmapped address 0x%08x!\n", val, addr);
+}
+
+static std::uint8_t io_read_byte(std::uint32_t addr)
+{
+    device* dev = io_device(addr);
+
+    if(dev != nullptr)
     {
-        //std::printf("warning: attempt to read from DMA interrupt register! Ignoring...\n");
-        return dma.read_dicr();
+        dev->reads++;
+        return dev->read8(addr);
     }
 
-
-    if(addr >= DMA_CHANNEL0_BASE && addr <= DMA_CHANNEL6_BASE + 8)
+    if(addr >= 0x1f000080 && addr <= 0x1f000084)
     {
-        //std::printf("dma: attempting read of DMA register 0x%08x\n", addr);
-        return dma.controller_read(addr);
+        std::printf("Attempt to read Expansion1! 0x%08x\n", addr);
+        return 0xFF;
     }
 
-    if(addr == PSX_TIMER_COUNTER_0 || addr == PSX_TIMER_COUNTER_1 || addr == PSX_TIMER_COUNTER_2)
+    std::printf("warning: attempt to read from unmapped address 0x%08x!\n", addr);
+    return 0x00;
+}
+
+static std::uint16_t io_read_hword(std::uint32_t addr)
+{
+    device* dev = io_device(addr);
+
+    if(dev != nullptr)
     {
-        //std::printf("warning: attempt to read timer counter 0x%08x!\n", addr);
-        return 0x00;
+        dev->reads++;
+        return dev->read16(addr);
     }
 
-    if(addr == 0x1F8010F8)
-        return DMA_1F8010F8H;
+    std::printf("warning: attempt to read from unmapped address 0x%08x!\n", addr);
+    return 0x00;
+}
+
+static std::uint32_t io_read_word(std::uint32_t addr)
+{
+    device* dev = io_device(addr);
+
+    if(dev != nullptr)
+    {
+        dev->reads++;
+        return dev->read32(addr);
+    }
 
-    if(addr == 0x1F8010FC)
-        return DMA_1F8010FCh;
+    if(addr == PSX_CACHE_CTRL_REG)
+        return current->mem_control.cache_ctrl;
 
-    return kuseg[addr + 0] | (kuseg[addr + 1] << 8) | (kuseg[addr + 2] << 16) | (kuseg[addr + 3] << 24);
+    std::printf("warning: attempt to read from unmapped address 0x%08x!\n", addr);
+    return 0x00;
 }
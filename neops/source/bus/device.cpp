@@ -0,0 +1,104 @@
+/**
+    This file is part of NeoPS.
+
+    NeoPS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    NeoPS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+**/
+#include <cstdio>
+
+#include "bus/device.hpp"
+
+using namespace bus;
+
+device::device(const char* name)
+{
+    this->name = name;
+    reads = 0;
+    writes = 0;
+}
+
+device::~device()
+{
+
+}
+
+std::uint8_t device::read8(std::uint32_t addr)
+{
+    std::printf("warning: %s: unhandled 8-bit read of 0x%08x!\n", name, addr);
+    return 0x00;
+}
+
+std::uint16_t device::read16(std::uint32_t addr)
+{
+    std::printf("warning: %s: unhandled 16-bit read of 0x%08x!\n", name, addr);
+    return 0x00;
+}
+
+std::uint32_t device::read32(std::uint32_t addr)
+{
+    std::printf("warning: %s: unhandled 32-bit read of 0x%08x!\n", name, addr);
+    return 0x00;
+}
+
+void device::write8(std::uint32_t addr, std::uint8_t val)
+{
+    std::printf("warning: %s: unhandled 8-bit write of 0x%02x to 0x%08x!\n", name, val, addr);
+}
+
+void device::write16(std::uint32_t addr, std::uint16_t val)
+{
+    std::printf("warning: %s: unhandled 16-bit write of 0x%04x to 0x%08x!\n", name, val, addr);
+}
+
+void device::write32(std::uint32_t addr, std::uint32_t val)
+{
+    std::printf("warning: %s: unhandled 32-bit write of 0x%08x to 0x%08x!\n", name, val, addr);
+}
+
+void device::dma_write(std::uint32_t val)
+{
+    std::printf("warning: %s: unhandled DMA write of 0x%08x!\n", name, val);
+}
+
+std::uint32_t device::dma_read()
+{
+    std::printf("warning: %s: unhandled DMA read!\n", name);
+    return 0x00;
+}
+
+void device::dma_write_block(const std::uint32_t* words, std::uint32_t count)
+{
+    for(std::uint32_t i = 0; i < count; i++)
+        dma_write(words[i]);
+}
+
+void device::dma_read_block(std::uint32_t* words, std::uint32_t count)
+{
+    for(std::uint32_t i = 0; i < count; i++)
+        words[i] = dma_read();
+}
+
+bool device::dma_ready()
+{
+    return true;
+}
+
+void device::reset()
+{
+
+}
+
+void device::serialize(state::serializer&)
+{
+
+}
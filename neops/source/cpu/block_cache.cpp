@@ -0,0 +1,56 @@
+/**
+    This file is part of NeoPS.
+
+    NeoPS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    NeoPS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with NeoPS.  If not, see <http://www.gnu.org/licenses/>.
+**/
+#include "cpu/block_cache.hpp"
+
+using namespace cpu;
+
+block_cache::block_cache()
+{
+
+}
+
+block_cache::~block_cache()
+{
+
+}
+
+block* block_cache::lookup(std::uint32_t phys_addr)
+{
+    std::unordered_map<std::uint32_t, block>::iterator it = blocks.find(phys_addr);
+
+    if(it == blocks.end() || !it->second.valid())
+        return nullptr;
+
+    return &it->second;
+}
+
+block* block_cache::create(std::uint32_t phys_addr, const std::uint32_t* page_gen)
+{
+    block& b = blocks[phys_addr]; // Element references survive a rehash, so we can hand these out.
+
+    b.phys_addr = phys_addr;
+    b.page_gen = page_gen;
+    b.generation = *page_gen;
+    b.ops.clear();
+
+    return &b;
+}
+
+void block_cache::flush()
+{
+    blocks.clear();
+}
@@ -16,10 +16,13 @@
 **/
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 
 #include "cpu/cop0.hpp"
 #include "bus/bus.hpp"
+#include "cpu/icache.hpp"
 #include "register.hpp"
+#include "state/state.hpp"
 
 #define KSEG0 0b100
 #define KSEG1 0b101
@@ -47,9 +50,14 @@ static std::uint32_t address_masks[] =  {0xffffffff, 0xffffffff, 0xffffffff, 0xf
 
 using namespace cpu;
 
-cop0::cop0()
+cop0::cop0(icache* ic, std::int32_t* budget)
 {
-
+    this->ic = ic;
+    this->budget = budget;
+    std::memset(gpr, 0x00, sizeof(gpr));
+    std::memset(tlb, 0x00, sizeof(tlb));
+    curr_exception = INTERRUPT;
+    trace = nullptr;
 }
 
 cop0::~cop0()
@@ -62,7 +70,7 @@ void cop0::trigger_exception(EXCEPTION_TYPE ex, r3000a* cpu)
     std::printf("cop0: entering exception %d!\n", ex);
 
     std::uint32_t status = gpr[12];
-    status = (status & 0x3f) | ((status << 2) & 0x3f);
+    status = (status & ~0x3f) | ((status << 2) & 0x3f);
 
     std::uint32_t cause;
     cause = (cause & ~0x7f) | ((ex << 2) & 0x7f);
@@ -88,6 +96,15 @@ void cop0::trigger_exception(EXCEPTION_TYPE ex, r3000a* cpu)
     cpu->set_pc(addr);
 }
 
+void cop0::serialize(state::serializer& s)
+{
+    s.section("cop0", 1);
+
+    s.value(gpr);
+    s.value(tlb);
+    s.value(curr_exception);
+}
+
 void cop0::rfe()
 {
     std::printf("cop0: rfe\n");
@@ -107,12 +124,84 @@ std::uint32_t cop0::read_gpr(unsigned reg)
     return gpr[reg];
 }
 
+std::uint32_t cop0::virtual_fetch32(std::uint32_t vaddr)
+{
+    if(!align_check(vaddr))
+    {
+        std::printf("fatal: attempt to fetch from unaligned memory address: 0x%08x (SIGBUS)\n", vaddr);
+        exit(-1);
+    }
+
+    return bus::read_word(virtual_to_physical(vaddr));
+}
+
+std::uint32_t cop0::isolated_read(std::uint32_t phys_addr, std::uint8_t size) const
+{
+    std::uint32_t word = ic->isolated_read(phys_addr);
+
+    // Pick the byte or half word out of the (little endian) word.
+    word >>= (phys_addr & 0x3) * 8;
+    return (size == 4) ? word : word & ((1u << (size * 8)) - 1);
+}
+
+void cop0::read_wait(std::uint32_t phys_addr, unsigned size)
+{
+    // Loads already paid for a read from RAM when they issued, so we only settle the difference.
+    if(!isolated())
+        *budget -= (std::int32_t)bus::read_cycles(phys_addr, size) - PSX_RAM_READ_CYCLES;
+}
+
+void cop0::isolated_write(std::uint32_t phys_addr, std::uint32_t value) const
+{
+    ic->isolated_write(phys_addr, value, (*bus::cache_control() & ICACHE_CTRL_TAG_TEST) != 0);
+}
+
+std::uint32_t cop0::virtual_to_physical(std::uint32_t vaddr)
+{
+    int segment = vaddr >> 29;
+
+    return vaddr & address_masks[segment];
+}
+
+std::uint32_t cop0::traced_access(std::uint32_t vaddr, std::uint8_t size, bool write, std::uint32_t value)
+{
+    if(trace->mode == memory_trace::RECORD)
+    {
+        memory_trace::access a = {vaddr, value, size, write};
+        trace->log.push_back(a);
+        return value;
+    }
+
+    if(trace->position >= trace->log.size())
+    {
+        trace->mismatch = true;
+        return 0;
+    }
+
+    const memory_trace::access& a = trace->log[trace->position++];
+
+    if(a.vaddr != vaddr || a.size != size || a.write != write || (write && a.value != value))
+        trace->mismatch = true;
+
+    return a.value;
+}
+
 void cop0::virtual_write8(std::uint32_t vaddr, std::uint8_t value)
 {
     int segment = vaddr >> 29;
     std::uint32_t phys_addr = vaddr & address_masks[segment];
 
-    bus::write_byte(phys_addr, value);
+    if(trace != nullptr)
+    {
+        traced_access(vaddr, 1, true, value);
+        if(trace->mode == memory_trace::REPLAY)
+            return;
+    }
+
+    if(isolated())
+        isolated_write(phys_addr, value);
+    else
+        bus::write_byte(phys_addr, value);
 }
 
 void cop0::virtual_write16(std::uint32_t vaddr, std::uint16_t value)
@@ -126,7 +215,18 @@ void cop0::virtual_write16(std::uint32_t vaddr, std::uint16_t value)
 
     int segment = vaddr >> 29;
     std::uint32_t phys_addr = vaddr & address_masks[segment];
-    bus::write_hword(phys_addr, value);
+
+    if(trace != nullptr)
+    {
+        traced_access(vaddr, 2, true, value);
+        if(trace->mode == memory_trace::REPLAY)
+            return;
+    }
+
+    if(isolated())
+        isolated_write(phys_addr, value);
+    else
+        bus::write_hword(phys_addr, value);
 }
 
 void cop0::virtual_write32(std::uint32_t vaddr, std::uint32_t value)
@@ -141,7 +241,17 @@ void cop0::virtual_write32(std::uint32_t vaddr, std::uint32_t value)
     int segment = vaddr >> 29;
     std::uint32_t phys_addr = vaddr & address_masks[segment];
 
-    bus::write_word(phys_addr, value);
+    if(trace != nullptr)
+    {
+        traced_access(vaddr, 4, true, value);
+        if(trace->mode == memory_trace::REPLAY)
+            return;
+    }
+
+    if(isolated())
+        isolated_write(phys_addr, value);
+    else
+        bus::write_word(phys_addr, value);
 }
 
 // TODO: Caching???
@@ -150,6 +260,19 @@ std::uint8_t cop0::virtual_read8(std::uint32_t vaddr)
     int segment = vaddr >> 29;
     std::uint32_t phys_addr = vaddr & address_masks[segment];
 
+    read_wait(phys_addr, 1);
+
+    if(trace != nullptr)
+    {
+        if(trace->mode == memory_trace::REPLAY)
+            return traced_access(vaddr, 1, false, 0);
+
+        return traced_access(vaddr, 1, false, isolated() ? isolated_read(phys_addr, 1) : bus::read_byte(phys_addr));
+    }
+
+    if(isolated())
+        return isolated_read(phys_addr, 1);
+
     return bus::read_byte(phys_addr);
 }
 
@@ -165,6 +288,19 @@ std::uint16_t cop0::virtual_read16(std::uint32_t vaddr)
     int segment = vaddr >> 29;
     std::uint32_t phys_addr = vaddr & address_masks[segment];
 
+    read_wait(phys_addr, 2);
+
+    if(trace != nullptr)
+    {
+        if(trace->mode == memory_trace::REPLAY)
+            return traced_access(vaddr, 2, false, 0);
+
+        return traced_access(vaddr, 2, false, isolated() ? isolated_read(phys_addr, 2) : bus::read_hword(phys_addr));
+    }
+
+    if(isolated())
+        return isolated_read(phys_addr, 2);
+
     return bus::read_hword(phys_addr);
 }
 
@@ -180,5 +316,18 @@ std::uint32_t cop0::virtual_read32(std::uint32_t vaddr)
     int segment = vaddr >> 29;
     std::uint32_t phys_addr = vaddr & address_masks[segment];
 
+    read_wait(phys_addr, 4);
+
+    if(trace != nullptr)
+    {
+        if(trace->mode == memory_trace::REPLAY)
+            return traced_access(vaddr, 4, false, 0);
+
+        return traced_access(vaddr, 4, false, isolated() ? isolated_read(phys_addr, 4) : bus::read_word(phys_addr));
+    }
+
+    if(isolated())
+        return isolated_read(phys_addr, 4);
+
     return bus::read_word(phys_addr);
 }
@@ -0,0 +1,944 @@
+/**
+    This file is part of NeoPS.
+
+    NeoPS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    NeoPS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+**/
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "cpu/gte.hpp"
+#include "state/state.hpp"
+
+#define GTE_MAC_MAX         0x7ffffffffffLL     /**< Largest value MAC1..3 hold before we flag (44 bits) */
+#define GTE_MAC_MIN         (-0x80000000000LL)
+
+// FLAG bits
+#define FLAG_MAC_POSITIVE(i)    (1u << (31 - (i)))  /**< MAC1..3 larger than 43 bits and positive (30..28) */
+#define FLAG_MAC_NEGATIVE(i)    (1u << (28 - (i)))  /**< MAC1..3 larger than 43 bits and negative (27..25) */
+#define FLAG_IR(i)              (1u << (25 - (i)))  /**< IR1..3 saturated (24..22) */
+#define FLAG_COLOR(i)           (1u << (22 - (i)))  /**< Color FIFO R, G or B saturated (21..19) */
+#define FLAG_SZ                 (1u << 18)          /**< SZ3 or OTZ saturated */
+#define FLAG_DIVIDE             (1u << 17)          /**< Divide overflow */
+#define FLAG_MAC0_POSITIVE      (1u << 16)          /**< MAC0 larger than 31 bits and positive */
+#define FLAG_MAC0_NEGATIVE      (1u << 15)          /**< MAC0 larger than 31 bits and negative */
+#define FLAG_SX                 (1u << 14)          /**< SX2 saturated */
+#define FLAG_SY                 (1u << 13)          /**< SY2 saturated */
+#define FLAG_IR0                (1u << 12)          /**< IR0 saturated */
+
+using namespace cpu;
+
+static const std::int32_t no_translation[3] = {0, 0, 0};
+
+/**
+ *  Reciprocal table of the GTE's divider (see @ref divide).
+ */
+static std::uint8_t unr_table[0x101];
+
+static bool build_unr_table()
+{
+    for(int i = 0; i < 0x101; i++)
+        unr_table[i] = (std::uint8_t)std::max(0, (0x40000 / (i + 0x100) + 1) / 2 - 0x101);
+
+    return true;
+}
+
+static bool unr_table_built = build_unr_table();
+
+/**
+ *  H / SZ3 the way the GTE does it, a reciprocal from a table plus a round of Newton-Raphson.
+ *  The result is NOT always the exact quotient, and games depend on that.
+ *
+ *  Only valid for lhs < rhs * 2 (anything else is a divide overflow, handled by our caller).
+ */
+static std::uint32_t divide(std::uint32_t lhs, std::uint32_t rhs)
+{
+    // Normalise the divisor so bit 15 is set.
+    int shift = 0;
+    while(shift < 16 && (rhs & (0x8000 >> shift)) == 0)
+        shift++;
+
+    lhs <<= shift;
+    rhs <<= shift;
+
+    std::int32_t divisor = (std::int32_t)(rhs | 0x8000);
+    std::int32_t x = 0x101 + unr_table[((divisor & 0x7fff) + 0x40) >> 7];
+    std::int32_t d = ((divisor * -x) + 0x80) >> 8;
+    std::uint32_t reciprocal = (std::uint32_t)(((x * (0x20000 + d)) + 0x80) >> 8);
+    std::uint32_t result = (std::uint32_t)(((std::uint64_t)lhs * reciprocal + 0x8000) >> 16);
+
+    return std::min<std::uint32_t>(result, 0x1ffff);
+}
+
+/**
+ *  Sign extend from 44 bits, MAC1..3 wrap around like this after every step of a sum.
+ */
+static inline std::int64_t wrap44(std::int64_t value)
+{
+    return (std::int64_t)((std::uint64_t)value << 20) >> 20;
+}
+
+template<typename T>
+static inline T clamp(T value, T low, T high)
+{
+    return value < low ? low : (value > high ? high : value);
+}
+
+/**
+ *  Multiplies a matrix by a vector, adding a translation vector (shifted up by 12) first. The running
+ *  sum is checked for 44-bit overflow after every step and wrapped to 44 bits, like the hardware does.
+ *
+ *  @arg m - 3x3 matrix.
+ *  @arg t - Translation vector.
+ *  @arg v - Vector.
+ *  @arg out - The three 44-bit sums.
+ *  @return Overflow bits for FLAG (30..25).
+ */
+static inline std::uint32_t multiply(const std::int16_t m[3][3], const std::int32_t t[3], const std::int16_t v[3], std::int64_t out[3])
+{
+    std::uint32_t overflow = 0;
+
+    for(int i = 0; i < 3; i++)
+    {
+        std::int64_t sum = (std::int64_t)t[i] << 12;
+
+        for(int j = 0; j < 3; j++)
+        {
+            sum += (std::int32_t)m[i][j] * v[j];
+
+            if(sum > GTE_MAC_MAX)
+                overflow |= FLAG_MAC_POSITIVE(i + 1);
+            else if(sum < GTE_MAC_MIN)
+                overflow |= FLAG_MAC_NEGATIVE(i + 1);
+
+            sum = wrap44(sum);
+        }
+
+        out[i] = sum;
+    }
+
+    return overflow;
+}
+
+gte::gte()
+{
+    reset();
+}
+
+gte::~gte()
+{
+
+}
+
+void gte::reset()
+{
+    std::memset(v, 0, sizeof(v));
+    std::memset(rgbc, 0, sizeof(rgbc));
+    otz = 0;
+    std::memset(ir, 0, sizeof(ir));
+    std::memset(sxy, 0, sizeof(sxy));
+    std::memset(sz, 0, sizeof(sz));
+    std::memset(rgb, 0, sizeof(rgb));
+    res1 = 0;
+    std::memset(mac, 0, sizeof(mac));
+    lzcs = 0;
+    lzcr = 32;
+
+    std::memset(rotation, 0, sizeof(rotation));
+    std::memset(translation, 0, sizeof(translation));
+    std::memset(light, 0, sizeof(light));
+    std::memset(background, 0, sizeof(background));
+    std::memset(color, 0, sizeof(color));
+    std::memset(far_color, 0, sizeof(far_color));
+    ofx = 0;
+    ofy = 0;
+    h = 0;
+    dqa = 0;
+    dqb = 0;
+    zsf3 = 0;
+    zsf4 = 0;
+    flag = 0;
+}
+
+void gte::serialize(state::serializer& s)
+{
+    s.section("gte", 1);
+
+    s.value(v);
+    s.value(rgbc);
+    s.value(otz);
+    s.value(ir);
+    s.value(sxy);
+    s.value(sz);
+    s.value(rgb);
+    s.value(res1);
+    s.value(mac);
+    s.value(lzcs);
+    s.value(lzcr);
+
+    s.value(rotation);
+    s.value(translation);
+    s.value(light);
+    s.value(background);
+    s.value(color);
+    s.value(far_color);
+    s.value(ofx);
+    s.value(ofy);
+    s.value(h);
+    s.value(dqa);
+    s.value(dqb);
+    s.value(zsf3);
+    s.value(zsf4);
+    s.value(flag);
+}
+
+///+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+
+static inline std::uint32_t pack(std::int16_t low, std::int16_t high)
+{
+    return (std::uint16_t)low | ((std::uint32_t)(std::uint16_t)high << 16);
+}
+
+static inline std::uint32_t pack_color(const std::uint8_t c[4])
+{
+    return c[0] | (c[1] << 8) | (c[2] << 16) | ((std::uint32_t)c[3] << 24);
+}
+
+static inline void unpack_color(std::uint8_t c[4], std::uint32_t value)
+{
+    c[0] = value & 0xff;
+    c[1] = (value >> 8) & 0xff;
+    c[2] = (value >> 16) & 0xff;
+    c[3] = value >> 24;
+}
+
+/**
+ *  The five registers holding a 3x3 matrix, two elements per register (R11R12, R13R21...) and R33 on its own.
+ */
+static std::uint32_t read_matrix(const std::int16_t m[3][3], unsigned reg)
+{
+    const std::int16_t* e = &m[0][0];
+
+    if(reg == 4)
+        return (std::uint32_t)(std::int32_t)e[8];
+
+    return pack(e[reg * 2], e[reg * 2 + 1]);
+}
+
+static void write_matrix(std::int16_t m[3][3], unsigned reg, std::uint32_t value)
+{
+    std::int16_t* e = &m[0][0];
+
+    if(reg == 4)
+    {
+        e[8] = (std::int16_t)value;
+        return;
+    }
+
+    e[reg * 2] = (std::int16_t)value;
+    e[reg * 2 + 1] = (std::int16_t)(value >> 16);
+}
+
+std::uint32_t gte::read_data(unsigned reg) const
+{
+    switch(reg)
+    {
+    case 0: case 2: case 4:
+        return pack(v[reg / 2][0], v[reg / 2][1]);
+    case 1: case 3: case 5:
+        return (std::uint32_t)(std::int32_t)v[reg / 2][2];
+    case 6:
+        return pack_color(rgbc);
+    case 7:
+        return otz;
+    case 8: case 9: case 10: case 11:
+        return (std::uint32_t)(std::int32_t)ir[reg - 8];
+    case 12: case 13: case 14:
+        return pack(sxy[reg - 12][0], sxy[reg - 12][1]);
+    case 15:
+        return pack(sxy[2][0], sxy[2][1]); // SXYP mirrors SXY2
+    case 16: case 17: case 18: case 19:
+        return sz[reg - 16];
+    case 20: case 21: case 22:
+        return pack_color(rgb[reg - 20]);
+    case 23:
+        return res1;
+    case 24: case 25: case 26: case 27:
+        return (std::uint32_t)mac[reg - 24];
+    case 28: case 29:
+    {
+        // ORGB, IR1..3 squashed to 5 bits each.
+        std::uint32_t r = clamp(ir[1] >> 7, 0, 0x1f);
+        std::uint32_t g = clamp(ir[2] >> 7, 0, 0x1f);
+        std::uint32_t b = clamp(ir[3] >> 7, 0, 0x1f);
+        return r | (g << 5) | (b << 10);
+    }
+    case 30:
+        return lzcs;
+    case 31:
+        return lzcr;
+    default:
+        return 0;
+    }
+}
+
+void gte::write_data(unsigned reg, std::uint32_t value)
+{
+    switch(reg)
+    {
+    case 0: case 2: case 4:
+        v[reg / 2][0] = (std::int16_t)value;
+        v[reg / 2][1] = (std::int16_t)(value >> 16);
+        break;
+    case 1: case 3: case 5:
+        v[reg / 2][2] = (std::int16_t)value;
+        break;
+    case 6:
+        unpack_color(rgbc, value);
+        break;
+    case 7:
+        otz = (std::uint16_t)value;
+        break;
+    case 8: case 9: case 10: case 11:
+        ir[reg - 8] = (std::int16_t)value;
+        break;
+    case 12: case 13: case 14:
+        sxy[reg - 12][0] = (std::int16_t)value;
+        sxy[reg - 12][1] = (std::int16_t)(value >> 16);
+        break;
+    case 15:
+        // Writing SXYP pushes the FIFO.
+        std::memmove(sxy[0], sxy[1], sizeof(sxy[0]) * 2);
+        sxy[2][0] = (std::int16_t)value;
+        sxy[2][1] = (std::int16_t)(value >> 16);
+        break;
+    case 16: case 17: case 18: case 19:
+        sz[reg - 16] = (std::uint16_t)value;
+        break;
+    case 20: case 21: case 22:
+        unpack_color(rgb[reg - 20], value);
+        break;
+    case 23:
+        res1 = value;
+        break;
+    case 24: case 25: case 26: case 27:
+        mac[reg - 24] = (std::int32_t)value;
+        break;
+    case 28:
+        // IRGB, 5 bits each into IR1..3.
+        ir[1] = (value & 0x1f) << 7;
+        ir[2] = ((value >> 5) & 0x1f) << 7;
+        ir[3] = ((value >> 10) & 0x1f) << 7;
+        break;
+    case 30:
+    {
+        // Count the leading zeroes, or the leading ones if it's negative.
+        std::uint32_t bits = (value & 0x80000000) ? ~value : value;
+
+        lzcs = value;
+        lzcr = 0;
+        while(lzcr < 32 && (bits & (0x80000000 >> lzcr)) == 0)
+            lzcr++;
+        break;
+    }
+    default: // ORGB and LZCR are read only.
+        break;
+    }
+}
+
+std::uint32_t gte::read_control(unsigned reg) const
+{
+    switch(reg)
+    {
+    case 0: case 1: case 2: case 3: case 4:
+        return read_matrix(rotation, reg);
+    case 5: case 6: case 7:
+        return (std::uint32_t)translation[reg - 5];
+    case 8: case 9: case 10: case 11: case 12:
+        return read_matrix(light, reg - 8);
+    case 13: case 14: case 15:
+        return (std::uint32_t)background[reg - 13];
+    case 16: case 17: case 18: case 19: case 20:
+        return read_matrix(color, reg - 16);
+    case 21: case 22: case 23:
+        return (std::uint32_t)far_color[reg - 21];
+    case 24:
+        return (std::uint32_t)ofx;
+    case 25:
+        return (std::uint32_t)ofy;
+    case 26:
+        return (std::uint32_t)(std::int32_t)(std::int16_t)h; // H is unsigned, but reads back sign extended.
+    case 27:
+        return (std::uint32_t)(std::int32_t)dqa;
+    case 28:
+        return (std::uint32_t)dqb;
+    case 29:
+        return (std::uint32_t)(std::int32_t)zsf3;
+    case 30:
+        return (std::uint32_t)(std::int32_t)zsf4;
+    case 31:
+        return flag;
+    default:
+        return 0;
+    }
+}
+
+void gte::write_control(unsigned reg, std::uint32_t value)
+{
+    switch(reg)
+    {
+    case 0: case 1: case 2: case 3: case 4:
+        write_matrix(rotation, reg, value);
+        break;
+    case 5: case 6: case 7:
+        translation[reg - 5] = (std::int32_t)value;
+        break;
+    case 8: case 9: case 10: case 11: case 12:
+        write_matrix(light, reg - 8, value);
+        break;
+    case 13: case 14: case 15:
+        background[reg - 13] = (std::int32_t)value;
+        break;
+    case 16: case 17: case 18: case 19: case 20:
+        write_matrix(color, reg - 16, value);
+        break;
+    case 21: case 22: case 23:
+        far_color[reg - 21] = (std::int32_t)value;
+        break;
+    case 24:
+        ofx = (std::int32_t)value;
+        break;
+    case 25:
+        ofy = (std::int32_t)value;
+        break;
+    case 26:
+        h = (std::uint16_t)value;
+        break;
+    case 27:
+        dqa = (std::int16_t)value;
+        break;
+    case 28:
+        dqb = (std::int32_t)value;
+        break;
+    case 29:
+        zsf3 = (std::int16_t)value;
+        break;
+    case 30:
+        zsf4 = (std::int16_t)value;
+        break;
+    case 31:
+        flag = value & 0x7ffff000;
+        if(flag & GTE_FLAG_ERROR)
+            flag |= 0x80000000;
+        break;
+    default:
+        break;
+    }
+}
+
+///+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+
+void gte::check_mac(int i, std::int64_t value)
+{
+    if(value > GTE_MAC_MAX)
+        flag |= FLAG_MAC_POSITIVE(i);
+    else if(value < GTE_MAC_MIN)
+        flag |= FLAG_MAC_NEGATIVE(i);
+}
+
+void gte::check_mac0(std::int64_t value)
+{
+    if(value > 0x7fffffffLL)
+        flag |= FLAG_MAC0_POSITIVE;
+    else if(value < -0x80000000LL)
+        flag |= FLAG_MAC0_NEGATIVE;
+}
+
+void gte::set_mac(int i, std::int64_t value, int shift)
+{
+    check_mac(i, value);
+    mac[i] = (std::int32_t)(value >> shift);
+}
+
+void gte::set_ir(int i, std::int32_t value, bool lm)
+{
+    std::int32_t low = lm ? 0 : -0x8000;
+
+    if(value < low || value > 0x7fff)
+        flag |= FLAG_IR(i);
+
+    ir[i] = (std::int16_t)clamp(value, low, 0x7fff);
+}
+
+void gte::set_mac_ir(int i, std::int64_t value, int shift, bool lm)
+{
+    set_mac(i, value, shift);
+    set_ir(i, mac[i], lm);
+}
+
+void gte::push_sz(std::int32_t value)
+{
+    if(value < 0 || value > 0xffff)
+        flag |= FLAG_SZ;
+
+    sz[0] = sz[1];
+    sz[1] = sz[2];
+    sz[2] = sz[3];
+    sz[3] = (std::uint16_t)clamp(value, 0, 0xffff);
+}
+
+void gte::push_sxy(std::int32_t x, std::int32_t y)
+{
+    if(x < -0x400 || x > 0x3ff)
+        flag |= FLAG_SX;
+    if(y < -0x400 || y > 0x3ff)
+        flag |= FLAG_SY;
+
+    std::memmove(sxy[0], sxy[1], sizeof(sxy[0]) * 2);
+    sxy[2][0] = (std::int16_t)clamp(x, -0x400, 0x3ff);
+    sxy[2][1] = (std::int16_t)clamp(y, -0x400, 0x3ff);
+}
+
+void gte::push_color()
+{
+    std::uint8_t c[4];
+
+    for(int i = 0; i < 3; i++)
+    {
+        std::int32_t value = mac[i + 1] >> 4;
+
+        if(value < 0 || value > 0xff)
+            flag |= FLAG_COLOR(i + 1);
+
+        c[i] = (std::uint8_t)clamp(value, 0, 0xff);
+    }
+
+    c[3] = rgbc[3];
+
+    std::memcpy(rgb[0], rgb[1], sizeof(rgb[0]));
+    std::memcpy(rgb[1], rgb[2], sizeof(rgb[1]));
+    std::memcpy(rgb[2], c, sizeof(rgb[2]));
+}
+
+void gte::multiply_add(const std::int16_t m[3][3], const std::int32_t t[3], const std::int16_t vec[3], int shift, bool lm)
+{
+    std::int64_t sums[3];
+
+    flag |= multiply(m, t, vec, sums);
+
+    for(int i = 0; i < 3; i++)
+        set_mac_ir(i + 1, sums[i], shift, lm);
+}
+
+void gte::multiply_add_fc(const std::int16_t m[3][3], const std::int16_t vec[3], int shift, bool lm)
+{
+    // The first column gets added to FC and checked (including IR saturation), then thrown away.
+    for(int i = 0; i < 3; i++)
+    {
+        std::int64_t first = ((std::int64_t)far_color[i] << 12) + (std::int32_t)m[i][0] * vec[0];
+        check_mac(i + 1, first);
+        set_ir(i + 1, (std::int32_t)(wrap44(first) >> shift), false);
+
+        std::int64_t sum = (std::int64_t)((std::int32_t)m[i][1] * vec[1]) + (std::int32_t)m[i][2] * vec[2];
+        set_mac_ir(i + 1, sum, shift, lm);
+    }
+}
+
+void gte::interpolate(const std::int64_t in[3], int shift, bool lm)
+{
+    for(int i = 0; i < 3; i++)
+        set_mac_ir(i + 1, ((std::int64_t)far_color[i] << 12) - in[i], shift, false);
+
+    for(int i = 0; i < 3; i++)
+        set_mac_ir(i + 1, (std::int64_t)(ir[i + 1] * ir[0]) + in[i], shift, lm);
+}
+
+///+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+
+void gte::rtps(const std::int16_t vec[3], int shift, bool lm, bool last)
+{
+    std::int64_t sums[3];
+
+    flag |= multiply(rotation, translation, vec, sums);
+
+    for(int i = 0; i < 3; i++)
+        set_mac(i + 1, sums[i], shift);
+
+    set_ir(1, mac[1], lm);
+    set_ir(2, mac[2], lm);
+
+    // IR3 is saturated from MAC3 as usual, but its flag comes from the sum SAR 12 (so with sf=0 the two disagree).
+    std::int64_t z = sums[2] >> 12;
+
+    if(z < -0x8000 || z > 0x7fff)
+        flag |= FLAG_IR(3);
+
+    ir[3] = (std::int16_t)clamp(mac[3], lm ? 0 : -0x8000, 0x7fff);
+
+    push_sz((std::int32_t)z);
+
+    std::int64_t n;
+
+    if(h < sz[3] * 2)
+    {
+        n = divide(h, sz[3]);
+    }
+    else
+    {
+        flag |= FLAG_DIVIDE;
+        n = 0x1ffff;
+    }
+
+    std::int64_t x = n * ir[1] + ofx;
+    std::int64_t y = n * ir[2] + ofy;
+
+    check_mac0(x);
+    check_mac0(y);
+    push_sxy((std::int32_t)(x >> 16), (std::int32_t)(y >> 16));
+
+    // Depth cueing, only for the last vertex of RTPT.
+    if(last)
+    {
+        std::int64_t depth = n * dqa + dqb;
+        std::int64_t ir0 = depth >> 12;
+
+        check_mac0(depth);
+        mac[0] = (std::int32_t)depth;
+
+        if(ir0 < 0 || ir0 > 0x1000)
+            flag |= FLAG_IR0;
+
+        ir[0] = (std::int16_t)clamp<std::int64_t>(ir0, 0, 0x1000);
+    }
+}
+
+void gte::nclip()
+{
+    std::int64_t value = (std::int64_t)sxy[0][0] * sxy[1][1] + (std::int64_t)sxy[1][0] * sxy[2][1] + (std::int64_t)sxy[2][0] * sxy[0][1]
+                       - (std::int64_t)sxy[0][0] * sxy[2][1] - (std::int64_t)sxy[1][0] * sxy[0][1] - (std::int64_t)sxy[2][0] * sxy[1][1];
+
+    check_mac0(value);
+    mac[0] = (std::int32_t)value;
+}
+
+void gte::op(int shift, bool lm)
+{
+    std::int64_t d1 = rotation[0][0];
+    std::int64_t d2 = rotation[1][1];
+    std::int64_t d3 = rotation[2][2];
+
+    set_mac_ir(1, ir[3] * d2 - ir[2] * d3, shift, lm);
+    set_mac_ir(2, ir[1] * d3 - ir[3] * d1, shift, lm);
+    set_mac_ir(3, ir[2] * d1 - ir[1] * d2, shift, lm);
+}
+
+void gte::dpcs(const std::uint8_t col[3], int shift, bool lm)
+{
+    std::int64_t in[3];
+
+    for(int i = 0; i < 3; i++)
+        in[i] = (std::int64_t)col[i] << 16;
+
+    interpolate(in, shift, lm);
+    push_color();
+}
+
+void gte::intpl(int shift, bool lm)
+{
+    std::int64_t in[3];
+
+    for(int i = 0; i < 3; i++)
+        in[i] = (std::int64_t)ir[i + 1] << 12;
+
+    interpolate(in, shift, lm);
+    push_color();
+}
+
+void gte::mvmva(std::uint32_t command, int shift, bool lm)
+{
+    unsigned mx = (command >> 17) & 0x3;
+    unsigned vx = (command >> 15) & 0x3;
+    unsigned cv = (command >> 13) & 0x3;
+
+    std::int16_t vec[3];
+    std::int16_t garbage[3][3];
+    const std::int16_t (*m)[3];
+
+    if(vx == 3)
+        std::memcpy(vec, &ir[1], sizeof(vec));
+    else
+        std::memcpy(vec, v[vx], sizeof(vec));
+
+    switch(mx)
+    {
+    case 0:
+        m = rotation;
+        break;
+    case 1:
+        m = light;
+        break;
+    case 2:
+        m = color;
+        break;
+    default:
+        // There is no fourth matrix, we get a mix of whatever's lying around instead.
+        garbage[0][0] = -(std::int16_t)(rgbc[0] << 4);
+        garbage[0][1] = (std::int16_t)(rgbc[0] << 4);
+        garbage[0][2] = ir[0];
+        garbage[1][0] = garbage[1][1] = garbage[1][2] = rotation[0][2];
+        garbage[2][0] = garbage[2][1] = garbage[2][2] = rotation[1][1];
+        m = garbage;
+        break;
+    }
+
+    switch(cv)
+    {
+    case 0:
+        multiply_add(m, translation, vec, shift, lm);
+        break;
+    case 1:
+        multiply_add(m, background, vec, shift, lm);
+        break;
+    case 2:
+        multiply_add_fc(m, vec, shift, lm);
+        break;
+    default:
+        multiply_add(m, no_translation, vec, shift, lm);
+        break;
+    }
+}
+
+void gte::ncds(const std::int16_t vec[3], int shift, bool lm)
+{
+    multiply_add(light, no_translation, vec, shift, lm);
+    multiply_add(color, background, &ir[1], shift, lm);
+    dcpl(shift, lm);
+}
+
+void gte::cdp(int shift, bool lm)
+{
+    multiply_add(color, background, &ir[1], shift, lm);
+    dcpl(shift, lm);
+}
+
+void gte::nccs(const std::int16_t vec[3], int shift, bool lm)
+{
+    multiply_add(light, no_translation, vec, shift, lm);
+    cc(shift, lm);
+}
+
+void gte::cc(int shift, bool lm)
+{
+    multiply_add(color, background, &ir[1], shift, lm);
+
+    for(int i = 0; i < 3; i++)
+        set_mac_ir(i + 1, ((std::int64_t)rgbc[i] << 4) * ir[i + 1], shift, lm);
+
+    push_color();
+}
+
+void gte::ncs(const std::int16_t vec[3], int shift, bool lm)
+{
+    multiply_add(light, no_translation, vec, shift, lm);
+    multiply_add(color, background, &ir[1], shift, lm);
+    push_color();
+}
+
+void gte::sqr(int shift)
+{
+    // Squares are never negative, so lm doesn't matter.
+    for(int i = 1; i < 4; i++)
+        set_mac_ir(i, (std::int64_t)ir[i] * ir[i], shift, false);
+}
+
+void gte::dcpl(int shift, bool lm)
+{
+    std::int64_t in[3];
+
+    for(int i = 0; i < 3; i++)
+        in[i] = ((std::int64_t)rgbc[i] << 4) * ir[i + 1];
+
+    interpolate(in, shift, lm);
+    push_color();
+}
+
+void gte::avsz3()
+{
+    std::int64_t value = (std::int64_t)zsf3 * (sz[1] + sz[2] + sz[3]);
+    std::int64_t z = value >> 12;
+
+    check_mac0(value);
+    mac[0] = (std::int32_t)value;
+
+    if(z < 0 || z > 0xffff)
+        flag |= FLAG_SZ;
+
+    otz = (std::uint16_t)clamp<std::int64_t>(z, 0, 0xffff);
+}
+
+void gte::avsz4()
+{
+    std::int64_t value = (std::int64_t)zsf4 * (sz[0] + sz[1] + sz[2] + sz[3]);
+    std::int64_t z = value >> 12;
+
+    check_mac0(value);
+    mac[0] = (std::int32_t)value;
+
+    if(z < 0 || z > 0xffff)
+        flag |= FLAG_SZ;
+
+    otz = (std::uint16_t)clamp<std::int64_t>(z, 0, 0xffff);
+}
+
+void gte::gpf(int shift, bool lm)
+{
+    for(int i = 1; i < 4; i++)
+        set_mac_ir(i, (std::int64_t)ir[0] * ir[i], shift, lm);
+
+    push_color();
+}
+
+void gte::gpl(int shift, bool lm)
+{
+    for(int i = 1; i < 4; i++)
+        set_mac_ir(i, ((std::int64_t)mac[i] << shift) + (std::int64_t)ir[0] * ir[i], shift, lm);
+
+    push_color();
+}
+
+unsigned gte::command_cycles(std::uint32_t command)
+{
+    switch(command & 0x3f)
+    {
+    case 0x01: return 15;   // RTPS
+    case 0x06: return 8;    // NCLIP
+    case 0x0c: return 6;    // OP
+    case 0x10: return 8;    // DPCS
+    case 0x11: return 8;    // INTPL
+    case 0x12: return 8;    // MVMVA
+    case 0x13: return 19;   // NCDS
+    case 0x14: return 13;   // CDP
+    case 0x16: return 44;   // NCDT
+    case 0x1b: return 17;   // NCCS
+    case 0x1c: return 11;   // CC
+    case 0x1e: return 14;   // NCS
+    case 0x20: return 30;   // NCT
+    case 0x28: return 5;    // SQR
+    case 0x29: return 8;    // DCPL
+    case 0x2a: return 17;   // DPCT
+    case 0x2d: return 5;    // AVSZ3
+    case 0x2e: return 6;    // AVSZ4
+    case 0x30: return 23;   // RTPT
+    case 0x3d: return 5;    // GPF
+    case 0x3e: return 5;    // GPL
+    case 0x3f: return 39;   // NCCT
+    default:   return 1;
+    }
+}
+
+void gte::execute(std::uint32_t command)
+{
+    int shift = (command & (1 << 19)) ? 12 : 0;
+    bool lm = (command & (1 << 10)) != 0;
+
+    flag = 0;
+
+    switch(command & 0x3f)
+    {
+    case 0x01:
+        rtps(v[0], shift, lm, true);
+        break;
+    case 0x06:
+        nclip();
+        break;
+    case 0x0c:
+        op(shift, lm);
+        break;
+    case 0x10:
+    {
+        std::uint8_t col[3] = {rgbc[0], rgbc[1], rgbc[2]};
+        dpcs(col, shift, lm);
+        break;
+    }
+    case 0x11:
+        intpl(shift, lm);
+        break;
+    case 0x12:
+        mvmva(command, shift, lm);
+        break;
+    case 0x13:
+        ncds(v[0], shift, lm);
+        break;
+    case 0x14:
+        cdp(shift, lm);
+        break;
+    case 0x16:
+        for(int i = 0; i < 3; i++)
+            ncds(v[i], shift, lm);
+        break;
+    case 0x1b:
+        nccs(v[0], shift, lm);
+        break;
+    case 0x1c:
+        cc(shift, lm);
+        break;
+    case 0x1e:
+        ncs(v[0], shift, lm);
+        break;
+    case 0x20:
+        for(int i = 0; i < 3; i++)
+            ncs(v[i], shift, lm);
+        break;
+    case 0x28:
+        sqr(shift);
+        break;
+    case 0x29:
+        dcpl(shift, lm);
+        break;
+    case 0x2a:
+        // Always the front of the FIFO, which moves along every time we push.
+        for(int i = 0; i < 3; i++)
+        {
+            std::uint8_t col[3] = {rgb[0][0], rgb[0][1], rgb[0][2]};
+            dpcs(col, shift, lm);
+        }
+        break;
+    case 0x2d:
+        avsz3();
+        break;
+    case 0x2e:
+        avsz4();
+        break;
+    case 0x30:
+        for(int i = 0; i < 3; i++)
+            rtps(v[i], shift, lm, i == 2);
+        break;
+    case 0x3d:
+        gpf(shift, lm);
+        break;
+    case 0x3e:
+        gpl(shift, lm);
+        break;
+    case 0x3f:
+        for(int i = 0; i < 3; i++)
+            nccs(v[i], shift, lm);
+        break;
+    default:
+        std::printf("warning: gte: unknown command 0x%07x!\n", command);
+        break;
+    }
+
+    if(flag & GTE_FLAG_ERROR)
+        flag |= 0x80000000;
+}
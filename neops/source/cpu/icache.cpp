@@ -0,0 +1,87 @@
+/**
+    This file is part of NeoPS.
+
+    NeoPS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    NeoPS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+**/
+#include <cstring>
+
+#include "cpu/icache.hpp"
+#include "state/state.hpp"
+
+using namespace cpu;
+
+icache::icache()
+{
+    reset();
+}
+
+void icache::reset()
+{
+    std::memset(tags, 0x00, sizeof(tags));
+    std::memset(data, 0x00, sizeof(data));
+}
+
+std::uint32_t icache::fetch(std::uint32_t phys_addr, std::uint32_t count)
+{
+    std::uint32_t refilled = 0;
+
+    while(count > 0)
+    {
+        std::uint32_t word = (phys_addr >> 2) & 0x3;
+        std::uint32_t run = 4 - word;
+
+        if(run > count)
+            run = count;
+
+        std::uint32_t need = valid_bits(phys_addr, run);
+        std::uint32_t& t = tags[(phys_addr & (ICACHE_SIZE - 1)) / ICACHE_LINE_SIZE];
+
+        if((t & (ICACHE_TAG_MASK | need)) != ((phys_addr & ICACHE_TAG_MASK) | need))
+        {
+            // Refill from the word that missed to the end of the line. Any words before it are only still good
+            // if the line was already holding this address.
+            std::uint32_t fill = valid_bits(phys_addr, 4 - word);
+
+            if((t & ICACHE_TAG_MASK) != (phys_addr & ICACHE_TAG_MASK))
+                t = phys_addr & ICACHE_TAG_MASK;
+
+            t |= fill;
+            refilled += 4 - word;
+        }
+
+        phys_addr += run * 4;
+        count -= run;
+    }
+
+    return refilled;
+}
+
+void icache::isolated_write(std::uint32_t addr, std::uint32_t value, bool tag_test)
+{
+    if(tag_test)
+    {
+        tags[(addr & (ICACHE_SIZE - 1)) / ICACHE_LINE_SIZE] = addr & ICACHE_TAG_MASK;
+        return;
+    }
+
+    data[(addr & (ICACHE_SIZE - 1)) >> 2] = value;
+}
+
+void icache::serialize(state::serializer& s)
+{
+    s.section("icache", 1);
+
+    s.value(tags);
+    s.value(data);
+}
@@ -18,8 +18,13 @@
 #include <cstdlib>
 #include <cstring>
 
+#include "bus/bus.hpp"
+#include "cpu/icache.hpp"
 #include "cpu/r3000a.hpp"
+#include "hle/hle.hpp"
+#include "cpu/recompiler.hpp"
 #include "register.hpp"
+#include "state/state.hpp"
 
 using namespace cpu;
 
@@ -28,6 +33,28 @@ const char* cpu_gpr_names[] = { "zero", "at", "v0", "v1", "a0", "a1", "a2", "a3"
                                 "t8", "t9", "s0", "s1", "s2", "s3", "s4", "s5",
                                 "s6", "s7", "s8", "s9", "gp", "sp", "s8/fp", "ra"};
 
+// Every handler in the op table. The threaded interpreter gets a label (and a direct call) for each of
+// these, anything else (op_illegal) goes through the handler pointer like it does in execute().
+#define R3000_THREADED_OPS(X) \
+    X(op_bcondz) X(op_j) X(op_jal) X(op_beq) X(op_bne) X(op_blez) X(op_bgtz) \
+    X(op_addi) X(op_addiu) X(op_slti) X(op_sltiu) X(op_andi) X(op_ori) X(op_xori) X(op_lui) \
+    X(op_cop0) X(op_cop1) X(op_cop2) X(op_cop3) \
+    X(op_lb) X(op_lh) X(op_lwl) X(op_lw) X(op_lbu) X(op_lhu) X(op_lwr) \
+    X(op_sb) X(op_sh) X(op_swl) X(op_sw) X(op_swr) \
+    X(op_lwc0) X(op_lwc1) X(op_lwc2) X(op_lwc3) X(op_swc0) X(op_swc1) X(op_swc2) X(op_swc3) \
+    X(op_sll) X(op_srl) X(op_sra) X(op_sllv) X(op_srav) X(op_jr) X(op_jalr) X(op_syscall) X(op_break) \
+    X(op_mfhi) X(op_mthi) X(op_mflo) X(op_mtlo) X(op_mult) X(op_multu) X(op_div) X(op_divu) \
+    X(op_add) X(op_addu) X(op_subu) X(op_and) X(op_or) X(op_xor) X(op_nor) X(op_slt) X(op_sltu)
+
+enum THREADED_LABEL
+{
+    THREADED_GENERIC = 0,
+#define R3000_LABEL(name) THREADED_##name,
+    R3000_THREADED_OPS(R3000_LABEL)
+#undef R3000_LABEL
+    THREADED_MAX
+};
+
 static inline uint32_t overflow(uint32_t x, uint32_t y, uint32_t z)
 {
     return (~(x ^ y) & (x ^ z) & 0x80000000);
@@ -44,9 +71,9 @@ static inline uint32_t overflow(uint32_t x, uint32_t y, uint32_t z)
  */
 void r3000a::op_addi()
 {
-    std::int32_t imm = (std::int16_t)instruction.i_type.imm; // Sign extend immediate value by casting to int16_t
-    int rt = instruction.i_type.rt;
-    int rs = instruction.i_type.rs;
+    std::int32_t imm = (std::int16_t)current->imm; // Sign extend immediate value by casting to int16_t
+    int rt = current->rt;
+    int rs = current->rs;
 
     std::int32_t rs_val = (std::int32_t)gpr[rs];
     std::uint32_t val = (std::int32_t)rs_val + (std::int32_t)imm;
@@ -72,9 +99,9 @@ void r3000a::op_addi()
  */
 void r3000a::op_addiu()
 {
-    std::uint32_t imm = (std::int16_t)instruction.i_type.imm;
-    int rt = instruction.i_type.rt;
-    int rs = instruction.i_type.rs;
+    std::uint32_t imm = (std::int16_t)current->imm;
+    int rt = current->rt;
+    int rs = current->rs;
 
     //std::printf("addiu: val = 0x%08x(%d)\n", (std::int16_t)imm, (std::int16_t)imm);
     write_gpr(rt, gpr[rs] + imm);
@@ -90,17 +117,17 @@ void r3000a::op_addiu()
  */
 void r3000a::op_andi()
 {
-    std::uint32_t imm = instruction.i_type.imm & 0x0000ffff; // TODO: Are bits 16-32 zeroed out?
-    int rs = instruction.i_type.rs;
-    int rt = instruction.i_type.rt;
+    std::uint32_t imm = current->imm & 0x0000ffff; // TODO: Are bits 16-32 zeroed out?
+    int rs = current->rs;
+    int rt = current->rt;
 
     write_gpr(rt, gpr[rs] & imm);
 }
 
 void r3000a::op_bgtz()
 {
-    std::int16_t target = (std::int16_t)(instruction.i_type.imm << 2);
-    int rs = instruction.i_type.rs;
+    std::int16_t target = (std::int16_t)(current->imm << 2);
+    int rs = current->rs;
 
     if(gpr[rs] != 0 && (gpr[rs] & 0x80000000) == 0)
     {
@@ -113,8 +140,8 @@ void r3000a::op_bgtz()
 
 void r3000a::op_blez()
 {
-    std::int16_t target = (std::int16_t)(instruction.i_type.imm << 2);
-    int rs = instruction.i_type.rs;
+    std::int16_t target = (std::int16_t)(current->imm << 2);
+    int rs = current->rs;
 
     if(gpr[rs] == 0 && gpr[rs] & 0x80000000)
     {
@@ -127,9 +154,9 @@ void r3000a::op_blez()
 
 void r3000a::op_bcondz()
 {
-    int rs = instruction.i_type.rs;
-    std::uint32_t is_bgez = (instruction.instruction >> 16) & 1;
-    std::uint32_t is_link = ((instruction.instruction >> 17) & 0xf) == 8;
+    int rs = current->rs;
+    std::uint32_t is_bgez = (current->word >> 16) & 1;
+    std::uint32_t is_link = ((current->word >> 17) & 0xf) == 8;
     std::int32_t val = (std::int32_t)gpr[rs];
 
     std::uint32_t test = (val < 0);
@@ -143,7 +170,7 @@ void r3000a::op_bcondz()
 
     if(test != 0)
     {
-        std::int16_t target = (std::int16_t)(instruction.i_type.imm << 2);
+        std::int16_t target = (std::int16_t)(current->imm << 2);
         //std::printf("bcondz: branching to: 0x%08x\n", pc + target - 4);
         next_pc += target;
         next_pc -= 4;
@@ -153,9 +180,9 @@ void r3000a::op_bcondz()
 
 void r3000a::op_beq()
 {
-    std::int16_t target = (std::int16_t)(instruction.i_type.imm << 2);
-    int rs = instruction.i_type.rs;
-    int rt = instruction.i_type.rt;
+    std::int16_t target = (std::int16_t)(current->imm << 2);
+    int rs = current->rs;
+    int rt = current->rt;
 
     if(gpr[rs] == gpr[rt])
     {
@@ -168,9 +195,9 @@ void r3000a::op_beq()
 
 void r3000a::op_bne()
 {
-    std::int16_t target = (std::int16_t)(instruction.i_type.imm << 2);
-    int rs = instruction.i_type.rs;
-    int rt = instruction.i_type.rt;
+    std::int16_t target = (std::int16_t)(current->imm << 2);
+    int rs = current->rs;
+    int rt = current->rt;
 
     if(gpr[rs] != gpr[rt])
     {
@@ -188,9 +215,9 @@ void r3000a::op_brk()
 
 void r3000a::op_cop0()
 {
-    if(instruction.instruction & (1 << 25))
+    if(current->word & (1 << 25))
     {
-        if((instruction.instruction & 0x1ffffff) == 0x10)
+        if((current->word & 0x1ffffff) == 0x10)
         {
             cp0->rfe();
         }
@@ -198,9 +225,9 @@ void r3000a::op_cop0()
         return;
     }
 
-    int rd = instruction.r_type.rd;
-    int rt = instruction.r_type.rt;
-    int rs = instruction.r_type.rs;
+    int rd = current->rd;
+    int rt = current->rt;
+    int rs = current->rs;
 
     if(rs == 0x00)
     {
@@ -233,8 +260,44 @@ void r3000a::op_cop1()
 
 void r3000a::op_cop2()
 {
-    std::printf("fatal: unhandled GTE instruction");
-    exit(-1);
+    if((cp0->read_gpr(0x0c) & 0x40000000) == 0)
+    {
+        cp0->trigger_exception(cop0::EXCEPTION_TYPE::COPROCESSOR_UNUSUABLE, this);
+        return;
+    }
+
+    if(current->word & (1 << 25))
+    {
+        cp2->execute(current->word & 0x1ffffff);
+        return;
+    }
+
+    int rd = current->rd;
+    int rt = current->rt;
+    int rs = current->rs;
+
+    if(rs == 0x00) // mfc2
+    {
+        load_delay = cp2->read_data(rd);
+        delay_reg = rt;
+    }
+    else if(rs == 0x02) // cfc2
+    {
+        load_delay = cp2->read_control(rd);
+        delay_reg = rt;
+    }
+    else if(rs == 0x04) // mtc2
+    {
+        cp2->write_data(rd, gpr[rt]);
+    }
+    else if(rs == 0x06) // ctc2
+    {
+        cp2->write_control(rd, gpr[rt]);
+    }
+    else
+    {
+        std::printf("warning: unknown cop2 instruction 0x%08x!\n", current->word);
+    }
 }
 
 void r3000a::op_cop3()
@@ -244,7 +307,7 @@ void r3000a::op_cop3()
 
 void r3000a::op_j()
 {
-    std::uint32_t addr = instruction.j_type.target;
+    std::uint32_t addr = current->target;
 
     next_pc = (pc & 0xf0000000) | (addr << 2);
     is_branch = true;
@@ -253,7 +316,7 @@ void r3000a::op_j()
 
 void r3000a::op_jal()
 {
-    std::uint32_t addr = instruction.j_type.target;
+    std::uint32_t addr = current->target;
 
     write_gpr(31, next_pc);
     //std::printf("jal: jump called with address 0x%08x! Returna address: 0x%08x\n", (pc & 0xf0000000) | (addr << 2), next_pc);
@@ -263,15 +326,9 @@ void r3000a::op_jal()
 
 void r3000a::op_lb()
 {
-    if(cp0->read_gpr(0x0c) & 0x00010000)
-    {
-        //std::printf("lb: ignoring read from cache!\n");
-        return;
-    }
-
-    std::uint32_t base = instruction.i_type.rs;
-    int rt = instruction.i_type.rt;
-    std::uint16_t offset = (std::int16_t)instruction.i_type.imm;
+    std::uint32_t base = current->rs;
+    int rt = current->rt;
+    std::uint16_t offset = (std::int16_t)current->imm;
 
     std::uint32_t vaddr = gpr[base] + (std::int16_t)offset;
     std::uint8_t val = (std::int8_t)cp0->virtual_read8(vaddr);
@@ -281,15 +338,9 @@ void r3000a::op_lb()
 
 void r3000a::op_lbu()
 {
-    if(cp0->read_gpr(0x0c) & 0x00010000)
-    {
-        //std::printf("lbu: ignoring read from cache!\n");
-        return;
-    }
-
-    std::uint32_t base = instruction.i_type.rs;
-    int rt = instruction.i_type.rt;
-    std::int16_t offset = (std::int16_t)instruction.i_type.imm;
+    std::uint32_t base = current->rs;
+    int rt = current->rt;
+    std::int16_t offset = (std::int16_t)current->imm;
 
     std::uint32_t vaddr = gpr[base] + (std::int16_t)offset;
     std::uint8_t val = cp0->virtual_read8(vaddr);
@@ -298,15 +349,9 @@ void r3000a::op_lbu()
 
 void r3000a::op_lh()
 {
-    if(cp0->read_gpr(0x0c) & 0x00010000)
-    {
-        //std::printf("lh: ignoring read from cache!\n");
-        return;
-    }
-
-    std::uint32_t base = instruction.i_type.rs;
-    int rt = instruction.i_type.rt;
-    std::int16_t offset = (std::int16_t)instruction.i_type.imm;
+    std::uint32_t base = current->rs;
+    int rt = current->rt;
+    std::int16_t offset = (std::int16_t)current->imm;
 
     std::uint32_t vaddr = gpr[base] + (std::int16_t)offset;
     std::int16_t val = (std::int16_t)cp0->virtual_read16(vaddr);
@@ -316,15 +361,9 @@ void r3000a::op_lh()
 
 void r3000a::op_lhu()
 {
-    if(cp0->read_gpr(0x0c) & 0x00010000)
-    {
-        //std::printf("lhu: ignoring read from cache!\n");
-        return;
-    }
-
-    std::uint32_t base = instruction.i_type.rs;
-    int rt = instruction.i_type.rt;
-    std::int16_t offset = (std::int16_t)instruction.i_type.imm;
+    std::uint32_t base = current->rs;
+    int rt = current->rt;
+    std::int16_t offset = (std::int16_t)current->imm;
 
     std::uint32_t vaddr = gpr[base] + (std::int16_t)offset;
     std::uint16_t val = cp0->virtual_read16(vaddr);
@@ -334,23 +373,17 @@ void r3000a::op_lhu()
 
 void r3000a::op_lui()
 {
-    int rt = instruction.i_type.rt;
-    std::uint32_t imm = instruction.i_type.imm << 16;
+    int rt = current->rt;
+    std::uint32_t imm = current->imm << 16;
 
     write_gpr(rt, imm);
 }
 
 void r3000a::op_lw()
 {
-    if(cp0->read_gpr(0x0c) & 0x00010000)
-    {
-        //std::printf("lw: Ignoring read from cache!\n");
-        return;
-    }
-
-    std::uint32_t base = instruction.i_type.rs;
-    int rt = instruction.i_type.rt;
-    std::uint32_t offset = (std::int16_t)instruction.i_type.imm;
+    std::uint32_t base = current->rs;
+    int rt = current->rt;
+    std::uint32_t offset = (std::int16_t)current->imm;
 
     std::uint32_t vaddr = offset + gpr[base];
     std::int32_t val = (std::int32_t)cp0->virtual_read32(vaddr);
@@ -371,8 +404,17 @@ void r3000a::op_lwc1()
 
 void r3000a::op_lwc2()
 {
-    std::printf("lwc2: invalid load from memory to GTE (not yet implemented)\n");
-    exit(-1);
+    if((cp0->read_gpr(0x0c) & 0x40000000) == 0)
+    {
+        cp0->trigger_exception(cop0::EXCEPTION_TYPE::COPROCESSOR_UNUSUABLE, this);
+        return;
+    }
+
+    std::uint32_t base = current->rs;
+    std::uint32_t offset = (std::int16_t)current->imm;
+
+    std::uint32_t vaddr = gpr[base] + offset;
+    cp2->write_data(current->rt, cp0->virtual_read32(vaddr));
 }
 
 void r3000a::op_lwc3()
@@ -382,19 +424,13 @@ void r3000a::op_lwc3()
 
 void r3000a::op_lwl()
 {
-    if(cp0->read_gpr(0x0c) & 0x00010000)
-    {
-        //std::printf("lw: Ignoring read from cache!\n");
-        return;
-    }
-
-    std::uint32_t base = instruction.i_type.rs;
-    int rt = instruction.i_type.rt;
-    std::uint32_t offset = (std::int16_t)instruction.i_type.imm;
+    std::uint32_t base = current->rs;
+    int rt = current->rt;
+    std::uint32_t offset = (std::int16_t)current->imm;
 
     std::uint32_t vaddr = offset + gpr[base]; // This Virtual Address is _possibly_ unaligned!
     std::uint32_t aligned_val = cp0->virtual_read32((vaddr & (~0x3)));
-    std::uint32_t reg_val = gpr_delay[rt];
+    std::uint32_t reg_val = (rt == (int)retire_reg) ? retire_value : gpr[rt]; // We merge with a load that's still landing.
 
     std::uint32_t val;
 
@@ -423,19 +459,13 @@ void r3000a::op_lwl()
 
 void r3000a::op_lwr()
 {
-    if(cp0->read_gpr(0x0c) & 0x00010000)
-    {
-        //std::printf("lw: Ignoring read from cache!\n");
-        return;
-    }
-
-    std::uint32_t base = instruction.i_type.rs;
-    int rt = instruction.i_type.rt;
-    std::uint32_t offset = (std::int16_t)instruction.i_type.imm;
+    std::uint32_t base = current->rs;
+    int rt = current->rt;
+    std::uint32_t offset = (std::int16_t)current->imm;
 
     std::uint32_t vaddr = offset + gpr[base]; // This Virtual Address is _possibly_ unaligned!
     std::uint32_t aligned_val = cp0->virtual_read32((vaddr & (~0x3)));
-    std::uint32_t reg_val = gpr_delay[rt];
+    std::uint32_t reg_val = (rt == (int)retire_reg) ? retire_value : gpr[rt]; // We merge with a load that's still landing.
 
     std::uint32_t val;
 
@@ -464,24 +494,18 @@ void r3000a::op_lwr()
 
 void r3000a::op_ori()
 {
-    int rt = instruction.i_type.rt;
-    int rs = instruction.i_type.rs;
-    std::uint16_t imm = instruction.i_type.imm;
+    int rt = current->rt;
+    int rs = current->rs;
+    std::uint16_t imm = current->imm;
 
     write_gpr(rt, gpr[rs] | imm);
 }
 
 void r3000a::op_sh()
 {
-    if(cp0->read_gpr(0x0c) & 0x00010000)
-    {
-        //std::printf("sh: ignoring read from cache!\n");
-        return;
-    }
-
-    std::uint32_t base = instruction.i_type.rs;
-    std::uint32_t rt = instruction.i_type.rt;
-    std::uint32_t offset = (std::int16_t)(instruction.i_type.imm);
+    std::uint32_t base = current->rs;
+    std::uint32_t rt = current->rt;
+    std::uint32_t offset = (std::int16_t)(current->imm);
 
     std::uint32_t vaddr = gpr[base] + offset;
     cp0->virtual_write16(vaddr, gpr[rt]);
@@ -489,9 +513,9 @@ void r3000a::op_sh()
 
 void r3000a::op_slti()
 {
-    std::int32_t imm = (std::int16_t)instruction.i_type.imm;
-    int rs = instruction.i_type.rs;
-    int rt = instruction.i_type.rt;
+    std::int32_t imm = (std::int16_t)current->imm;
+    int rs = current->rs;
+    int rt = current->rt;
     std::int32_t val = gpr[rs];
 
     if(val < imm)
@@ -502,15 +526,9 @@ void r3000a::op_slti()
 
 void r3000a::op_sb()
 {
-    if(cp0->read_gpr(0x0c) & 0x00010000)
-    {
-        //std::printf("sb: ignoring read from cache!\n");
-        return;
-    }
-
-    std::uint32_t base = instruction.i_type.rs;
-    std::uint32_t rt = instruction.i_type.rt;
-    std::uint32_t offset = (std::int16_t)(instruction.i_type.imm);
+    std::uint32_t base = current->rs;
+    std::uint32_t rt = current->rt;
+    std::uint32_t offset = (std::int16_t)(current->imm);
 
     std::uint32_t vaddr = gpr[base] + offset;
     cp0->virtual_write8(vaddr, gpr[rt]);
@@ -518,15 +536,9 @@ void r3000a::op_sb()
 
 void r3000a::op_sw()
 {
-    if(cp0->read_gpr(0x0c) & 0x00010000)
-    {
-        //std::printf("sw: ignoring read from cache!\n");
-        return;
-    }
-
-    std::uint32_t base = instruction.i_type.rs;
-    std::uint32_t rt = instruction.i_type.rt;
-    std::uint32_t offset = (std::int16_t)(instruction.i_type.imm);
+    std::uint32_t base = current->rs;
+    std::uint32_t rt = current->rt;
+    std::uint32_t offset = (std::int16_t)(current->imm);
 
     std::uint32_t vaddr = gpr[base] + offset;
     cp0->virtual_write32(vaddr, gpr[rt]);
@@ -534,15 +546,18 @@ void r3000a::op_sw()
 
 void r3000a::op_swl()
 {
-    std::uint32_t base = instruction.i_type.rs;
-    std::uint32_t rt = instruction.i_type.rt;
-    std::uint32_t offset = (std::int16_t)(instruction.i_type.imm);
+    std::uint32_t base = current->rs;
+    std::uint32_t rt = current->rt;
+    std::uint32_t offset = (std::int16_t)(current->imm);
 
     std::uint32_t vaddr = gpr[base] + offset; // This address _may_ be unaligned!
+    std::int32_t before = budget;
     std::uint32_t aligned_val = cp0->virtual_read32(vaddr & (~0x3));
     std::uint32_t reg_val = gpr[rt];
     std::uint32_t val;
 
+    budget = before; // The real thing merges on the bus, the CPU never waits for a read.
+
     switch(vaddr & 0x3)
     {
     case 0:
@@ -565,15 +580,18 @@ void r3000a::op_swl()
 
 void r3000a::op_swr()
 {
-    std::uint32_t base = instruction.i_type.rs;
-    std::uint32_t rt = instruction.i_type.rt;
-    std::uint32_t offset = (std::int16_t)(instruction.i_type.imm);
+    std::uint32_t base = current->rs;
+    std::uint32_t rt = current->rt;
+    std::uint32_t offset = (std::int16_t)(current->imm);
 
     std::uint32_t vaddr = gpr[base] + offset; // This address _may_ be unaligned!
+    std::int32_t before = budget;
     std::uint32_t aligned_val = cp0->virtual_read32(vaddr & (~0x3));
     std::uint32_t reg_val = gpr[rt];
     std::uint32_t val;
 
+    budget = before; // The real thing merges on the bus, the CPU never waits for a read.
+
     switch(vaddr & 0x3)
     {
     case 0:
@@ -606,8 +624,17 @@ void r3000a::op_swc1()
 
 void r3000a::op_swc2()
 {
-    std::printf("swc2: invalid write  to GTE (not yet implemented)\n");
-    exit(-1);
+    if((cp0->read_gpr(0x0c) & 0x40000000) == 0)
+    {
+        cp0->trigger_exception(cop0::EXCEPTION_TYPE::COPROCESSOR_UNUSUABLE, this);
+        return;
+    }
+
+    std::uint32_t base = current->rs;
+    std::uint32_t offset = (std::int16_t)current->imm;
+
+    std::uint32_t vaddr = gpr[base] + offset;
+    cp0->virtual_write32(vaddr, cp2->read_data(current->rt));
 }
 
 void r3000a::op_swc3()
@@ -617,9 +644,9 @@ void r3000a::op_swc3()
 
 void r3000a::op_xori()
 {
-    int rs = instruction.i_type.rs;
-    int rt = instruction.i_type.rt;
-    std::uint32_t imm = (std::uint32_t)instruction.i_type.imm;
+    int rs = current->rs;
+    int rt = current->rt;
+    std::uint32_t imm = (std::uint32_t)current->imm;
 
     std::uint32_t val = gpr[rs] ^ imm;
     write_gpr(rt, val);
@@ -629,9 +656,9 @@ void r3000a::op_xori()
 
 void r3000a::op_add()
 {
-    int rs = instruction.r_type.rs;
-    int rt = instruction.r_type.rt;
-    int rd = instruction.r_type.rd;
+    int rs = current->rs;
+    int rt = current->rt;
+    int rd = current->rd;
 
     std::int32_t rs_val = (std::int32_t)gpr[rs];
     std::int32_t rt_val = (std::int32_t)gpr[rt];
@@ -649,18 +676,18 @@ void r3000a::op_add()
 
 void r3000a::op_addu()
 {
-    int rs = instruction.r_type.rs;
-    int rt = instruction.r_type.rt;
-    int rd = instruction.r_type.rd;
+    int rs = current->rs;
+    int rt = current->rt;
+    int rd = current->rd;
 
     write_gpr(rd, gpr[rs] + gpr[rt]);
 }
 
 void r3000a::op_and()
 {
-    int rs = instruction.r_type.rs;
-    int rt = instruction.r_type.rt;
-    int rd = instruction.r_type.rd;
+    int rs = current->rs;
+    int rt = current->rt;
+    int rd = current->rd;
 
     std::uint32_t val = gpr[rs] & gpr[rt];
     write_gpr(rd, val);
@@ -673,8 +700,10 @@ void r3000a::op_break()
 
 void r3000a::op_div()
 {
-    std::int32_t numerator = (std::int32_t)gpr[instruction.r_type.rs];
-    std::int32_t divisor = (std::int32_t)gpr[instruction.r_type.rt];
+    hilo_ready = now() + R3000_DIV_CYCLES;
+
+    std::int32_t numerator = (std::int32_t)gpr[current->rs];
+    std::int32_t divisor = (std::int32_t)gpr[current->rt];
 
     if(divisor == 0) // Division by zero! That isn't good!!!
     {
@@ -699,8 +728,10 @@ void r3000a::op_div()
 
 void r3000a::op_divu()
 {
-    int rs = instruction.r_type.rs;
-    int rt = instruction.r_type.rt;
+    hilo_ready = now() + R3000_DIV_CYCLES;
+
+    int rs = current->rs;
+    int rt = current->rt;
 
     std::uint32_t numerator = gpr[rs];
     std::uint32_t divisor = gpr[rt];
@@ -719,7 +750,9 @@ void r3000a::op_divu()
 
 void r3000a::op_mfhi()
 {
-    int rd = instruction.r_type.rd;
+    wait_hilo();
+
+    int rd = current->rd;
 
     write_gpr(rd, hi);
 }
@@ -727,30 +760,36 @@ void r3000a::op_mfhi()
 
 void r3000a::op_mflo()
 {
-    int rd = instruction.r_type.rd;
+    wait_hilo();
+
+    int rd = current->rd;
 
     write_gpr(rd, lo);
 }
 
 void r3000a::op_mthi()
 {
-    int rs = instruction.r_type.rs;
+    int rs = current->rs;
 
     hi = gpr[rs];
 }
 
 void r3000a::op_mtlo()
 {
-    int rs = instruction.r_type.rs;
+    int rs = current->rs;
 
     lo = gpr[rs];
 }
 
 void r3000a::op_mult()
 {
-    int rs = instruction.r_type.rs;
-    int rt = instruction.r_type.rt;
-    int rd = instruction.r_type.rd;
+    int rs = current->rs;
+    int rt = current->rt;
+    int rd = current->rd;
+
+    // The multiplier finishes early when rs has fewer significant bits.
+    std::uint32_t bits = ((std::int32_t)gpr[rs] < 0) ? ~gpr[rs] : gpr[rs];
+    hilo_ready = now() + ((bits < 0x800) ? 6 : (bits < 0x100000) ? 9 : 13);
 
     std::uint64_t val = (std::int32_t)gpr[rs] * (std::int32_t)gpr[rt];
 
@@ -760,9 +799,11 @@ void r3000a::op_mult()
 
 void r3000a::op_multu()
 {
-    int rs = instruction.r_type.rs;
-    int rt = instruction.r_type.rt;
-    int rd = instruction.r_type.rd;
+    int rs = current->rs;
+    int rt = current->rt;
+    int rd = current->rd;
+
+    hilo_ready = now() + ((gpr[rs] < 0x800) ? 6 : (gpr[rs] < 0x100000) ? 9 : 13);
 
     std::uint64_t val = gpr[rs] * gpr[rt];
 
@@ -772,9 +813,9 @@ void r3000a::op_multu()
 
 void r3000a::op_nor()
 {
-    int rs = instruction.r_type.rs;
-    int rt = instruction.r_type.rt;
-    int rd = instruction.r_type.rd;
+    int rs = current->rs;
+    int rt = current->rt;
+    int rd = current->rd;
 
     std::uint32_t val = ~(gpr[rs] | gpr[rt]);
     write_gpr(rd, val);
@@ -782,17 +823,18 @@ void r3000a::op_nor()
 
 void r3000a::op_jalr()
 {
-    int rs = instruction.r_type.rs;
+    int rs = current->rs;
+    std::uint32_t target = gpr[rs]; // Read it before we link, in case rs is ra.
 
     write_gpr(31, next_pc);
-    //std::printf("jalr: Attempting to jump to 0x%08x! Return address: 0x%08x\n", gpr[rs], next_pc);
-    next_pc = gpr[rs];
+    //std::printf("jalr: Attempting to jump to 0x%08x! Return address: 0x%08x\n", target, next_pc);
+    next_pc = target;
     is_branch = true;
 }
 
 void r3000a::op_jr()
 {
-    int rs = instruction.r_type.rs;
+    int rs = current->rs;
 
     //std::printf("jr: Attempting to jump to 0x%08x!\n", gpr[rs]);
     next_pc = gpr[rs];
@@ -801,9 +843,9 @@ void r3000a::op_jr()
 
 void r3000a::op_or()
 {
-    int rd = instruction.r_type.rd;
-    int rs = instruction.r_type.rs;
-    int rt = instruction.r_type.rt;
+    int rd = current->rd;
+    int rs = current->rs;
+    int rt = current->rt;
 
     std::uint32_t val = gpr[rs] | gpr[rt];
     write_gpr(rd, val);
@@ -811,9 +853,9 @@ void r3000a::op_or()
 
 void r3000a::op_sll()
 {
-    int rt = instruction.r_type.rt;
-    int rd = instruction.r_type.rd;
-    int sh = instruction.r_type.shamt;
+    int rt = current->rt;
+    int rd = current->rd;
+    int sh = current->shamt;
 
     std::uint32_t val = gpr[rt] << sh;
     write_gpr(rd, val);
@@ -821,9 +863,9 @@ void r3000a::op_sll()
 
 void r3000a::op_sllv()
 {
-    int rd = instruction.r_type.rd;
-    int rs = instruction.r_type.rs;
-    int rt = instruction.r_type.rt;
+    int rd = current->rd;
+    int rs = current->rs;
+    int rt = current->rt;
 
     std::uint32_t val = gpr[rt] << (gpr[rs] & 0x1f);
     write_gpr(rd, val);
@@ -831,9 +873,9 @@ void r3000a::op_sllv()
 
 void r3000a::op_sltiu()
 {
-    std::uint32_t imm = (std::int16_t)instruction.i_type.imm;
-    int rs = instruction.i_type.rs;
-    int rt = instruction.i_type.rt;
+    std::uint32_t imm = (std::int16_t)current->imm;
+    int rs = current->rs;
+    int rt = current->rt;
 
     if(gpr[rs] < imm)
         write_gpr(rt, 0x00000001);
@@ -843,8 +885,8 @@ void r3000a::op_sltiu()
 
 void r3000a::op_slt()
 {
-    int rd = instruction.r_type.rd;
-    int rs = instruction.r_type.rs;
+    int rd = current->rd;
+    int rs = current->rs;
 
     std::int32_t vs = (std::int32_t)gpr[rs];
     std::int32_t vt = (std::int32_t)gpr[rs];
@@ -857,9 +899,9 @@ void r3000a::op_slt()
 
 void r3000a::op_sltu()
 {
-    int rd = instruction.r_type.rd;
-    int rt = instruction.r_type.rt;
-    int rs = instruction.r_type.rs;
+    int rd = current->rd;
+    int rt = current->rt;
+    int rs = current->rs;
 
     if(gpr[rs] < gpr[rt])
         write_gpr(rd, 0x00000001);
@@ -869,18 +911,18 @@ void r3000a::op_sltu()
 
 void r3000a::op_sra()
 {
-    int rd = instruction.r_type.rd;
-    int rt = instruction.r_type.rt;
+    int rd = current->rd;
+    int rt = current->rt;
 
-    std::int32_t val = (std::int32_t)(gpr[rt]) >> instruction.r_type.shamt;
+    std::int32_t val = (std::int32_t)(gpr[rt]) >> current->shamt;
     write_gpr(rd, (std::uint32_t)val);
 }
 
 void r3000a::op_srav()
 {
-    int rd = instruction.r_type.rd;
-    int rs = instruction.r_type.rs;
-    int rt = instruction.r_type.rt;
+    int rd = current->rd;
+    int rs = current->rs;
+    int rt = current->rt;
 
     std::uint32_t val = (std::int32_t)(gpr[rt]) >> (gpr[rs] & 0x1f);
     write_gpr(rd, (std::uint32_t)val);
@@ -888,18 +930,18 @@ void r3000a::op_srav()
 
 void r3000a::op_srl()
 {
-    int rd = instruction.r_type.rd;
-    int rt = instruction.r_type.rt;
+    int rd = current->rd;
+    int rt = current->rt;
 
-    std::uint32_t val = gpr[rt] >> instruction.r_type.shamt;
+    std::uint32_t val = gpr[rt] >> current->shamt;
     write_gpr(rd, val);
 }
 
 void r3000a::op_srlv()
 {
-    int rd = instruction.r_type.rd;
-    int rs = instruction.r_type.rs;
-    int rt = instruction.r_type.rt;
+    int rd = current->rd;
+    int rs = current->rs;
+    int rt = current->rt;
 
     std::uint32_t val = gpr[rt] >> (gpr[rs] & 0x1f);
     write_gpr(rd, val);
@@ -907,9 +949,9 @@ void r3000a::op_srlv()
 
 void r3000a::op_subu()
 {
-    int rd = instruction.r_type.rd;
-    int rt = instruction.r_type.rt;
-    int rs = instruction.r_type.rs;
+    int rd = current->rd;
+    int rt = current->rt;
+    int rs = current->rs;
 
     write_gpr(rd, gpr[rs] - gpr[rt]);
 }
@@ -919,11 +961,23 @@ void r3000a::op_syscall()
     cp0->trigger_exception(cop0::EXCEPTION_TYPE::SYSCALL, this);
 }
 
+void r3000a::op_illegal()
+{
+    std::uint32_t opcode = current->word >> 26;
+
+    if(opcode == 0)
+        std::printf("fatal: unhandled special instruction 0x%08x! Opcode: 0x%02x\n", current->word, current->word & 0x3f);
+    else
+        std::printf("fatal: unhandled instruction 0x%08x! Opcode: 0x%02x\n", current->word, opcode);
+
+    exit(-1);
+}
+
 void r3000a::op_xor()
 {
-    int rd = instruction.r_type.rd;
-    int rt = instruction.r_type.rt;
-    int rs = instruction.r_type.rs;
+    int rd = current->rd;
+    int rt = current->rt;
+    int rs = current->rs;
 
     std::uint32_t val = gpr[rs] ^ gpr[rt];
     write_gpr(rd, val);
@@ -933,90 +987,126 @@ void r3000a::op_xor()
 
 r3000a::r3000a()
 {
-    cp0 = new cop0();
+    ic = new icache();
+    cp0 = new cop0(ic, &budget);
+    cp2 = new gte();
+    jit = nullptr;
+    exec_mode = INTERPRETER;
+    budget = 0;
+    budget_ahead = 0;
+    block_fetch = 0;
+    run_start = 0;
+    run_end = 0;
+    hilo_ready = 0;
+    fetch_cycles = 0;
+    hle_kernel = nullptr;
+    hook_addr = 0;
+    hook = nullptr;
+    hook_data = nullptr;
+
+    for(int i = 0; i < R3000_OP_MAX; i++)
+        ops[i] = &r3000a::op_illegal;
 
-    for(int i = 0; i < 0x3f; i++)
+    // Fill instruction jump table
+    ops[0x01] = &r3000a::op_bcondz;
+    ops[0x02] = &r3000a::op_j;
+    ops[0x03] = &r3000a::op_jal;
+    ops[0x04] = &r3000a::op_beq;
+    ops[0x05] = &r3000a::op_bne;
+    ops[0x06] = &r3000a::op_blez;
+    ops[0x07] = &r3000a::op_bgtz;
+    ops[0x08] = &r3000a::op_addi;
+    ops[0x09] = &r3000a::op_addiu;
+    ops[0x0a] = &r3000a::op_slti;
+    ops[0x0b] = &r3000a::op_sltiu;
+    ops[0x0c] = &r3000a::op_andi;
+    ops[0x0d] = &r3000a::op_ori;
+    ops[0x0e] = &r3000a::op_xori;
+    ops[0x0f] = &r3000a::op_lui;
+    ops[0x10] = &r3000a::op_cop0;
+    ops[0x11] = &r3000a::op_cop1;
+    ops[0x12] = &r3000a::op_cop2;
+    ops[0x13] = &r3000a::op_cop3;
+    ops[0x20] = &r3000a::op_lb;
+    ops[0x21] = &r3000a::op_lh;
+    ops[0x22] = &r3000a::op_lwl;
+    ops[0x23] = &r3000a::op_lw;
+    ops[0x24] = &r3000a::op_lbu;
+    ops[0x25] = &r3000a::op_lhu;
+    ops[0x26] = &r3000a::op_lwr;
+    ops[0x28] = &r3000a::op_sb;
+    ops[0x29] = &r3000a::op_sh;
+    ops[0x2a] = &r3000a::op_swl;
+    ops[0x2b] = &r3000a::op_sw;
+    ops[0x2e] = &r3000a::op_swr;
+    ops[0x30] = &r3000a::op_lwc0;
+    ops[0x31] = &r3000a::op_lwc1;
+    ops[0x32] = &r3000a::op_lwc2;
+    ops[0x33] = &r3000a::op_lwc3;
+    ops[0x38] = &r3000a::op_swc0;
+    ops[0x39] = &r3000a::op_swc1;
+    ops[0x3a] = &r3000a::op_swc2;
+    ops[0x3b] = &r3000a::op_swc3;
+
+
+    ops[R3000_SPECIAL + 0x00] = &r3000a::op_sll;
+    ops[R3000_SPECIAL + 0x02] = &r3000a::op_srl;
+    ops[R3000_SPECIAL + 0x03] = &r3000a::op_sra;
+    ops[R3000_SPECIAL + 0x04] = &r3000a::op_sllv;
+    ops[R3000_SPECIAL + 0x06] = &r3000a::op_srl;
+    ops[R3000_SPECIAL + 0x07] = &r3000a::op_srav;
+    ops[R3000_SPECIAL + 0x08] = &r3000a::op_jr;
+    ops[R3000_SPECIAL + 0x09] = &r3000a::op_jalr;
+    ops[R3000_SPECIAL + 0x0c] = &r3000a::op_syscall;
+    ops[R3000_SPECIAL + 0x0d] = &r3000a::op_break;
+    ops[R3000_SPECIAL + 0x10] = &r3000a::op_mfhi;
+    ops[R3000_SPECIAL + 0x11] = &r3000a::op_mthi;
+    ops[R3000_SPECIAL + 0x12] = &r3000a::op_mflo;
+    ops[R3000_SPECIAL + 0x13] = &r3000a::op_mtlo;
+    ops[R3000_SPECIAL + 0x18] = &r3000a::op_mult;
+    ops[R3000_SPECIAL + 0x19] = &r3000a::op_multu;
+    ops[R3000_SPECIAL + 0x1a] = &r3000a::op_div;
+    ops[R3000_SPECIAL + 0x1b] = &r3000a::op_divu;
+    ops[R3000_SPECIAL + 0x20] = &r3000a::op_add;
+    ops[R3000_SPECIAL + 0x21] = &r3000a::op_addu;
+    ops[R3000_SPECIAL + 0x23] = &r3000a::op_subu;
+    ops[R3000_SPECIAL + 0x24] = &r3000a::op_and;
+    ops[R3000_SPECIAL + 0x25] = &r3000a::op_or;
+    ops[R3000_SPECIAL + 0x26] = &r3000a::op_xor;
+    ops[R3000_SPECIAL + 0x27] = &r3000a::op_nor;
+    ops[R3000_SPECIAL + 0x2a] = &r3000a::op_slt;
+    ops[R3000_SPECIAL + 0x2b] = &r3000a::op_sltu;
+
+    // Everything issues in a cycle. Loads hold the pipeline up until the data's back, which for RAM (where
+    // nearly all of them go) takes a while, so we charge that up front and cop0 settles the difference for
+    // anywhere else. Stores go through the write buffer. GTE commands get their own cost in decode().
+    for(int i = 0; i < R3000_OP_MAX; i++)
+        costs[i] = 1;
+
+    costs[0x20] = costs[0x21] = costs[0x22] = costs[0x23] = 1 + PSX_RAM_READ_CYCLES;
+    costs[0x24] = costs[0x25] = costs[0x26] = costs[0x32] = 1 + PSX_RAM_READ_CYCLES;
+
+    // Work out which label of the threaded interpreter every entry jumps to.
+    for(int i = 0; i < R3000_OP_MAX; i++)
     {
-        ops_normal[i] = nullptr;
-        ops_special[i] = nullptr;
+        labels[i] = THREADED_GENERIC;
+#define R3000_LABEL(name) if(ops[i] == &r3000a::name) labels[i] = THREADED_##name;
+        R3000_THREADED_OPS(R3000_LABEL)
+#undef R3000_LABEL
     }
 
-    // Fill instruction jump table
-    ops_normal[0x01] = &op_bcondz;
-    ops_normal[0x02] = &op_j;
-    ops_normal[0x03] = &op_jal;
-    ops_normal[0x04] = &op_beq;
-    ops_normal[0x05] = &op_bne;
-    ops_normal[0x06] = &op_blez;
-    ops_normal[0x07] = &op_bgtz;
-    ops_normal[0x08] = &op_addi;
-    ops_normal[0x09] = &op_addiu;
-    ops_normal[0x0a] = &op_slti;
-    ops_normal[0x0b] = &op_sltiu;
-    ops_normal[0x0c] = &op_andi;
-    ops_normal[0x0d] = &op_ori;
-    ops_normal[0x0e] = &op_xori;
-    ops_normal[0x0f] = &op_lui;
-    ops_normal[0x10] = &op_cop0;
-    ops_normal[0x11] = &op_cop1;
-    ops_normal[0x12] = &op_cop2;
-    ops_normal[0x13] = &op_cop3;
-    ops_normal[0x20] = &op_lb;
-    ops_normal[0x21] = &op_lh;
-    ops_normal[0x22] = &op_lwl;
-    ops_normal[0x23] = &op_lw;
-    ops_normal[0x24] = &op_lbu;
-    ops_normal[0x25] = &op_lhu;
-    ops_normal[0x26] = &op_lwr;
-    ops_normal[0x28] = &op_sb;
-    ops_normal[0x29] = &op_sh;
-    ops_normal[0x2a] = &op_swl;
-    ops_normal[0x2b] = &op_sw;
-    ops_normal[0x2e] = &op_swr;
-    ops_normal[0x30] = &op_lwc0;
-    ops_normal[0x31] = &op_lwc1;
-    ops_normal[0x32] = &op_lwc2;
-    ops_normal[0x33] = &op_lwc3;
-    ops_normal[0x38] = &op_swc0;
-    ops_normal[0x39] = &op_swc1;
-    ops_normal[0x3a] = &op_swc2;
-    ops_normal[0x3b] = &op_swc3;
-
-
-    ops_special[0x00] = &op_sll;
-    ops_special[0x02] = &op_srl;
-    ops_special[0x03] = &op_sra;
-    ops_special[0x04] = &op_sllv;
-    ops_special[0x06] = &op_srl;
-    ops_special[0x07] = &op_srav;
-    ops_special[0x08] = &op_jr;
-    ops_special[0x09] = &op_jalr;
-    ops_special[0x0c] = &op_syscall;
-    ops_special[0x0d] = &op_break;
-    ops_special[0x10] = &op_mfhi;
-    ops_special[0x11] = &op_mthi;
-    ops_special[0x12] = &op_mflo;
-    ops_special[0x13] = &op_mtlo;
-    ops_special[0x18] = &op_mult;
-    ops_special[0x19] = &op_multu;
-    ops_special[0x1a] = &op_div;
-    ops_special[0x1b] = &op_divu;
-    ops_special[0x20] = &op_add;
-    ops_special[0x21] = &op_addu;
-    ops_special[0x23] = &op_subu;
-    ops_special[0x24] = &op_and;
-    ops_special[0x25] = &op_or;
-    ops_special[0x26] = &op_xor;
-    ops_special[0x27] = &op_nor;
-    ops_special[0x2a] = &op_slt;
-    ops_special[0x2b] = &op_sltu;
-
     reset();
 }
 
 r3000a::~r3000a()
 {
+#ifdef NEOPS_HAS_RECOMPILER
+    delete jit;
+#endif
+    delete hle_kernel;
+    delete cp2;
     delete cp0;
+    delete ic;
 }
 
 void r3000a::reset()
@@ -1026,13 +1116,90 @@ void r3000a::reset()
     pc = 0xbfc00000; // BIOS location.
     hi = 0xcafebabe;
     lo = 0xcaf3bab3;
+    epc = 0;
     next_pc = pc + 4;
     is_branch = false;
     delay_slot = false;
     load_delay = 0;
     delay_reg = 0;
+    retire_value = 0;
+    retire_reg = 0;
     std::memset(gpr, 0x00, sizeof(gpr));
-    std::memset(gpr_delay, 0x00, sizeof(gpr_delay));
+    std::memset(&next_instruction, 0x00, sizeof(next_instruction));
+    cp2->reset();
+    ic->reset();
+    budget = 0;
+    budget_ahead = 0;
+    block_fetch = 0;
+    run_start = 0;
+    run_end = 0;
+    hilo_ready = 0;
+
+    cache.flush();
+    current_block = nullptr;
+
+#ifdef NEOPS_HAS_RECOMPILER
+    if(jit != nullptr)
+        jit->flush();
+#endif
+    block_pc = 0;
+    block_index = 0;
+}
+
+void r3000a::serialize(state::serializer& s)
+{
+    s.section("r3000a", 1);
+    bool hle = hle_kernel != nullptr;
+    std::uint64_t clock = now();
+
+    s.value(gpr);
+    s.value(hi);
+    s.value(lo);
+    s.value(epc);
+    s.value(pc);
+    s.value(next_pc);
+    s.value(load_delay);
+    s.value(delay_reg);
+    s.value(retire_value);
+    s.value(retire_reg);
+    s.value(is_branch);
+    s.value(delay_slot);
+    s.value(next_instruction);
+    s.value(hle);
+
+    if(s.loading())
+        set_hle(hle);
+
+    // Ours, so before anything that opens a section of its own.
+    s.value(clock);
+    s.value(hilo_ready);
+
+    cp0->serialize(s);
+    cp2->serialize(s);
+
+    if(hle_kernel != nullptr)
+        hle_kernel->serialize(s);
+
+    ic->serialize(s);
+
+    if(s.loading())
+    {
+        budget = 0;
+        budget_ahead = 0;
+        run_start = clock;
+        run_end = clock;
+
+        // RAM's changed under us, so nothing we decoded or compiled can be trusted.
+        cache.flush();
+        current_block = nullptr;
+
+#ifdef NEOPS_HAS_RECOMPILER
+        if(jit != nullptr)
+            jit->flush();
+#endif
+        block_pc = 0;
+        block_index = 0;
+    }
 }
 
 std::uint32_t r3000a::read_gpr(unsigned reg) const
@@ -1042,47 +1209,374 @@ std::uint32_t r3000a::read_gpr(unsigned reg) const
 
 void r3000a::write_gpr(unsigned reg, std::uint32_t value)
 {
-    gpr_delay[reg] = value;
+    gpr[reg] = value;
     gpr[0] = 0x00000000;
+
+    if(reg == retire_reg)
+        retire_reg = 0;
 }
 
-void r3000a::cycle()
+void r3000a::decode(std::uint32_t word, decoded_instruction& op) const
+{
+    instruction_t in;
+    in.instruction = word;
+
+    std::uint32_t opcode = word >> 26;
+    std::uint32_t index = (opcode == 0) ? R3000_SPECIAL + (word & 0x3f) : opcode;
+
+    op.handler = ops[index];
+    op.label = labels[index];
+    op.cycles = costs[index];
+
+    if(opcode == 0x12 && (word & (1 << 25)))
+        op.cycles = gte::command_cycles(word & 0x1ffffff);
+
+    op.word = word;
+    op.target = in.j_type.target;
+    op.imm = in.i_type.imm;
+    op.rs = in.r_type.rs;
+    op.rt = in.r_type.rt;
+    op.rd = in.r_type.rd;
+    op.shamt = in.r_type.shamt;
+}
+
+block* r3000a::build_block(std::uint32_t phys_addr)
 {
-    instruction.instruction = cp0->virtual_read32(pc);
+    const std::uint32_t* gen = bus::page_generation(phys_addr);
+
+    if(gen == nullptr)
+        return nullptr;
+
+    block* b = cache.create(phys_addr, gen);
+    std::uint32_t addr = phys_addr;
+    bool delay = false;
+
+    // Decode up to (and including) the delay slot of the first branch. We never cross a page,
+    // so a block only ever has to watch a single page's generation.
+    while(b->ops.size() < BLOCK_MAX_INSTRUCTIONS)
+    {
+        // Don't run on into a kernel entry point (or the hook), it has to start its own (uncached) block.
+        if(!b->ops.empty() && !delay && trapped(addr))
+            break;
+
+        decoded_instruction op;
+        decode(bus::read_word(addr), op);
+        b->ops.push_back(op);
+
+        addr += 4;
+
+        if(delay || (addr & (PSX_PAGE_SIZE - 1)) == 0)
+            break;
+
+        std::uint32_t opcode = op.word >> 26;
+        std::uint32_t funct = op.word & 0x3f;
+
+        if((opcode >= 0x01 && opcode <= 0x07) || (opcode == 0 && (funct == 0x08 || funct == 0x09)))
+            delay = true;
+    }
+
+    return b;
+}
+
+const decoded_instruction* r3000a::fetch()
+{
+    // Fast path, we're still running straight through a block.
+    if(current_block != nullptr && pc == block_pc && block_index < current_block->ops.size() && current_block->valid())
+    {
+        budget -= fetch_cycles;
+        block_pc += 4;
+        return &current_block->ops[block_index++];
+    }
+
+    current_block = nullptr;
+
+    if((pc & 0x3) == 0)
+    {
+        std::uint32_t phys_addr = cop0::virtual_to_physical(pc);
+
+        // Kernel entry points and the hook are never cached, so we see every jump to them.
+        if(trapped(phys_addr))
+        {
+            if(hook != nullptr && phys_addr == hook_addr)
+            {
+                hook_callback callback = hook;
+                hook = nullptr;
+
+                // Whatever the jump's delay slot loaded lands before we hand over.
+                gpr[delay_reg] = load_delay;
+                gpr[0] = 0;
+                load_delay = 0;
+                delay_reg = 0;
+
+                callback(hook_data);
+                return fetch();
+            }
+
+            if(hle_kernel != nullptr && hle_kernel->intercept(phys_addr))
+                return fetch();
+
+            budget -= fetch_stall(pc, phys_addr, 1);
+            decode(cp0->virtual_fetch32(pc), uncached);
+            return &uncached;
+        }
+
+        current_block = cache.lookup(phys_addr);
+        if(current_block == nullptr)
+            current_block = build_block(phys_addr);
+    }
+
+    if(current_block == nullptr)
+    {
+        // Not somewhere we can cache (or misaligned, which virtual_fetch32 will complain about).
+        budget -= fetch_stall(pc, cop0::virtual_to_physical(pc), 1);
+        decode(cp0->virtual_fetch32(pc), uncached);
+        return &uncached;
+    }
+
+    // Refilling the instruction cache is charged for the whole block now. Uncached code is charged as it goes,
+    // so where we happen to start a block (after loading a state, say) doesn't change how long anything takes.
+    if(pc < 0xa0000000 && (*bus::cache_control() & ICACHE_CTRL_ENABLE))
+    {
+        budget -= fetch_stall(pc, current_block->phys_addr, current_block->ops.size());
+        fetch_cycles = 0;
+    }
+    else
+    {
+        fetch_cycles = fetch_stall(pc, current_block->phys_addr, 1);
+        budget -= fetch_cycles;
+    }
+
+    block_pc = pc + 4;
+    block_index = 1;
+    return &current_block->ops[0];
+}
+
+inline void r3000a::issue(const decoded_instruction* op)
+{
+    current = op;
     pc = next_pc;
     next_pc += 4;
 
     delay_slot = is_branch;
     is_branch = false;
 
-    write_gpr(delay_reg, load_delay);
+    // The load issued by the last instruction lands once this one's read its operands.
+    retire_value = load_delay;
+    retire_reg = delay_reg;
     load_delay = 0;
     delay_reg = 0;
+}
 
-    std::uint32_t opcode = instruction.instruction >> 26;
-    //std::printf("(0x%08x): 0x%08x\n", pc - 4, instruction.instruction);
+inline void r3000a::retire()
+{
+    gpr[retire_reg] = retire_value;
+    gpr[0] = 0x00000000;
+}
 
-    if(opcode == 0)
+void r3000a::execute(const decoded_instruction* op)
+{
+    issue(op);
+
+    //std::printf("(0x%08x): 0x%08x\n", pc - 4, current->word);
+    (this->*current->handler)();
+
+    retire();
+}
+
+void r3000a::cycle()
+{
+    const decoded_instruction* op = fetch();
+
+    budget -= op->cycles;
+    execute(op);
+}
+
+void r3000a::start_run(std::uint32_t cycles)
+{
+    std::uint64_t start = now();
+
+    budget = (std::int32_t)(cycles & 0x7fffffff);
+    budget_ahead = 0;
+    run_start = start;
+    run_end = start + budget;
+}
+
+void r3000a::preempt(std::uint32_t cycles)
+{
+    std::uint64_t end = run_start + cycles;
+
+    if(end >= run_end)
+        return;
+
+    // now() stays put, there's just less budget left to get there.
+    budget -= (std::int32_t)(run_end - end);
+    run_end = end;
+}
+
+std::uint32_t r3000a::run(std::uint32_t cycles)
+{
+    if(exec_mode == THREADED)
+        return run_threaded(cycles);
+
+#ifdef NEOPS_HAS_RECOMPILER
+    if(jit != nullptr && exec_mode != INTERPRETER)
+        return jit->run(cycles);
+#endif
+
+    std::uint64_t start = now();
+    start_run(cycles);
+
+    while(budget > 0)
+        cycle();
+
+    return (std::uint32_t)(now() - start);
+}
+
+std::uint32_t r3000a::run_threaded(std::uint32_t cycles)
+{
+    const decoded_instruction* op;
+    std::uint64_t start = now();
+
+    start_run(cycles);
+
+#if defined(__GNUC__)
+    // Label addresses, in THREADED_* order.
+    static void* const dispatch[THREADED_MAX] =
     {
-        std::uint32_t opcode_s = instruction.instruction & 0x3f;
-        if(ops_special[opcode_s] == nullptr)
+        &&threaded_generic,
+#define R3000_LABEL(name) &&threaded_##name,
+        R3000_THREADED_OPS(R3000_LABEL)
+#undef R3000_LABEL
+    };
+
+    // The jump to the next instruction is copied onto the end of every handler, so each one
+    // has its own indirect branch for the predictor to learn.
+#define R3000_DISPATCH()                        \
+    if(budget <= 0)                             \
+        return (std::uint32_t)(now() - start);  \
+    op = fetch();                               \
+    budget -= op->cycles;                       \
+    issue(op);                                  \
+    goto *dispatch[op->label]
+
+    R3000_DISPATCH();
+
+threaded_generic:
+    (this->*op->handler)();
+    retire();
+    R3000_DISPATCH();
+
+#define R3000_LABEL(name) threaded_##name: name(); retire(); R3000_DISPATCH();
+    R3000_THREADED_OPS(R3000_LABEL)
+#undef R3000_LABEL
+#undef R3000_DISPATCH
+#else
+    // No computed goto, so settle for a switch the compiler can (hopefully) turn into a jump table.
+    while(budget > 0)
+    {
+        op = fetch();
+        budget -= op->cycles;
+        issue(op);
+
+        switch(op->label)
         {
-            std::printf("fatal: unhandled special instruction 0x%08x! Opcode: 0x%02x\n", instruction.instruction, opcode_s);
-            exit(-1);
+#define R3000_LABEL(name) case THREADED_##name: name(); break;
+        R3000_THREADED_OPS(R3000_LABEL)
+#undef R3000_LABEL
+        default:
+            (this->*op->handler)();
+            break;
         }
 
-        (this->*ops_special[opcode_s])();
+        retire();
     }
+
+    return (std::uint32_t)(now() - start);
+#endif
+}
+
+bool r3000a::set_hle(bool enabled)
+{
+    if(enabled == (hle_kernel != nullptr))
+        return enabled;
+
+    if(enabled)
+        hle_kernel = new hle::kernel(this);
     else
     {
-        if(ops_normal[opcode] == nullptr)
-        {
-            std::printf("fatal: unhandled instruction 0x%08x! Opcode: 0x%02x\n", instruction.instruction, opcode);
-            exit(-1);
-        }
+        delete hle_kernel;
+        hle_kernel = nullptr;
+    }
+
+    // Blocks built without HLE may have run on into a kernel entry point.
+    flush_code();
+    return enabled;
+}
+
+void r3000a::set_hook(std::uint32_t phys_addr, hook_callback callback, void* data)
+{
+    hook_addr = phys_addr;
+    hook = callback;
+    hook_data = data;
+
+    // Same again, there might be a block running on into the hook, or one compiled there.
+    if(hook != nullptr)
+        flush_code();
+}
+
+bool r3000a::trapped(std::uint32_t phys_addr) const
+{
+    return (hle_kernel != nullptr && hle::kernel::traps(phys_addr)) || (hook != nullptr && phys_addr == hook_addr);
+}
+
+std::uint32_t r3000a::fetch_stall(std::uint32_t vaddr, std::uint32_t phys_addr, std::uint32_t count)
+{
+    // Only kuseg and kseg0 go through the instruction cache, and only while it's on.
+    if(vaddr < 0xa0000000 && (*bus::cache_control() & ICACHE_CTRL_ENABLE))
+        return ic->fetch(phys_addr, count) * ICACHE_REFILL_CYCLES;
+
+    // Otherwise every instruction is a read of its own.
+    return count * bus::read_cycles(phys_addr, 4);
+}
 
-        (this->*ops_normal[opcode])();
+void r3000a::wait_hilo()
+{
+    std::uint64_t t = now();
+
+    if(hilo_ready > t)
+        budget -= (std::int32_t)(hilo_ready - t);
+}
+
+void r3000a::flush_code()
+{
+    cache.flush();
+    current_block = nullptr;
+
+#ifdef NEOPS_HAS_RECOMPILER
+    if(jit != nullptr)
+        jit->flush();
+#endif
+}
+
+bool r3000a::set_exec_mode(EXEC_MODE mode)
+{
+#ifdef NEOPS_HAS_RECOMPILER
+    if((mode == RECOMPILER || mode == DIFFERENTIAL) && jit == nullptr)
+        jit = new recompiler(this);
+
+    if(jit != nullptr)
+        jit->set_differential(mode == DIFFERENTIAL);
+
+    exec_mode = mode;
+    return true;
+#else
+    if(mode == RECOMPILER || mode == DIFFERENTIAL)
+    {
+        std::printf("warning: the recompiler isn't available on this host, sticking with the interpreter!\n");
+        return false;
     }
 
-    std::memcpy(gpr, gpr_delay, sizeof(gpr));
-}
\ No newline at end of file
+    exec_mode = mode;
+    return true;
+#endif
+}
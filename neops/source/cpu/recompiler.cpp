@@ -0,0 +1,1604 @@
+/**
+    This file is part of NeoPS.
+
+    NeoPS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    NeoPS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with NeoPS.  If not, see <http://www.gnu.org/licenses/>.
+**/
+#include "cpu/recompiler.hpp"
+
+#ifdef NEOPS_HAS_RECOMPILER
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#include "bus/bus.hpp"
+#include "cpu/icache.hpp"
+#include "cpu/r3000a.hpp"
+#include "register.hpp"
+
+#ifdef NEOPS_HAS_FASTMEM
+#include <signal.h>
+#include <ucontext.h>
+#endif
+
+using namespace cpu;
+
+enum X64_REG
+{
+    RAX = 0, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15,
+};
+
+enum X64_COND
+{
+    CC_B    = 0x2,
+    CC_E    = 0x4,
+    CC_NE   = 0x5,
+    CC_S    = 0x8,
+    CC_NS   = 0x9,
+    CC_L    = 0xc,
+    CC_LE   = 0xe,
+};
+
+// Calling convention for the helpers we call out to.
+#if defined(_WIN32)
+#define ARG0        RCX
+#define ARG1        RDX
+#define ARG2        R8
+#define FRAME_SIZE  40 // 32 bytes of shadow space, plus 8 to keep the stack aligned.
+#else
+#define ARG0        RDI
+#define ARG1        RSI
+#define ARG2        RDX
+#define FRAME_SIZE  8
+#endif
+
+/**
+ *  Native instructions we know how to emit. Anything not in here goes back through the interpreter.
+ */
+enum NATIVE_OP
+{
+    OP_FALLBACK = 0,
+    OP_ADDIU,
+    OP_ANDI,
+    OP_ORI,
+    OP_XORI,
+    OP_LUI,
+    OP_SLTI,
+    OP_SLTIU,
+    OP_ADDU,
+    OP_SUBU,
+    OP_AND,
+    OP_OR,
+    OP_XOR,
+    OP_NOR,
+    OP_SLTU,
+    OP_SLL,
+    OP_SRL,
+    OP_SRA,
+    OP_SLLV,
+    OP_SRLV,
+    OP_SRAV,
+    OP_MFHI,
+    OP_MFLO,
+    OP_MTHI,
+    OP_MTLO,
+    OP_LB,
+    OP_LBU,
+    OP_LH,
+    OP_LHU,
+    OP_LW,
+    OP_SB,
+    OP_SH,
+    OP_SW,
+    OP_BEQ,
+    OP_BNE,
+    OP_BGTZ,
+    OP_BCONDZ,
+    OP_J,
+    OP_JAL,
+    OP_JR,
+    OP_JALR,
+};
+
+/**
+ *  Does this instruction have a delay slot?
+ */
+static inline bool is_branch_word(std::uint32_t word)
+{
+    std::uint32_t opcode = word >> 26;
+    std::uint32_t funct = word & 0x3f;
+
+    return (opcode >= 0x01 && opcode <= 0x07) || (opcode == 0 && (funct == 0x08 || funct == 0x09));
+}
+
+/**
+ *  Just enough of an x86-64 assembler to get us by. All memory operands are [rbx + disp32],
+ *  where rbx always holds the r3000a we're running.
+ */
+class cpu::x64_emitter
+{
+public:
+    x64_emitter(std::uint8_t* buffer) : ptr(buffer) {}
+
+    std::uint8_t* pos() const
+    {
+        return ptr;
+    }
+
+    void byte(std::uint8_t b)
+    {
+        *ptr++ = b;
+    }
+
+    void dword(std::uint32_t d)
+    {
+        std::memcpy(ptr, &d, sizeof(d));
+        ptr += sizeof(d);
+    }
+
+    void qword(std::uint64_t q)
+    {
+        std::memcpy(ptr, &q, sizeof(q));
+        ptr += sizeof(q);
+    }
+
+    void rex(bool w, int reg, int base)
+    {
+        std::uint8_t r = 0x40 | (w << 3) | ((reg & 8) >> 1) | ((base & 8) >> 3);
+
+        if(r != 0x40)
+            byte(r);
+    }
+
+    void modrm_reg(int reg, int rm)
+    {
+        byte(0xc0 | ((reg & 7) << 3) | (rm & 7));
+    }
+
+    void modrm_rbx(int reg, std::int32_t disp)
+    {
+        byte(0x80 | ((reg & 7) << 3) | RBX);
+        dword(disp);
+    }
+
+    void mov_r32_m(int dst, std::int32_t disp)
+    {
+        rex(false, dst, RBX);
+        byte(0x8b);
+        modrm_rbx(dst, disp);
+    }
+
+    void mov_m_r32(std::int32_t disp, int src)
+    {
+        rex(false, src, RBX);
+        byte(0x89);
+        modrm_rbx(src, disp);
+    }
+
+    void mov_m_imm32(std::int32_t disp, std::uint32_t imm)
+    {
+        byte(0xc7);
+        modrm_rbx(0, disp);
+        dword(imm);
+    }
+
+    // mov [rbx + index*4 + disp], src
+    void mov_mindex_r32(std::int32_t disp, int index, int src)
+    {
+        byte(0x89);
+        byte(0x80 | ((src & 7) << 3) | 0x04);
+        byte(0x80 | ((index & 7) << 3) | RBX);
+        dword(disp);
+    }
+
+    void mov_r32_imm(int dst, std::uint32_t imm)
+    {
+        rex(false, 0, dst);
+        byte(0xb8 + (dst & 7));
+        dword(imm);
+    }
+
+    void mov_r64_imm(int dst, std::uint64_t imm)
+    {
+        rex(true, 0, dst);
+        byte(0xb8 + (dst & 7));
+        qword(imm);
+    }
+
+    void mov_r32_r32(int dst, int src)
+    {
+        rex(false, src, dst);
+        byte(0x89);
+        modrm_reg(src, dst);
+    }
+
+    void mov_r64_r64(int dst, int src)
+    {
+        rex(true, src, dst);
+        byte(0x89);
+        modrm_reg(src, dst);
+    }
+
+    // op = 0x01 add, 0x09 or, 0x21 and, 0x29 sub, 0x31 xor, 0x39 cmp, 0x85 test
+    void alu_r32_r32(std::uint8_t op, int dst, int src)
+    {
+        rex(false, src, dst);
+        byte(op);
+        modrm_reg(src, dst);
+    }
+
+    // ext = 0 add, 1 or, 4 and, 5 sub, 6 xor, 7 cmp
+    void alu_r32_imm(int ext, int dst, std::uint32_t imm)
+    {
+        rex(false, 0, dst);
+        byte(0x81);
+        modrm_reg(ext, dst);
+        dword(imm);
+    }
+
+    // ext = 4 shl, 5 shr, 7 sar
+    void shift_r32_imm(int ext, int dst, std::uint8_t amount)
+    {
+        rex(false, 0, dst);
+        byte(0xc1);
+        modrm_reg(ext, dst);
+        byte(amount);
+    }
+
+    void shift_r32_cl(int ext, int dst)
+    {
+        rex(false, 0, dst);
+        byte(0xd3);
+        modrm_reg(ext, dst);
+    }
+
+    void not_r32(int dst)
+    {
+        rex(false, 0, dst);
+        byte(0xf7);
+        modrm_reg(2, dst);
+    }
+
+    // setcc al; movzx eax, al
+    void setcc_eax(int cc)
+    {
+        byte(0x0f);
+        byte(0x90 + cc);
+        byte(0xc0);
+        byte(0x0f);
+        byte(0xb6);
+        byte(0xc0);
+    }
+
+    void cmp_m32_imm(std::int32_t disp, std::uint32_t imm)
+    {
+        byte(0x81);
+        modrm_rbx(7, disp);
+        dword(imm);
+    }
+
+    // imul dst, [rbx + disp], imm
+    void imul_r32_m_imm(int dst, std::int32_t disp, std::uint32_t imm)
+    {
+        rex(false, dst, RBX);
+        byte(0x69);
+        modrm_rbx(dst, disp);
+        dword(imm);
+    }
+
+    void sub_m32_imm(std::int32_t disp, std::uint32_t imm)
+    {
+        byte(0x81);
+        modrm_rbx(5, disp);
+        dword(imm);
+    }
+
+    void cmp_m8_imm(std::int32_t disp, std::uint8_t imm)
+    {
+        byte(0x80);
+        modrm_rbx(7, disp);
+        byte(imm);
+    }
+
+    // cmp dword [rax], imm
+    void cmp_mrax_imm32(std::uint32_t imm)
+    {
+        byte(0x81);
+        byte(0x38);
+        dword(imm);
+    }
+
+    // test dword [rax], imm
+    void test_mrax_imm32(std::uint32_t imm)
+    {
+        byte(0xf7);
+        byte(0x00);
+        dword(imm);
+    }
+
+    // inc dword [rax + rcx*4]
+    void inc_mrax_rcx4()
+    {
+        byte(0xff);
+        byte(0x04);
+        byte(0x88);
+    }
+
+    // mov/movzx/movsx eax, [r15 + r13]
+    void load_fastmem(int size, bool sign)
+    {
+        byte(0x43);
+
+        if(size == 4)
+        {
+            byte(0x8b);
+        }
+        else
+        {
+            byte(0x0f);
+            byte(size == 1 ? (sign ? 0xbe : 0xb6) : (sign ? 0xbf : 0xb7));
+        }
+
+        byte(0x04);
+        byte(0x2f);
+    }
+
+    // mov [r15 + r13], r14b/r14w/r14d
+    void store_fastmem(int size)
+    {
+        if(size == 2)
+            byte(0x66);
+
+        byte(0x47);
+        byte(size == 1 ? 0x88 : 0x89);
+        byte(0x34);
+        byte(0x2f);
+    }
+
+    void nop()
+    {
+        byte(0x90);
+    }
+
+    void jcc8(int cc, std::int8_t rel)
+    {
+        byte(0x70 + cc);
+        byte(rel);
+    }
+
+    /**
+     *  Emit a jcc with a 32-bit displacement, returning the displacement so it can be patched later.
+     */
+    std::uint8_t* jcc32(int cc)
+    {
+        byte(0x0f);
+        byte(0x80 + cc);
+        std::uint8_t* site = ptr;
+        dword(0);
+        return site;
+    }
+
+    std::uint8_t* jmp32()
+    {
+        byte(0xe9);
+        std::uint8_t* site = ptr;
+        dword(0);
+        return site;
+    }
+
+    void jmp_r64(int reg)
+    {
+        rex(false, 0, reg);
+        byte(0xff);
+        modrm_reg(4, reg);
+    }
+
+    void call_r64(int reg)
+    {
+        rex(false, 0, reg);
+        byte(0xff);
+        modrm_reg(2, reg);
+    }
+
+    void push(int reg)
+    {
+        rex(false, 0, reg);
+        byte(0x50 + (reg & 7));
+    }
+
+    void pop(int reg)
+    {
+        rex(false, 0, reg);
+        byte(0x58 + (reg & 7));
+    }
+
+    void sub_rsp(std::uint8_t imm)
+    {
+        byte(0x48);
+        byte(0x83);
+        byte(0xec);
+        byte(imm);
+    }
+
+    void add_rsp(std::uint8_t imm)
+    {
+        byte(0x48);
+        byte(0x83);
+        byte(0xc4);
+        byte(imm);
+    }
+
+    void ret()
+    {
+        byte(0xc3);
+    }
+
+    static void patch(std::uint8_t* site, const std::uint8_t* target)
+    {
+        std::int32_t rel = (std::int32_t)(target - (site + 4));
+        std::memcpy(site, &rel, sizeof(rel));
+    }
+
+private:
+    std::uint8_t* ptr;
+};
+
+/**
+ *  The recompiler running native code on this thread. A fastmem fault can only come from the thread running
+ *  the code, so that's the only one whose sites the handler needs to look at (and nobody else touches them).
+ */
+static thread_local recompiler* running = nullptr;
+
+#ifdef NEOPS_HAS_FASTMEM
+static struct sigaction previous_segv;
+static bool segv_installed = false;
+static std::mutex segv_lock;    /**< Recompilers can start up on any thread */
+
+static void segv_handler(int sig, siginfo_t* info, void* context)
+{
+    ucontext_t* uc = (ucontext_t*)context;
+    std::uint8_t* resume = recompiler::fastmem_fault((std::uint8_t*)uc->uc_mcontext.gregs[REG_RIP]);
+
+    if(resume != nullptr)
+    {
+        uc->uc_mcontext.gregs[REG_RIP] = (greg_t)resume;
+        return;
+    }
+
+    // Not ours, so pass it along. If nobody else wants it, put the default back and crash when we return, like we should.
+    if(previous_segv.sa_flags & SA_SIGINFO)
+        previous_segv.sa_sigaction(sig, info, context);
+    else if(previous_segv.sa_handler != SIG_DFL && previous_segv.sa_handler != SIG_IGN)
+        previous_segv.sa_handler(sig);
+    else
+        signal(SIGSEGV, SIG_DFL);
+}
+
+static bool install_segv_handler()
+{
+    std::lock_guard<std::mutex> lock(segv_lock);
+
+    if(segv_installed)
+        return true;
+
+    struct sigaction sa;
+    std::memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = segv_handler;
+    sa.sa_flags = SA_SIGINFO;
+    sigemptyset(&sa.sa_mask);
+
+    segv_installed = (sigaction(SIGSEGV, &sa, &previous_segv) == 0);
+    return segv_installed;
+}
+#endif
+
+recompiler::recompiler(r3000a* cpu)
+{
+    this->cpu = cpu;
+
+#if defined(_WIN32)
+    code = (std::uint8_t*)VirtualAlloc(nullptr, RECOMPILER_CODE_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+#else
+    code = (std::uint8_t*)mmap(nullptr, RECOMPILER_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(code == MAP_FAILED)
+        code = nullptr;
+#endif
+
+    if(code == nullptr)
+    {
+        std::printf("fatal: recompiler: unable to allocate executable memory!\n");
+        exit(-1);
+    }
+
+    std::uint8_t* base = (std::uint8_t*)cpu;
+    off_gpr         = (std::uint8_t*)&cpu->gpr[0] - base;
+    off_hi          = (std::uint8_t*)&cpu->hi - base;
+    off_lo          = (std::uint8_t*)&cpu->lo - base;
+    off_pc          = (std::uint8_t*)&cpu->pc - base;
+    off_next_pc     = (std::uint8_t*)&cpu->next_pc - base;
+    off_load_delay  = (std::uint8_t*)&cpu->load_delay - base;
+    off_delay_reg   = (std::uint8_t*)&cpu->delay_reg - base;
+    off_is_branch   = (std::uint8_t*)&cpu->is_branch - base;
+    off_budget      = (std::uint8_t*)&cpu->budget - base;
+    off_ahead       = (std::uint8_t*)&cpu->budget_ahead - base;
+    off_block_fetch = (std::uint8_t*)&cpu->block_fetch - base;
+
+    differential = false;
+    checked = 0;
+    skipped = 0;
+    epoch = 0;
+
+    fastmem = nullptr;
+#ifdef NEOPS_HAS_FASTMEM
+    fastmem = bus::fastmem_base();
+
+    if(fastmem != nullptr && !install_segv_handler())
+    {
+        std::printf("warning: recompiler: unable to install fault handler, fastmem disabled!\n");
+        fastmem = nullptr;
+    }
+#endif
+
+    emit_trampolines();
+}
+
+recompiler::~recompiler()
+{
+    if(differential)
+        std::printf("recompiler: %llu blocks checked against the interpreter, %llu skipped (self-modifying)\n", (unsigned long long)checked, (unsigned long long)skipped);
+
+    if(running == this)
+        running = nullptr;
+
+#if defined(_WIN32)
+    VirtualFree(code, 0, MEM_RELEASE);
+#else
+    munmap(code, RECOMPILER_CODE_SIZE);
+#endif
+}
+
+void recompiler::emit_trampolines()
+{
+    x64_emitter e(code);
+
+    // enter(cpu, code): save everything we use, keep the CPU in rbx and jump into the block.
+    enter = (enter_t)e.pos();
+    e.push(RBX);
+    e.push(RBP);
+    e.push(R12);
+    e.push(R13);
+    e.push(R14);
+    e.push(R15);
+    e.sub_rsp(FRAME_SIZE);
+    e.mov_r64_r64(RBX, ARG0);
+    e.jmp_r64(ARG1);
+
+    // Blocks jump here to get back out, with the link request (or nullptr) in rax.
+    leave = e.pos();
+    e.add_rsp(FRAME_SIZE);
+    e.pop(R15);
+    e.pop(R14);
+    e.pop(R13);
+    e.pop(R12);
+    e.pop(RBP);
+    e.pop(RBX);
+    e.ret();
+
+    code_base = e.pos() - code;
+    code_used = code_base;
+}
+
+void recompiler::flush()
+{
+    blocks.clear();
+    fallbacks.clear();
+    fastmem_sites.clear();
+    code_used = code_base;
+    epoch++;
+}
+
+recompiler::native_block* recompiler::lookup(std::uint32_t vaddr)
+{
+    std::unordered_map<std::uint32_t, native_block>::iterator it = blocks.find(vaddr);
+
+    if(it != blocks.end() && *it->second.page_gen == it->second.generation)
+        return &it->second;
+
+    std::uint8_t* stale = (it != blocks.end()) ? it->second.body : nullptr;
+    std::uint32_t start_epoch = epoch;
+    native_block nb;
+
+    if(!compile(vaddr, nb))
+        return nullptr;
+
+    // Anything still linked to the old code gets bounced along to the new code.
+    if(stale != nullptr && epoch == start_epoch)
+    {
+        x64_emitter e(stale);
+        x64_emitter::patch(e.jmp32(), nb.body);
+    }
+
+    native_block& slot = blocks[vaddr];
+    slot = nb;
+    return &slot;
+}
+
+int recompiler::classify(const decoded_instruction& op) const
+{
+    static const struct
+    {
+        operation_t handler;
+        int         kind;
+    } natives[] =
+    {
+        {&r3000a::op_addiu, OP_ADDIU},
+        {&r3000a::op_andi, OP_ANDI},
+        {&r3000a::op_ori, OP_ORI},
+        {&r3000a::op_xori, OP_XORI},
+        {&r3000a::op_lui, OP_LUI},
+        {&r3000a::op_slti, OP_SLTI},
+        {&r3000a::op_sltiu, OP_SLTIU},
+        {&r3000a::op_addu, OP_ADDU},
+        {&r3000a::op_subu, OP_SUBU},
+        {&r3000a::op_and, OP_AND},
+        {&r3000a::op_or, OP_OR},
+        {&r3000a::op_xor, OP_XOR},
+        {&r3000a::op_nor, OP_NOR},
+        {&r3000a::op_sltu, OP_SLTU},
+        {&r3000a::op_sll, OP_SLL},
+        {&r3000a::op_srl, OP_SRL},
+        {&r3000a::op_sra, OP_SRA},
+        {&r3000a::op_sllv, OP_SLLV},
+        {&r3000a::op_srlv, OP_SRLV},
+        {&r3000a::op_srav, OP_SRAV},
+        {&r3000a::op_mfhi, OP_MFHI},
+        {&r3000a::op_mflo, OP_MFLO},
+        {&r3000a::op_mthi, OP_MTHI},
+        {&r3000a::op_mtlo, OP_MTLO},
+        {&r3000a::op_lb, OP_LB},
+        {&r3000a::op_lbu, OP_LBU},
+        {&r3000a::op_lh, OP_LH},
+        {&r3000a::op_lhu, OP_LHU},
+        {&r3000a::op_lw, OP_LW},
+        {&r3000a::op_sb, OP_SB},
+        {&r3000a::op_sh, OP_SH},
+        {&r3000a::op_sw, OP_SW},
+        {&r3000a::op_beq, OP_BEQ},
+        {&r3000a::op_bne, OP_BNE},
+        {&r3000a::op_bgtz, OP_BGTZ},
+        {&r3000a::op_bcondz, OP_BCONDZ},
+        {&r3000a::op_j, OP_J},
+        {&r3000a::op_jal, OP_JAL},
+        {&r3000a::op_jr, OP_JR},
+        {&r3000a::op_jalr, OP_JALR},
+    };
+
+    // We match on the handler the decoder picked rather than the opcode, so we always do exactly
+    // what the interpreter would have done with this instruction.
+    for(std::size_t i = 0; i < sizeof(natives) / sizeof(natives[0]); i++)
+    {
+        if(op.handler == natives[i].handler)
+            return natives[i].kind;
+    }
+
+    return OP_FALLBACK;
+}
+
+void recompiler::emit_load_gpr(x64_emitter& e, int reg, unsigned mips_reg)
+{
+    if(mips_reg == 0)
+        e.alu_r32_r32(0x31, reg, reg); // xor reg, reg
+    else
+        e.mov_r32_m(reg, off_gpr + mips_reg * 4);
+}
+
+void recompiler::emit_store_gpr(x64_emitter& e, unsigned mips_reg, int reg)
+{
+    if(mips_reg != 0)
+        e.mov_m_r32(off_gpr + mips_reg * 4, reg);
+}
+
+// Retire the pending load (if any). Clobbers ecx and edx, leaves eax alone.
+void recompiler::emit_apply_load_delay(x64_emitter& e)
+{
+    e.mov_r32_m(RCX, off_delay_reg);
+    e.mov_r32_m(RDX, off_load_delay);
+    e.mov_mindex_r32(off_gpr, RCX, RDX);
+    e.mov_m_imm32(off_gpr, 0);
+    e.mov_m_imm32(off_delay_reg, 0);
+    e.mov_m_imm32(off_load_delay, 0);
+}
+
+void recompiler::emit_call(x64_emitter& e, const void* function)
+{
+    e.mov_r64_imm(RAX, (std::uint64_t)function);
+    e.call_r64(RAX);
+}
+
+// Tell anything we call how far ahead of itself the budget is: the cycles of the instructions after this one, and
+// fetching them if the block's uncached (see @ref fetch_block). Clobbers eax. Set it back to 0 after the call.
+void recompiler::emit_set_ahead(x64_emitter& e, std::uint32_t cycles, std::uint32_t ops)
+{
+    if(ops == 0)
+    {
+        e.mov_m_imm32(off_ahead, cycles);
+        return;
+    }
+
+    e.imul_r32_m_imm(RAX, off_block_fetch, ops);
+    e.alu_r32_imm(0, RAX, cycles);
+    e.mov_m_r32(off_ahead, RAX);
+}
+
+void recompiler::emit_exit_static(x64_emitter& e, std::uint32_t target)
+{
+    e.mov_m_imm32(off_pc, target);
+    e.mov_m_imm32(off_next_pc, target + 4);
+
+    // Until the dispatcher links us to the next block, this jump lands on the stub right after it,
+    // which hands the dispatcher the address to patch.
+    std::uint8_t* site = e.jmp32();
+    x64_emitter::patch(site, e.pos());
+    e.mov_r64_imm(RAX, (std::uint64_t)site);
+    x64_emitter::patch(e.jmp32(), leave);
+}
+
+// Exit to the address in r12d.
+void recompiler::emit_exit_dynamic(x64_emitter& e)
+{
+    e.mov_m_r32(off_pc, R12);
+    e.mov_r32_r32(RAX, R12);
+    e.alu_r32_imm(0, RAX, 4);
+    e.mov_m_r32(off_next_pc, RAX);
+    e.alu_r32_r32(0x31, RAX, RAX);
+    x64_emitter::patch(e.jmp32(), leave);
+}
+
+bool recompiler::compile(std::uint32_t vaddr, native_block& nb)
+{
+    std::uint32_t phys_addr = cop0::virtual_to_physical(vaddr);
+
+    // Kernel entry points (and the hook) have to go through the interpreter's fetch, where they get looked at.
+    if(cpu->trapped(phys_addr))
+        return false;
+
+    block* b = cpu->cache.lookup(phys_addr);
+
+    if(b == nullptr)
+        b = cpu->build_block(phys_addr);
+
+    if(b == nullptr)
+        return false;
+
+    if(code_used + RECOMPILER_BLOCK_MAX > RECOMPILER_CODE_SIZE)
+        flush();
+
+    const std::vector<decoded_instruction>& ops = b->ops;
+    std::size_t n = ops.size();
+    std::vector<int> kinds(n);
+
+    for(std::size_t i = 0; i < n; i++)
+        kinds[i] = classify(ops[i]);
+
+    // We only emit a branch natively if its delay slot is in this block and is native too, otherwise
+    // the pair goes through the interpreter, which keeps track of the delay slot for us.
+    for(std::size_t i = 0; i < n; i++)
+    {
+        if(!is_branch_word(ops[i].word))
+            continue;
+
+        if(i + 1 >= n || kinds[i + 1] == OP_FALLBACK || is_branch_word(ops[i + 1].word))
+        {
+            kinds[i] = OP_FALLBACK;
+            if(i + 1 < n)
+                kinds[i + 1] = OP_FALLBACK;
+        }
+    }
+
+    // Fastmem code can't cope with an isolated cache, so any block using it checks for one whenever it could have changed.
+    bool fast = false;
+
+    for(std::size_t i = 0; i < n; i++)
+        fast = fast || (kinds[i] >= OP_LB && kinds[i] <= OP_SW);
+
+    fast = fast && fastmem != nullptr && !differential;
+
+    /**
+     *  A fastmem access, and where it has to go if it faults.
+     */
+    struct fastmem_access
+    {
+        std::uint8_t*   site;   /**< The access itself. */
+        std::uint8_t*   resume; /**< First instruction after it. */
+        int             kind;   /**< What sort of access it is. */
+        std::uint32_t   ahead;  /**< Cycles of the instructions after it. */
+        std::uint32_t   ops;    /**< Instructions after it. */
+    };
+
+    x64_emitter e(code + code_used);
+    std::vector<std::uint8_t*> exits; // Jumps to the bail-out at the end of the block.
+    std::vector<fastmem_access> accesses;
+
+    nb.body = e.pos();
+    nb.page_gen = b->page_gen;
+    nb.generation = b->generation;
+    nb.length = n;
+
+    // Bail out if the code's been overwritten, we've been entered in a delay slot, or we're out of budget.
+    e.mov_r64_imm(RAX, (std::uint64_t)b->page_gen);
+    e.cmp_mrax_imm32(b->generation);
+    exits.push_back(e.jcc32(CC_NE));
+    e.cmp_m8_imm(off_is_branch, 0);
+    exits.push_back(e.jcc32(CC_NE));
+    e.cmp_m32_imm(off_budget, 0);
+    exits.push_back(e.jcc32(CC_LE));
+
+    if(fast)
+    {
+        e.mov_r64_imm(RAX, (std::uint64_t)cpu->cp0->status_register());
+        e.test_mrax_imm32(0x00010000);
+        exits.push_back(e.jcc32(CC_NE));
+        e.mov_r64_imm(R15, (std::uint64_t)fastmem);
+    }
+
+    // The whole block's cost comes off the budget up front. Anything that needs to know the time part way
+    // through (MULT/DIV and hi/lo) gets told how much of that we haven't actually run yet.
+    std::vector<std::uint32_t> ahead(n);
+    std::uint32_t cycles = 0;
+
+    for(std::size_t i = n; i-- > 0;)
+    {
+        ahead[i] = cycles;
+        cycles += ops[i].cycles;
+    }
+
+    e.sub_m32_imm(off_budget, cycles);
+
+    // Charge for fetching the block, same as the interpreter does: refills if it goes through the instruction
+    // cache and that's on, a bus read per instruction if not (see @ref r3000a::fetch_stall).
+    e.mov_r64_r64(ARG0, RBX);
+    e.mov_r32_imm(ARG1, vaddr);
+    e.mov_r32_imm(ARG2, n);
+    emit_call(e, (const void*)&recompiler::fetch_block);
+
+    bool pending = true;    // Could there be a load waiting to be retired? We can't know on entry.
+    bool synced = false;    // Do pc/next_pc in memory already point at this instruction?
+    int branch = OP_FALLBACK;
+    std::uint32_t branch_target = 0;
+
+    for(std::size_t i = 0; i < n; i++)
+    {
+        const decoded_instruction& op = ops[i];
+        std::uint32_t pc = vaddr + i * 4;
+        bool last = (i + 1 == n);
+        std::int32_t simm = (std::int16_t)op.imm;
+
+        if(kinds[i] == OP_FALLBACK)
+        {
+            if(!synced)
+            {
+                e.mov_m_imm32(off_pc, pc);
+                e.mov_m_imm32(off_next_pc, pc + 4);
+            }
+
+            // It might want the time (MULT/DIV, or memory), so it has to know where we really are.
+            emit_set_ahead(e, ahead[i], n - 1 - i);
+
+            fallbacks.push_back(op);
+            e.mov_r64_r64(ARG0, RBX);
+            e.mov_r64_imm(ARG1, (std::uint64_t)&fallbacks.back());
+            emit_call(e, (const void*)&recompiler::interpret);
+
+            e.mov_m_imm32(off_ahead, 0);
+
+            if(!last)
+            {
+                // Bail if it took an exception (or a branch), or wrote over us.
+                e.alu_r32_imm(7, RAX, pc + 4);
+                exits.push_back(e.jcc32(CC_NE));
+                e.mov_r64_imm(RAX, (std::uint64_t)b->page_gen);
+                e.cmp_mrax_imm32(b->generation);
+                exits.push_back(e.jcc32(CC_NE));
+
+                if(fast)
+                {
+                    e.mov_r64_imm(RAX, (std::uint64_t)cpu->cp0->status_register());
+                    e.test_mrax_imm32(0x00010000);
+                    exits.push_back(e.jcc32(CC_NE));
+                }
+            }
+
+            synced = true;
+            pending = true;
+            continue;
+        }
+
+        synced = false;
+
+        switch(kinds[i])
+        {
+        case OP_ADDIU:
+        case OP_ANDI:
+        case OP_ORI:
+        case OP_XORI:
+        case OP_LUI:
+        case OP_SLTI:
+        case OP_SLTIU:
+            emit_load_gpr(e, RAX, op.rs);
+
+            if(kinds[i] == OP_ADDIU)
+                e.alu_r32_imm(0, RAX, simm);
+            else if(kinds[i] == OP_ANDI)
+                e.alu_r32_imm(4, RAX, op.imm);
+            else if(kinds[i] == OP_ORI)
+                e.alu_r32_imm(1, RAX, op.imm);
+            else if(kinds[i] == OP_XORI)
+                e.alu_r32_imm(6, RAX, op.imm);
+            else if(kinds[i] == OP_LUI)
+                e.mov_r32_imm(RAX, (std::uint32_t)op.imm << 16);
+            else
+            {
+                e.alu_r32_imm(7, RAX, simm);
+                e.setcc_eax(kinds[i] == OP_SLTI ? CC_L : CC_B);
+            }
+
+            if(pending)
+                emit_apply_load_delay(e);
+            emit_store_gpr(e, op.rt, RAX);
+            break;
+
+        case OP_ADDU:
+        case OP_SUBU:
+        case OP_AND:
+        case OP_OR:
+        case OP_XOR:
+        case OP_NOR:
+        case OP_SLTU:
+            emit_load_gpr(e, RAX, op.rs);
+            emit_load_gpr(e, RCX, op.rt);
+
+            if(kinds[i] == OP_ADDU)
+                e.alu_r32_r32(0x01, RAX, RCX);
+            else if(kinds[i] == OP_SUBU)
+                e.alu_r32_r32(0x29, RAX, RCX);
+            else if(kinds[i] == OP_AND)
+                e.alu_r32_r32(0x21, RAX, RCX);
+            else if(kinds[i] == OP_OR)
+                e.alu_r32_r32(0x09, RAX, RCX);
+            else if(kinds[i] == OP_XOR)
+                e.alu_r32_r32(0x31, RAX, RCX);
+            else if(kinds[i] == OP_NOR)
+            {
+                e.alu_r32_r32(0x09, RAX, RCX);
+                e.not_r32(RAX);
+            }
+            else
+            {
+                e.alu_r32_r32(0x39, RAX, RCX);
+                e.setcc_eax(CC_B);
+            }
+
+            if(pending)
+                emit_apply_load_delay(e);
+            emit_store_gpr(e, op.rd, RAX);
+            break;
+
+        case OP_SLL:
+        case OP_SRL:
+        case OP_SRA:
+            emit_load_gpr(e, RAX, op.rt);
+            e.shift_r32_imm(kinds[i] == OP_SLL ? 4 : (kinds[i] == OP_SRL ? 5 : 7), RAX, op.shamt);
+
+            if(pending)
+                emit_apply_load_delay(e);
+            emit_store_gpr(e, op.rd, RAX);
+            break;
+
+        case OP_SLLV:
+        case OP_SRLV:
+        case OP_SRAV:
+            emit_load_gpr(e, RAX, op.rt);
+            emit_load_gpr(e, RCX, op.rs);
+            e.shift_r32_cl(kinds[i] == OP_SLLV ? 4 : (kinds[i] == OP_SRLV ? 5 : 7), RAX); // x86 masks the count to 5 bits, like we want.
+
+            if(pending)
+                emit_apply_load_delay(e);
+            emit_store_gpr(e, op.rd, RAX);
+            break;
+
+        case OP_MFHI:
+        case OP_MFLO:
+            emit_set_ahead(e, ahead[i], n - 1 - i);
+            e.mov_r64_r64(ARG0, RBX);
+            emit_call(e, (const void*)&recompiler::wait_hilo);
+            e.mov_m_imm32(off_ahead, 0);
+            e.mov_r32_m(RAX, kinds[i] == OP_MFHI ? off_hi : off_lo);
+
+            if(pending)
+                emit_apply_load_delay(e);
+            emit_store_gpr(e, op.rd, RAX);
+            break;
+
+        case OP_MTHI:
+        case OP_MTLO:
+            emit_load_gpr(e, RAX, op.rs);
+
+            if(pending)
+                emit_apply_load_delay(e);
+            e.mov_m_r32(kinds[i] == OP_MTHI ? off_hi : off_lo, RAX);
+            e.mov_m_imm32((kinds[i] == OP_MTHI ? off_hi : off_lo) + 4, 0);
+            break;
+
+        case OP_LB:
+        case OP_LBU:
+        case OP_LH:
+        case OP_LHU:
+        case OP_LW:
+        case OP_SB:
+        case OP_SH:
+        case OP_SW:
+        {
+            bool store = (kinds[i] == OP_SB || kinds[i] == OP_SH || kinds[i] == OP_SW);
+            const void* helper = nullptr;
+
+            switch(kinds[i])
+            {
+            case OP_LB:  helper = (const void*)&recompiler::load_byte; break;
+            case OP_LBU: helper = (const void*)&recompiler::load_byte_unsigned; break;
+            case OP_LH:  helper = (const void*)&recompiler::load_hword; break;
+            case OP_LHU: helper = (const void*)&recompiler::load_hword_unsigned; break;
+            case OP_LW:  helper = (const void*)&recompiler::load_word; break;
+            case OP_SB:  helper = (const void*)&recompiler::store_byte; break;
+            case OP_SH:  helper = (const void*)&recompiler::store_hword; break;
+            default:     helper = (const void*)&recompiler::store_word; break;
+            }
+
+            // Address (and value) come from the registers as they were BEFORE this instruction.
+            emit_load_gpr(e, R13, op.rs);
+            e.alu_r32_imm(0, R13, simm);
+            if(store)
+                emit_load_gpr(e, R14, op.rt);
+
+            if(pending)
+                emit_apply_load_delay(e);
+
+            if(fast)
+            {
+                int size = (kinds[i] == OP_LW || kinds[i] == OP_SW) ? 4 : ((kinds[i] == OP_LH || kinds[i] == OP_LHU || kinds[i] == OP_SH) ? 2 : 1);
+
+                if(store)
+                {
+                    // We're going around the bus, so we have to bump the page's write generation ourselves.
+                    e.mov_r32_r32(RCX, R13);
+                    e.alu_r32_imm(4, RCX, 0x1fffffff);
+                    e.shift_r32_imm(5, RCX, PSX_PAGE_SHIFT);
+                    e.mov_r64_imm(RAX, (std::uint64_t)bus::page_generation_table());
+                    e.inc_mrax_rcx4();
+                }
+
+                fastmem_access access;
+                access.site = e.pos();
+                access.kind = kinds[i];
+                access.ahead = ahead[i];
+                access.ops = n - 1 - i;
+
+                if(store)
+                {
+                    e.store_fastmem(size);
+                }
+                else
+                {
+                    e.load_fastmem(size, kinds[i] == OP_LH); // lb zero extends, just like the interpreter.
+
+                    // Loads paid for a read from RAM when they issued, and the helpers settle the difference
+                    // (see @ref cop0::read_wait). The only other thing fastmem reaches is the scratchpad, so
+                    // settle it for that here. This is skipped once the site's been patched to use the helper.
+                    e.mov_r32_r32(RCX, R13);
+                    e.alu_r32_imm(4, RCX, 0x1fffffff);
+                    e.alu_r32_imm(7, RCX, PSX_SCRATCHPAD_BASE);
+                    std::uint8_t* ram = e.jcc32(CC_B);
+                    e.sub_m32_imm(off_budget, bus::read_cycles(PSX_SCRATCHPAD_BASE, size) - PSX_RAM_READ_CYCLES);
+                    x64_emitter::patch(ram, e.pos());
+                }
+
+                while(e.pos() < access.site + RECOMPILER_FASTMEM_SITE)
+                    e.nop();
+
+                access.resume = e.pos();
+                accesses.push_back(access);
+
+                if(kinds[i] == OP_LBU)
+                {
+                    emit_store_gpr(e, op.rt, RAX);
+                }
+                else if(!store)
+                {
+                    e.mov_m_r32(off_load_delay, RAX);
+                    e.mov_m_imm32(off_delay_reg, op.rt);
+                }
+            }
+            else
+            {
+                // Devices see the time, so they have to see where we really are.
+                emit_set_ahead(e, ahead[i], n - 1 - i);
+                e.mov_r64_r64(ARG0, RBX);
+                e.mov_r32_r32(ARG1, R13);
+                if(store)
+                    e.mov_r32_r32(ARG2, R14);
+                else
+                    e.mov_r32_imm(ARG2, op.rt);
+                emit_call(e, helper);
+                e.mov_m_imm32(off_ahead, 0);
+            }
+
+            if(store && !last)
+            {
+                // We might have just written over ourselves.
+                e.mov_r64_imm(RAX, (std::uint64_t)b->page_gen);
+                e.cmp_mrax_imm32(b->generation);
+                std::uint8_t* ok = e.jcc32(CC_E);
+                e.mov_m_imm32(off_pc, pc + 4);
+                e.mov_m_imm32(off_next_pc, pc + 8);
+                exits.push_back(e.jmp32());
+                x64_emitter::patch(ok, e.pos());
+            }
+            break;
+        }
+
+        case OP_BEQ:
+        case OP_BNE:
+        case OP_BGTZ:
+        case OP_BCONDZ:
+        {
+            std::int16_t offset = (std::int16_t)(op.imm << 2);
+            branch_target = pc + 8 + offset - 4;
+
+            emit_load_gpr(e, RAX, op.rs);
+
+            int not_taken;
+            if(kinds[i] == OP_BEQ || kinds[i] == OP_BNE)
+            {
+                emit_load_gpr(e, RCX, op.rt);
+                e.alu_r32_r32(0x39, RAX, RCX);
+                not_taken = (kinds[i] == OP_BEQ) ? CC_NE : CC_E;
+            }
+            else
+            {
+                e.alu_r32_r32(0x85, RAX, RAX);
+
+                if(kinds[i] == OP_BGTZ)
+                    not_taken = CC_LE;
+                else
+                    not_taken = ((op.word >> 16) & 1) ? CC_S : CC_NS; // bgez/bltz
+            }
+
+            e.mov_r32_imm(R12, pc + 8);
+            e.jcc8(not_taken, 6);
+            e.mov_r32_imm(R12, branch_target);
+
+            if(pending)
+                emit_apply_load_delay(e);
+
+            if(kinds[i] == OP_BCONDZ && ((op.word >> 17) & 0xf) == 8)
+                e.mov_m_imm32(off_gpr + 31 * 4, pc + 8);
+            break;
+        }
+
+        case OP_J:
+        case OP_JAL:
+            branch_target = ((pc + 4) & 0xf0000000) | (op.target << 2);
+
+            if(pending)
+                emit_apply_load_delay(e);
+
+            if(kinds[i] == OP_JAL)
+                e.mov_m_imm32(off_gpr + 31 * 4, pc + 8);
+            break;
+
+        case OP_JR:
+        case OP_JALR:
+            if(op.rs == 0)
+                e.alu_r32_r32(0x31, R12, R12);
+            else
+                e.mov_r32_m(R12, off_gpr + op.rs * 4);
+
+            if(pending)
+                emit_apply_load_delay(e);
+
+            if(kinds[i] == OP_JALR)
+                e.mov_m_imm32(off_gpr + 31 * 4, pc + 8);
+            break;
+        }
+
+        if(kinds[i] >= OP_BEQ)
+            branch = kinds[i];
+
+        // Only the delayed loads leave something behind for the next instruction to retire.
+        pending = (kinds[i] == OP_LB || kinds[i] == OP_LH || kinds[i] == OP_LHU || kinds[i] == OP_LW);
+    }
+
+    std::uint32_t end = vaddr + n * 4;
+
+    if(kinds[n - 1] == OP_FALLBACK)
+    {
+        // The interpreter's already left pc/next_pc where they need to be.
+        e.alu_r32_r32(0x31, RAX, RAX);
+        x64_emitter::patch(e.jmp32(), leave);
+    }
+    else if(branch == OP_J || branch == OP_JAL)
+    {
+        emit_exit_static(e, branch_target);
+    }
+    else if(branch == OP_JR || branch == OP_JALR)
+    {
+        emit_exit_dynamic(e);
+    }
+    else if(branch != OP_FALLBACK)
+    {
+        if(branch_target != end)
+        {
+            e.alu_r32_imm(7, R12, branch_target);
+            std::uint8_t* not_taken = e.jcc32(CC_NE);
+            emit_exit_static(e, branch_target);
+            x64_emitter::patch(not_taken, e.pos());
+        }
+
+        emit_exit_static(e, end);
+    }
+    else
+    {
+        emit_exit_static(e, end);
+    }
+
+    // Bail out, without touching anything.
+    for(std::size_t i = 0; i < exits.size(); i++)
+        x64_emitter::patch(exits[i], e.pos());
+
+    e.alu_r32_r32(0x31, RAX, RAX);
+    x64_emitter::patch(e.jmp32(), leave);
+
+    // Slow paths for the fastmem accesses. Nothing jumps here until an access faults and gets patched.
+    for(std::size_t i = 0; i < accesses.size(); i++)
+    {
+        const void* helper = nullptr;
+        bool store = false;
+
+        switch(accesses[i].kind)
+        {
+        case OP_LB:
+        case OP_LBU: helper = (const void*)&recompiler::read_byte; break;
+        case OP_LH:  helper = (const void*)&recompiler::read_hword_signed; break;
+        case OP_LHU: helper = (const void*)&recompiler::read_hword; break;
+        case OP_LW:  helper = (const void*)&recompiler::read_word; break;
+        case OP_SB:  helper = (const void*)&recompiler::store_byte; store = true; break;
+        case OP_SH:  helper = (const void*)&recompiler::store_hword; store = true; break;
+        default:     helper = (const void*)&recompiler::store_word; store = true; break;
+        }
+
+        fastmem_sites[accesses[i].site] = e.pos();
+
+        emit_set_ahead(e, accesses[i].ahead, accesses[i].ops);
+        e.mov_r64_r64(ARG0, RBX);
+        e.mov_r32_r32(ARG1, R13);
+        if(store)
+            e.mov_r32_r32(ARG2, R14);
+        emit_call(e, helper);
+        e.mov_m_imm32(off_ahead, 0);
+        x64_emitter::patch(e.jmp32(), accesses[i].resume);
+    }
+
+    code_used = e.pos() - code;
+    return true;
+}
+
+void recompiler::interpret_one()
+{
+    cpu->cycle();
+}
+
+std::uint32_t recompiler::run(std::uint32_t cycles)
+{
+    std::uint64_t start = cpu->now();
+
+    cpu->start_run(cycles);
+    running = this;
+
+    while(cpu->budget > 0)
+    {
+        // We never compile starting in a delay slot, so let the interpreter get us out of it. Same goes
+        // for an isolated cache, which fastmem code knows nothing about.
+        if(cpu->is_branch || (cpu->pc & 0x3) || (*cpu->cp0->status_register() & 0x00010000))
+        {
+            interpret_one();
+            continue;
+        }
+
+        native_block* nb = lookup(cpu->pc);
+        if(nb == nullptr)
+        {
+            interpret_one();
+            continue;
+        }
+
+        if(differential)
+        {
+            run_block_differential(nb);
+            continue;
+        }
+
+        std::uint32_t start_epoch = epoch;
+        std::uint8_t* site = enter(cpu, nb->body);
+
+        // The block exited to an address we hadn't compiled yet, so compile it and link them together.
+        if(site != nullptr)
+        {
+            native_block* next = lookup(cpu->pc);
+
+            if(next != nullptr && epoch == start_epoch)
+                x64_emitter::patch(site, next->body);
+        }
+    }
+
+    // The budget goes negative by however far the last block overshot.
+    return (std::uint32_t)(cpu->now() - start);
+}
+
+void recompiler::capture(cpu_state& state) const
+{
+    std::memcpy(state.gpr, cpu->gpr, sizeof(state.gpr));
+    state.hi = cpu->hi;
+    state.lo = cpu->lo;
+    state.pc = cpu->pc;
+    state.next_pc = cpu->next_pc;
+    state.load_delay = cpu->load_delay;
+    state.delay_reg = cpu->delay_reg;
+    state.is_branch = cpu->is_branch;
+    state.hilo_ready = cpu->hilo_ready;
+}
+
+void recompiler::restore(const cpu_state& state)
+{
+    std::memcpy(cpu->gpr, state.gpr, sizeof(state.gpr));
+    cpu->hi = state.hi;
+    cpu->lo = state.lo;
+    cpu->pc = state.pc;
+    cpu->next_pc = state.next_pc;
+    cpu->load_delay = state.load_delay;
+    cpu->delay_reg = state.delay_reg;
+    cpu->is_branch = state.is_branch;
+    cpu->hilo_ready = state.hilo_ready;
+}
+
+void recompiler::run_block_differential(native_block* nb)
+{
+    cpu_state before;
+    cpu_state interpreted;
+    cpu_state recompiled;
+    std::uint32_t vaddr = cpu->pc;
+
+    capture(before);
+    cop0 cop_before = *cpu->cp0;
+    gte gte_before = *cpu->cp2;
+
+    // Interpret the block first. This is the run that actually talks to the bus.
+    trace.mode = memory_trace::RECORD;
+    trace.log.clear();
+    trace.position = 0;
+    trace.mismatch = false;
+
+    cpu->cp0->set_trace(&trace);
+    for(std::uint32_t i = 0; i < nb->length && cpu->pc == vaddr + i * 4; i++)
+        cpu->cycle();
+    cpu->cp0->set_trace(nullptr);
+
+    // It wrote to its own page, so the native code would (rightly) refuse to run.
+    if(*nb->page_gen != nb->generation)
+    {
+        skipped++;
+        return;
+    }
+
+    capture(interpreted);
+    cop0 cop_interpreted = *cpu->cp0;
+    gte gte_interpreted = *cpu->cp2;
+
+    // Now rewind and run it again natively, feeding it the same memory.
+    restore(before);
+    *cpu->cp0 = cop_before;
+    *cpu->cp2 = gte_before;
+
+    trace.mode = memory_trace::REPLAY;
+    cpu->cp0->set_trace(&trace);
+
+    std::int32_t budget = cpu->budget;
+    cpu->budget = 1;
+    enter(cpu, nb->body);
+    cpu->budget = budget;
+
+    cpu->cp0->set_trace(nullptr);
+    capture(recompiled);
+
+    bool ok = !trace.mismatch && trace.position == trace.log.size();
+
+    for(int i = 0; i < R3000_GPR_MAX; i++)
+        ok = ok && interpreted.gpr[i] == recompiled.gpr[i];
+
+    ok = ok && interpreted.hi == recompiled.hi && interpreted.lo == recompiled.lo;
+    ok = ok && interpreted.pc == recompiled.pc && interpreted.next_pc == recompiled.next_pc;
+    ok = ok && interpreted.load_delay == recompiled.load_delay && interpreted.delay_reg == recompiled.delay_reg;
+    ok = ok && interpreted.is_branch == recompiled.is_branch;
+
+    for(unsigned i = 0; i < COP0_MAX_REGS; i++)
+        ok = ok && cop_interpreted.read_gpr(i) == cpu->cp0->read_gpr(i);
+
+    for(unsigned i = 0; i < GTE_NUM_REGS; i++)
+    {
+        ok = ok && gte_interpreted.read_data(i) == cpu->cp2->read_data(i);
+        ok = ok && gte_interpreted.read_control(i) == cpu->cp2->read_control(i);
+    }
+
+    if(!ok)
+    {
+        std::printf("fatal: recompiler: block at 0x%08x disagrees with the interpreter!\n", vaddr);
+        std::printf("                  interpreter    recompiler\n");
+
+        for(int i = 1; i < R3000_GPR_MAX; i++)
+        {
+            std::printf("    %-8s      0x%08x     0x%08x%s\n", cpu_gpr_names[i], interpreted.gpr[i], recompiled.gpr[i],
+                        interpreted.gpr[i] != recompiled.gpr[i] ? "  <--" : "");
+        }
+
+        std::printf("    hi            0x%08x     0x%08x\n", (std::uint32_t)interpreted.hi, (std::uint32_t)recompiled.hi);
+        std::printf("    lo            0x%08x     0x%08x\n", (std::uint32_t)interpreted.lo, (std::uint32_t)recompiled.lo);
+        std::printf("    pc            0x%08x     0x%08x\n", interpreted.pc, recompiled.pc);
+        std::printf("    next_pc       0x%08x     0x%08x\n", interpreted.next_pc, recompiled.next_pc);
+        std::printf("    load          r%-2u=0x%08x  r%-2u=0x%08x\n", interpreted.delay_reg, interpreted.load_delay, recompiled.delay_reg, recompiled.load_delay);
+        std::printf("    memory        %u accesses    %u replayed%s\n", (unsigned)trace.log.size(), (unsigned)trace.position, trace.mismatch ? " (MISMATCH)" : "");
+        exit(-1);
+    }
+
+    // They agree, but carry on from the interpreter's state to be safe.
+    restore(interpreted);
+    *cpu->cp0 = cop_interpreted;
+    *cpu->cp2 = gte_interpreted;
+    checked++;
+}
+
+std::uint8_t* recompiler::fastmem_fault(std::uint8_t* rip)
+{
+    if(running == nullptr)
+        return nullptr;
+
+    std::unordered_map<const std::uint8_t*, std::uint8_t*>::iterator it = running->fastmem_sites.find(rip);
+
+    if(it == running->fastmem_sites.end())
+        return nullptr;
+
+    // Whatever this hit isn't RAM, and probably never will be, so send it the slow way for good.
+    x64_emitter e(rip);
+    x64_emitter::patch(e.jmp32(), it->second);
+    return it->second;
+}
+
+///+++++++++++++++++++++++++++++++CALLED FROM NATIVE CODE+++++++++++++++++++++++++++++++///
+
+std::uint32_t recompiler::interpret(r3000a* cpu, const decoded_instruction* op)
+{
+    cpu->execute(op);
+
+    return cpu->pc;
+}
+
+void recompiler::fetch_block(r3000a* cpu, std::uint32_t vaddr, std::uint32_t count)
+{
+    std::uint32_t phys_addr = cop0::virtual_to_physical(vaddr);
+
+    // Same as the interpreter: refilling the cache is paid for up front, uncached code as it goes. We pay for
+    // all of it now, but remember what each instruction costs for when something wants the time part way through.
+    if(vaddr < 0xa0000000 && (*bus::cache_control() & ICACHE_CTRL_ENABLE))
+    {
+        cpu->block_fetch = 0;
+        cpu->budget -= cpu->fetch_stall(vaddr, phys_addr, count);
+    }
+    else
+    {
+        cpu->block_fetch = cpu->fetch_stall(vaddr, phys_addr, 1);
+        cpu->budget -= cpu->block_fetch * count;
+    }
+}
+
+void recompiler::wait_hilo(r3000a* cpu)
+{
+    cpu->wait_hilo();
+}
+
+std::uint32_t recompiler::read_byte(r3000a* cpu, std::uint32_t vaddr)
+{
+    return cpu->cp0->virtual_read8(vaddr);
+}
+
+std::uint32_t recompiler::read_hword(r3000a* cpu, std::uint32_t vaddr)
+{
+    return cpu->cp0->virtual_read16(vaddr);
+}
+
+std::uint32_t recompiler::read_hword_signed(r3000a* cpu, std::uint32_t vaddr)
+{
+    return (std::uint32_t)(std::int16_t)cpu->cp0->virtual_read16(vaddr);
+}
+
+std::uint32_t recompiler::read_word(r3000a* cpu, std::uint32_t vaddr)
+{
+    return cpu->cp0->virtual_read32(vaddr);
+}
+
+void recompiler::load_byte(r3000a* cpu, std::uint32_t vaddr, std::uint32_t rt)
+{
+    std::uint8_t val = (std::int8_t)cpu->cp0->virtual_read8(vaddr);
+    cpu->load_delay = (std::uint32_t)val;
+    cpu->delay_reg = rt;
+}
+
+void recompiler::load_byte_unsigned(r3000a* cpu, std::uint32_t vaddr, std::uint32_t rt)
+{
+    std::uint8_t val = cpu->cp0->virtual_read8(vaddr);
+    if(rt != 0)
+        cpu->gpr[rt] = val;
+}
+
+void recompiler::load_hword(r3000a* cpu, std::uint32_t vaddr, std::uint32_t rt)
+{
+    std::int16_t val = (std::int16_t)cpu->cp0->virtual_read16(vaddr);
+    cpu->load_delay = (std::uint32_t)val;
+    cpu->delay_reg = rt;
+}
+
+void recompiler::load_hword_unsigned(r3000a* cpu, std::uint32_t vaddr, std::uint32_t rt)
+{
+    cpu->load_delay = cpu->cp0->virtual_read16(vaddr);
+    cpu->delay_reg = rt;
+}
+
+void recompiler::load_word(r3000a* cpu, std::uint32_t vaddr, std::uint32_t rt)
+{
+    cpu->load_delay = cpu->cp0->virtual_read32(vaddr);
+    cpu->delay_reg = rt;
+}
+
+void recompiler::store_byte(r3000a* cpu, std::uint32_t vaddr, std::uint32_t value)
+{
+    cpu->cp0->virtual_write8(vaddr, value);
+}
+
+void recompiler::store_hword(r3000a* cpu, std::uint32_t vaddr, std::uint32_t value)
+{
+    cpu->cp0->virtual_write16(vaddr, value);
+}
+
+void recompiler::store_word(r3000a* cpu, std::uint32_t vaddr, std::uint32_t value)
+{
+    cpu->cp0->virtual_write32(vaddr, value);
+}
+
+#endif // NEOPS_HAS_RECOMPILER
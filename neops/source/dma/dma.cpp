@@ -16,7 +16,9 @@
 **/
 #include "dma/dma.hpp"
 #include "bus/bus.hpp"
+#include "state/state.hpp"
 
+#include <algorithm>
 #include <vector>
 #include <cstdio>
 #include <cstdlib>
@@ -24,20 +26,124 @@
 
 using namespace bus;
 
-dma_controller::dma_controller()
+/**
+ *  Bus cycles to move one word on each port. Most devices keep up with RAM, the CD-ROM, SPU and PIO
+ *  sit behind slower buses (these are rough, they depend on the delays set in the memory control registers).
+ */
+static const std::uint32_t word_cycles[7] =
+{
+    DMA_WORD_CYCLES,    // MDECin
+    DMA_WORD_CYCLES,    // MDECout
+    DMA_WORD_CYCLES,    // GPU
+    24,                 // CDROM
+    4,                  // SPU
+    20,                 // PIO
+    DMA_WORD_CYCLES,    // OTC
+};
+
+dma_controller::dma_controller() : device("dma")
+{
+    std::memset(ports, 0x00, sizeof(ports));
+    event_added = false;
+    reset();
+}
+
+dma_controller::~dma_controller()
+{
+
+}
+
+void dma_controller::reset()
 {
     std::memset(&channels, 0x00, sizeof(channel) * 7);
     dpcr = 0x07654321;
+    dicr = 0;
+    current = -1;
+
+    if(event_added)
+        scheduler::cancel(event);
 }
 
-dma_controller::~dma_controller()
+void dma_controller::serialize(state::serializer& s)
 {
+    // Cycles until whoever has the bus gets their next burst.
+    std::uint64_t wait = 0;
+    std::uint64_t time = scheduler::exact();
+
+    if(!s.loading() && event_added && scheduler::pending(event))
+        wait = std::max(scheduler::due(event), time) - time;
 
+    s.section(get_name(), 1);
+    s.value(dpcr);
+    s.value(dicr);
+    s.value(channels);
+    s.value(current);
+    s.value(wait);
+
+    if(s.loading() && current != -1)
+    {
+        add_event();
+        scheduler::schedule(event, wait);
+    }
+}
+
+std::uint32_t dma_controller::read32(std::uint32_t addr)
+{
+    if(addr == DMA_CTRL_REG)
+        return read_dpcr();
+
+    if(addr == DMA_INTERRUPT_REG)
+        return read_dicr();
+
+    if(addr == 0x1F8010F8)
+        return DMA_1F8010F8H;
+
+    if(addr == 0x1F8010FC)
+        return DMA_1F8010FCh;
+
+    return controller_read(addr);
+}
+
+void dma_controller::write16(std::uint32_t addr, std::uint16_t val)
+{
+    if(addr >= DMA_CHANNEL0_BASE && addr <= DMA_CHANNEL6_BASE + 8)
+    {
+        std::printf("dma: attempting to write 0x%08x to DMA register 0x%08x\n", val, addr);
+        controller_write(addr, val);
+        return;
+    }
+
+    device::write16(addr, val);
+}
+
+void dma_controller::write32(std::uint32_t addr, std::uint32_t val)
+{
+    if(addr == DMA_CTRL_REG)
+    {
+        write_dpcr(val);
+        return;
+    }
+
+    if(addr == DMA_INTERRUPT_REG)
+    {
+        write_dicr(val);
+        return;
+    }
+
+    if(addr >= DMA_CHANNEL0_BASE && addr <= DMA_CHANNEL6_BASE + 8)
+    {
+        std::printf("dma: attempting to write 0x%08x to DMA register 0x%08x\n", val, addr);
+        controller_write(addr, val);
+        return;
+    }
+
+    device::write32(addr, val);
 }
 
 void dma_controller::write_dpcr(std::uint32_t val)
 {
     dpcr = val;
+    arbitrate();
 }
 
 std::uint32_t dma_controller::read_dpcr()
@@ -148,12 +254,11 @@ void dma_controller::controller_write(std::uint32_t address, std::uint32_t val)
         channels[channel].dma_chop_size = (val >> 16) & 0x07;
         channels[channel].cpu_chop_size = (val >> 20) & 0x07;
 
-        if(channel_active(channel))
-        {
-            // FIXME: What in the fuck is this...
-            if((dpcr & 0x08000000) || (dpcr & 0x00800000) || (dpcr & 0x00080000) || (dpcr & 0x00008000) || (dpcr & 0x00000800) || (dpcr & 0x00000080) || (dpcr & 0x00000008))
-                do_dma(channel);
-        }
+        // Clearing the enable bit stops a transfer in its tracks.
+        if(!channel_enabled(channel))
+            channels[channel].started = false;
+
+        arbitrate();
     }
     else
     {
@@ -162,17 +267,167 @@ void dma_controller::controller_write(std::uint32_t address, std::uint32_t val)
     }
 }
 
-void dma_controller::do_dma(int channel)
+int dma_controller::next_channel() const
+{
+    int best = -1;
+    std::uint32_t best_priority = 8;
+
+    for(int i = 0; i < 7; i++)
+    {
+        if((dpcr & (0x08 << (i * 4))) == 0)
+            continue;
+
+        if(!channel_enabled(i) || (!channels[i].started && !channel_trigger(i)))
+            continue;
+
+        // Lower numbers win. On a tie, the higher channel does.
+        std::uint32_t priority = (dpcr >> (i * 4)) & 0x07;
+
+        if(priority <= best_priority)
+        {
+            best = i;
+            best_priority = priority;
+        }
+    }
+
+    return best;
+}
+
+void dma_controller::arbitrate()
+{
+    // Whoever has the bus keeps it until their next burst.
+    if(current != -1)
+        return;
+
+    add_event();
+
+    while((current = next_channel()) != -1)
+    {
+        if(!channels[current].started)
+            start(current);
+
+        if(!burst(current))
+            return;
+
+        transfer_done(current);
+    }
+}
+
+void dma_controller::add_event()
+{
+    // Not in the constructor: the system we belong to hasn't made its scheduler yet.
+    if(!event_added)
+    {
+        event = scheduler::add_event("dma", resume, this);
+        event_added = true;
+    }
+}
+
+void dma_controller::resume(void* data)
+{
+    dma_controller* dma = (dma_controller*)data;
+
+    dma->current = -1;
+    dma->arbitrate();
+}
+
+void dma_controller::start(int channel)
+{
+    bus::channel& c = channels[channel];
+
+    c.next_addr = c.base_address & 0x1ffffc;
+    c.cycles = 0;
+    c.started = true;
+
+    // The trigger bit only starts things off.
+    c.channel_control &= ~0x10000000;
+
+    if(c.syncmode == SYNC_MODE::IMMEDIATE)
+    {
+        c.words_left = c.block_control & 0x0000ffff; // One block
+
+        if(c.words_left == 0)
+            c.words_left = 0x10000;
+    }
+    else if(c.syncmode == SYNC_MODE::REQUEST)
+    {
+        std::uint16_t bs = c.block_control & 0x0000ffff;
+        std::uint16_t ba = c.block_control >> 16;
+
+        c.words_left = bs * ba;
+    }
+    else
+    {
+        c.words_left = 0;
+    }
+}
+
+bool dma_controller::burst(int channel)
 {
-    if(channels[channel].syncmode == SYNC_MODE::LINKED_LIST)
-        dma_list_copy(channel);
+    bus::channel& c = channels[channel];
+    device* dev = ports[channel];
+    std::uint32_t cycles = 0;
+    std::uint32_t gap = 0;
+
+    if(c.syncmode == SYNC_MODE::LINKED_LIST)
+    {
+        cycles = dma_list_copy(channel);
+    }
+    else if(channel == PORT::OTC)
+    {
+        clear_ordering_table(c.next_addr, c.words_left);
+        cycles = c.words_left * word_cycles[channel];
+        c.words_left = 0;
+    }
+    else if(c.syncmode == SYNC_MODE::IMMEDIATE)
+    {
+        std::uint32_t words = c.words_left;
+
+        // Chopping: a few words, then the CPU gets the bus for a while.
+        if(c.channel_control & 0x100)
+        {
+            words = std::min(words, 1u << c.dma_chop_size);
+            gap = 1u << c.cpu_chop_size;
+        }
+
+        cycles = dma_block_copy(channel, words);
+
+        if(c.channel_control & 0x100)
+            c.base_address = c.next_addr;
+    }
     else
-        dma_block_copy(channel);
+    {
+        std::uint32_t block_size = c.block_control & 0x0000ffff;
+
+        // A block at a time, for as long as the device is asking for them.
+        while(c.words_left != 0 && (dev == nullptr || dev->dma_ready()))
+        {
+            cycles += dma_block_copy(channel, std::min(block_size, c.words_left));
+
+            c.base_address = c.next_addr;
+            c.block_control = (c.block_control & 0x0000ffff) | ((c.block_control - 0x10000) & 0xffff0000);
+        }
+
+        gap = DMA_DRQ_POLL_CYCLES;
+    }
+
+    c.cycles += cycles;
+    scheduler::stall(cycles);
+
+    // The CPU can't get a look in until the burst's over, so if that's the lot we might as well finish now.
+    if(c.words_left == 0)
+        return true;
+
+    // The burst's stall is already on the clock (see @ref scheduler::exact), so only the gap's left to wait.
+    scheduler::schedule(event, gap);
+    return false;
 }
 
-void dma_controller::dma_list_copy(int channel)
+std::uint32_t dma_controller::dma_list_copy(int channel)
 {
-    std::uint32_t addr = channels[channel].base_address & 0x1ffffc;;
+    std::uint32_t addr = channels[channel].base_address & 0x1ffffc;
+    std::uint32_t cycles = 0;
+    std::uint32_t nodes = 0;
 
     if(channels[channel].direction == DIRECTION::TO_RAM)
     {
@@ -186,19 +441,25 @@ void dma_controller::dma_list_copy(int channel)
         exit(-1);
     }
 
+    device* dev = ports[channel];
+
     while(1)
     {
+        // There's only so many word-aligned nodes in RAM, so any more than that means we've been around a loop.
+        if(++nodes > DMA_LIST_MAX_NODES)
+        {
+            std::printf("warning: dma_list_copy: linked list at 0x%08x never ends, giving up!\n", channels[channel].base_address);
+            break;
+        }
+
         std::uint32_t entry = bus::read_word(addr);
-        std::uint32_t words_left = entry >> 24;
+        std::uint32_t words = entry >> 24;
 
-        while(words_left > 0)
-        {
-            addr = (addr + 4) & 0x1ffffc;
-            std::uint32_t command = bus::read_word(addr);
-            std::printf("GPU command 0x%08x\n", command);
+        // Each node's packet sits right after its header, so it goes over in one go.
+        if(dev && words != 0)
+            write_device(dev, addr + 4, words);
 
-            words_left--;
-        }
+        cycles += DMA_LIST_NODE_CYCLES + words * DMA_WORD_CYCLES;
 
         if((entry & 0x800000) != 0)
             break;
@@ -206,60 +467,134 @@ void dma_controller::dma_list_copy(int channel)
         addr = entry & 0x1ffffc;
     }
 
-    transfer_done(channel);
+    channels[channel].base_address = 0x00ffffff;
+    return cycles;
 }
 
-void dma_controller::dma_block_copy(int channel)
+void dma_controller::write_device(device* dev, std::uint32_t addr, std::uint32_t words)
 {
-    std::uint32_t addr;
-    std::uint32_t words_left;
-    int increment;
+    while(words != 0)
+    {
+        std::uint32_t cur_addr = addr & 0x1ffffc;
+        std::uint32_t count = std::min(words, (PSX_MEM_SIZE - cur_addr) / 4);
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        // RAM is little endian. Devices want words they can use, so it's one at a time for us.
+        for(std::uint32_t i = 0; i < count; i++)
+            dev->dma_write(bus::read_word(cur_addr + i * 4));
+#else
+        dev->dma_write_block((const std::uint32_t*)(bus::ram() + cur_addr), count);
+#endif
+
+        addr += count * 4;
+        words -= count;
+    }
+}
 
-    addr = channels[channel].base_address;
+void dma_controller::clear_ordering_table(std::uint32_t addr, std::uint32_t words)
+{
+    if(words == 0)
+        return;
 
-    increment = channels[channel].direction == 0 ? 4 : -4;
+    // The table runs backwards: every entry points at the one below it, and the lowest one ends the list.
+    std::uint8_t* ram = bus::ram();
+    std::uint32_t highest = addr & 0x1ffffc;
+    std::uint32_t lowest = (addr - (words - 1) * 4) & 0x1ffffc;
 
-    if(channels[channel].syncmode == SYNC_MODE::IMMEDIATE)
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ != __ORDER_BIG_ENDIAN__
+    if(lowest <= highest)
     {
-        words_left = channels[channel].block_control & 0x0000ffff; // One block
+        // Doesn't wrap, so it's one run of RAM the compiler can fill with vectors.
+        std::uint32_t* table = (std::uint32_t*)(ram + lowest);
+
+        table[0] = 0x00ffffff;
+
+        for(std::uint32_t i = 1; i < words; i++)
+            table[i] = lowest + (i - 1) * 4;
+
+        bus::ram_written(lowest, words * 4);
+        return;
     }
-    else if(channels[channel].syncmode == SYNC_MODE::REQUEST)
+#endif
+
+    for(std::uint32_t i = 0; i < words; i++)
     {
-        std::uint16_t bs = channels[channel].block_control & 0x0000ffff;
-        std::uint16_t ba = channels[channel].block_control >> 16;
+        std::uint32_t cur_addr = (addr - i * 4) & 0x1ffffc;
+        std::uint32_t value = (i == words - 1) ? 0x00ffffff : ((cur_addr - 4) & 0x1fffff);
 
-        words_left = bs * ba;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        value = __builtin_bswap32(value);
+#endif
+        std::memcpy(ram + cur_addr, &value, sizeof(value));
     }
-    else if(channels[channel].syncmode == SYNC_MODE::LINKED_LIST)
+
+    if(lowest <= highest)
     {
-        std::printf("dma_block_copy: SYNC_MODE::LINKED_LIST not supported for block copy!\n");
-        exit(-1);
+        bus::ram_written(lowest, words * 4);
+    }
+    else
+    {
+        bus::ram_written(0, highest + 4);
+        bus::ram_written(lowest, PSX_MEM_SIZE - lowest);
+    }
+}
+
+std::uint32_t dma_controller::dma_block_copy(int channel, std::uint32_t words)
+{
+    bus::channel& c = channels[channel];
+    std::uint32_t addr = c.next_addr;
+    std::uint32_t words_left = words;
+    int increment = (c.channel_control & 0x02) ? -4 : 4;
+    device* dev = ports[channel];
+
+    if(dev && increment > 0 && c.direction == DIRECTION::FROM_RAM)
+    {
+        write_device(dev, addr, words_left);
+        addr += words_left * 4;
+        words_left = 0;
     }
 
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ != __ORDER_BIG_ENDIAN__
+    // Let the device write straight into RAM, a run at a time up to the end of RAM, where we wrap around.
+    while(dev && increment > 0 && words_left != 0)
+    {
+        std::uint32_t cur_addr = addr & 0x1ffffc;
+        std::uint32_t count = std::min(words_left, (PSX_MEM_SIZE - cur_addr) / 4);
+
+        dev->dma_read_block((std::uint32_t*)(bus::ram() + cur_addr), count);
+        bus::ram_written(cur_addr, count * 4);
+
+        addr += count * 4;
+        words_left -= count;
+    }
+#endif
+
     while(words_left != 0)
     {
         std::uint32_t value = 0;
-        std::uint32_t cur_addr = addr & 0x1ffffc;;
+        std::uint32_t cur_addr = addr & 0x1ffffc;
 
-        if(channels[channel].direction == DIRECTION::FROM_RAM)
+        if(c.direction == DIRECTION::FROM_RAM)
         {
             value = bus::read_word(cur_addr);
+
+            if(dev)
+                dev->dma_write(value);
         }
-        else if(channels[channel].direction == DIRECTION::TO_RAM)
+        else if(c.direction == DIRECTION::TO_RAM)
         {
-            if(channel == PORT::OTC)
-            {
-                if(words_left == 1)
-                    value = 0x00ffffff; // end of table marker
-                else
-                    value = (addr - 4) & 0x1fffff;
-            }
+            if(dev)
+                value = dev->dma_read();
+
+            bus::write_word(cur_addr, value);
         }
 
-        bus::write_word(cur_addr, value);
         addr += increment;
         words_left--;
     }
 
-    transfer_done(channel);
-}
\ No newline at end of file
+    c.next_addr = addr & 0x1ffffc;
+    c.words_left -= words;
+
+    return words * word_cycles[channel];
+}
@@ -0,0 +1,140 @@
+/**
+    This file is part of NeoPS.
+
+    NeoPS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    NeoPS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+**/
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "exe/exe.hpp"
+#include "bus/bus.hpp"
+#include "cpu/cop0.hpp"
+#include "cpu/r3000a.hpp"
+
+#define EXE_MAGIC           "PS-X EXE"
+#define EXE_MAGIC_SIZE      8
+
+using namespace exe;
+
+/**
+ *  Read a little endian word out of the header.
+ */
+static std::uint32_t read_le32(const std::uint8_t* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((std::uint32_t)p[3] << 24);
+}
+
+/**
+ *  Does a range of virtual addresses sit entirely in RAM?
+ */
+static bool in_ram(std::uint32_t vaddr, std::uint32_t size)
+{
+    std::uint32_t phys_addr = cpu::cop0::virtual_to_physical(vaddr);
+
+    return phys_addr < PSX_MEM_SIZE && size <= PSX_MEM_SIZE - phys_addr;
+}
+
+executable::executable()
+{
+    std::memset(&hdr, 0x00, sizeof(hdr));
+}
+
+bool executable::load(const std::string& path)
+{
+    std::FILE* file = std::fopen(path.c_str(), "rb");
+
+    if(file == nullptr)
+    {
+        std::printf("warning: exe: couldn't open %s!\n", path.c_str());
+        return false;
+    }
+
+    std::uint8_t raw[EXE_HEADER_SIZE];
+
+    if(std::fread(raw, 1, sizeof(raw), file) != sizeof(raw) || std::memcmp(raw, EXE_MAGIC, EXE_MAGIC_SIZE) != 0)
+    {
+        std::printf("warning: exe: %s isn't a PS-X EXE!\n", path.c_str());
+        std::fclose(file);
+        return false;
+    }
+
+    header h;
+    h.pc = read_le32(raw + 0x10);
+    h.gp = read_le32(raw + 0x14);
+    h.text_addr = read_le32(raw + 0x18);
+    h.text_size = read_le32(raw + 0x1c);
+    h.bss_addr = read_le32(raw + 0x28);
+    h.bss_size = read_le32(raw + 0x2c);
+    h.stack_addr = read_le32(raw + 0x30);
+    h.stack_size = read_le32(raw + 0x34);
+
+    if(h.text_size == 0 || !in_ram(h.text_addr, h.text_size) || (h.bss_size != 0 && !in_ram(h.bss_addr, h.bss_size)))
+    {
+        std::printf("warning: exe: %s doesn't fit in RAM (text 0x%08x+0x%x, bss 0x%08x+0x%x)!\n", path.c_str(), h.text_addr, h.text_size, h.bss_addr, h.bss_size);
+        std::fclose(file);
+        return false;
+    }
+
+    std::vector<std::uint8_t> t(h.text_size);
+
+    // Plenty of tools don't bother padding the file out to a whole sector, so a short read is fine, the rest is zeroes.
+    std::size_t got = std::fread(t.data(), 1, t.size(), file);
+    std::fclose(file);
+
+    if(got == 0)
+    {
+        std::printf("warning: exe: %s has no text!\n", path.c_str());
+        return false;
+    }
+
+    if(got < t.size())
+        std::printf("warning: exe: %s is short 0x%x bytes of text, zeroing them!\n", path.c_str(), (unsigned)(t.size() - got));
+
+    hdr = h;
+    text.swap(t);
+    return true;
+}
+
+void executable::start(cpu::r3000a& cpu) const
+{
+    if(!loaded())
+    {
+        std::printf("fatal: exe: nothing to start!\n");
+        exit(-1);
+    }
+
+    std::uint8_t* ram = bus::ram();
+    std::uint32_t text_phys = cpu::cop0::virtual_to_physical(hdr.text_addr);
+    std::uint32_t bss_phys = cpu::cop0::virtual_to_physical(hdr.bss_addr);
+
+    std::memcpy(ram + text_phys, text.data(), text.size());
+    bus::ram_written(text_phys, text.size());
+
+    if(hdr.bss_size != 0)
+    {
+        std::memset(ram + bss_phys, 0x00, hdr.bss_size);
+        bus::ram_written(bss_phys, hdr.bss_size);
+    }
+
+    cpu.write_gpr(28, hdr.gp);
+
+    if(hdr.stack_addr != 0)
+    {
+        cpu.write_gpr(29, hdr.stack_addr + hdr.stack_size);
+        cpu.write_gpr(30, hdr.stack_addr + hdr.stack_size);
+    }
+
+    cpu.set_pc(hdr.pc);
+}
@@ -0,0 +1,911 @@
+/**
+    This file is part of NeoPS.
+
+    NeoPS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    NeoPS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+**/
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "gpu/gpu.hpp"
+#include "state/state.hpp"
+
+static inline std::int32_t sign_extend11(std::uint32_t val)
+{
+    return (std::int32_t)(val << 21) >> 21;
+}
+
+gpu::gpu::gpu() : device("gpu"), vram(GPU_VRAM_WIDTH * GPU_VRAM_HEIGHT + GPU_VRAM_SLACK), raster(vram.data())
+{
+    sleeping = false;
+    completed = 0;
+    pushed = 0;
+    quit = false;
+    async = true;
+    upload = nullptr;
+
+    reset();
+}
+
+gpu::gpu::~gpu()
+{
+    stop_thread();
+    delete[] upload;
+}
+
+void gpu::gpu::set_async(bool enabled)
+{
+    if(!enabled)
+        stop_thread();
+
+    async = enabled;
+}
+
+void gpu::gpu::start_thread()
+{
+    quit = false;
+    render_thread = std::thread(&gpu::render_loop, this);
+}
+
+void gpu::gpu::stop_thread()
+{
+    if(!render_thread.joinable())
+        return;
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        quit = true;
+    }
+
+    wake.notify_one();
+    render_thread.join();
+}
+
+void gpu::gpu::push(const primitive& p)
+{
+    pushed++;
+
+    if(!async)
+    {
+        raster.submit(p);
+        completed = pushed;
+        return;
+    }
+
+    if(!render_thread.joinable())
+        start_thread();
+
+    // Full. The GPU thread's busy drawing, so just give it a moment.
+    while(!ring.push(p))
+        std::this_thread::yield();
+
+    if(sleeping)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        wake.notify_one();
+    }
+}
+
+void gpu::gpu::sync()
+{
+    if(!async)
+    {
+        raster.flush();
+        return;
+    }
+
+    if(completed >= pushed)
+        return;
+
+    std::unique_lock<std::mutex> guard(lock);
+    idle.wait(guard, [this]{ return completed >= pushed; });
+}
+
+void gpu::gpu::render_loop()
+{
+    std::uint64_t drawn = completed;
+
+    for(;;)
+    {
+        const primitive* p;
+
+        while((p = ring.front()) != nullptr)
+        {
+            raster.submit(*p);
+            ring.pop();
+            drawn++;
+        }
+
+        // Out of work, so whatever's queued had better be in VRAM before anyone's told it's done.
+        raster.flush();
+
+        std::unique_lock<std::mutex> guard(lock);
+        completed = drawn;
+        idle.notify_all();
+
+        sleeping = true;
+        wake.wait(guard, [this]{ return quit || !ring.empty(); });
+        sleeping = false;
+
+        if(quit && ring.empty())
+            return;
+    }
+}
+
+void gpu::gpu::reset()
+{
+    sync();
+    std::fill(vram.begin(), vram.end(), 0);
+
+    gp1(0x00000000);
+}
+
+void gpu::gpu::serialize(state::serializer& s)
+{
+    sync();
+
+    s.section(get_name(), 1);
+    s.value(gpustat);
+    s.value(mode);
+    s.value(fifo);
+    s.value(fifo_length);
+    s.value(fifo_needed);
+    s.value(write_transfer);
+    s.value(read_transfer);
+    s.value(gpuread_latch);
+    s.value(polyline_last);
+    s.value(polyline_command);
+    s.value(texture_window);
+    s.value(area_top_left);
+    s.value(area_bottom_right);
+    s.value(draw_offset);
+    s.value(allow_texture_disable);
+    s.value(display_start);
+    s.value(display_range_x);
+    s.value(display_range_y);
+    s.bytes(vram.data(), GPU_VRAM_WIDTH * GPU_VRAM_HEIGHT * sizeof(std::uint16_t));
+
+    if(s.loading())
+    {
+        delete[] upload;
+        upload = nullptr;
+
+        if(mode == CPU_TO_VRAM)
+            upload = new std::uint16_t[(write_transfer.width * write_transfer.height + 1) / 2 * 2];
+
+        if(read_transfer.words != 0)
+            readback.resize((read_transfer.width * read_transfer.height + 1) / 2 * 2);
+
+        offset_x = sign_extend11(draw_offset & 0x7ff);
+        offset_y = sign_extend11((draw_offset >> 11) & 0x7ff);
+    }
+
+    if(mode == CPU_TO_VRAM)
+        s.bytes(upload, (write_transfer.width * write_transfer.height + 1) / 2 * 2 * sizeof(std::uint16_t));
+
+    if(read_transfer.words != 0)
+        s.bytes(readback.data(), readback.size() * sizeof(std::uint16_t));
+}
+
+std::uint32_t gpu::gpu::read32(std::uint32_t addr)
+{
+    if(addr == GPU_GPUREAD_STAT)
+        return read_gpustat();
+
+    return gpuread();
+}
+
+void gpu::gpu::write32(std::uint32_t addr, std::uint32_t val)
+{
+    if(addr == GPU_GP1_SEND)
+        gp1(val);
+    else
+        gp0(val);
+}
+
+void gpu::gpu::dma_write(std::uint32_t val)
+{
+    gp0(val);
+}
+
+std::uint32_t gpu::gpu::dma_read()
+{
+    return gpuread();
+}
+
+void gpu::gpu::dma_write_block(const std::uint32_t* words, std::uint32_t count)
+{
+    while(count != 0)
+    {
+        if(mode != CPU_TO_VRAM)
+        {
+            gp0(*words++);
+            count--;
+            continue;
+        }
+
+        // Image data goes straight into the upload, all but the last word (which sends it off).
+        std::uint32_t total = (write_transfer.width * write_transfer.height + 1) / 2;
+        std::uint32_t n = std::min(count, write_transfer.words - 1);
+
+        std::memcpy(upload + (total - write_transfer.words) * 2, words, n * sizeof(std::uint32_t));
+        write_transfer.words -= n;
+        words += n;
+        count -= n;
+
+        if(count != 0)
+        {
+            gp0(*words++);
+            count--;
+        }
+    }
+}
+
+void gpu::gpu::dma_read_block(std::uint32_t* words, std::uint32_t count)
+{
+    std::uint32_t n = std::min(count, read_transfer.words);
+
+    if(n != 0)
+    {
+        std::uint32_t total = (read_transfer.width * read_transfer.height + 1) / 2;
+
+        std::memcpy(words, &readback[(total - read_transfer.words) * 2], n * sizeof(std::uint32_t));
+        read_transfer.words -= n;
+        gpuread_latch = words[n - 1];
+    }
+
+    for(std::uint32_t i = n; i < count; i++)
+        words[i] = gpuread();
+}
+
+bool gpu::gpu::dma_ready()
+{
+    return (read_gpustat() >> 25) & 1;
+}
+
+unsigned gpu::gpu::dot_cycles() const
+{
+    static const unsigned dividers[4] = {10, 8, 5, 4}; // 256, 320, 512 and 640 dots wide
+
+    // Horizontal resolution 2 (368 dots) beats whatever's in horizontal resolution 1.
+    if(gpustat & 0x10000)
+        return 7;
+
+    return dividers[(gpustat >> 17) & 3];
+}
+
+std::uint32_t gpu::gpu::read_gpustat() const
+{
+    // We're always ready: for commands (26), to send VRAM (27) and for DMA blocks (28).
+    std::uint32_t stat = gpustat | 0x1c000000;
+
+    // DMA request follows the DMA direction.
+    switch((stat >> 29) & 3)
+    {
+    case 0:
+        stat &= ~0x02000000;
+        break;
+    case 1:
+        stat |= 0x02000000; // The fifo's never full.
+        break;
+    case 2:
+        stat |= ((stat >> 28) & 1) << 25;
+        break;
+    case 3:
+        stat |= ((stat >> 27) & 1) << 25;
+        break;
+    }
+
+    return stat;
+}
+
+unsigned gpu::gpu::command_length(std::uint32_t command)
+{
+    std::uint8_t op = command >> 24;
+
+    switch(op >> 5)
+    {
+    case 0x1: // Polygons
+    {
+        unsigned vertices = (op & 0x08) ? 4 : 3;
+        unsigned length = 1 + vertices;
+
+        if(op & 0x04)
+            length += vertices;     // UV (and CLUT/texpage) of every vertex.
+
+        if(op & 0x10)
+            length += vertices - 1; // Colors, other than the first.
+
+        return length;
+    }
+    case 0x2: // Lines (polylines collect the rest of their vertices on their own)
+        return (op & 0x10) ? 4 : 3;
+    case 0x3: // Rectangles
+    {
+        unsigned length = 2;
+
+        if(op & 0x04)
+            length++;
+
+        if(((op >> 3) & 3) == 0)
+            length++;
+
+        return length;
+    }
+    case 0x4: // VRAM to VRAM
+        return 4;
+    case 0x5: // CPU to VRAM
+    case 0x6: // VRAM to CPU
+        return 3;
+    case 0x0:
+        return op == 0x02 ? 3 : 1;
+    default:
+        return 1;
+    }
+}
+
+void gpu::gpu::gp0(std::uint32_t val)
+{
+    switch(mode)
+    {
+    case CPU_TO_VRAM:
+    {
+        std::uint32_t pixel = (write_transfer.width * write_transfer.height + 1) / 2 - write_transfer.words;
+
+        upload[pixel * 2] = val & 0xffff;
+        upload[pixel * 2 + 1] = val >> 16;
+
+        if(--write_transfer.words == 0)
+        {
+            primitive p;
+
+            std::memset(&p, 0x00, sizeof(p));
+            p.type = primitive::UPLOAD;
+            p.v[0].x = write_transfer.x;
+            p.v[0].y = write_transfer.y;
+            p.width = write_transfer.width;
+            p.height = write_transfer.height;
+            p.pixels = upload;
+            p.state = current_state(0);
+
+            upload = nullptr;
+            mode = COMMAND;
+            push(p);
+        }
+
+        return;
+    }
+    case POLYLINE:
+        draw_polyline(val);
+        return;
+    case COMMAND:
+        break;
+    }
+
+    if(fifo_length == 0)
+        fifo_needed = command_length(val);
+
+    fifo[fifo_length++] = val;
+
+    if(fifo_length == fifo_needed)
+    {
+        execute();
+        fifo_length = 0;
+    }
+}
+
+void gpu::gpu::execute()
+{
+    std::uint32_t command = fifo[0];
+    std::uint8_t op = command >> 24;
+
+    switch(op >> 5)
+    {
+    case 0x1:
+        draw_polygon();
+        return;
+    case 0x2:
+        draw_line();
+        return;
+    case 0x3:
+        draw_rectangle();
+        return;
+    case 0x4:
+        copy_rectangle();
+        return;
+    case 0x5:
+        start_upload();
+        return;
+    case 0x6:
+        start_readback();
+        return;
+    default:
+        break;
+    }
+
+    switch(op)
+    {
+    case 0x00: // NOP
+    case 0x01: // Clear cache (we don't have one)
+        break;
+    case 0x02:
+        fill_rectangle();
+        break;
+    case 0x1f: // Interrupt request
+        gpustat |= 0x01000000;
+        break;
+    case 0xe1: // Draw mode
+        gpustat = (gpustat & ~0x87ff) | (command & 0x7ff) | (((command >> 11) & 1) << 15);
+        break;
+    case 0xe2:
+        texture_window = command & 0x000fffff;
+        break;
+    case 0xe3:
+        area_top_left = command & 0x000fffff;
+        break;
+    case 0xe4:
+        area_bottom_right = command & 0x000fffff;
+        break;
+    case 0xe5:
+        draw_offset = command & 0x003fffff;
+        offset_x = sign_extend11(draw_offset & 0x7ff);
+        offset_y = sign_extend11((draw_offset >> 11) & 0x7ff);
+        break;
+    case 0xe6: // Mask bits
+        gpustat = (gpustat & ~0x1800) | ((command & 3) << 11);
+        break;
+    default:
+        std::printf("warning: gpu: unknown GP0 command 0x%08x!\n", command);
+        break;
+    }
+}
+
+void gpu::gpu::gp1(std::uint32_t val)
+{
+    std::uint8_t op = (val >> 24) & 0x3f;
+
+    switch(op)
+    {
+    case 0x00: // Reset
+        delete[] upload;
+        upload = nullptr;
+
+        gpustat = 0x14802000;
+        mode = COMMAND;
+        fifo_length = 0;
+        fifo_needed = 0;
+        std::memset(&write_transfer, 0x00, sizeof(write_transfer));
+        std::memset(&read_transfer, 0x00, sizeof(read_transfer));
+        readback.clear();
+        std::memset(&polyline_last, 0x00, sizeof(polyline_last));
+        gpuread_latch = 0;
+        polyline_command = 0;
+        texture_window = 0;
+        area_top_left = 0;
+        area_bottom_right = 0;
+        draw_offset = 0;
+        offset_x = 0;
+        offset_y = 0;
+        allow_texture_disable = false;
+        display_start = 0;
+        display_range_x = 0xc60260;
+        display_range_y = 0x3fc10;
+        break;
+    case 0x01: // Reset command buffer
+        delete[] upload;
+        upload = nullptr;
+        mode = COMMAND;
+        fifo_length = 0;
+        break;
+    case 0x02: // Acknowledge interrupt
+        gpustat &= ~0x01000000;
+        break;
+    case 0x03: // Display enable
+        gpustat = (gpustat & ~0x00800000) | ((val & 1) << 23);
+        break;
+    case 0x04: // DMA direction
+        gpustat = (gpustat & ~0x60000000) | ((val & 3) << 29);
+        break;
+    case 0x05:
+        display_start = val & 0x7ffff;
+        break;
+    case 0x06:
+        display_range_x = val & 0xffffff;
+        break;
+    case 0x07:
+        display_range_y = val & 0xfffff;
+        break;
+    case 0x08: // Display mode
+        gpustat = (gpustat & ~0x007f4000) | ((val & 0x3f) << 17) | (((val >> 6) & 1) << 16) | (((val >> 7) & 1) << 14);
+        break;
+    case 0x09:
+        allow_texture_disable = val & 1;
+        break;
+    default:
+        if(op >= 0x10 && op <= 0x1f) // Get GPU info
+        {
+            switch(val & 0x07)
+            {
+            case 2:
+                gpuread_latch = texture_window;
+                break;
+            case 3:
+                gpuread_latch = area_top_left;
+                break;
+            case 4:
+                gpuread_latch = area_bottom_right;
+                break;
+            case 5:
+                gpuread_latch = draw_offset;
+                break;
+            case 7:
+                gpuread_latch = GPU_VERSION;
+                break;
+            default:
+                break;
+            }
+
+            break;
+        }
+
+        std::printf("warning: gpu: unknown GP1 command 0x%08x!\n", val);
+        break;
+    }
+}
+
+std::uint32_t gpu::gpu::gpuread()
+{
+    if(read_transfer.words == 0)
+        return gpuread_latch;
+
+    std::uint32_t pixel = (read_transfer.width * read_transfer.height + 1) / 2 - read_transfer.words;
+
+    read_transfer.words--;
+    gpuread_latch = readback[pixel * 2] | (readback[pixel * 2 + 1] << 16);
+
+    return gpuread_latch;
+}
+
+void gpu::gpu::start_transfer(transfer& t)
+{
+    t.x = fifo[1] & 0x3ff;
+    t.y = (fifo[1] >> 16) & 0x1ff;
+    t.width = ((fifo[2] - 1) & 0x3ff) + 1;
+    t.height = (((fifo[2] >> 16) - 1) & 0x1ff) + 1;
+    t.words = (t.width * t.height + 1) / 2;
+}
+
+void gpu::gpu::start_upload()
+{
+    start_transfer(write_transfer);
+
+    delete[] upload;
+    upload = new std::uint16_t[write_transfer.words * 2];
+    mode = CPU_TO_VRAM;
+}
+
+void gpu::gpu::start_readback()
+{
+    start_transfer(read_transfer);
+
+    // Everything drawn so far has to be in VRAM. Take a copy of the whole rectangle while
+    // the GPU thread's idle, so it's free to carry on drawing while the CPU reads.
+    sync();
+
+    readback.resize(read_transfer.words * 2);
+
+    for(std::size_t i = 0; i < readback.size(); i++)
+    {
+        std::uint32_t x = (read_transfer.x + i % read_transfer.width) & (GPU_VRAM_WIDTH - 1);
+        std::uint32_t y = (read_transfer.y + i / read_transfer.width) & (GPU_VRAM_HEIGHT - 1);
+
+        readback[i] = vram[y * GPU_VRAM_WIDTH + x];
+    }
+}
+
+void gpu::gpu::copy_rectangle()
+{
+    primitive p;
+
+    std::memset(&p, 0x00, sizeof(p));
+    p.type = primitive::COPY;
+    p.v[1].x = fifo[1] & 0x3ff;
+    p.v[1].y = (fifo[1] >> 16) & 0x1ff;
+    p.v[0].x = fifo[2] & 0x3ff;
+    p.v[0].y = (fifo[2] >> 16) & 0x1ff;
+    p.width = ((fifo[3] - 1) & 0x3ff) + 1;
+    p.height = (((fifo[3] >> 16) - 1) & 0x1ff) + 1;
+    p.state = current_state(0);
+
+    push(p);
+}
+
+gpu::draw_state gpu::gpu::current_state(std::uint16_t clut) const
+{
+    draw_state st;
+
+    st.area_x1 = area_top_left & 0x3ff;
+    st.area_y1 = (area_top_left >> 10) & 0x1ff;
+    st.area_x2 = area_bottom_right & 0x3ff;
+    st.area_y2 = (area_bottom_right >> 10) & 0x1ff;
+    st.texpage_x = (gpustat & 0x0f) * 64;
+    st.texpage_y = ((gpustat >> 4) & 1) * 256;
+    st.clut_x = (clut & 0x3f) * 16;
+    st.clut_y = (clut >> 6) & 0x1ff;
+    st.depth = std::min<std::uint8_t>((gpustat >> 7) & 3, 2); // 3 is reserved, and behaves like 15-bit.
+    st.semi_mode = (gpustat >> 5) & 3;
+    st.window_mask_x = texture_window & 0x1f;
+    st.window_mask_y = (texture_window >> 5) & 0x1f;
+    st.window_offset_x = (texture_window >> 10) & 0x1f;
+    st.window_offset_y = (texture_window >> 15) & 0x1f;
+    st.dither = (gpustat >> 9) & 1;
+    st.set_mask = (gpustat >> 11) & 1;
+    st.check_mask = (gpustat >> 12) & 1;
+
+    return st;
+}
+
+void gpu::gpu::set_texpage(std::uint16_t texpage)
+{
+    std::uint32_t disable = allow_texture_disable ? ((texpage >> 11) & 1) : 0;
+
+    gpustat = (gpustat & ~0x81ff) | (texpage & 0x1ff) | (disable << 15);
+}
+
+gpu::vertex gpu::gpu::decode_vertex(std::uint32_t position, std::uint32_t color) const
+{
+    vertex v;
+
+    v.x = sign_extend11(position & 0x7ff) + offset_x;
+    v.y = sign_extend11((position >> 16) & 0x7ff) + offset_y;
+    v.r = color & 0xff;
+    v.g = (color >> 8) & 0xff;
+    v.b = (color >> 16) & 0xff;
+    v.u = 0;
+    v.v = 0;
+
+    return v;
+}
+
+void gpu::gpu::submit(primitive& p, std::int32_t x1, std::int32_t y1, std::int32_t x2, std::int32_t y2)
+{
+    p.x1 = std::max(x1, p.state.area_x1);
+    p.y1 = std::max(y1, p.state.area_y1);
+    p.x2 = std::min(x2, p.state.area_x2);
+    p.y2 = std::min(y2, p.state.area_y2);
+
+    if(p.x1 > p.x2 || p.y1 > p.y2)
+        return;
+
+    push(p);
+}
+
+void gpu::gpu::draw_polygon()
+{
+    std::uint32_t command = fifo[0];
+    bool quad = command & 0x08000000;
+    bool shaded = command & 0x10000000;
+    bool textured = command & 0x04000000;
+    unsigned count = quad ? 4 : 3;
+    unsigned word = 1;
+    std::uint16_t clut = 0;
+    vertex v[4];
+
+    for(unsigned i = 0; i < count; i++)
+    {
+        std::uint32_t color = (shaded && i > 0) ? fifo[word++] : command;
+        v[i] = decode_vertex(fifo[word++], color);
+
+        if(textured)
+        {
+            std::uint32_t uv = fifo[word++];
+            v[i].u = uv & 0xff;
+            v[i].v = (uv >> 8) & 0xff;
+
+            if(i == 0)
+                clut = uv >> 16;
+            else if(i == 1)
+                set_texpage(uv >> 16);
+        }
+    }
+
+    primitive p;
+    p.type = primitive::TRIANGLE;
+    p.width = 0;
+    p.height = 0;
+    p.shaded = shaded;
+    p.textured = textured && !(gpustat & 0x8000);
+    p.raw = command & 0x01000000;
+    p.semi = command & 0x02000000;
+    p.pixels = nullptr;
+    p.state = current_state(clut);
+
+    for(unsigned t = 0; t < count - 2; t++)
+    {
+        p.v[0] = v[t];
+        p.v[1] = v[t + 1];
+        p.v[2] = v[t + 2];
+
+        std::int32_t x1 = std::min(std::min(p.v[0].x, p.v[1].x), p.v[2].x);
+        std::int32_t y1 = std::min(std::min(p.v[0].y, p.v[1].y), p.v[2].y);
+        std::int32_t x2 = std::max(std::max(p.v[0].x, p.v[1].x), p.v[2].x);
+        std::int32_t y2 = std::max(std::max(p.v[0].y, p.v[1].y), p.v[2].y);
+
+        // The GPU won't draw anything this big.
+        if(x2 - x1 >= GPU_VRAM_WIDTH || y2 - y1 >= GPU_VRAM_HEIGHT)
+            continue;
+
+        submit(p, x1, y1, x2, y2);
+    }
+}
+
+/**
+ *  Record a line between two vertices.
+ */
+static gpu::primitive make_line(const gpu::vertex& a, const gpu::vertex& b, std::uint32_t command)
+{
+    gpu::primitive p;
+
+    p.type = gpu::primitive::LINE;
+    p.v[0] = a;
+    p.v[1] = b;
+    p.v[2] = b;
+    p.width = 0;
+    p.height = 0;
+    p.shaded = command & 0x10000000;
+    p.textured = false;
+    p.raw = false;
+    p.semi = command & 0x02000000;
+    p.pixels = nullptr;
+
+    return p;
+}
+
+void gpu::gpu::draw_line()
+{
+    std::uint32_t command = fifo[0];
+    bool shaded = command & 0x10000000;
+
+    vertex a = decode_vertex(fifo[1], command);
+    vertex b = decode_vertex(fifo[shaded ? 3 : 2], shaded ? fifo[2] : command);
+
+    primitive p = make_line(a, b, command);
+    p.state = current_state(0);
+
+    if(std::abs(b.x - a.x) < GPU_VRAM_WIDTH && std::abs(b.y - a.y) < GPU_VRAM_HEIGHT)
+        submit(p, std::min(a.x, b.x), std::min(a.y, b.y), std::max(a.x, b.x), std::max(a.y, b.y));
+
+    if(command & 0x08000000)
+    {
+        polyline_command = command;
+        polyline_last = b;
+        fifo_length = 0;
+        mode = POLYLINE;
+    }
+}
+
+void gpu::gpu::draw_polyline(std::uint32_t val)
+{
+    if((val & 0xf000f000) == 0x50005000)
+    {
+        fifo_length = 0;
+        mode = COMMAND;
+        return;
+    }
+
+    bool shaded = polyline_command & 0x10000000;
+    fifo[fifo_length++] = val;
+
+    if(fifo_length < (shaded ? 2u : 1u))
+        return;
+
+    vertex b = decode_vertex(fifo[fifo_length - 1], shaded ? fifo[0] : polyline_command);
+    vertex a = polyline_last;
+    fifo_length = 0;
+    polyline_last = b;
+
+    primitive p = make_line(a, b, polyline_command);
+    p.state = current_state(0);
+
+    if(std::abs(b.x - a.x) < GPU_VRAM_WIDTH && std::abs(b.y - a.y) < GPU_VRAM_HEIGHT)
+        submit(p, std::min(a.x, b.x), std::min(a.y, b.y), std::max(a.x, b.x), std::max(a.y, b.y));
+}
+
+void gpu::gpu::draw_rectangle()
+{
+    std::uint32_t command = fifo[0];
+    bool textured = command & 0x04000000;
+    unsigned word = 1;
+    std::uint16_t clut = 0;
+
+    primitive p;
+    p.type = primitive::RECTANGLE;
+    p.v[0] = decode_vertex(fifo[word++], command);
+
+    if(textured)
+    {
+        std::uint32_t uv = fifo[word++];
+        p.v[0].u = uv & 0xff;
+        p.v[0].v = (uv >> 8) & 0xff;
+        clut = uv >> 16;
+    }
+
+    switch((command >> 27) & 3)
+    {
+    case 0:
+        p.width = fifo[word] & 0x3ff;
+        p.height = (fifo[word] >> 16) & 0x1ff;
+        break;
+    case 1:
+        p.width = p.height = 1;
+        break;
+    case 2:
+        p.width = p.height = 8;
+        break;
+    case 3:
+        p.width = p.height = 16;
+        break;
+    }
+
+    if(p.width == 0 || p.height == 0)
+        return;
+
+    p.v[1] = p.v[0];
+    p.v[2] = p.v[0];
+    p.shaded = false;
+    p.textured = textured && !(gpustat & 0x8000);
+    p.raw = command & 0x01000000;
+    p.semi = command & 0x02000000;
+    p.pixels = nullptr;
+    p.state = current_state(clut);
+
+    submit(p, p.v[0].x, p.v[0].y, p.v[0].x + p.width - 1, p.v[0].y + p.height - 1);
+}
+
+void gpu::gpu::fill_rectangle()
+{
+    primitive p;
+
+    std::memset(&p, 0x00, sizeof(p));
+    p.type = primitive::FILL;
+    p.v[0].x = fifo[1] & 0x3f0;
+    p.v[0].y = (fifo[1] >> 16) & 0x1ff;
+    p.v[0].r = fifo[0] & 0xff;
+    p.v[0].g = (fifo[0] >> 8) & 0xff;
+    p.v[0].b = (fifo[0] >> 16) & 0xff;
+    p.width = ((fifo[2] & 0x3ff) + 0x0f) & ~0x0f;
+    p.height = (fifo[2] >> 16) & 0x1ff;
+
+    if(p.width == 0 || p.height == 0)
+        return;
+
+    // Fills ignore the drawing area, and wrap around VRAM. If it wraps, it could be anywhere.
+    if(p.v[0].x + p.width <= GPU_VRAM_WIDTH && p.v[0].y + p.height <= GPU_VRAM_HEIGHT)
+    {
+        p.x1 = p.v[0].x;
+        p.y1 = p.v[0].y;
+        p.x2 = p.v[0].x + p.width - 1;
+        p.y2 = p.v[0].y + p.height - 1;
+    }
+    else
+    {
+        p.x1 = 0;
+        p.y1 = 0;
+        p.x2 = GPU_VRAM_WIDTH - 1;
+        p.y2 = GPU_VRAM_HEIGHT - 1;
+    }
+
+    push(p);
+}
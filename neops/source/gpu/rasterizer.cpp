@@ -0,0 +1,905 @@
+/**
+    This file is part of NeoPS.
+
+    NeoPS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    NeoPS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+**/
+#include <algorithm>
+
+#include "gpu/rasterizer.hpp"
+
+#ifdef NEOPS_HAS_RASTERIZER_SIMD
+#include <immintrin.h>
+#endif
+
+using namespace gpu;
+
+/**
+ *  Offsets added to 8-bit colors before they're cut down to 5 bits, when dithering.
+ */
+static const std::int8_t dither_table[4][4] = { {-4,  0, -3,  1},
+                                                { 2, -2,  3, -1},
+                                                {-3,  1, -4,  0},
+                                                { 3, -1,  2, -2} };
+
+/**
+ *  One edge of a triangle. Its function is positive on the inside, and proportional to the weight of the opposite vertex.
+ */
+struct edge
+{
+    std::int64_t    step_x;     /**< Change per pixel to the right. */
+    std::int64_t    step_y;     /**< Change per line down. */
+    std::int64_t    origin;     /**< Value at (0, 0), including the fill rule bias. */
+
+    edge(const vertex& p, const vertex& q)
+    {
+        step_x = -(std::int64_t)(q.y - p.y);
+        step_y = (std::int64_t)(q.x - p.x);
+        origin = -step_x * p.x - step_y * p.y;
+
+        // Pixels exactly on the edge belong to the triangle for left and top edges only, so
+        // the right and bottom edges are never drawn. Anything else needs the function to be >= 1.
+        if(!(q.y < p.y || (q.y == p.y && q.x > p.x)))
+            origin--;
+    }
+
+    std::int64_t at(std::int32_t x, std::int32_t y) const
+    {
+        return origin + step_x * x + step_y * y;
+    }
+};
+
+void rasterizer::rect::merge(const rect& r)
+{
+    if(r.empty())
+        return;
+
+    if(empty())
+    {
+        *this = r;
+        return;
+    }
+
+    x1 = std::min(x1, r.x1);
+    y1 = std::min(y1, r.y1);
+    x2 = std::max(x2, r.x2);
+    y2 = std::max(y2, r.y2);
+}
+
+rasterizer::rasterizer(std::uint16_t* vram)
+{
+    this->vram = vram;
+    kernel = SCALAR;
+    drawn = {0, 0, -1, -1};
+    sampled = drawn;
+    batch = 0;
+    busy = 0;
+    quit = false;
+    next_tile = 0;
+
+    set_threads(0);
+    set_kernel(AVX2);
+}
+
+rasterizer::~rasterizer()
+{
+    stop_workers();
+}
+
+void rasterizer::set_threads(unsigned n)
+{
+    flush();
+    stop_workers();
+
+    if(n == 0)
+        n = std::min<unsigned>(std::max(std::thread::hardware_concurrency(), 1u), RASTERIZER_MAX_THREADS);
+
+    threads = n;
+}
+
+bool rasterizer::set_kernel(KERNEL k)
+{
+    switch(k)
+    {
+    case SCALAR:
+        break;
+#ifdef NEOPS_HAS_RASTERIZER_SIMD
+    case AVX2:
+        __builtin_cpu_init();
+        if(!__builtin_cpu_supports("avx2"))
+            return false;
+        break;
+#endif
+    default:
+        return false;
+    }
+
+    kernel = k;
+    return true;
+}
+
+void rasterizer::start_workers()
+{
+    quit = false;
+
+    for(unsigned i = 1; i < threads; i++)
+        workers.push_back(std::thread(&rasterizer::worker, this, batch));
+}
+
+void rasterizer::stop_workers()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        quit = true;
+    }
+
+    wake.notify_all();
+
+    for(std::size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+
+    workers.clear();
+}
+
+void rasterizer::worker(std::uint32_t seen)
+{
+    for(;;)
+    {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            wake.wait(guard, [&]{ return quit || batch != seen; });
+
+            if(quit)
+                return;
+
+            seen = batch;
+        }
+
+        render_tiles();
+
+        std::lock_guard<std::mutex> guard(lock);
+        if(--busy == 0)
+            done.notify_one();
+    }
+}
+
+rasterizer::rect rasterizer::texture_footprint(const primitive& p)
+{
+    rect r = {0, 0, -1, -1};
+
+    if(!p.textured)
+        return r;
+
+    const draw_state& st = p.state;
+    std::int32_t width = 64 << st.depth;
+
+    r.x1 = st.texpage_x;
+    r.y1 = st.texpage_y;
+    r.x2 = st.texpage_x + width - 1;
+    r.y2 = st.texpage_y + 255;
+
+    if(st.depth < 2)
+    {
+        rect clut = {st.clut_x, st.clut_y, st.clut_x + (st.depth == 0 ? 15 : 255), st.clut_y};
+        r.merge(clut);
+    }
+
+    // Anything that wraps around could be reading from anywhere.
+    if(r.x2 >= GPU_VRAM_WIDTH)
+    {
+        r.x1 = 0;
+        r.x2 = GPU_VRAM_WIDTH - 1;
+    }
+
+    if(r.y2 >= GPU_VRAM_HEIGHT)
+    {
+        r.y1 = 0;
+        r.y2 = GPU_VRAM_HEIGHT - 1;
+    }
+
+    return r;
+}
+
+void rasterizer::submit(const primitive& p)
+{
+    if(p.type == primitive::COPY)
+    {
+        flush();
+        copy(p);
+        return;
+    }
+
+    if(p.type == primitive::UPLOAD)
+    {
+        flush();
+        upload(p);
+        return;
+    }
+
+    rect box = {p.x1, p.y1, p.x2, p.y2};
+    rect texture = texture_footprint(p);
+
+    // Reading a texture the batch draws to, or drawing over one it reads from. Either way
+    // the tiles would race each other, so get the batch into VRAM first.
+    if(texture.intersects(drawn) || box.intersects(sampled))
+        flush();
+
+    queue.push_back(p);
+    drawn.merge(box);
+    sampled.merge(texture);
+
+    if(queue.size() >= RASTERIZER_MAX_QUEUE)
+        flush();
+}
+
+void rasterizer::flush()
+{
+    if(queue.empty())
+        return;
+
+    if(threads > 1 && workers.empty())
+        start_workers();
+
+    next_tile = 0;
+
+    if(workers.empty())
+    {
+        render_tiles();
+    }
+    else
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            busy = workers.size();
+            batch++;
+        }
+
+        wake.notify_all();
+        render_tiles();
+
+        std::unique_lock<std::mutex> guard(lock);
+        done.wait(guard, [this]{ return busy == 0; });
+    }
+
+    queue.clear();
+    drawn = {0, 0, -1, -1};
+    sampled = drawn;
+}
+
+void rasterizer::render_tiles()
+{
+    unsigned tile;
+
+    while((tile = next_tile++) < RASTERIZER_TILES_X * RASTERIZER_TILES_Y)
+    {
+        rect clip;
+        clip.x1 = (tile % RASTERIZER_TILES_X) * RASTERIZER_TILE_SIZE;
+        clip.y1 = (tile / RASTERIZER_TILES_X) * RASTERIZER_TILE_SIZE;
+        clip.x2 = clip.x1 + RASTERIZER_TILE_SIZE - 1;
+        clip.y2 = clip.y1 + RASTERIZER_TILE_SIZE - 1;
+
+        if(!clip.intersects(drawn))
+            continue;
+
+        for(std::size_t i = 0; i < queue.size(); i++)
+        {
+            const primitive& p = queue[i];
+            rect box = {p.x1, p.y1, p.x2, p.y2};
+
+            if(!box.intersects(clip))
+                continue;
+
+            rect r = {std::max(clip.x1, box.x1), std::max(clip.y1, box.y1), std::min(clip.x2, box.x2), std::min(clip.y2, box.y2)};
+            render(p, r);
+        }
+    }
+}
+
+void rasterizer::render(const primitive& p, const rect& clip)
+{
+    switch(p.type)
+    {
+    case primitive::TRIANGLE:
+        triangle(p, clip);
+        break;
+    case primitive::LINE:
+        line(p, clip);
+        break;
+    case primitive::RECTANGLE:
+        rectangle(p, clip);
+        break;
+    case primitive::FILL:
+        fill(p, clip);
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+ *  Gradient of an attribute across a triangle, in 16.16 fixed point.
+ */
+static void gradient(const vertex& a, const vertex& b, const vertex& c, std::int64_t area,
+                     std::int32_t av, std::int32_t bv, std::int32_t cv, std::int64_t& ddx, std::int64_t& ddy)
+{
+    ddx = (((std::int64_t)(bv - av) * (c.y - a.y) - (std::int64_t)(cv - av) * (b.y - a.y)) * 65536) / area;
+    ddy = (((std::int64_t)(cv - av) * (b.x - a.x) - (std::int64_t)(bv - av) * (c.x - a.x)) * 65536) / area;
+}
+
+void rasterizer::triangle(const primitive& p, const rect& clip)
+{
+    const vertex* a = &p.v[0];
+    const vertex* b = &p.v[1];
+    const vertex* c = &p.v[2];
+
+    std::int64_t area = (std::int64_t)(b->x - a->x) * (c->y - a->y) - (std::int64_t)(c->x - a->x) * (b->y - a->y);
+
+    if(area == 0)
+        return;
+
+    if(area < 0)
+    {
+        std::swap(b, c);
+        area = -area;
+    }
+
+    const edge edges[3] = {edge(*b, *c), edge(*c, *a), edge(*a, *b)};
+
+    std::int64_t ddx[5] = {0, 0, 0, 0, 0};
+    std::int64_t ddy[5] = {0, 0, 0, 0, 0};
+
+    if(p.shaded)
+    {
+        gradient(*a, *b, *c, area, a->r, b->r, c->r, ddx[0], ddy[0]);
+        gradient(*a, *b, *c, area, a->g, b->g, c->g, ddx[1], ddy[1]);
+        gradient(*a, *b, *c, area, a->b, b->b, c->b, ddx[2], ddy[2]);
+    }
+
+    if(p.textured)
+    {
+        gradient(*a, *b, *c, area, a->u, b->u, c->u, ddx[3], ddy[3]);
+        gradient(*a, *b, *c, area, a->v, b->v, c->v, ddx[4], ddy[4]);
+    }
+
+    const std::int32_t base[5] = {a->r, a->g, a->b, a->u, a->v};
+
+    for(std::int32_t y = clip.y1; y <= clip.y2; y++)
+    {
+        // Work out where the row enters and leaves the triangle, one edge at a time.
+        std::int32_t x1 = clip.x1;
+        std::int32_t x2 = clip.x2;
+
+        for(int i = 0; i < 3 && x1 <= x2; i++)
+        {
+            std::int64_t value = edges[i].at(clip.x1, y);
+            std::int64_t step = edges[i].step_x;
+
+            if(step > 0)
+            {
+                if(value < 0)
+                    x1 = (std::int32_t)std::max<std::int64_t>(x1, clip.x1 + (-value + step - 1) / step);
+            }
+            else if(step < 0)
+            {
+                if(value < 0)
+                    x2 = x1 - 1;
+                else
+                    x2 = (std::int32_t)std::min<std::int64_t>(x2, clip.x1 + value / -step);
+            }
+            else if(value < 0)
+            {
+                x2 = x1 - 1;
+            }
+        }
+
+        if(x1 > x2)
+            continue;
+
+        std::int32_t start[5];
+
+        for(int i = 0; i < 5; i++)
+            start[i] = (std::int32_t)(((std::int64_t)base[i] << 16) + ddx[i] * (x1 - a->x) + ddy[i] * (y - a->y) + 0x8000);
+
+        span s;
+        s.y = y;
+        s.x1 = x1;
+        s.x2 = x2 + 1;
+        s.r = start[0];
+        s.g = start[1];
+        s.b = start[2];
+        s.u = start[3];
+        s.v = start[4];
+        s.dr = (std::int32_t)ddx[0];
+        s.dg = (std::int32_t)ddx[1];
+        s.db = (std::int32_t)ddx[2];
+        s.du = (std::int32_t)ddx[3];
+        s.dv = (std::int32_t)ddx[4];
+
+        draw_span(p, s);
+    }
+}
+
+void rasterizer::line(const primitive& p, const rect& clip)
+{
+    const vertex& a = p.v[0];
+    const vertex& b = p.v[1];
+
+    std::int32_t dx = b.x - a.x;
+    std::int32_t dy = b.y - a.y;
+    std::int32_t steps = std::max(std::abs(dx), std::abs(dy));
+
+    // Both ends are drawn, so a line of length 0 is still a pixel.
+    std::int64_t x = ((std::int64_t)a.x << 16) + 0x8000;
+    std::int64_t y = ((std::int64_t)a.y << 16) + 0x8000;
+    std::int64_t r = ((std::int64_t)a.r << 16) + 0x8000;
+    std::int64_t g = ((std::int64_t)a.g << 16) + 0x8000;
+    std::int64_t bl = ((std::int64_t)a.b << 16) + 0x8000;
+    std::int64_t step_x = 0, step_y = 0, step_r = 0, step_g = 0, step_b = 0;
+
+    if(steps > 0)
+    {
+        step_x = ((std::int64_t)dx << 16) / steps;
+        step_y = ((std::int64_t)dy << 16) / steps;
+
+        if(p.shaded)
+        {
+            step_r = (((std::int64_t)b.r - a.r) << 16) / steps;
+            step_g = (((std::int64_t)b.g - a.g) << 16) / steps;
+            step_b = (((std::int64_t)b.b - a.b) << 16) / steps;
+        }
+    }
+
+    for(std::int32_t i = 0; i <= steps; i++)
+    {
+        std::int32_t px = (std::int32_t)(x >> 16);
+        std::int32_t py = (std::int32_t)(y >> 16);
+
+        if(px >= clip.x1 && px <= clip.x2 && py >= clip.y1 && py <= clip.y2)
+        {
+            span s = {py, px, px + 1, (std::int32_t)r, (std::int32_t)g, (std::int32_t)bl, 0, 0, 0, 0, 0, 0, 0};
+            draw_span(p, s);
+        }
+
+        x += step_x;
+        y += step_y;
+        r += step_r;
+        g += step_g;
+        bl += step_b;
+    }
+}
+
+void rasterizer::rectangle(const primitive& p, const rect& clip)
+{
+    const vertex& a = p.v[0];
+
+    for(std::int32_t y = clip.y1; y <= clip.y2; y++)
+    {
+        span s;
+        s.y = y;
+        s.x1 = clip.x1;
+        s.x2 = clip.x2 + 1;
+        s.r = a.r << 16;
+        s.g = a.g << 16;
+        s.b = a.b << 16;
+        s.u = (a.u + (clip.x1 - a.x)) << 16;
+        s.v = (a.v + (y - a.y)) << 16;
+        s.dr = 0;
+        s.dg = 0;
+        s.db = 0;
+        s.du = 1 << 16;
+        s.dv = 0;
+
+        draw_span(p, s);
+    }
+}
+
+void rasterizer::fill(const primitive& p, const rect& clip)
+{
+    // Fills ignore the drawing area and the mask settings, and wrap around the edges of VRAM.
+    std::uint16_t color = (p.v[0].r >> 3) | ((p.v[0].g >> 3) << 5) | ((p.v[0].b >> 3) << 10);
+
+    for(std::int32_t y = clip.y1; y <= clip.y2; y++)
+    {
+        if(((y - p.v[0].y) & (GPU_VRAM_HEIGHT - 1)) >= p.height)
+            continue;
+
+        std::uint16_t* row = vram + y * GPU_VRAM_WIDTH;
+
+        for(std::int32_t x = clip.x1; x <= clip.x2; x++)
+        {
+            if(((x - p.v[0].x) & (GPU_VRAM_WIDTH - 1)) < p.width)
+                row[x] = color;
+        }
+    }
+}
+
+void rasterizer::write_pixel(const draw_state& st, std::uint32_t x, std::uint32_t y, std::uint16_t pixel)
+{
+    std::uint16_t& dst = vram[(y & (GPU_VRAM_HEIGHT - 1)) * GPU_VRAM_WIDTH + (x & (GPU_VRAM_WIDTH - 1))];
+
+    if(st.check_mask && (dst & 0x8000))
+        return;
+
+    dst = pixel | (st.set_mask ? 0x8000 : 0x0000);
+}
+
+void rasterizer::copy(const primitive& p)
+{
+    std::vector<std::uint16_t> line(p.width);
+
+    // A line at a time through a buffer, so overlapping copies don't eat their own tail.
+    for(std::int32_t row = 0; row < p.height; row++)
+    {
+        const std::uint16_t* src = vram + ((p.v[1].y + row) & (GPU_VRAM_HEIGHT - 1)) * GPU_VRAM_WIDTH;
+
+        for(std::int32_t column = 0; column < p.width; column++)
+            line[column] = src[(p.v[1].x + column) & (GPU_VRAM_WIDTH - 1)];
+
+        for(std::int32_t column = 0; column < p.width; column++)
+            write_pixel(p.state, p.v[0].x + column, p.v[0].y + row, line[column]);
+    }
+}
+
+void rasterizer::upload(const primitive& p)
+{
+    const std::uint16_t* pixel = p.pixels;
+
+    for(std::int32_t row = 0; row < p.height; row++)
+    {
+        for(std::int32_t column = 0; column < p.width; column++)
+            write_pixel(p.state, p.v[0].x + column, p.v[0].y + row, *pixel++);
+    }
+
+    delete[] p.pixels;
+}
+
+/**
+ *  Fetch a texel, through the texture window and the CLUT.
+ */
+static inline std::uint16_t fetch_texel(const std::uint16_t* vram, const draw_state& st, std::uint32_t u, std::uint32_t v)
+{
+    u = ((u & ~(st.window_mask_x * 8u)) | ((st.window_offset_x & st.window_mask_x) * 8u)) & 0xff;
+    v = ((v & ~(st.window_mask_y * 8u)) | ((st.window_offset_y & st.window_mask_y) * 8u)) & 0xff;
+
+    const std::uint16_t* row = vram + ((st.texpage_y + v) & (GPU_VRAM_HEIGHT - 1)) * GPU_VRAM_WIDTH;
+    const std::uint16_t* clut = vram + st.clut_y * GPU_VRAM_WIDTH;
+
+    switch(st.depth)
+    {
+    case 0:
+    {
+        std::uint16_t indices = row[(st.texpage_x + u / 4) & (GPU_VRAM_WIDTH - 1)];
+        return clut[(st.clut_x + ((indices >> ((u & 3) * 4)) & 0xf)) & (GPU_VRAM_WIDTH - 1)];
+    }
+    case 1:
+    {
+        std::uint16_t indices = row[(st.texpage_x + u / 2) & (GPU_VRAM_WIDTH - 1)];
+        return clut[(st.clut_x + ((indices >> ((u & 1) * 8)) & 0xff)) & (GPU_VRAM_WIDTH - 1)];
+    }
+    default:
+        return row[(st.texpage_x + u) & (GPU_VRAM_WIDTH - 1)];
+    }
+}
+
+static inline std::int32_t blend(std::int32_t back, std::int32_t front, std::uint8_t mode)
+{
+    std::int32_t value;
+
+    switch(mode)
+    {
+    case 0:
+        value = (back + front) >> 1;
+        break;
+    case 1:
+        value = back + front;
+        break;
+    case 2:
+        value = back - front;
+        break;
+    default:
+        value = back + (front >> 2);
+        break;
+    }
+
+    return std::min(std::max(value, 0), 31);
+}
+
+void rasterizer::draw_span(const primitive& p, const span& s)
+{
+    const draw_state& st = p.state;
+    std::uint16_t* row = vram + s.y * GPU_VRAM_WIDTH;
+    const std::int8_t* dither = dither_table[s.y & 3];
+    bool dithered = st.dither && p.type != primitive::RECTANGLE && (p.shaded || (p.textured && !p.raw));
+    std::uint16_t mask = st.set_mask ? 0x8000 : 0x0000;
+    std::int32_t done = 0;
+
+#ifdef NEOPS_HAS_RASTERIZER_SIMD
+    if(kernel == AVX2)
+        done = draw_span_avx2(p, s);
+#endif
+
+    // Pick up wherever the SIMD kernel left off.
+    std::int32_t r = (std::int32_t)((std::uint32_t)s.r + (std::uint32_t)done * (std::uint32_t)s.dr);
+    std::int32_t g = (std::int32_t)((std::uint32_t)s.g + (std::uint32_t)done * (std::uint32_t)s.dg);
+    std::int32_t b = (std::int32_t)((std::uint32_t)s.b + (std::uint32_t)done * (std::uint32_t)s.db);
+    std::int32_t u = (std::int32_t)((std::uint32_t)s.u + (std::uint32_t)done * (std::uint32_t)s.du);
+    std::int32_t v = (std::int32_t)((std::uint32_t)s.v + (std::uint32_t)done * (std::uint32_t)s.dv);
+
+    for(std::int32_t x = s.x1 + done; x < s.x2; x++, r += s.dr, g += s.dg, b += s.db, u += s.du, v += s.dv)
+    {
+        std::uint16_t& pixel = row[x];
+
+        if(st.check_mask && (pixel & 0x8000))
+            continue;
+
+        std::int32_t cr = std::min(std::max(r >> 16, 0), 255);
+        std::int32_t cg = std::min(std::max(g >> 16, 0), 255);
+        std::int32_t cb = std::min(std::max(b >> 16, 0), 255);
+        std::uint16_t texel = 0;
+        bool semi = p.semi;
+
+        if(p.textured)
+        {
+            texel = fetch_texel(vram, st, (std::uint32_t)(u >> 16), (std::uint32_t)(v >> 16));
+
+            if(texel == 0x0000) // Fully transparent.
+                continue;
+
+            // Only texels with bit 15 set are semi-transparent.
+            semi = semi && (texel & 0x8000);
+
+            if(p.raw)
+            {
+                cr = (texel & 0x1f) << 3;
+                cg = ((texel >> 5) & 0x1f) << 3;
+                cb = ((texel >> 10) & 0x1f) << 3;
+            }
+            else
+            {
+                // Texel * color / 128, so a color of 0x80 leaves the texture alone.
+                cr = std::min(((texel & 0x1f) * cr) >> 4, 255);
+                cg = std::min((((texel >> 5) & 0x1f) * cg) >> 4, 255);
+                cb = std::min((((texel >> 10) & 0x1f) * cb) >> 4, 255);
+            }
+        }
+
+        if(dithered)
+        {
+            std::int32_t d = dither[x & 3];
+            cr = std::min(std::max(cr + d, 0), 255);
+            cg = std::min(std::max(cg + d, 0), 255);
+            cb = std::min(std::max(cb + d, 0), 255);
+        }
+
+        cr >>= 3;
+        cg >>= 3;
+        cb >>= 3;
+
+        if(semi)
+        {
+            cr = blend(pixel & 0x1f, cr, st.semi_mode);
+            cg = blend((pixel >> 5) & 0x1f, cg, st.semi_mode);
+            cb = blend((pixel >> 10) & 0x1f, cb, st.semi_mode);
+        }
+
+        pixel = (std::uint16_t)(cr | (cg << 5) | (cb << 10) | (texel & 0x8000) | mask);
+    }
+}
+
+#ifdef NEOPS_HAS_RASTERIZER_SIMD
+/**
+ *  Gather 8 pixels of VRAM. Each gather reads 32 bits, which is why VRAM has some slack at the end.
+ */
+__attribute__((target("avx2")))
+static inline __m256i gather_pixels(const std::uint16_t* vram, __m256i index)
+{
+    return _mm256_and_si256(_mm256_i32gather_epi32((const int*)vram, index, 2), _mm256_set1_epi32(0xffff));
+}
+
+/**
+ *  Fetch 8 texels, already through the texture window.
+ */
+__attribute__((target("avx2")))
+static inline __m256i fetch_texels_avx2(const std::uint16_t* vram, const draw_state& st, __m256i u, __m256i v)
+{
+    const __m256i width_mask = _mm256_set1_epi32(GPU_VRAM_WIDTH - 1);
+    __m256i row = _mm256_slli_epi32(_mm256_and_si256(_mm256_add_epi32(_mm256_set1_epi32(st.texpage_y), v), _mm256_set1_epi32(GPU_VRAM_HEIGHT - 1)), 10);
+    __m256i clut = _mm256_set1_epi32(st.clut_y * GPU_VRAM_WIDTH);
+    __m256i column, indices;
+
+    switch(st.depth)
+    {
+    case 0:
+        column = _mm256_and_si256(_mm256_add_epi32(_mm256_set1_epi32(st.texpage_x), _mm256_srli_epi32(u, 2)), width_mask);
+        indices = gather_pixels(vram, _mm256_add_epi32(row, column));
+        indices = _mm256_and_si256(_mm256_srlv_epi32(indices, _mm256_slli_epi32(_mm256_and_si256(u, _mm256_set1_epi32(3)), 2)), _mm256_set1_epi32(0xf));
+        column = _mm256_and_si256(_mm256_add_epi32(_mm256_set1_epi32(st.clut_x), indices), width_mask);
+        return gather_pixels(vram, _mm256_add_epi32(clut, column));
+    case 1:
+        column = _mm256_and_si256(_mm256_add_epi32(_mm256_set1_epi32(st.texpage_x), _mm256_srli_epi32(u, 1)), width_mask);
+        indices = gather_pixels(vram, _mm256_add_epi32(row, column));
+        indices = _mm256_and_si256(_mm256_srlv_epi32(indices, _mm256_slli_epi32(_mm256_and_si256(u, _mm256_set1_epi32(1)), 3)), _mm256_set1_epi32(0xff));
+        column = _mm256_and_si256(_mm256_add_epi32(_mm256_set1_epi32(st.clut_x), indices), width_mask);
+        return gather_pixels(vram, _mm256_add_epi32(clut, column));
+    default:
+        column = _mm256_and_si256(_mm256_add_epi32(_mm256_set1_epi32(st.texpage_x), u), width_mask);
+        return gather_pixels(vram, _mm256_add_epi32(row, column));
+    }
+}
+
+__attribute__((target("avx2")))
+static inline __m256i clamp_avx2(__m256i value, __m256i high)
+{
+    return _mm256_min_epi32(_mm256_max_epi32(value, _mm256_setzero_si256()), high);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i blend_avx2(__m256i back, __m256i front, std::uint8_t mode)
+{
+    __m256i value;
+
+    switch(mode)
+    {
+    case 0:
+        value = _mm256_srai_epi32(_mm256_add_epi32(back, front), 1);
+        break;
+    case 1:
+        value = _mm256_add_epi32(back, front);
+        break;
+    case 2:
+        value = _mm256_sub_epi32(back, front);
+        break;
+    default:
+        value = _mm256_add_epi32(back, _mm256_srli_epi32(front, 2));
+        break;
+    }
+
+    return clamp_avx2(value, _mm256_set1_epi32(31));
+}
+
+/**
+ *  Texture a channel: 5-bit texel * 8-bit color / 16, saturated.
+ */
+__attribute__((target("avx2")))
+static inline __m256i modulate_avx2(__m256i texel, __m256i color)
+{
+    // Both fit in the low 16 bits of each lane, and so does the product.
+    return _mm256_min_epi32(_mm256_srli_epi32(_mm256_mullo_epi16(texel, color), 4), _mm256_set1_epi32(255));
+}
+
+__attribute__((target("avx2")))
+std::int32_t rasterizer::draw_span_avx2(const primitive& p, const span& s)
+{
+    // Only whole groups, so we never touch a pixel outside the span (it could be another tile's).
+    std::int32_t count = (s.x2 - s.x1) & ~7;
+
+    if(count == 0)
+        return 0;
+
+    const draw_state& st = p.state;
+    std::uint16_t* row = vram + s.y * GPU_VRAM_WIDTH;
+    bool dithered = st.dither && p.type != primitive::RECTANGLE && (p.shaded || (p.textured && !p.raw));
+
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ones = _mm256_set1_epi32(-1);
+    const __m256i max8 = _mm256_set1_epi32(255);
+    const __m256i mask5 = _mm256_set1_epi32(0x1f);
+    const __m256i bit15 = _mm256_set1_epi32(0x8000);
+    const __m256i set_mask = st.set_mask ? bit15 : zero;
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+    // Texture window: u = (u & ~(mask * 8)) | ((offset & mask) * 8), all in 8 bits.
+    const __m256i window_and_u = _mm256_set1_epi32(~(st.window_mask_x * 8) & 0xff);
+    const __m256i window_or_u = _mm256_set1_epi32((st.window_offset_x & st.window_mask_x) * 8);
+    const __m256i window_and_v = _mm256_set1_epi32(~(st.window_mask_y * 8) & 0xff);
+    const __m256i window_or_v = _mm256_set1_epi32((st.window_offset_y & st.window_mask_y) * 8);
+
+    __m256i r = _mm256_add_epi32(_mm256_set1_epi32(s.r), _mm256_mullo_epi32(lanes, _mm256_set1_epi32(s.dr)));
+    __m256i g = _mm256_add_epi32(_mm256_set1_epi32(s.g), _mm256_mullo_epi32(lanes, _mm256_set1_epi32(s.dg)));
+    __m256i b = _mm256_add_epi32(_mm256_set1_epi32(s.b), _mm256_mullo_epi32(lanes, _mm256_set1_epi32(s.db)));
+    __m256i u = _mm256_add_epi32(_mm256_set1_epi32(s.u), _mm256_mullo_epi32(lanes, _mm256_set1_epi32(s.du)));
+    __m256i v = _mm256_add_epi32(_mm256_set1_epi32(s.v), _mm256_mullo_epi32(lanes, _mm256_set1_epi32(s.dv)));
+    const __m256i step_r = _mm256_slli_epi32(_mm256_set1_epi32(s.dr), 3);
+    const __m256i step_g = _mm256_slli_epi32(_mm256_set1_epi32(s.dg), 3);
+    const __m256i step_b = _mm256_slli_epi32(_mm256_set1_epi32(s.db), 3);
+    const __m256i step_u = _mm256_slli_epi32(_mm256_set1_epi32(s.du), 3);
+    const __m256i step_v = _mm256_slli_epi32(_mm256_set1_epi32(s.dv), 3);
+
+    // We move 8 pixels at a time, so every group sees the dither pattern the same way round.
+    const std::int8_t* pattern = dither_table[s.y & 3];
+    const __m256i dither = _mm256_setr_epi32(pattern[(s.x1 + 0) & 3], pattern[(s.x1 + 1) & 3], pattern[(s.x1 + 2) & 3], pattern[(s.x1 + 3) & 3],
+                                             pattern[(s.x1 + 4) & 3], pattern[(s.x1 + 5) & 3], pattern[(s.x1 + 6) & 3], pattern[(s.x1 + 7) & 3]);
+
+    for(std::int32_t x = s.x1; x < s.x1 + count; x += 8)
+    {
+        __m256i pixels = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(row + x)));
+        __m256i keep = zero; // Lanes we leave alone.
+
+        if(st.check_mask)
+            keep = _mm256_cmpeq_epi32(_mm256_and_si256(pixels, bit15), bit15);
+
+        __m256i cr = clamp_avx2(_mm256_srai_epi32(r, 16), max8);
+        __m256i cg = clamp_avx2(_mm256_srai_epi32(g, 16), max8);
+        __m256i cb = clamp_avx2(_mm256_srai_epi32(b, 16), max8);
+        __m256i texel = zero;
+        __m256i semi = p.semi ? ones : zero;
+
+        if(p.textured)
+        {
+            __m256i tu = _mm256_or_si256(_mm256_and_si256(_mm256_srai_epi32(u, 16), window_and_u), window_or_u);
+            __m256i tv = _mm256_or_si256(_mm256_and_si256(_mm256_srai_epi32(v, 16), window_and_v), window_or_v);
+
+            texel = fetch_texels_avx2(vram, st, tu, tv);
+            keep = _mm256_or_si256(keep, _mm256_cmpeq_epi32(texel, zero));
+
+            if(p.semi)
+                semi = _mm256_cmpeq_epi32(_mm256_and_si256(texel, bit15), bit15);
+
+            __m256i tr = _mm256_and_si256(texel, mask5);
+            __m256i tg = _mm256_and_si256(_mm256_srli_epi32(texel, 5), mask5);
+            __m256i tb = _mm256_and_si256(_mm256_srli_epi32(texel, 10), mask5);
+
+            if(p.raw)
+            {
+                cr = _mm256_slli_epi32(tr, 3);
+                cg = _mm256_slli_epi32(tg, 3);
+                cb = _mm256_slli_epi32(tb, 3);
+            }
+            else
+            {
+                cr = modulate_avx2(tr, cr);
+                cg = modulate_avx2(tg, cg);
+                cb = modulate_avx2(tb, cb);
+            }
+        }
+
+        if(dithered)
+        {
+            cr = clamp_avx2(_mm256_add_epi32(cr, dither), max8);
+            cg = clamp_avx2(_mm256_add_epi32(cg, dither), max8);
+            cb = clamp_avx2(_mm256_add_epi32(cb, dither), max8);
+        }
+
+        cr = _mm256_srli_epi32(cr, 3);
+        cg = _mm256_srli_epi32(cg, 3);
+        cb = _mm256_srli_epi32(cb, 3);
+
+        if(p.semi)
+        {
+            __m256i br = _mm256_and_si256(pixels, mask5);
+            __m256i bg = _mm256_and_si256(_mm256_srli_epi32(pixels, 5), mask5);
+            __m256i bb = _mm256_and_si256(_mm256_srli_epi32(pixels, 10), mask5);
+
+            cr = _mm256_blendv_epi8(cr, blend_avx2(br, cr, st.semi_mode), semi);
+            cg = _mm256_blendv_epi8(cg, blend_avx2(bg, cg, st.semi_mode), semi);
+            cb = _mm256_blendv_epi8(cb, blend_avx2(bb, cb, st.semi_mode), semi);
+        }
+
+        __m256i out = _mm256_or_si256(_mm256_or_si256(cr, _mm256_slli_epi32(cg, 5)), _mm256_slli_epi32(cb, 10));
+        out = _mm256_or_si256(out, _mm256_or_si256(_mm256_and_si256(texel, bit15), set_mask));
+        out = _mm256_blendv_epi8(out, pixels, keep);
+
+        // Back down to 16 bits. The pack works within each 128-bit half, so pull the two results together.
+        out = _mm256_permute4x64_epi64(_mm256_packus_epi32(out, out), 0x08);
+        _mm_storeu_si128((__m128i*)(row + x), _mm256_castsi256_si128(out));
+
+        r = _mm256_add_epi32(r, step_r);
+        g = _mm256_add_epi32(g, step_g);
+        b = _mm256_add_epi32(b, step_b);
+        u = _mm256_add_epi32(u, step_u);
+        v = _mm256_add_epi32(v, step_v);
+    }
+
+    return count;
+}
+#endif
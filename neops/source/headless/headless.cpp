@@ -0,0 +1,139 @@
+/**
+    This file is part of NeoPS.
+
+    NeoPS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    NeoPS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+**/
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "headless/headless.hpp"
+#include "bus/bus.hpp"
+#include "gpu/gpu.hpp"
+#include "hle/hle.hpp"
+#include "state/state.hpp"
+#include "system/system.hpp"
+
+/**
+ *  64-bit FNV-1a.
+ */
+static std::uint64_t hash(const void* data, std::size_t size)
+{
+    const std::uint8_t* bytes = (const std::uint8_t*)data;
+    std::uint64_t h = 0xcbf29ce484222325ULL;
+
+    for(std::size_t i = 0; i < size; i++)
+    {
+        h ^= bytes[i];
+        h *= 0x100000001b3ULL;
+    }
+
+    return h;
+}
+
+/**
+ *  Hash everything the CPU (and its coprocessors) would put in a save state.
+ */
+static std::uint64_t hash_cpu(cpu::r3000a& cpu)
+{
+    state::serializer measure(state::serializer::MEASURE, nullptr, 0);
+    cpu.serialize(measure);
+    measure.finish();
+
+    std::vector<std::uint8_t> buffer(measure.size());
+    state::serializer s(state::serializer::SAVE, buffer.data(), buffer.size());
+    cpu.serialize(s);
+    s.finish();
+
+    return hash(buffer.data(), buffer.size());
+}
+
+int headless::run(const options& opts)
+{
+    psx::system machine;
+
+    if(!machine.load_bios(opts.bios))
+    {
+        std::printf("fatal: headless: couldn't load the BIOS from %s!\n", opts.bios);
+        exit(-1);
+    }
+
+    cpu::r3000a& cpu = machine.get_cpu();
+    gpu::gpu& gpu = machine.get_gpu();
+
+    cpu.set_exec_mode(opts.exec_mode);
+    gpu.set_threads(opts.gpu_threads);
+
+    if(opts.hle || opts.fast_boot)
+    {
+        cpu.set_hle(true);
+        cpu.get_hle()->set_tty(stderr); // Keep stdout for the hashes.
+
+        if(opts.fast_boot)
+            cpu.get_hle()->fast_boot();
+    }
+
+    if(opts.exe != nullptr && !machine.sideload(opts.exe))
+    {
+        std::printf("fatal: headless: couldn't load the executable %s!\n", opts.exe);
+        exit(-1);
+    }
+
+    if(opts.load_state != nullptr)
+    {
+        state::snapshot snap(cpu);
+
+        if(!snap.read(opts.load_state) || !snap.load())
+        {
+            std::printf("fatal: headless: couldn't load the save state %s!\n", opts.load_state);
+            exit(-1);
+        }
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    // Runs over by up to an instruction or a block, so we report what it actually ran, not what we asked for.
+    std::uint64_t ran = machine.run(opts.cycles);
+    gpu.sync();
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::printf("cycles %" PRIu64 "\n", ran);
+    std::printf("frames %.2f\n", ran / (double)HEADLESS_CYCLES_PER_FRAME);
+    std::printf("pc %08x\n", cpu.get_pc());
+    std::printf("ram %016" PRIx64 "\n", hash(bus::ram(), PSX_MEM_SIZE));
+    std::printf("vram %016" PRIx64 "\n", hash(gpu.get_vram(), GPU_VRAM_WIDTH * GPU_VRAM_HEIGHT * sizeof(std::uint16_t)));
+    std::printf("cpu %016" PRIx64 "\n", hash_cpu(cpu));
+    std::fflush(stdout);
+
+    std::fprintf(stderr, "headless: %.3fs, %.2f MHz (%.2fx real time)\n", seconds, ran / seconds / 1000000.0, ran / seconds / R3000_CLOCK);
+
+    if(opts.stats)
+        bus::print_io_stats();
+
+    if(opts.save_state != nullptr)
+    {
+        state::snapshot snap(cpu);
+
+        if(!snap.save() || !snap.write(opts.save_state))
+        {
+            std::printf("fatal: headless: couldn't write the save state %s!\n", opts.save_state);
+            exit(-1);
+        }
+    }
+
+    return 0;
+}
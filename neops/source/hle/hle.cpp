@@ -0,0 +1,1156 @@
+/**
+    This file is part of NeoPS.
+
+    NeoPS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    NeoPS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+**/
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "hle/hle.hpp"
+#include "bus/bus.hpp"
+#include "cpu/cop0.hpp"
+#include "cpu/r3000a.hpp"
+#include "state/state.hpp"
+
+#define HLE_EVENT_HANDLE    0xf1000000
+#define HLE_THREAD_HANDLE   0xff000000
+#define HLE_ERROR           0xffffffff
+
+#define EVENT_FREE          0x0000
+#define EVENT_DISABLED      0x1000
+#define EVENT_ENABLED       0x2000
+#define EVENT_DELIVERED     0x4000
+
+#define EVENT_MODE_CALLBACK 0x1000
+#define EVENT_MODE_READY    0x2000
+
+using namespace hle;
+
+const kernel::function kernel::functions[] =
+{
+    {HLE_A0_VECTOR, 0x00, "open",           &kernel::fn_open,           false},
+    {HLE_A0_VECTOR, 0x01, "lseek",          &kernel::fn_lseek,          false},
+    {HLE_A0_VECTOR, 0x02, "read",           &kernel::fn_read,           false},
+    {HLE_A0_VECTOR, 0x03, "write",          &kernel::fn_write,          false},
+    {HLE_A0_VECTOR, 0x04, "close",          &kernel::fn_close,          false},
+    {HLE_A0_VECTOR, 0x0e, "abs",            &kernel::fn_abs,            true},
+    {HLE_A0_VECTOR, 0x0f, "labs",           &kernel::fn_abs,            true},
+    {HLE_A0_VECTOR, 0x10, "atoi",           &kernel::fn_atoi,           true},
+    {HLE_A0_VECTOR, 0x11, "atol",           &kernel::fn_atoi,           true},
+    {HLE_A0_VECTOR, 0x15, "strcat",         &kernel::fn_strcat,         true},
+    {HLE_A0_VECTOR, 0x16, "strncat",        &kernel::fn_strncat,        true},
+    {HLE_A0_VECTOR, 0x17, "strcmp",         &kernel::fn_strcmp,         true},
+    {HLE_A0_VECTOR, 0x18, "strncmp",        &kernel::fn_strncmp,        true},
+    {HLE_A0_VECTOR, 0x19, "strcpy",         &kernel::fn_strcpy,         true},
+    {HLE_A0_VECTOR, 0x1a, "strncpy",        &kernel::fn_strncpy,        true},
+    {HLE_A0_VECTOR, 0x1b, "strlen",         &kernel::fn_strlen,         true},
+    {HLE_A0_VECTOR, 0x1c, "index",          &kernel::fn_strchr,         true},
+    {HLE_A0_VECTOR, 0x1d, "rindex",         &kernel::fn_strrchr,        true},
+    {HLE_A0_VECTOR, 0x1e, "strchr",         &kernel::fn_strchr,         true},
+    {HLE_A0_VECTOR, 0x1f, "strrchr",        &kernel::fn_strrchr,        true},
+    {HLE_A0_VECTOR, 0x25, "toupper",        &kernel::fn_toupper,        true},
+    {HLE_A0_VECTOR, 0x26, "tolower",        &kernel::fn_tolower,        true},
+    {HLE_A0_VECTOR, 0x27, "bcopy",          &kernel::fn_bcopy,          true},
+    {HLE_A0_VECTOR, 0x28, "bzero",          &kernel::fn_bzero,          true},
+    {HLE_A0_VECTOR, 0x29, "bcmp",           &kernel::fn_memcmp,         true},
+    {HLE_A0_VECTOR, 0x2a, "memcpy",         &kernel::fn_memcpy,         true},
+    {HLE_A0_VECTOR, 0x2b, "memset",         &kernel::fn_memset,         true},
+    {HLE_A0_VECTOR, 0x2c, "memmove",        &kernel::fn_memmove,        true},
+    {HLE_A0_VECTOR, 0x2d, "memcmp",         &kernel::fn_memcmp,         true},
+    {HLE_A0_VECTOR, 0x2e, "memchr",         &kernel::fn_memchr,         true},
+    {HLE_A0_VECTOR, 0x2f, "rand",           &kernel::fn_rand,           false},
+    {HLE_A0_VECTOR, 0x30, "srand",          &kernel::fn_srand,          false},
+    {HLE_A0_VECTOR, 0x33, "malloc",         &kernel::fn_malloc,         false},
+    {HLE_A0_VECTOR, 0x34, "free",           &kernel::fn_free,           false},
+    {HLE_A0_VECTOR, 0x37, "calloc",         &kernel::fn_calloc,         false},
+    {HLE_A0_VECTOR, 0x38, "realloc",        &kernel::fn_realloc,        false},
+    {HLE_A0_VECTOR, 0x39, "InitHeap",       &kernel::fn_init_heap,      false},
+    {HLE_A0_VECTOR, 0x3c, "putchar",        &kernel::fn_putchar,        true},
+    {HLE_A0_VECTOR, 0x3e, "puts",           &kernel::fn_puts,           true},
+    {HLE_A0_VECTOR, 0x3f, "printf",         &kernel::fn_printf,         true},
+    {HLE_A0_VECTOR, 0x44, "FlushCache",     &kernel::fn_flush_cache,    true},
+    {HLE_A0_VECTOR, 0x9f, "SetMem",         &kernel::fn_set_mem,        true},
+
+    {HLE_B0_VECTOR, 0x07, "DeliverEvent",   &kernel::fn_deliver_event,  false},
+    {HLE_B0_VECTOR, 0x08, "OpenEvent",      &kernel::fn_open_event,     false},
+    {HLE_B0_VECTOR, 0x09, "CloseEvent",     &kernel::fn_close_event,    false},
+    {HLE_B0_VECTOR, 0x0a, "WaitEvent",      &kernel::fn_wait_event,     false},
+    {HLE_B0_VECTOR, 0x0b, "TestEvent",      &kernel::fn_test_event,     false},
+    {HLE_B0_VECTOR, 0x0c, "EnableEvent",    &kernel::fn_enable_event,   false},
+    {HLE_B0_VECTOR, 0x0d, "DisableEvent",   &kernel::fn_disable_event,  false},
+    {HLE_B0_VECTOR, 0x0e, "OpenThread",     &kernel::fn_open_thread,    false},
+    {HLE_B0_VECTOR, 0x0f, "CloseThread",    &kernel::fn_close_thread,   false},
+    {HLE_B0_VECTOR, 0x10, "ChangeThread",   &kernel::fn_change_thread,  false},
+    {HLE_B0_VECTOR, 0x20, "UnDeliverEvent", &kernel::fn_undeliver_event, false},
+    {HLE_B0_VECTOR, 0x32, "open",           &kernel::fn_open,           false},
+    {HLE_B0_VECTOR, 0x33, "lseek",          &kernel::fn_lseek,          false},
+    {HLE_B0_VECTOR, 0x34, "read",           &kernel::fn_read,           false},
+    {HLE_B0_VECTOR, 0x35, "write",          &kernel::fn_write,          false},
+    {HLE_B0_VECTOR, 0x36, "close",          &kernel::fn_close,          false},
+    {HLE_B0_VECTOR, 0x3d, "putchar",        &kernel::fn_putchar,        true},
+    {HLE_B0_VECTOR, 0x3f, "puts",           &kernel::fn_puts,           true},
+    {HLE_B0_VECTOR, 0x42, "firstfile",      &kernel::fn_first_file,     false},
+    {HLE_B0_VECTOR, 0x43, "nextfile",       &kernel::fn_first_file,     false},
+
+    {HLE_C0_VECTOR, 0x0a, "ChangeClearRCnt", &kernel::fn_change_clear_rcnt, false},
+};
+
+kernel::kernel(cpu::r3000a* cpu)
+{
+    this->cpu = cpu;
+    tty = stdout;
+
+    native = false;
+    heap_start = 0;
+    heap_end = 0;
+    rand_seed = 0;
+    current_thread = 0;
+    std::memset(events, 0x00, sizeof(events));
+    std::memset(threads, 0x00, sizeof(threads));
+    switched = false;
+}
+
+bool kernel::intercept(std::uint32_t phys_addr)
+{
+    // With the real BIOS in charge, its exception handler is too.
+    if(phys_addr == HLE_EXCEPTION)
+    {
+        if(!native)
+            return false;
+
+        exception();
+        return true;
+    }
+
+    std::uint32_t number = cpu->gpr[9];
+    const function* f = find(phys_addr, number);
+
+    if(f == nullptr || (!native && !f->standalone))
+    {
+        if(!native)
+            return false;
+
+        std::size_t table = (phys_addr - HLE_A0_VECTOR) >> 4;
+
+        if(!reported[table * 256 + (number & 0xff)])
+        {
+            std::printf("warning: hle: no kernel function %c0(%02xh), returning 0!\n", (int)('A' + table), number);
+            reported[table * 256 + (number & 0xff)] = true;
+        }
+    }
+
+    // The call's the instruction after the jump's delay slot, so anything that slot loaded lands now.
+    cpu->gpr[cpu->delay_reg] = cpu->load_delay;
+    cpu->gpr[0] = 0;
+    cpu->load_delay = 0;
+    cpu->delay_reg = 0;
+
+    switched = false;
+    std::uint32_t result = (f != nullptr) ? (this->*f->handler)() : 0;
+
+    if(!switched)
+    {
+        cpu->write_gpr(2, result);
+        cpu->set_pc(cpu->gpr[31]);
+    }
+
+    return true;
+}
+
+const kernel::function* kernel::find(std::uint32_t vector, std::uint32_t number) const
+{
+    for(std::size_t i = 0; i < sizeof(functions) / sizeof(functions[0]); i++)
+    {
+        if(functions[i].vector == vector && functions[i].number == number)
+            return &functions[i];
+    }
+
+    return nullptr;
+}
+
+void kernel::exception()
+{
+    cpu::cop0* cp0 = cpu->cp0;
+    std::uint32_t sr = cp0->read_gpr(12);
+    std::uint32_t code = (cp0->read_gpr(13) >> 2) & 0x1f;
+    std::uint32_t epc = cp0->read_gpr(14);
+
+    // Anything the interrupted code had loading lands first, same as a call.
+    cpu->gpr[cpu->delay_reg] = cpu->load_delay;
+    cpu->gpr[0] = 0;
+    cpu->load_delay = 0;
+    cpu->delay_reg = 0;
+
+    // Pop the interrupt enable/kernel mode stack, like the RFE on the way out would.
+    sr = (sr & ~0xf) | ((sr >> 2) & 0xf);
+
+    if(code == cpu::cop0::SYSCALL)
+    {
+        switch(cpu->gpr[4])
+        {
+        case 1: // EnterCriticalSection
+            cpu->write_gpr(2, (sr & 0x401) == 0x401);
+            sr &= ~0x401;
+            break;
+
+        case 2: // ExitCriticalSection
+            sr |= 0x401;
+            break;
+
+        default:
+            std::printf("warning: hle: unknown syscall %u!\n", cpu->gpr[4]);
+            break;
+        }
+
+        epc += 4;
+    }
+    else if(code != cpu::cop0::INTERRUPT)
+    {
+        std::printf("warning: hle: exception %u at 0x%08x, skipping the instruction!\n", code, epc);
+        epc += 4;
+    }
+
+    cp0->write_gpr(12, sr);
+    cpu->set_pc(epc);
+}
+
+void kernel::fast_boot()
+{
+    // Memory control, the way the BIOS leaves it.
+    static const std::uint32_t mem_control[] = {0x1f000000, 0x1f802000, 0x0013243f, 0x00003022, 0x0013243f, 0x200931e1, 0x00020843, 0x00070777, 0x00031125};
+
+    for(std::size_t i = 0; i < sizeof(mem_control) / sizeof(mem_control[0]); i++)
+        bus::write_word(PSX_MEM_CONTROL_BASE + i * 4, mem_control[i]);
+
+    bus::write_word(PSX_MEM_RAM_SIZE_REG, 0x00000b88);
+    write32(0x80000000 | HLE_RAM_SIZE_ADDR, 2);
+
+    // j HLE_IDLE_ADDR, nop
+    write32(HLE_IDLE_ADDR, 0x08000000 | ((HLE_IDLE_ADDR & 0x0fffffff) >> 2));
+    write32(HLE_IDLE_ADDR + 4, 0x00000000);
+
+    native = true;
+    heap_start = 0;
+    heap_end = 0;
+    rand_seed = 0;
+    current_thread = 0;
+    std::memset(events, 0x00, sizeof(events));
+    std::memset(threads, 0x00, sizeof(threads));
+    threads[0].used = 1;
+
+    // Exceptions go to RAM (and so to us), not the BIOS.
+    cpu->cp0->write_gpr(12, cpu->cp0->read_gpr(12) & ~0x00400000);
+
+    cpu->write_gpr(29, HLE_STACK_TOP);
+    cpu->write_gpr(30, HLE_STACK_TOP);
+    cpu->set_pc(HLE_IDLE_ADDR);
+}
+
+void kernel::serialize(state::serializer& s)
+{
+    s.section("hle", 1);
+
+    s.value(native);
+    s.value(heap_start);
+    s.value(heap_end);
+    s.value(rand_seed);
+    s.value(current_thread);
+    s.value(events);
+    s.value(threads);
+}
+
+std::uint32_t kernel::arg(unsigned n) const
+{
+    if(n < 4)
+        return cpu->gpr[4 + n];
+
+    // Everything past a3 is on the stack, after the 4 words the caller leaves for a0-a3.
+    return read32(cpu->gpr[29] + n * 4);
+}
+
+std::uint8_t kernel::read8(std::uint32_t vaddr) const
+{
+    return bus::read_byte(cpu::cop0::virtual_to_physical(vaddr));
+}
+
+std::uint32_t kernel::read32(std::uint32_t vaddr) const
+{
+    return bus::read_word(cpu::cop0::virtual_to_physical(vaddr));
+}
+
+void kernel::write8(std::uint32_t vaddr, std::uint8_t value)
+{
+    bus::write_byte(cpu::cop0::virtual_to_physical(vaddr), value);
+}
+
+void kernel::write32(std::uint32_t vaddr, std::uint32_t value)
+{
+    bus::write_word(cpu::cop0::virtual_to_physical(vaddr), value);
+}
+
+std::uint32_t kernel::string_length(std::uint32_t vaddr) const
+{
+    std::uint32_t length = 0;
+
+    while(read8(vaddr + length) != 0)
+        length++;
+
+    return length;
+}
+
+void kernel::print(const char* text, std::size_t length)
+{
+    std::fwrite(text, 1, length, tty);
+}
+
+///+++++++++++++++++++++++++++++++++++++++++++FILES+++++++++++++++++++++++++++++++++++++++++++///
+
+// There are no devices to open files on, but 0 and 1 are always the TTY.
+
+std::uint32_t kernel::fn_open()
+{
+    return HLE_ERROR;
+}
+
+std::uint32_t kernel::fn_lseek()
+{
+    return HLE_ERROR;
+}
+
+std::uint32_t kernel::fn_read()
+{
+    return HLE_ERROR;
+}
+
+std::uint32_t kernel::fn_write()
+{
+    std::uint32_t fd = arg(0);
+    std::uint32_t src = arg(1);
+    std::uint32_t length = arg(2);
+
+    if(fd > 1)
+        return HLE_ERROR;
+
+    std::string text;
+
+    for(std::uint32_t i = 0; i < length; i++)
+        text += (char)read8(src + i);
+
+    print(text.data(), text.size());
+    return length;
+}
+
+std::uint32_t kernel::fn_close()
+{
+    return (arg(0) > 1) ? HLE_ERROR : arg(0);
+}
+
+std::uint32_t kernel::fn_first_file()
+{
+    return 0; // Nothing found
+}
+
+///+++++++++++++++++++++++++++++++++++++++++++STRINGS+++++++++++++++++++++++++++++++++++++++++///
+
+std::uint32_t kernel::fn_abs()
+{
+    std::int32_t value = (std::int32_t)arg(0);
+
+    return (value < 0) ? 0 - (std::uint32_t)value : (std::uint32_t)value;
+}
+
+std::uint32_t kernel::fn_atoi()
+{
+    std::uint32_t src = arg(0);
+    std::uint32_t value = 0;
+    bool negative = false;
+
+    while(read8(src) == ' ' || (read8(src) >= '\t' && read8(src) <= '\r'))
+        src++;
+
+    if(read8(src) == '-' || read8(src) == '+')
+        negative = (read8(src++) == '-');
+
+    while(read8(src) >= '0' && read8(src) <= '9')
+        value = value * 10 + (read8(src++) - '0');
+
+    return negative ? 0 - value : value;
+}
+
+std::uint32_t kernel::fn_strcat()
+{
+    std::uint32_t dst = arg(0);
+    std::uint32_t src = arg(1);
+
+    if(dst == 0 || src == 0)
+        return 0;
+
+    std::uint32_t end = dst + string_length(dst);
+    std::uint8_t c;
+
+    do
+    {
+        c = read8(src++);
+        write8(end++, c);
+    } while(c != 0);
+
+    return dst;
+}
+
+std::uint32_t kernel::fn_strncat()
+{
+    std::uint32_t dst = arg(0);
+    std::uint32_t src = arg(1);
+    std::uint32_t count = arg(2);
+
+    if(dst == 0 || src == 0)
+        return 0;
+
+    std::uint32_t end = dst + string_length(dst);
+
+    for(std::uint32_t i = 0; i < count; i++)
+    {
+        std::uint8_t c = read8(src + i);
+
+        if(c == 0)
+            break;
+
+        write8(end++, c);
+    }
+
+    write8(end, 0);
+    return dst;
+}
+
+std::uint32_t kernel::fn_strcmp()
+{
+    std::uint32_t a = arg(0);
+    std::uint32_t b = arg(1);
+
+    if(a == 0 || b == 0)
+        return (a == b) ? 0 : (a == 0 ? HLE_ERROR : 1);
+
+    for(;; a++, b++)
+    {
+        std::uint8_t ca = read8(a);
+        std::uint8_t cb = read8(b);
+
+        if(ca != cb || ca == 0)
+            return (std::uint32_t)(ca - cb);
+    }
+}
+
+std::uint32_t kernel::fn_strncmp()
+{
+    std::uint32_t a = arg(0);
+    std::uint32_t b = arg(1);
+    std::uint32_t count = arg(2);
+
+    if(a == 0 || b == 0)
+        return (a == b) ? 0 : (a == 0 ? HLE_ERROR : 1);
+
+    for(std::uint32_t i = 0; i < count; i++)
+    {
+        std::uint8_t ca = read8(a + i);
+        std::uint8_t cb = read8(b + i);
+
+        if(ca != cb || ca == 0)
+            return (std::uint32_t)(ca - cb);
+    }
+
+    return 0;
+}
+
+std::uint32_t kernel::fn_strcpy()
+{
+    std::uint32_t dst = arg(0);
+    std::uint32_t src = arg(1);
+
+    if(dst == 0 || src == 0)
+        return 0;
+
+    for(std::uint32_t i = 0;; i++)
+    {
+        std::uint8_t c = read8(src + i);
+        write8(dst + i, c);
+
+        if(c == 0)
+            return dst;
+    }
+}
+
+std::uint32_t kernel::fn_strncpy()
+{
+    std::uint32_t dst = arg(0);
+    std::uint32_t src = arg(1);
+    std::uint32_t count = arg(2);
+    bool ended = false;
+
+    if(dst == 0 || src == 0)
+        return 0;
+
+    // Like the C library, whatever's left after the string gets zeroed.
+    for(std::uint32_t i = 0; i < count; i++)
+    {
+        std::uint8_t c = ended ? 0 : read8(src + i);
+
+        ended = ended || c == 0;
+        write8(dst + i, c);
+    }
+
+    return dst;
+}
+
+std::uint32_t kernel::fn_strlen()
+{
+    return (arg(0) == 0) ? 0 : string_length(arg(0));
+}
+
+std::uint32_t kernel::fn_strchr()
+{
+    std::uint32_t src = arg(0);
+    std::uint8_t c = arg(1) & 0xff;
+
+    if(src == 0)
+        return 0;
+
+    for(;; src++)
+    {
+        std::uint8_t ch = read8(src);
+
+        if(ch == c)
+            return src;
+
+        if(ch == 0)
+            return 0;
+    }
+}
+
+std::uint32_t kernel::fn_strrchr()
+{
+    std::uint32_t src = arg(0);
+    std::uint8_t c = arg(1) & 0xff;
+    std::uint32_t found = 0;
+
+    if(src == 0)
+        return 0;
+
+    for(;; src++)
+    {
+        std::uint8_t ch = read8(src);
+
+        if(ch == c)
+            found = src;
+
+        if(ch == 0)
+            return found;
+    }
+}
+
+std::uint32_t kernel::fn_toupper()
+{
+    std::uint8_t c = arg(0) & 0xff;
+
+    return (c >= 'a' && c <= 'z') ? c - 'a' + 'A' : c;
+}
+
+std::uint32_t kernel::fn_tolower()
+{
+    std::uint8_t c = arg(0) & 0xff;
+
+    return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+}
+
+///+++++++++++++++++++++++++++++++++++++++++++MEMORY++++++++++++++++++++++++++++++++++++++++++///
+
+std::uint32_t kernel::fn_bcopy()
+{
+    std::uint32_t src = arg(0);
+    std::uint32_t dst = arg(1);
+    std::uint32_t length = arg(2);
+
+    for(std::uint32_t i = 0; i < length; i++)
+        write8(dst + i, read8(src + i));
+
+    return 0;
+}
+
+std::uint32_t kernel::fn_bzero()
+{
+    std::uint32_t dst = arg(0);
+    std::uint32_t length = arg(1);
+
+    for(std::uint32_t i = 0; i < length; i++)
+        write8(dst + i, 0);
+
+    return 0;
+}
+
+std::uint32_t kernel::fn_memcpy()
+{
+    std::uint32_t dst = arg(0);
+    std::uint32_t src = arg(1);
+    std::uint32_t length = arg(2);
+
+    if(dst == 0)
+        return 0;
+
+    for(std::uint32_t i = 0; i < length; i++)
+        write8(dst + i, read8(src + i));
+
+    return dst;
+}
+
+std::uint32_t kernel::fn_memset()
+{
+    std::uint32_t dst = arg(0);
+    std::uint8_t value = arg(1) & 0xff;
+    std::uint32_t length = arg(2);
+
+    if(dst == 0)
+        return 0;
+
+    for(std::uint32_t i = 0; i < length; i++)
+        write8(dst + i, value);
+
+    return dst;
+}
+
+std::uint32_t kernel::fn_memmove()
+{
+    std::uint32_t dst = arg(0);
+    std::uint32_t src = arg(1);
+    std::uint32_t length = arg(2);
+
+    if(dst == 0)
+        return 0;
+
+    // Copy backwards if the end of the source would get overwritten before we got to it.
+    if(dst > src && dst < src + length)
+    {
+        for(std::uint32_t i = length; i > 0; i--)
+            write8(dst + i - 1, read8(src + i - 1));
+    }
+    else
+    {
+        for(std::uint32_t i = 0; i < length; i++)
+            write8(dst + i, read8(src + i));
+    }
+
+    return dst;
+}
+
+std::uint32_t kernel::fn_memcmp()
+{
+    std::uint32_t a = arg(0);
+    std::uint32_t b = arg(1);
+    std::uint32_t length = arg(2);
+
+    for(std::uint32_t i = 0; i < length; i++)
+    {
+        std::uint8_t ca = read8(a + i);
+        std::uint8_t cb = read8(b + i);
+
+        if(ca != cb)
+            return (std::uint32_t)(ca - cb);
+    }
+
+    return 0;
+}
+
+std::uint32_t kernel::fn_memchr()
+{
+    std::uint32_t src = arg(0);
+    std::uint8_t c = arg(1) & 0xff;
+    std::uint32_t length = arg(2);
+
+    for(std::uint32_t i = 0; i < length; i++)
+    {
+        if(read8(src + i) == c)
+            return src + i;
+    }
+
+    return 0;
+}
+
+std::uint32_t kernel::fn_rand()
+{
+    rand_seed = rand_seed * 0x41c64e6d + 0x3039;
+    return (rand_seed >> 16) & 0x7fff;
+}
+
+std::uint32_t kernel::fn_srand()
+{
+    rand_seed = arg(0);
+    return 0;
+}
+
+std::uint32_t kernel::fn_flush_cache()
+{
+    // Nothing to do, anything we've cached from RAM notices when it's written (see bus::page_generation).
+    return 0;
+}
+
+std::uint32_t kernel::fn_set_mem()
+{
+    std::uint32_t megabytes = arg(0);
+
+    // The bus doesn't model the RAM window, so all there is to change is the kernel's idea of it.
+    if(megabytes == 2 || megabytes == 8)
+        write32(0x80000000 | HLE_RAM_SIZE_ADDR, megabytes);
+
+    return 0;
+}
+
+///++++++++++++++++++++++++++++++++++++++++++++HEAP++++++++++++++++++++++++++++++++++++++++++++///
+
+// Like the BIOS, the heap keeps its bookkeeping in RAM: every block starts with a word holding its size,
+// with bit 0 set if it's in use, and the blocks run back to back from heap_start to heap_end.
+
+std::uint32_t kernel::heap_alloc(std::uint32_t size)
+{
+    if(heap_start == 0)
+        return 0;
+
+    size = std::max<std::uint32_t>((size + 3) & ~3u, 4);
+
+    for(std::uint32_t block = heap_start; block + 4 <= heap_end;)
+    {
+        std::uint32_t header = read32(block);
+        std::uint32_t block_size = header & ~3u;
+
+        if((header & 1) == 0)
+        {
+            // Merge in any free blocks after us first.
+            for(std::uint32_t next = block + 4 + block_size; next + 4 <= heap_end && (read32(next) & 1) == 0; next = block + 4 + block_size)
+                block_size += 4 + (read32(next) & ~3u);
+
+            write32(block, block_size);
+
+            if(block_size >= size)
+            {
+                // Split off whatever's left, if it's big enough to be worth a block.
+                if(block_size - size >= 8)
+                {
+                    write32(block + 4 + size, block_size - size - 4);
+                    block_size = size;
+                }
+
+                write32(block, block_size | 1);
+                return block + 4;
+            }
+        }
+
+        block += 4 + block_size;
+    }
+
+    return 0;
+}
+
+std::uint32_t kernel::fn_malloc()
+{
+    return heap_alloc(arg(0));
+}
+
+std::uint32_t kernel::fn_free()
+{
+    std::uint32_t ptr = arg(0);
+
+    if(ptr >= heap_start + 4 && ptr < heap_end)
+        write32(ptr - 4, read32(ptr - 4) & ~1u);
+
+    return 0;
+}
+
+std::uint32_t kernel::fn_calloc()
+{
+    std::uint32_t size = arg(0) * arg(1);
+    std::uint32_t ptr = heap_alloc(size);
+
+    for(std::uint32_t i = 0; ptr != 0 && i < size; i++)
+        write8(ptr + i, 0);
+
+    return ptr;
+}
+
+std::uint32_t kernel::fn_realloc()
+{
+    std::uint32_t ptr = arg(0);
+    std::uint32_t size = arg(1);
+
+    if(ptr == 0)
+        return heap_alloc(size);
+
+    if(size == 0)
+    {
+        fn_free();
+        return 0;
+    }
+
+    std::uint32_t moved = heap_alloc(size);
+
+    if(moved == 0)
+        return 0;
+
+    std::uint32_t old_size = read32(ptr - 4) & ~3u;
+
+    for(std::uint32_t i = 0; i < std::min(old_size, size); i++)
+        write8(moved + i, read8(ptr + i));
+
+    write32(ptr - 4, read32(ptr - 4) & ~1u);
+    return moved;
+}
+
+std::uint32_t kernel::fn_init_heap()
+{
+    std::uint32_t start = (arg(0) + 3) & ~3u;
+    std::uint32_t end = (arg(0) + arg(1)) & ~3u;
+
+    if(end < start + 8)
+    {
+        heap_start = 0;
+        heap_end = 0;
+        return 0;
+    }
+
+    heap_start = start;
+    heap_end = end;
+    write32(heap_start, heap_end - heap_start - 4);
+    return 0;
+}
+
+///+++++++++++++++++++++++++++++++++++++++++++CONSOLE+++++++++++++++++++++++++++++++++++++++++///
+
+std::uint32_t kernel::fn_putchar()
+{
+    char c = (char)arg(0);
+
+    print(&c, 1);
+    return arg(0) & 0xff;
+}
+
+std::uint32_t kernel::fn_puts()
+{
+    std::uint32_t src = arg(0);
+    std::string text;
+
+    if(src == 0)
+        return 0;
+
+    // Unlike the C library's, no newline.
+    for(std::uint8_t c = read8(src); c != 0; c = read8(++src))
+        text += (char)c;
+
+    print(text.data(), text.size());
+    return 0;
+}
+
+/**
+ *  Format one printf conversion onto the end of out.
+ */
+template<typename T> static void format(std::string& out, const std::string& spec, T value)
+{
+    int length = std::snprintf(nullptr, 0, spec.c_str(), value);
+
+    if(length <= 0)
+        return;
+
+    std::string text(length + 1, '\0');
+    std::snprintf(&text[0], text.size(), spec.c_str(), value);
+    out.append(text.data(), length);
+}
+
+std::uint32_t kernel::fn_printf()
+{
+    std::uint32_t fmt = arg(0);
+    unsigned next = 1;
+    std::string out;
+
+    for(std::uint8_t c = read8(fmt++); c != 0; c = read8(fmt++))
+    {
+        if(c != '%')
+        {
+            out += (char)c;
+            continue;
+        }
+
+        std::string spec = "%";
+
+        for(c = read8(fmt++); c != 0 && std::strchr("-+ #0", c) != nullptr; c = read8(fmt++))
+            spec += (char)c;
+
+        if(c == '*')
+        {
+            spec += std::to_string((std::int32_t)arg(next++));
+            c = read8(fmt++);
+        }
+
+        for(; c >= '0' && c <= '9'; c = read8(fmt++))
+            spec += (char)c;
+
+        if(c == '.')
+        {
+            spec += '.';
+            c = read8(fmt++);
+
+            if(c == '*')
+            {
+                spec += std::to_string((std::int32_t)arg(next++));
+                c = read8(fmt++);
+            }
+
+            for(; c >= '0' && c <= '9'; c = read8(fmt++))
+                spec += (char)c;
+        }
+
+        // Everything's 32 bits, so the size doesn't matter.
+        while(c == 'l' || c == 'h')
+            c = read8(fmt++);
+
+        switch(c)
+        {
+        case 'd':
+        case 'i':
+            format(out, spec + "d", (int)(std::int32_t)arg(next++));
+            break;
+
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X':
+            format(out, spec + (char)c, (unsigned)arg(next++));
+            break;
+
+        case 'p':
+            format(out, spec + "x", (unsigned)arg(next++));
+            break;
+
+        case 'c':
+            format(out, spec + "c", (int)(arg(next++) & 0xff));
+            break;
+
+        case 's':
+        {
+            std::uint32_t src = arg(next++);
+            std::string text;
+
+            for(std::uint8_t ch = (src != 0) ? read8(src) : 0; ch != 0; ch = read8(++src))
+                text += (char)ch;
+
+            format(out, spec + "s", text.c_str());
+            break;
+        }
+
+        case '%':
+            out += '%';
+            break;
+
+        case 0:
+            fmt--; // Leave the terminator for the loop to find.
+            break;
+
+        default:
+            out += spec;
+            out += (char)c;
+            break;
+        }
+    }
+
+    print(out.data(), out.size());
+    return out.size();
+}
+
+///++++++++++++++++++++++++++++++++++++++++++++EVENTS++++++++++++++++++++++++++++++++++++++++++///
+
+// Nothing delivers hardware events yet (there's no interrupt controller), so only software events ever fire.
+
+event* kernel::find_event(std::uint32_t handle)
+{
+    std::uint32_t index = handle & 0xffff;
+
+    if((handle & 0xffff0000) != HLE_EVENT_HANDLE || index >= HLE_MAX_EVENTS || events[index].status == EVENT_FREE)
+        return nullptr;
+
+    return &events[index];
+}
+
+std::uint32_t kernel::fn_open_event()
+{
+    for(std::uint32_t i = 0; i < HLE_MAX_EVENTS; i++)
+    {
+        if(events[i].status != EVENT_FREE)
+            continue;
+
+        events[i].ev_class = arg(0);
+        events[i].spec = arg(1);
+        events[i].mode = arg(2);
+        events[i].func = arg(3);
+        events[i].status = EVENT_DISABLED;
+        return HLE_EVENT_HANDLE | i;
+    }
+
+    return HLE_ERROR;
+}
+
+std::uint32_t kernel::fn_close_event()
+{
+    event* e = find_event(arg(0));
+
+    if(e == nullptr)
+        return 0;
+
+    e->status = EVENT_FREE;
+    return 1;
+}
+
+std::uint32_t kernel::fn_test_event()
+{
+    event* e = find_event(arg(0));
+
+    if(e == nullptr || e->status != EVENT_DELIVERED)
+        return 0;
+
+    e->status = EVENT_ENABLED;
+    return 1;
+}
+
+std::uint32_t kernel::fn_wait_event()
+{
+    // The BIOS would spin here until the event came in, but nothing can deliver it while we're waiting.
+    return fn_test_event();
+}
+
+std::uint32_t kernel::fn_enable_event()
+{
+    event* e = find_event(arg(0));
+
+    if(e == nullptr)
+        return 0;
+
+    e->status = EVENT_ENABLED;
+    return 1;
+}
+
+std::uint32_t kernel::fn_disable_event()
+{
+    event* e = find_event(arg(0));
+
+    if(e == nullptr)
+        return 0;
+
+    e->status = EVENT_DISABLED;
+    return 1;
+}
+
+std::uint32_t kernel::fn_deliver_event()
+{
+    for(std::uint32_t i = 0; i < HLE_MAX_EVENTS; i++)
+    {
+        event& e = events[i];
+
+        if(e.status != EVENT_ENABLED || e.ev_class != arg(0) || e.spec != arg(1))
+            continue;
+
+        if(e.mode == EVENT_MODE_READY)
+            e.status = EVENT_DELIVERED;
+        else if(e.mode == EVENT_MODE_CALLBACK)
+            std::printf("warning: hle: event 0x%08x wants its callback at 0x%08x called, which we can't do!\n", HLE_EVENT_HANDLE | i, e.func);
+    }
+
+    return 0;
+}
+
+std::uint32_t kernel::fn_undeliver_event()
+{
+    for(std::uint32_t i = 0; i < HLE_MAX_EVENTS; i++)
+    {
+        event& e = events[i];
+
+        if(e.status == EVENT_DELIVERED && e.mode == EVENT_MODE_READY && e.ev_class == arg(0) && e.spec == arg(1))
+            e.status = EVENT_ENABLED;
+    }
+
+    return 0;
+}
+
+///++++++++++++++++++++++++++++++++++++++++++++THREADS+++++++++++++++++++++++++++++++++++++++++///
+
+std::uint32_t kernel::fn_open_thread()
+{
+    for(std::uint32_t i = 0; i < HLE_MAX_THREADS; i++)
+    {
+        if(threads[i].used)
+            continue;
+
+        std::memset(&threads[i], 0x00, sizeof(threads[i]));
+        threads[i].used = 1;
+        threads[i].pc = arg(0);
+        threads[i].gpr[29] = arg(1);
+        threads[i].gpr[30] = arg(1);
+        threads[i].gpr[28] = arg(2);
+        return HLE_THREAD_HANDLE | i;
+    }
+
+    return HLE_ERROR;
+}
+
+std::uint32_t kernel::fn_close_thread()
+{
+    std::uint32_t index = arg(0) & 0xffff;
+
+    if((arg(0) & 0xffff0000) != HLE_THREAD_HANDLE || index >= HLE_MAX_THREADS || index == current_thread)
+        return 0;
+
+    threads[index].used = 0;
+    return 1;
+}
+
+std::uint32_t kernel::fn_change_thread()
+{
+    std::uint32_t index = arg(0) & 0xffff;
+
+    if((arg(0) & 0xffff0000) != HLE_THREAD_HANDLE || index >= HLE_MAX_THREADS || !threads[index].used)
+        return HLE_ERROR;
+
+    if(index == current_thread)
+        return 1;
+
+    // We come back out of the call (returning 1) whenever somebody changes back to us.
+    thread& from = threads[current_thread];
+    std::memcpy(from.gpr, cpu->gpr, sizeof(from.gpr));
+    from.gpr[2] = 1;
+    from.hi = (std::uint32_t)cpu->hi;
+    from.lo = (std::uint32_t)cpu->lo;
+    from.pc = cpu->gpr[31];
+
+    thread& to = threads[index];
+    std::memcpy(cpu->gpr, to.gpr, sizeof(cpu->gpr));
+    cpu->gpr[0] = 0;
+    cpu->hi = to.hi;
+    cpu->lo = to.lo;
+    cpu->set_pc(to.pc);
+
+    current_thread = index;
+    switched = true;
+    return 1;
+}
+
+///++++++++++++++++++++++++++++++++++++++++++++COUNTERS++++++++++++++++++++++++++++++++++++++++///
+
+std::uint32_t kernel::fn_change_clear_rcnt()
+{
+    return 0;
+}
@@ -1,19 +1,133 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
-#include "bus/bus.hpp"
-#include "bios/bios.hpp"
+#include "benchmark/benchmark.hpp"
 #include "cpu/r3000a.hpp"
+#include "headless/headless.hpp"
+#include "hle/hle.hpp"
+#include "scheduler/scheduler.hpp"
+#include "system/system.hpp"
 
-int main()
+/**
+ *  Get the value that goes with an option, or die if there isn't one.
+ */
+static const char* option_value(int argc, char** argv, int& i)
 {
+    if(i + 1 >= argc)
+    {
+        std::printf("fatal: %s needs a value!\n", argv[i]);
+        exit(-1);
+    }
+
+    return argv[++i];
+}
+
+int main(int argc, char** argv)
+{
+    headless::options opts;
+    bool headless_run = false;
+    std::uint64_t frames = 0;
+
+    opts.bios = "bios/SCPH1001.bin";
+    opts.exe = nullptr;
+    opts.load_state = nullptr;
+    opts.save_state = nullptr;
+    opts.cycles = 0;
+    opts.exec_mode = cpu::r3000a::INTERPRETER;
+    opts.gpu_threads = 0;
+    opts.stats = false;
+    opts.hle = false;
+    opts.fast_boot = false;
+
+    for(int i = 1; i < argc; i++)
+    {
+        if(std::strcmp(argv[i], "--benchmark") == 0)
+        {
+            psx::system machine; // Most of the benchmarks bring their own CPUs, they just need a bus.
+
+            benchmark::interpreter(BENCHMARK_CYCLES);
+            benchmark::gte(BENCHMARK_GTE_COMMANDS);
+            benchmark::rasterizer(BENCHMARK_PRIMITIVES);
+            benchmark::savestate(BENCHMARK_SNAPSHOTS);
+            benchmark::rewind(BENCHMARK_REWIND_FRAMES);
+            benchmark::dma(machine, BENCHMARK_DMA_WORDS);
+            return 0;
+        }
+        else if(std::strcmp(argv[i], "--recompiler") == 0)
+            opts.exec_mode = cpu::r3000a::RECOMPILER;
+        else if(std::strcmp(argv[i], "--differential") == 0)
+            opts.exec_mode = cpu::r3000a::DIFFERENTIAL;
+        else if(std::strcmp(argv[i], "--threaded") == 0)
+            opts.exec_mode = cpu::r3000a::THREADED;
+        else if(std::strcmp(argv[i], "--headless") == 0)
+            headless_run = true;
+        else if(std::strcmp(argv[i], "--bios") == 0)
+            opts.bios = option_value(argc, argv, i);
+        else if(std::strcmp(argv[i], "--cycles") == 0)
+            opts.cycles = std::strtoull(option_value(argc, argv, i), nullptr, 0);
+        else if(std::strcmp(argv[i], "--frames") == 0)
+            frames = std::strtoull(option_value(argc, argv, i), nullptr, 0);
+        else if(std::strcmp(argv[i], "--exe") == 0)
+            opts.exe = option_value(argc, argv, i);
+        else if(std::strcmp(argv[i], "--load-state") == 0)
+            opts.load_state = option_value(argc, argv, i);
+        else if(std::strcmp(argv[i], "--save-state") == 0)
+            opts.save_state = option_value(argc, argv, i);
+        else if(std::strcmp(argv[i], "--gpu-threads") == 0)
+            opts.gpu_threads = std::strtoul(option_value(argc, argv, i), nullptr, 0);
+        else if(std::strcmp(argv[i], "--stats") == 0)
+            opts.stats = true;
+        else if(std::strcmp(argv[i], "--hle") == 0)
+            opts.hle = true;
+        else if(std::strcmp(argv[i], "--fast-boot") == 0)
+            opts.fast_boot = true;
+        else
+            std::printf("warning: unknown option %s!\n", argv[i]);
+    }
+
+    if(headless_run)
+    {
+        opts.cycles += frames * HEADLESS_CYCLES_PER_FRAME;
+
+        if(opts.cycles == 0)
+        {
+            std::printf("fatal: --headless needs --cycles or --frames!\n");
+            exit(-1);
+        }
+
+        return headless::run(opts);
+    }
+
     // INITILISATION FUNCTIONS
-    bus::psmem_init();
-    bios::load_bios("bios/SCPH1001.bin");
-    cpu::r3000a cpu;
+    psx::system machine;
+
+    if(!machine.load_bios(opts.bios))
+    {
+        std::printf("fatal: couldn't load the BIOS from %s!\n", opts.bios);
+        exit(-1);
+    }
+
+    machine.get_cpu().set_exec_mode(opts.exec_mode);
+
+    if(opts.hle || opts.fast_boot)
+    {
+        machine.get_cpu().set_hle(true);
+
+        if(opts.fast_boot)
+            machine.get_cpu().get_hle()->fast_boot();
+    }
+
+    if(opts.exe != nullptr && !machine.sideload(opts.exe))
+    {
+        std::printf("fatal: couldn't load the executable %s!\n", opts.exe);
+        exit(-1);
+    }
 
     bool running = true;
 
     while(running)
-        cpu.cycle();
+        machine.run(SCHEDULER_MAX_SLICE);
 
     return 0;
 }
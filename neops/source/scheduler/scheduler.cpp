@@ -0,0 +1,282 @@
+/**
+    This file is part of NeoPS.
+
+    NeoPS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    NeoPS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+**/
+#include <algorithm>
+#include <cassert>
+#include <vector>
+
+#include "scheduler/scheduler.hpp"
+#include "state/state.hpp"
+
+/**
+ *  An event a device has added.
+ */
+struct event
+{
+    const char*                 name;       /**< Name, for debugging. */
+    scheduler::event_callback   callback;   /**< What to call when we fire. */
+    void*                       data;       /**< Handed to callback. */
+    std::uint64_t               when;       /**< Cycle we're due. */
+    std::uint32_t               generation; /**< Bumped every time we're scheduled or cancelled. */
+    bool                        pending;    /**< Are we waiting to fire? */
+};
+
+/**
+ *  An entry in the queue. Rescheduling or cancelling an event leaves its old entries behind, so
+ *  entries whose generation doesn't match their event's are stale and get thrown away.
+ */
+struct queue_entry
+{
+    std::uint64_t           when;
+    scheduler::event_id     id;
+    std::uint32_t           generation;
+
+    bool operator>(const queue_entry& other) const
+    {
+        return when > other.when;
+    }
+};
+
+/**
+ *  One machine's events and time. See @ref scheduler::bind.
+ */
+struct scheduler::context
+{
+    std::vector<event> events;          /**< Every event ever added, indexed by event_id. */
+    std::vector<queue_entry> queue;     /**< Min-heap of pending (and stale) events, soonest first. */
+    std::uint64_t time = 0;             /**< Cycles since power on. */
+    std::uint64_t stalled = 0;          /**< Cycles the CPU has sat out that haven't passed yet. */
+    clock_callback clock = nullptr;     /**< Tells us how far into its slice the CPU has got. */
+    preempt_callback preempt = nullptr; /**< Cuts the CPU's slice short. */
+    void* clock_data = nullptr;         /**< Handed to clock and preempt. */
+};
+
+static thread_local scheduler::context* current = nullptr; /**< The scheduler everything on this thread uses */
+
+using namespace scheduler;
+
+/**
+ *  Get rid of stale entries at the top of the queue, so the top (if any) is the next event due.
+ */
+static void drop_stale()
+{
+    while(!current->queue.empty())
+    {
+        const queue_entry& top = current->queue.front();
+
+        if(current->events[top.id].pending && current->events[top.id].generation == top.generation)
+            return;
+
+        std::pop_heap(current->queue.begin(), current->queue.end(), std::greater<queue_entry>());
+        current->queue.pop_back();
+    }
+}
+
+/**
+ *  Make sure the CPU stops (if it's running a slice) by the time the next event is due.
+ */
+static void preempt_cpu()
+{
+    if(current->preempt == nullptr)
+        return;
+
+    std::uint64_t next = next_event();
+    std::uint64_t start = current->time + current->stalled;
+
+    if(next == SCHEDULER_NEVER)
+        return;
+
+    // The CPU's slice is measured in its own cycles, which don't include what it's sat out.
+    std::uint64_t cycles = (next > start) ? next - start : 0;
+    current->preempt(current->clock_data, (std::uint32_t)std::min<std::uint64_t>(cycles, 0xffffffff));
+}
+
+scheduler::context* scheduler::create()
+{
+    return new context();
+}
+
+void scheduler::destroy(context* ctx)
+{
+    if(current == ctx)
+        current = nullptr;
+
+    delete ctx;
+}
+
+void scheduler::bind(context* ctx)
+{
+    current = ctx;
+}
+
+scheduler::context* scheduler::bound()
+{
+    return current;
+}
+
+event_id scheduler::add_event(const char* name, event_callback callback, void* data)
+{
+    event ev;
+
+    ev.name = name;
+    ev.callback = callback;
+    ev.data = data;
+    ev.when = 0;
+    ev.generation = 0;
+    ev.pending = false;
+
+    current->events.push_back(ev);
+    return current->events.size() - 1;
+}
+
+void scheduler::schedule(event_id id, std::uint64_t cycles)
+{
+    assert(id < current->events.size());
+
+    event& ev = current->events[id];
+    ev.when = exact() + cycles;
+    ev.generation++;
+    ev.pending = true;
+
+    queue_entry entry;
+    entry.when = ev.when;
+    entry.id = id;
+    entry.generation = ev.generation;
+
+    current->queue.push_back(entry);
+    std::push_heap(current->queue.begin(), current->queue.end(), std::greater<queue_entry>());
+
+    preempt_cpu();
+}
+
+void scheduler::cancel(event_id id)
+{
+    assert(id < current->events.size());
+
+    current->events[id].pending = false;
+    current->events[id].generation++;
+}
+
+bool scheduler::pending(event_id id)
+{
+    assert(id < current->events.size());
+    return current->events[id].pending;
+}
+
+std::uint64_t scheduler::due(event_id id)
+{
+    assert(id < current->events.size());
+    return current->events[id].when;
+}
+
+std::uint64_t scheduler::now()
+{
+    return current->time;
+}
+
+void scheduler::set_clock(clock_callback clock, preempt_callback preempt, void* data)
+{
+    current->clock = clock;
+    current->preempt = preempt;
+    current->clock_data = data;
+}
+
+std::uint64_t scheduler::exact()
+{
+    if(current->clock == nullptr)
+        return current->time + current->stalled;
+
+    // Whatever the CPU's sat out so far has already happened, as far as it's concerned.
+    return current->time + current->stalled + current->clock(current->clock_data);
+}
+
+std::uint64_t scheduler::next_event()
+{
+    drop_stale();
+
+    if(current->queue.empty())
+        return SCHEDULER_NEVER;
+
+    return current->queue.front().when;
+}
+
+std::uint32_t scheduler::slice()
+{
+    std::uint64_t next = next_event();
+
+    if(next <= current->time)
+        return 0;
+
+    return (std::uint32_t)std::min<std::uint64_t>(next - current->time, SCHEDULER_MAX_SLICE);
+}
+
+void scheduler::advance(std::uint32_t cycles)
+{
+    std::uint64_t target = current->time + cycles + current->stalled;
+    current->stalled = 0;
+
+    // Callbacks can schedule more events (even for right now), so keep going until nothing's due.
+    while(next_event() <= target)
+    {
+        queue_entry entry = current->queue.front();
+        std::pop_heap(current->queue.begin(), current->queue.end(), std::greater<queue_entry>());
+        current->queue.pop_back();
+
+        // The callback might add events, so don't hang on to a reference into the vector.
+        event_callback callback = current->events[entry.id].callback;
+        void* data = current->events[entry.id].data;
+        current->events[entry.id].pending = false;
+
+        // The CPU may have overshot, but as far as the event's concerned it's right on time.
+        current->time = std::max(current->time, entry.when);
+        callback(data);
+
+        target += current->stalled;
+        current->stalled = 0;
+    }
+
+    current->time = target;
+}
+
+void scheduler::stall(std::uint32_t cycles)
+{
+    current->stalled += cycles;
+    preempt_cpu();
+}
+
+void scheduler::reset()
+{
+    for(std::size_t i = 0; i < current->events.size(); i++)
+    {
+        current->events[i].pending = false;
+        current->events[i].generation++;
+    }
+
+    current->queue.clear();
+    current->time = 0;
+    current->stalled = 0;
+}
+
+void scheduler::serialize(state::serializer& s)
+{
+    s.section("scheduler", 1);
+
+    if(s.loading())
+        reset();
+
+    s.value(current->time);
+    s.value(current->stalled);
+}
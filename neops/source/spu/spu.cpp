@@ -15,17 +15,70 @@
     along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
 **/
 #include <cstdio>
+#include <cstring>
 
 #include "spu/spu.hpp"
+#include "state/state.hpp"
 
-static std::uint32_t spu_creg[PSX_SPU_NUM_CREG]; /**< Our SPU control registers */
+spu::spu::spu() : device("spu")
+{
+    reset();
+}
+
+spu::spu::~spu()
+{
+
+}
 
-using namespace spu;
+void spu::spu::reset()
+{
+    std::memset(creg, 0x00, sizeof(creg));
+}
+
+void spu::spu::serialize(state::serializer& s)
+{
+    s.section(get_name(), 1);
+    s.value(creg);
+}
+
+std::uint16_t spu::spu::read16(std::uint32_t addr)
+{
+    if(addr >= PSX_SPU_CREG_START && addr <= PSX_SPU_CREG_END)
+    {
+        //std::printf("warning: attempt to read spu register! Ignoring...\n");
+        return 0x00;
+    }
+
+    if(addr <= 0x1f801e80)
+    {
+        std::printf("attempt to read spu 0x%08x\n", addr);
+        return 0x00;
+    }
+
+    return device::read16(addr);
+}
+
+void spu::spu::write16(std::uint32_t addr, std::uint16_t val)
+{
+    if(addr >= PSX_SPU_CREG_START && addr <= PSX_SPU_CREG_END)
+    {
+        write_creg(addr, val);
+        return;
+    }
+
+    if(addr <= 0x1f801e80)
+    {
+        std::printf("attempt to write spu with value 0x%08x!\n", val);
+        return;
+    }
+
+    device::write16(addr, val);
+}
 
-void spu::write_creg(std::uint32_t reg, std::uint32_t val)
+void spu::spu::write_creg(std::uint32_t reg, std::uint16_t val)
 {
-    std::uint32_t r_idx = reg - PSX_SPU_CREG_START;
+    std::uint32_t r_idx = (reg - PSX_SPU_CREG_START) >> 1;
     //std::printf("info: writing 0x%08x to spu register %d\n", val, r_idx);
 
-    spu_creg[r_idx] = val;
+    creg[r_idx] = val;
 }
@@ -0,0 +1,249 @@
+/**
+    This file is part of NeoPS.
+
+    NeoPS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    NeoPS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+**/
+#include <cassert>
+#include <cstring>
+#include <utility>
+
+#include "state/rewind.hpp"
+
+using namespace state;
+
+static void put_varint(std::vector<std::uint8_t>& out, std::size_t value)
+{
+    while(value >= 0x80)
+    {
+        out.push_back((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+
+    out.push_back(value);
+}
+
+static std::size_t get_varint(const std::vector<std::uint8_t>& in, std::size_t& pos)
+{
+    std::size_t value = 0;
+
+    for(unsigned shift = 0; pos < in.size(); shift += 7)
+    {
+        std::uint8_t byte = in[pos++];
+        value |= (std::size_t)(byte & 0x7f) << shift;
+
+        if((byte & 0x80) == 0)
+            break;
+    }
+
+    return value;
+}
+
+static bool block_is_zero(const std::uint8_t* data)
+{
+    static const std::uint8_t zero[REWIND_BLOCK_SIZE] = {};
+    return std::memcmp(data, zero, REWIND_BLOCK_SIZE) == 0;
+}
+
+/**
+ *  Run length encode older ^ newer. What comes out is a run of one byte value (a count, then the value), then a
+ *  count of bytes that follow as they are, over and over.
+ *
+ *  @arg older - The older snapshot, or nullptr to encode newer by itself.
+ *  @arg newer - The newer snapshot.
+ *  @arg size - Size of both.
+ *  @arg out - Where the encoded bytes go.
+ */
+static void encode(const std::uint8_t* older, const std::uint8_t* newer, std::size_t size, std::vector<std::uint8_t>& out)
+{
+    std::size_t i = 0;
+
+    auto at = [older, newer](std::size_t pos) -> std::uint8_t
+    {
+        return older ? older[pos] ^ newer[pos] : newer[pos];
+    };
+
+    while(i < size)
+    {
+        std::uint8_t value = at(i);
+        std::size_t start = i;
+
+        while(i < size && at(i) == value)
+        {
+            // Most blocks haven't changed at all, so check a block at a time before going byte by byte.
+            if(value == 0 && (i % REWIND_BLOCK_SIZE) == 0 && size - i >= REWIND_BLOCK_SIZE)
+            {
+                bool same = older ? std::memcmp(older + i, newer + i, REWIND_BLOCK_SIZE) == 0 : block_is_zero(newer + i);
+
+                if(same)
+                {
+                    i += REWIND_BLOCK_SIZE;
+                    continue;
+                }
+            }
+
+            i++;
+        }
+
+        put_varint(out, i - start);
+        out.push_back(value);
+
+        // Take bytes as they are up to the next few of the same value in a row, which are cheaper as a run.
+        std::size_t literal = i;
+
+        while(i < size && !(size - i >= 4 && at(i) == at(i + 1) && at(i) == at(i + 2) && at(i) == at(i + 3)))
+            i++;
+
+        put_varint(out, i - literal);
+
+        for(std::size_t j = literal; j < i; j++)
+            out.push_back(at(j));
+    }
+}
+
+/**
+ *  XOR what @ref encode made into a snapshot.
+ */
+static void decode(const std::vector<std::uint8_t>& in, std::uint8_t* data, std::size_t size)
+{
+    std::size_t pos = 0;
+    std::size_t at = 0;
+
+    while(pos < in.size())
+    {
+        std::size_t run = get_varint(in, pos);
+        std::uint8_t value = in[pos++];
+
+        assert(at + run <= size);
+
+        if(value != 0)
+        {
+            for(std::size_t j = 0; j < run; j++)
+                data[at + j] ^= value;
+        }
+
+        at += run;
+
+        std::size_t count = get_varint(in, pos);
+
+        assert(at + count <= size && pos + count <= in.size());
+        (void)size;
+
+        for(std::size_t j = 0; j < count; j++)
+            data[at + j] ^= in[pos + j];
+
+        at += count;
+        pos += count;
+    }
+}
+
+rewind::rewind(cpu::r3000a& cpu, std::size_t budget, std::uint32_t keyframe_interval) : snap(cpu)
+{
+    this->budget = budget;
+    this->keyframe_interval = keyframe_interval;
+    have_latest = false;
+    used = 0;
+    since_keyframe = 0;
+}
+
+void rewind::push()
+{
+    snap.save();
+
+    if(have_latest)
+    {
+        frame old;
+
+        old.size = latest.size();
+
+        // A keyframe every so often, and whenever the snapshot changes size (we can't XOR those).
+        if(since_keyframe >= keyframe_interval || snap.size() != latest.size())
+        {
+            old.keyframe = true;
+            encode(nullptr, latest.data(), latest.size(), old.data);
+            since_keyframe = 0;
+        }
+        else
+        {
+            old.keyframe = false;
+            encode(snap.data(), latest.data(), latest.size(), old.data);
+            since_keyframe++;
+        }
+
+        used += old.data.size();
+        history.push_back(std::move(old));
+
+        while(used > budget && !history.empty())
+        {
+            used -= history.front().data.size();
+            history.pop_front();
+        }
+    }
+
+    latest.assign(snap.data(), snap.data() + snap.size());
+    have_latest = true;
+}
+
+bool rewind::step_back(std::uint32_t count)
+{
+    if(!have_latest || count > history.size())
+        return false;
+
+    std::size_t target = history.size() - count;
+    std::size_t from = history.size();
+
+    // Start from the nearest keyframe after the one we want, if there is one.
+    for(std::size_t i = target; i < history.size(); i++)
+    {
+        if(history[i].keyframe)
+        {
+            from = i;
+            break;
+        }
+    }
+
+    std::size_t i = history.size();
+
+    if(from != history.size())
+    {
+        latest.assign(history[from].size, 0x00);
+        decode(history[from].data, latest.data(), latest.size());
+        i = from;
+    }
+
+    // Each frame's the XOR with the one after it, so undo them newest first.
+    while(i > target)
+    {
+        frame& f = history[--i];
+
+        if(f.keyframe)
+            latest.assign(f.size, 0x00);
+
+        decode(f.data, latest.data(), latest.size());
+    }
+
+    while(history.size() > target)
+    {
+        used -= history.back().data.size();
+        history.pop_back();
+    }
+
+    // Count back to the last keyframe, so the next one comes when it would have.
+    since_keyframe = 0;
+
+    for(std::size_t i = history.size(); i-- > 0 && !history[i].keyframe; )
+        since_keyframe++;
+
+    snap.assign(latest.data(), latest.size());
+    return snap.load();
+}
@@ -0,0 +1,255 @@
+/**
+    This file is part of NeoPS.
+
+    NeoPS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    NeoPS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+**/
+#include <cstdio>
+#include <cstring>
+
+#include "state/state.hpp"
+#include "bus/bus.hpp"
+#include "cpu/r3000a.hpp"
+#include "scheduler/scheduler.hpp"
+
+#define STATE_SECTION_HEADER_SIZE   (STATE_NAME_SIZE + 8)   /**< Name, version and size */
+
+using namespace state;
+
+serializer::serializer(MODE mode, std::uint8_t* buffer, std::size_t size)
+{
+    this->mode = mode;
+    this->buffer = buffer;
+    this->capacity = size;
+    position = 0;
+    section_start = 0;
+    section_end = 0;
+    failed = false;
+}
+
+void serializer::bytes(void* data, std::size_t size)
+{
+    if(mode == MEASURE)
+    {
+        position += size;
+        return;
+    }
+
+    std::size_t end = (mode == LOAD && section_start != 0) ? section_end : capacity;
+
+    if(failed)
+        return;
+
+    if(size > end - position)
+    {
+        // Past the end of a section we're loading, so it was written by an older version that didn't have this.
+        if(mode == LOAD && section_start != 0)
+            std::memset(data, 0x00, size);
+        else
+            failed = true;
+
+        return;
+    }
+
+    if(mode == SAVE)
+        std::memcpy(buffer + position, data, size);
+    else
+        std::memcpy(data, buffer + position, size);
+
+    position += size;
+}
+
+void serializer::end_section()
+{
+    if(section_start == 0)
+        return;
+
+    if(mode == SAVE && !failed)
+    {
+        std::uint32_t size = position - section_start;
+        std::memcpy(buffer + section_start - 4, &size, sizeof(size));
+    }
+    else if(mode == LOAD)
+    {
+        // Skip anything a newer layout added that we didn't read.
+        position = section_end;
+    }
+
+    section_start = 0;
+}
+
+std::uint32_t serializer::section(const char* name, std::uint32_t version)
+{
+    char saved_name[STATE_NAME_SIZE] = {};
+    std::uint32_t saved_version = version;
+    std::uint32_t size = 0;
+
+    end_section();
+    std::strncpy(saved_name, name, STATE_NAME_SIZE - 1);
+
+    bytes(saved_name, sizeof(saved_name));
+    bytes(&saved_version, sizeof(saved_version));
+    bytes(&size, sizeof(size));
+
+    if(failed)
+        return version;
+
+    section_start = position;
+
+    if(mode != LOAD)
+        return version;
+
+    if(std::strncmp(saved_name, name, STATE_NAME_SIZE) != 0 || size > capacity - position)
+    {
+        std::printf("warning: state: expected section %s, found %.*s!\n", name, STATE_NAME_SIZE, saved_name);
+        failed = true;
+        section_start = 0;
+        return version;
+    }
+
+    if(saved_version > version)
+    {
+        std::printf("warning: state: section %s is version %u, we only know up to %u!\n", name, saved_version, version);
+        failed = true;
+    }
+
+    section_end = position + size;
+    return saved_version;
+}
+
+bool serializer::finish()
+{
+    end_section();
+    return !failed;
+}
+
+snapshot::snapshot(cpu::r3000a& cpu) : cpu(cpu)
+{
+    serializer measure(serializer::MEASURE, nullptr, 0);
+
+    visit(measure);
+    measure.finish();
+
+    // A little extra for anything that comes and goes (transfers in flight and such).
+    buffer.resize(measure.size() + measure.size() / 8);
+    used = 0;
+}
+
+void snapshot::visit(serializer& s)
+{
+    std::uint32_t magic = STATE_MAGIC;
+    std::uint32_t version = STATE_VERSION;
+
+    s.value(magic);
+    s.value(version);
+
+    if(s.loading() && (magic != STATE_MAGIC || version != STATE_VERSION))
+    {
+        std::printf("warning: state: not a save state we can read (magic 0x%08x, version %u)!\n", magic, version);
+        return;
+    }
+
+    scheduler::serialize(s);
+    cpu.serialize(s);
+    bus::serialize(s);
+}
+
+bool snapshot::save()
+{
+    serializer s(serializer::SAVE, buffer.data(), buffer.size());
+
+    visit(s);
+
+    if(!s.finish())
+    {
+        // Didn't fit, so grow to fit and go again.
+        serializer measure(serializer::MEASURE, nullptr, 0);
+
+        visit(measure);
+        measure.finish();
+        buffer.resize(measure.size() + measure.size() / 8);
+
+        s = serializer(serializer::SAVE, buffer.data(), buffer.size());
+        visit(s);
+
+        if(!s.finish())
+            return false;
+    }
+
+    used = s.size();
+    return true;
+}
+
+bool snapshot::load()
+{
+    serializer s(serializer::LOAD, buffer.data(), used);
+
+    visit(s);
+
+    // The header's all that's been read if it's wrong.
+    return s.finish() && s.size() > 8;
+}
+
+void snapshot::assign(const std::uint8_t* data, std::size_t size)
+{
+    if(size > buffer.size())
+        buffer.resize(size);
+
+    std::memcpy(buffer.data(), data, size);
+    used = size;
+}
+
+bool snapshot::write(const char* path) const
+{
+    std::FILE* file = std::fopen(path, "wb");
+
+    if(file == nullptr)
+    {
+        std::printf("warning: state: couldn't open %s for writing!\n", path);
+        return false;
+    }
+
+    bool ok = std::fwrite(buffer.data(), 1, used, file) == used;
+
+    std::fclose(file);
+    return ok;
+}
+
+bool snapshot::read(const char* path)
+{
+    std::FILE* file = std::fopen(path, "rb");
+
+    if(file == nullptr)
+    {
+        std::printf("warning: state: couldn't open %s!\n", path);
+        return false;
+    }
+
+    std::fseek(file, 0, SEEK_END);
+    long length = std::ftell(file);
+    std::fseek(file, 0, SEEK_SET);
+
+    if(length < 0)
+    {
+        std::fclose(file);
+        return false;
+    }
+
+    if((std::size_t)length > buffer.size())
+        buffer.resize(length);
+
+    used = std::fread(buffer.data(), 1, length, file);
+    std::fclose(file);
+
+    return used == (std::size_t)length;
+}
@@ -0,0 +1,124 @@
+/**
+    This file is part of NeoPS.
+
+    NeoPS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    NeoPS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+**/
+#include <algorithm>
+
+#include "system/system.hpp"
+#include "bios/bios.hpp"
+#include "hle/hle.hpp"
+
+using namespace psx;
+
+system::system() : counters(gpu_device)
+{
+    running = false;
+    bus_context = bus::psmem_init();
+    events = scheduler::create();
+    scheduler::bind(events);
+
+    bus::register_device(&dma, DMA_REGISTER_BASE, DMA_REGISTER_SIZE);
+    bus::register_device(&gpu_device, GPU_REGISTER_BASE, GPU_REGISTER_SIZE);
+    bus::register_device(&spu_device, PSX_SPU_BASE, PSX_SPU_SIZE);
+    bus::register_device(&counters, TIMER_REGISTER_BASE, TIMER_REGISTER_SIZE);
+    dma.connect(bus::PORT::GPU, &gpu_device);
+    bus::reset_devices();
+
+    cpu = new cpu::r3000a();
+    scheduler::set_clock(&system::cpu_clock, &system::cpu_preempt, this);
+}
+
+system::~system()
+{
+    bind();
+
+    // The CPU goes first, while its recompiler can still see our bus.
+    delete cpu;
+
+    bus::psmem_destroy(bus_context);
+    scheduler::destroy(events);
+}
+
+void system::bind()
+{
+    bus::bind(bus_context);
+    scheduler::bind(events);
+}
+
+bool system::load_bios(const std::string& path)
+{
+    bind();
+    return bios::load_bios(path);
+}
+
+bool system::sideload(const std::string& path)
+{
+    bind();
+
+    if(!program.load(path))
+        return false;
+
+    if(cpu->get_hle() != nullptr && cpu->get_hle()->booted())
+        program.start(*cpu);
+    else
+        cpu->set_hook(cpu::cop0::virtual_to_physical(EXE_SHELL_ENTRY), &system::start_program, this);
+
+    return true;
+}
+
+void system::start_program(void* data)
+{
+    system* self = (system*)data;
+
+    self->program.start(*self->cpu);
+}
+
+std::uint32_t system::cpu_clock(void* data)
+{
+    system* self = (system*)data;
+
+    // Between slices, the scheduler's already caught up with everything the CPU ran.
+    return self->running ? self->cpu->ran() : 0;
+}
+
+void system::cpu_preempt(void* data, std::uint32_t cycles)
+{
+    system* self = (system*)data;
+
+    if(self->running)
+        self->cpu->preempt(cycles);
+}
+
+std::uint64_t system::run(std::uint64_t cycles)
+{
+    bind();
+
+    std::uint64_t start = scheduler::now();
+    std::uint64_t end = start + cycles;
+
+    // Run the CPU up to the next event, then let the scheduler catch up with it.
+    while(scheduler::now() < end)
+    {
+        std::uint32_t slice = (std::uint32_t)std::min<std::uint64_t>(scheduler::slice(), end - scheduler::now());
+
+        running = true;
+        std::uint32_t ran = cpu->run(slice);
+        running = false;
+
+        scheduler::advance(ran);
+    }
+
+    return scheduler::now() - start;
+}
@@ -0,0 +1,538 @@
+/**
+    This file is part of NeoPS.
+
+    NeoPS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    NeoPS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with NeoPS.  If not, see <http://www.gnu.org/licenses/>.
+**/
+#include <algorithm>
+#include <cstring>
+
+#include "timers/timers.hpp"
+#include "gpu/gpu.hpp"
+#include "state/state.hpp"
+
+using namespace timers;
+
+/**
+ *  Convert CPU cycles to video cycles, rounding down.
+ */
+static inline std::uint64_t video_cycles(std::uint64_t cycles)
+{
+    return cycles * GPU_VIDEO_CLOCK_MUL / GPU_VIDEO_CLOCK_DIV;
+}
+
+/**
+ *  Get the first CPU cycle we're at least some number of video cycles in by.
+ */
+static inline std::uint64_t cpu_cycles(std::uint64_t video)
+{
+    return (video * GPU_VIDEO_CLOCK_DIV + GPU_VIDEO_CLOCK_MUL - 1) / GPU_VIDEO_CLOCK_MUL;
+}
+
+/**
+ *  Count how many times a value comes up in a number of ticks of a counter going round 0 to 0xffff.
+ *
+ *  @arg from - Where the counter starts.
+ *  @arg ticks - How long it counts for.
+ *  @arg value - The value.
+ */
+static inline std::uint64_t reaches(std::uint32_t from, std::uint64_t ticks, std::uint32_t value)
+{
+    std::uint64_t first = (value - from) & 0xffff;
+
+    if(first == 0)
+        first = 0x10000;
+
+    return (ticks >= first) ? 1 + (ticks - first) / 0x10000 : 0;
+}
+
+root_counters::root_counters(gpu::gpu& video) : device("timers"), video(video)
+{
+    events_added = false;
+
+    for(int i = 0; i < TIMER_COUNT; i++)
+    {
+        counters[i].owner = this;
+        counters[i].index = i;
+        counters[i].event = 0;
+    }
+
+    reset();
+}
+
+root_counters::~root_counters()
+{
+
+}
+
+void root_counters::reset()
+{
+    // Not the scheduler's time if we haven't got events: our system's scheduler might not exist yet.
+    std::uint64_t time = events_added ? scheduler::now() : 0;
+
+    for(int i = 0; i < TIMER_COUNT; i++)
+    {
+        counters[i].value = 0;
+        counters[i].mode = TIMER_MODE_IRQ_LINE;
+        counters[i].target = 0;
+        counters[i].last = time;
+        counters[i].irq_done = false;
+        counters[i].released = false;
+
+        if(events_added)
+            scheduler::cancel(counters[i].event);
+    }
+
+    irqs = 0;
+}
+
+void root_counters::serialize(state::serializer& s)
+{
+    // Cycles until each counter's IRQ event, or 0 if it hasn't got one (one that's due already goes in 1).
+    std::uint64_t wait[TIMER_COUNT] = {};
+    std::uint64_t time = scheduler::exact();
+
+    for(int i = 0; i < TIMER_COUNT; i++)
+    {
+        if(!s.loading() && events_added && scheduler::pending(counters[i].event))
+            wait[i] = std::max<std::uint64_t>(scheduler::due(counters[i].event), time + 1) - time;
+    }
+
+    s.section(get_name(), 1);
+
+    for(int i = 0; i < TIMER_COUNT; i++)
+    {
+        s.value(counters[i].value);
+        s.value(counters[i].mode);
+        s.value(counters[i].target);
+        s.value(counters[i].last);
+        s.value(counters[i].irq_done);
+        s.value(counters[i].released);
+    }
+
+    s.value(irqs);
+    s.value(wait);
+
+    if(s.loading())
+    {
+        add_events();
+
+        for(int i = 0; i < TIMER_COUNT; i++)
+        {
+            if(wait[i] != 0)
+                scheduler::schedule(counters[i].event, wait[i]);
+        }
+    }
+}
+
+std::uint16_t root_counters::read16(std::uint32_t addr)
+{
+    return read32(addr);
+}
+
+std::uint32_t root_counters::read32(std::uint32_t addr)
+{
+    int index = (addr - TIMER_REGISTER_BASE) >> 4;
+    counter& c = counters[index];
+
+    switch(addr & 0xf)
+    {
+    case TIMER_COUNTER:
+        catch_up(index);
+        return c.value;
+    case TIMER_MODE:
+    {
+        catch_up(index);
+
+        std::uint32_t mode = c.mode;
+        c.mode &= ~(TIMER_MODE_HIT_TARGET | TIMER_MODE_HIT_OVERFLOW);
+        return mode;
+    }
+    case TIMER_TARGET:
+        return c.target;
+    }
+
+    return device::read32(addr);
+}
+
+void root_counters::write16(std::uint32_t addr, std::uint16_t val)
+{
+    write32(addr, val);
+}
+
+void root_counters::write32(std::uint32_t addr, std::uint32_t val)
+{
+    int index = (addr - TIMER_REGISTER_BASE) >> 4;
+    counter& c = counters[index];
+
+    switch(addr & 0xf)
+    {
+    case TIMER_COUNTER:
+        catch_up(index);
+        c.value = val & 0xffff;
+        break;
+    case TIMER_MODE:
+        // Writing the mode starts the counter over, with the IRQ line back up.
+        catch_up(index);
+        c.mode = (val & 0x3ff) | (c.mode & (TIMER_MODE_HIT_TARGET | TIMER_MODE_HIT_OVERFLOW)) | TIMER_MODE_IRQ_LINE;
+        c.value = 0;
+        c.irq_done = false;
+        c.released = false;
+        break;
+    case TIMER_TARGET:
+        catch_up(index);
+        c.target = val & 0xffff;
+        break;
+    default:
+        device::write32(addr, val);
+        return;
+    }
+
+    schedule_irq(index);
+}
+
+CLOCK root_counters::source(int index) const
+{
+    std::uint32_t select = (counters[index].mode >> 8) & 3;
+
+    switch(index)
+    {
+    case 0:
+        return (select & 1) ? DOT : SYSTEM;
+    case 1:
+        return (select & 1) ? HBLANK : SYSTEM;
+    default:
+        return (select & 2) ? SYSTEM_8 : SYSTEM;
+    }
+}
+
+std::uint64_t root_counters::ticks_at(CLOCK clock, std::uint64_t time) const
+{
+    std::uint64_t line = video.pal() ? GPU_PAL_LINE_CYCLES : GPU_NTSC_LINE_CYCLES;
+
+    switch(clock)
+    {
+    case SYSTEM:
+        return time;
+    case SYSTEM_8:
+        return time / 8;
+    case DOT:
+        return video_cycles(time) / video.dot_cycles();
+    case HBLANK:
+        // Blanking starts GPU_HBLANK_START into every line.
+        return (video_cycles(time) + line - GPU_HBLANK_START) / line;
+    }
+
+    return 0;
+}
+
+std::uint64_t root_counters::time_of(CLOCK clock, std::uint64_t ticks) const
+{
+    std::uint64_t line = video.pal() ? GPU_PAL_LINE_CYCLES : GPU_NTSC_LINE_CYCLES;
+
+    switch(clock)
+    {
+    case SYSTEM:
+        return ticks;
+    case SYSTEM_8:
+        return ticks * 8;
+    case DOT:
+        return cpu_cycles(ticks * video.dot_cycles());
+    case HBLANK:
+        return (ticks == 0) ? 0 : cpu_cycles(ticks * line - line + GPU_HBLANK_START);
+    }
+
+    return 0;
+}
+
+bool root_counters::blanking(int index, std::uint64_t video_time, std::uint64_t& change) const
+{
+    bool pal = video.pal();
+    std::uint64_t period = pal ? GPU_PAL_LINE_CYCLES : GPU_NTSC_LINE_CYCLES;
+    std::uint64_t start = GPU_HBLANK_START;
+
+    // Vertical blanking is the last few lines of a field.
+    if(index == 1)
+    {
+        start = period * (pal ? GPU_PAL_VBLANK_START : GPU_NTSC_VBLANK_START);
+        period *= pal ? GPU_PAL_LINES : GPU_NTSC_LINES;
+    }
+
+    std::uint64_t offset = video_time % period;
+    bool blank = offset >= start;
+
+    change = video_time - offset + (blank ? period : start);
+    return blank;
+}
+
+bool root_counters::stopped(int index) const
+{
+    std::uint32_t mode = counters[index].mode;
+    std::uint32_t sync = (mode >> 1) & 3;
+
+    return index == 2 && (mode & TIMER_MODE_SYNC_ENABLE) && (sync == 0 || sync == 3);
+}
+
+void root_counters::catch_up(int index)
+{
+    run(index, scheduler::exact());
+}
+
+void root_counters::run(int index, std::uint64_t until)
+{
+    counter& c = counters[index];
+    CLOCK clock = source(index);
+
+    while(c.last < until)
+    {
+        std::uint32_t sync = (c.mode >> 1) & 3;
+        std::uint64_t end = until;
+        bool counting = !stopped(index);
+        bool entering = false;
+
+        // Counters 0 and 1 go a blank at a time while they're synced to it (unless sync mode 3's already seen one).
+        if(index != 2 && (c.mode & TIMER_MODE_SYNC_ENABLE) && !(sync == 3 && c.released))
+        {
+            std::uint64_t change;
+            bool blank = blanking(index, video_cycles(c.last), change);
+
+            change = cpu_cycles(change);
+
+            if(change < end)
+            {
+                end = change;
+                entering = !blank;
+            }
+
+            switch(sync)
+            {
+            case 0: // Pause during the blank
+                counting = !blank;
+                break;
+            case 1: // Reset at the blank
+                counting = true;
+                break;
+            case 2: // Reset at the blank, and pause outside it
+                counting = blank;
+                break;
+            case 3: // Pause until the first blank, then run free
+                counting = false;
+                break;
+            }
+        }
+
+        if(counting)
+            count(index, ticks_at(clock, end) - ticks_at(clock, c.last));
+
+        c.last = end;
+
+        if(entering)
+        {
+            if(sync == 1 || sync == 2)
+                c.value = 0;
+            else if(sync == 3)
+                c.released = true;
+        }
+    }
+}
+
+void root_counters::count(int index, std::uint64_t ticks)
+{
+    counter& c = counters[index];
+    std::uint64_t targets = 0;
+    std::uint64_t overflows = 0;
+    std::uint32_t value = c.value;
+
+    // Resetting at a target of 0 is the same as going round at 0xffff.
+    bool wraps = (c.mode & TIMER_MODE_RESET_TARGET) && c.target != 0;
+
+    if(ticks == 0)
+        return;
+
+    // Above the target, it has to get to 0xffff and go round to 0 before it can hit it.
+    if(wraps && value >= c.target)
+    {
+        std::uint64_t round = 0x10000 - value;
+
+        if(value < 0xffff && ticks >= 0xffffu - value)
+            overflows++;
+
+        if(ticks < round)
+        {
+            value += ticks;
+            ticks = 0;
+        }
+        else
+        {
+            value = 0;
+            ticks -= round;
+        }
+    }
+
+    if(ticks == 0)
+    {
+        // Nothing left after going round.
+    }
+    else if(wraps)
+    {
+        // Goes value + 1 up to the target, which takes it straight back to 0.
+        std::uint64_t first = c.target - value;
+        std::uint64_t hits = (ticks >= first) ? 1 + (ticks - first) / c.target : 0;
+
+        targets += hits;
+
+        if(c.target == 0xffff)
+            overflows += hits;
+
+        value = (value + ticks) % c.target;
+    }
+    else
+    {
+        targets += reaches(value, ticks, c.target);
+        overflows += reaches(value, ticks, 0xffff);
+        value = (value + ticks) & 0xffff;
+    }
+
+    c.value = value;
+
+    if(targets != 0)
+        c.mode |= TIMER_MODE_HIT_TARGET;
+
+    if(overflows != 0)
+        c.mode |= TIMER_MODE_HIT_OVERFLOW;
+
+    std::uint64_t raised = 0;
+
+    if(c.mode & TIMER_MODE_IRQ_TARGET)
+        raised += targets;
+
+    if(c.mode & TIMER_MODE_IRQ_OVERFLOW)
+        raised += overflows;
+
+    if(raised != 0)
+        interrupt(index, raised);
+}
+
+std::uint64_t root_counters::ticks_until(int index, std::uint32_t value) const
+{
+    const counter& c = counters[index];
+    bool wraps = (c.mode & TIMER_MODE_RESET_TARGET) && c.target != 0;
+
+    if(!wraps)
+    {
+        std::uint64_t ticks = (value - c.value) & 0xffff;
+        return (ticks == 0) ? 0x10000 : ticks;
+    }
+
+    // Between 1 and the target is all it reaches once it's gone round.
+    std::uint64_t round = 0;
+    std::uint32_t from = c.value;
+
+    if(from >= c.target)
+    {
+        if(value > from)
+            return value - from;
+
+        round = 0x10000 - from;
+        from = 0;
+    }
+
+    if(value < 1 || value > c.target)
+        return 0;
+
+    return round + ((value > from) ? value - from : value + c.target - from);
+}
+
+void root_counters::interrupt(int index, std::uint64_t raised)
+{
+    counter& c = counters[index];
+
+    if(!(c.mode & TIMER_MODE_IRQ_REPEAT))
+    {
+        if(c.irq_done)
+            return;
+
+        c.irq_done = true;
+        raised = 1;
+    }
+
+    // The interrupt controller sees the line go low. Pulses are only low for a few cycles, so we leave it up.
+    if(c.mode & TIMER_MODE_IRQ_TOGGLE)
+    {
+        bool falls = (c.mode & TIMER_MODE_IRQ_LINE) || raised >= 2;
+
+        if(raised & 1)
+            c.mode ^= TIMER_MODE_IRQ_LINE;
+
+        if(!falls)
+            return;
+    }
+
+    irqs |= 1 << index;
+}
+
+void root_counters::schedule_irq(int index)
+{
+    counter& c = counters[index];
+    std::uint64_t ticks = 0;
+
+    add_events();
+
+    if(!stopped(index) && ((c.mode & TIMER_MODE_IRQ_REPEAT) || !c.irq_done))
+    {
+        if(c.mode & TIMER_MODE_IRQ_TARGET)
+            ticks = ticks_until(index, c.target);
+
+        if(c.mode & TIMER_MODE_IRQ_OVERFLOW)
+        {
+            std::uint64_t overflow = ticks_until(index, 0xffff);
+
+            if(ticks == 0 || (overflow != 0 && overflow < ticks))
+                ticks = overflow;
+        }
+    }
+
+    if(ticks == 0)
+    {
+        scheduler::cancel(c.event);
+        return;
+    }
+
+    // As if it counts all the way there. If it's paused or reset on the way, it'll just be early.
+    CLOCK clock = source(index);
+    std::uint64_t when = time_of(clock, ticks_at(clock, c.last) + ticks);
+
+    std::uint64_t time = scheduler::exact();
+
+    scheduler::schedule(c.event, (when > time) ? when - time : 0);
+}
+
+void root_counters::add_events()
+{
+    // Not in the constructor: the system we belong to hasn't made its scheduler yet.
+    if(events_added)
+        return;
+
+    for(int i = 0; i < TIMER_COUNT; i++)
+        counters[i].event = scheduler::add_event("timer", fire, &counters[i]);
+
+    events_added = true;
+}
+
+void root_counters::fire(void* data)
+{
+    counter* c = (counter*)data;
+
+    c->owner->run(c->index, scheduler::now());
+    c->owner->schedule_irq(c->index);
+}